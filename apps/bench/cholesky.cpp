@@ -0,0 +1,89 @@
+#include "graph.h"
+#include "program.h"
+#include <chrono>
+#include <iomanip>
+
+using namespace simit;
+
+typedef std::chrono::duration<double,std::milli> Milliseconds;
+
+static void report(const std::string &function, int n, double first,
+                   double warm) {
+  std::cout << std::left << std::setw(15) << function << std::setw(10) << n
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << first << " ms" << std::setw(12) << warm
+            << " ms" << std::endl;
+}
+
+// Times the first run of the function, which analyzes the sparsity of the
+// matrix, and the average of the later runs, which only refactorize it
+static void bench(Program &program, const std::string &function, Set &verts,
+                  Set &edges, int n, int runs) {
+  Function func = program.compile(function);
+  func.bind("verts", &verts);
+  func.bind("edges", &edges);
+  func.init();
+  func.mapArgs();
+
+  auto start = std::chrono::high_resolution_clock::now();
+  func.run();
+  Milliseconds first = std::chrono::high_resolution_clock::now() - start;
+
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < runs; ++i) {
+    func.run();
+  }
+  Milliseconds warm = std::chrono::high_resolution_clock::now() - start;
+  func.unmapArgs();
+
+  report(function, n, first.count(), warm.count() / runs);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: cholesky <path to cholesky code> [grid size] [runs]"
+              << std::endl;
+    return -1;
+  }
+  int n = (argc >= 3) ? std::stoi(argv[2]) : 20;
+  int runs = (argc >= 4) ? std::stoi(argv[3]) : 10;
+
+  simit::Settings settings;
+  settings.floatSize = sizeof(double);
+  simit::init(settings);
+
+  // A n x n x n grid, where each vertex is connected to its six neighbors
+  Set verts;
+  Set edges(verts, verts);
+  FieldRef<double>   b  = verts.addField<double>("b");
+  verts.addField<double>("x");
+  FieldRef<double,3> b3 = verts.addField<double,3>("b3");
+  verts.addField<double,3>("x3");
+  FieldRef<double>   k  = edges.addField<double>("k");
+
+  std::vector<ElementRef> vertRefs;
+  for (int i = 0; i < n*n*n; ++i) {
+    ElementRef vert = verts.add();
+    vertRefs.push_back(vert);
+    b.set(vert, 1.0);
+    b3.set(vert, {1.0, 2.0, 3.0});
+  }
+  for (int z = 0; z < n; ++z) {
+    for (int y = 0; y < n; ++y) {
+      for (int x = 0; x < n; ++x) {
+        int i = (z*n + y)*n + x;
+        if (x+1 < n) k.set(edges.add(vertRefs[i], vertRefs[i+1]), 1.0);
+        if (y+1 < n) k.set(edges.add(vertRefs[i], vertRefs[i+n]), 1.0);
+        if (z+1 < n) k.set(edges.add(vertRefs[i], vertRefs[i+n*n]), 1.0);
+      }
+    }
+  }
+
+  Program program;
+  program.loadFile(argv[1]);
+  std::cout << std::left << std::setw(15) << "function" << std::setw(10)
+            << "grid" << std::right << std::setw(15) << "first run"
+            << std::setw(15) << "later runs" << std::endl;
+  bench(program, "solve", verts, edges, n, runs);
+  bench(program, "solve_blocked", verts, edges, n, runs);
+}
@@ -0,0 +1,218 @@
+#include "graph.h"
+#include "program.h"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <vector>
+
+using namespace simit;
+
+// A field layout, with the number of elements in the blocks of AoSoA fields
+struct LayoutConfig {
+  std::string name;
+  Set::Layout layout;
+  int blockWidth;
+};
+
+static const std::vector<LayoutConfig> layouts = {
+  {"AoS", Set::AoS, 1},
+  {"SoA", Set::SoA, 1},
+  {"AoSoA4", Set::AoSoA, 4},
+  {"AoSoA8", Set::AoSoA, 8},
+  {"AoSoA16", Set::AoSoA, 16}
+};
+
+// A n x n x n grid of cubes with unit edges, each split into five tets, whose
+// vertices are connected by springs along the edges of the cubes. Either edge
+// set may be null.
+static void createMesh(Set *points, Set *springs, Set *tets, int n) {
+  auto node = [n](int x, int y, int z) {return (x*(n+1) + y)*(n+1) + z;};
+  points->addElements((n+1)*(n+1)*(n+1));
+  if (springs != nullptr) {
+    std::vector<int> springEndpoints;
+    for (int x = 0; x <= n; ++x) {
+      for (int y = 0; y <= n; ++y) {
+        for (int z = 0; z <= n; ++z) {
+          if (x < n) springEndpoints.insert(springEndpoints.end(),
+                                            {node(x,y,z), node(x+1,y,z)});
+          if (y < n) springEndpoints.insert(springEndpoints.end(),
+                                            {node(x,y,z), node(x,y+1,z)});
+          if (z < n) springEndpoints.insert(springEndpoints.end(),
+                                            {node(x,y,z), node(x,y,z+1)});
+        }
+      }
+    }
+    springs->addEdges(springEndpoints.data(), springEndpoints.size()/2);
+  }
+
+  if (tets != nullptr) {
+    std::vector<int> tetEndpoints;
+    for (int x = 0; x < n; ++x) {
+      for (int y = 0; y < n; ++y) {
+        for (int z = 0; z < n; ++z) {
+          int c[8] = {node(x,y,z),   node(x+1,y,z),   node(x,y+1,z),
+                      node(x+1,y+1,z), node(x,y,z+1), node(x+1,y,z+1),
+                      node(x,y+1,z+1), node(x+1,y+1,z+1)};
+          int cubeTets[5][4] = {{c[0], c[1], c[2], c[4]},
+                                {c[1], c[3], c[2], c[7]},
+                                {c[1], c[4], c[5], c[7]},
+                                {c[2], c[4], c[7], c[6]},
+                                {c[1], c[2], c[4], c[7]}};
+          for (auto &tet : cubeTets) {
+            tetEndpoints.insert(tetEndpoints.end(), tet, tet+4);
+          }
+        }
+      }
+    }
+    tets->addEdges(tetEndpoints.data(), tetEndpoints.size()/4);
+  }
+}
+
+// The position of point i of the grid created by createMesh
+static std::vector<double> gridPosition(int i, int n) {
+  return {(double)(i / ((n+1)*(n+1))), (double)((i / (n+1)) % (n+1)),
+          (double)(i % (n+1))};
+}
+
+// Returns the average time of a run of the function, in milliseconds
+static double timeRuns(Function &function, int runs) {
+  function.init();
+  function.mapArgs();
+  function.run();  // Warm up
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < runs; ++i) {
+    function.run();
+  }
+  std::chrono::duration<double,std::milli> time =
+      std::chrono::high_resolution_clock::now() - start;
+  function.unmapArgs();
+  return time.count() / runs;
+}
+
+static void report(const std::string &program, const std::string &layout,
+                   double time, double checksum) {
+  std::cout << std::left << std::setw(10) << program << std::setw(10) << layout
+            << std::right << std::setw(12) << std::fixed
+            << std::setprecision(3) << time << " ms"
+            << std::setw(16) << std::setprecision(6) << checksum << std::endl;
+}
+
+// Runs the springs timestep with the vector fields of the points laid out as
+// given by config
+static void benchSprings(const std::string &codefile,
+                         const LayoutConfig &config, int n, int runs) {
+  Set points;
+  Set springs(points, points);
+  FieldRef<double,3> x = points.addField<double,3>("x", config.layout,
+                                                   config.blockWidth);
+  FieldRef<double,3> v = points.addField<double,3>("v", config.layout,
+                                                   config.blockWidth);
+  FieldRef<double>   m     = points.addField<double>("m");
+  FieldRef<bool>     fixed = points.addField<bool>("fixed");
+  FieldRef<double>   k     = springs.addField<double>("k");
+  FieldRef<double>   l0    = springs.addField<double>("l0");
+  createMesh(&points, &springs, nullptr, n);
+
+  for (ElementRef p : points) {
+    x.set(p, gridPosition(p.getIdent(), n));
+    v.set(p, {0.0, 0.0, 0.0});
+    m.set(p, 1.0);
+    fixed.set(p, false);
+  }
+  for (ElementRef s : springs) {
+    k.set(s, 1e4);
+    l0.set(s, 1.0);
+  }
+
+  Program program;
+  program.loadFile(codefile);
+  for (const std::string &field : {"x", "v"}) {
+    program.setFieldLayout("Point", field, config.layout, config.blockWidth);
+  }
+  Function timestep = program.compile("timestep");
+  timestep.bind("points",  &points);
+  timestep.bind("springs", &springs);
+  double time = timeRuns(timestep, runs);
+
+  // Keep the results comparable between the layouts
+  double checksum = 0.0;
+  for (ElementRef p : points) {
+    checksum += x.get(p)(1);
+  }
+  report("springs", config.name, time, checksum);
+}
+
+// Runs the FEM timestep with the vector fields of the vertices laid out as
+// given by config
+static void benchFem(const std::string &codefile, const LayoutConfig &config,
+                     int n, int runs) {
+  Set verts;
+  Set tets(verts, verts, verts, verts);
+  FieldRef<double,3> x  = verts.addField<double,3>("x", config.layout,
+                                                   config.blockWidth);
+  FieldRef<double,3> v  = verts.addField<double,3>("v", config.layout,
+                                                   config.blockWidth);
+  FieldRef<double,3> fe = verts.addField<double,3>("fe", config.layout,
+                                                   config.blockWidth);
+  FieldRef<int>      c  = verts.addField<int>("c");
+  verts.addField<double>("m");
+  FieldRef<double>   u  = tets.addField<double>("u");
+  FieldRef<double>   l  = tets.addField<double>("l");
+  tets.addField<double>("W");
+  tets.addField<double,3,3>("B");
+  createMesh(&verts, nullptr, &tets, n);
+
+  for (ElementRef vert : verts) {
+    x.set(vert, gridPosition(vert.getIdent(), n));
+    v.set(vert, {0.0, 0.0, 0.0});
+    fe.set(vert, {0.0, 0.0, 0.0});
+    c.set(vert, 0);
+  }
+  for (ElementRef tet : tets) {
+    u.set(tet, 3.4e5);
+    l.set(tet, 1.5e6);
+  }
+
+  Program program;
+  program.loadFile(codefile);
+  for (const std::string &field : {"x", "v", "fe"}) {
+    program.setFieldLayout("Vert", field, config.layout, config.blockWidth);
+  }
+  Function initializeTet = program.compile("initializeTet");
+  initializeTet.bind("verts", &verts);
+  initializeTet.bind("tets",  &tets);
+  initializeTet.runSafe();
+
+  Function timestep = program.compile("main");
+  timestep.bind("verts", &verts);
+  timestep.bind("tets",  &tets);
+  double time = timeRuns(timestep, runs);
+
+  double checksum = 0.0;
+  for (ElementRef vert : verts) {
+    checksum += x.get(vert)(1);
+  }
+  report("fem", config.name, time, checksum);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3 || argc > 5) {
+    std::cerr << "Usage: field_layouts <path to springs code> "
+              << "<path to fem code> [n] [runs]" << std::endl;
+    return -1;
+  }
+  int n = (argc >= 4) ? std::stoi(argv[3]) : 40;
+  int runs = (argc >= 5) ? std::stoi(argv[4]) : 10;
+
+  simit::Settings settings;
+  settings.floatSize = sizeof(double);
+  simit::init(settings);
+
+  for (const LayoutConfig &config : layouts) {
+    benchSprings(argv[1], config, n, runs);
+  }
+  for (const LayoutConfig &config : layouts) {
+    benchFem(argv[2], config, n, runs);
+  }
+}
@@ -0,0 +1,146 @@
+#include "graph.h"
+#include "path_expressions.h"
+#include "path_indices.h"
+#include "init.h"
+#include <chrono>
+#include <iomanip>
+#include <sys/resource.h>
+
+using namespace simit;
+using simit::pe::Var;
+using simit::pe::PathExpression;
+using simit::pe::PathIndex;
+
+typedef std::chrono::duration<double,std::milli> Milliseconds;
+
+// The peak resident memory of the process so far, in megabytes
+static double peakMemory() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+// A n x n x n grid of cubes, each split into five tets
+static void createTetGrid(simit::Set *verts, simit::Set *tets, int n) {
+  auto node = [n](int x, int y, int z) {return (x*(n+1) + y)*(n+1) + z;};
+  verts->addElements((n+1)*(n+1)*(n+1));
+  std::vector<int> endpoints;
+  endpoints.reserve(n*n*n*5*4);
+  for (int x = 0; x < n; ++x) {
+    for (int y = 0; y < n; ++y) {
+      for (int z = 0; z < n; ++z) {
+        int c[8] = {node(x,y,z),   node(x+1,y,z),   node(x,y+1,z),
+                    node(x+1,y+1,z), node(x,y,z+1), node(x+1,y,z+1),
+                    node(x,y+1,z+1), node(x+1,y+1,z+1)};
+        int cubeTets[5][4] = {{c[0], c[1], c[2], c[4]},
+                              {c[1], c[3], c[2], c[7]},
+                              {c[1], c[4], c[5], c[7]},
+                              {c[2], c[4], c[7], c[6]},
+                              {c[1], c[2], c[4], c[7]}};
+        for (auto &tet : cubeTets) {
+          endpoints.insert(endpoints.end(), tet, tet+4);
+        }
+      }
+    }
+  }
+  tets->addEdges(endpoints.data(), endpoints.size()/4);
+}
+
+// Replace `count` tets spread over the mesh by new tets with the same vertices,
+// like a remeshing step
+static void remesh(simit::Set *tets, int count) {
+  std::vector<ElementRef> removed;
+  int stride = tets->getSize() / (count+1);
+  int i = 0;
+  for (ElementRef tet : *tets) {
+    if (i % stride == stride-1 && (int)removed.size() < count) {
+      removed.push_back(tet);
+    }
+    ++i;
+  }
+
+  // Remove the tets with the highest idents first, so that the tets that are
+  // moved in their place are not removed
+  std::vector<int> endpoints;
+  for (auto tet = removed.rbegin(); tet != removed.rend(); ++tet) {
+    for (ElementRef vertex : tets->getEndpoints(*tet)) {
+      endpoints.push_back(vertex.getIdent());
+    }
+    tets->remove(*tet);
+  }
+  tets->addEdges(endpoints.data(), removed.size());
+}
+
+// Build the index of the stiffness matrix of a tet mesh, which connects the
+// vertices that share a tet, and update it after a remeshing step. Returns
+// false if the updated index does not have the nonzeros of the original one.
+static bool bench(int n, int remeshed) {
+  simit::Set verts;
+  simit::Set tets(verts, verts, verts, verts);
+  createTetGrid(&verts, &tets, n);
+
+  Var vi("vi", pe::Set("verts"));
+  Var t("t", pe::Set("tets"));
+  Var vj("vj", pe::Set("verts"));
+  PathExpression vt = pe::Link::make(vi, t, pe::Link::ve);
+  PathExpression tv = pe::Link::make(t, vj, pe::Link::ev);
+  PathExpression vtv = pe::And::make({vi,vj}, {{pe::QuantifiedVar::Exist,t}},
+                                 vt, tv);
+
+  pe::PathIndexBuilder builder;
+  builder.bind("verts", &verts);
+  builder.bind("tets", &tets);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  PathIndex index = builder.buildSegmented(vtv, 0);
+  Milliseconds time = std::chrono::high_resolution_clock::now() - start;
+  double memory = peakMemory();
+
+  remesh(&tets, remeshed);
+  start = std::chrono::high_resolution_clock::now();
+  PathIndex updated = builder.buildSegmented(vtv, 0);
+  Milliseconds updateTime = std::chrono::high_resolution_clock::now() - start;
+  if (updated.numNeighbors() != index.numNeighbors()) {
+    std::cerr << "Remeshing changed the number of nonzeros from "
+              << index.numNeighbors() << " to " << updated.numNeighbors()
+              << std::endl;
+    return false;
+  }
+
+  std::cout << std::left << std::setw(10) << tets.getSize()
+            << std::setw(12) << index.numNeighbors()
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << time.count() << " ms"
+            << std::setprecision(1) << std::setw(10) << memory << " MB"
+            << std::setprecision(3)
+            << std::setw(12) << updateTime.count() << " ms"
+            << std::endl;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int threads = (argc >= 2) ? std::stoi(argv[1]) : 1;
+  std::vector<int> sizes = {10, 20, 40, 80};
+  if (argc >= 3) {
+    sizes.clear();
+    for (int i = 2; i < argc; ++i) {
+      sizes.push_back(std::stoi(argv[i]));
+    }
+  }
+
+  simit::Settings settings;
+  settings.threads = threads;
+  simit::init(settings);
+
+  // Sizes are run in increasing order, so the peak memory is that of the
+  // current size. The update time is for replacing 100 tets.
+  std::cout << std::left << std::setw(10) << "tets" << std::setw(12)
+            << "nonzeros" << std::right << std::setw(15) << "build time"
+            << std::setw(13) << "peak memory" << std::setw(15) << "update time"
+            << std::endl;
+  for (int n : sizes) {
+    if (!bench(n, 100)) {
+      return -1;
+    }
+  }
+}
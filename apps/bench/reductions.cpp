@@ -0,0 +1,153 @@
+#include "graph.h"
+#include "program.h"
+#include "mesh.h"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+
+using namespace simit;
+
+// The ways parallel map reductions accumulate into shared locations
+static const std::vector<std::string> reductions = {
+  "coloring", "privatization", "atomics", "auto"
+};
+
+// Returns the average time of a run of the function, in milliseconds
+static double timeRuns(Function &function, int runs) {
+  function.init();
+  function.mapArgs();
+  function.run();  // Warm up
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < runs; ++i) {
+    function.run();
+  }
+  std::chrono::duration<double,std::milli> time =
+      std::chrono::high_resolution_clock::now() - start;
+  function.unmapArgs();
+  return time.count() / runs;
+}
+
+static void report(const std::string &program, const std::string &reduction,
+                   int threads, double time) {
+  std::cout << std::left << std::setw(10) << program
+            << std::setw(15) << reduction << std::setw(4) << threads
+            << std::right << std::setw(12) << std::fixed
+            << std::setprecision(3) << time << " ms" << std::endl;
+}
+
+static void benchSprings(const std::string &codefile,
+                         const std::string &datafile, int threads) {
+  MeshVol mesh;
+  mesh.loadTet(datafile+".node", datafile+".ele");
+  mesh.loadTetEdge(datafile+".edge");
+
+  for (const std::string &reduction : reductions) {
+    simit::Settings settings;
+    settings.floatSize = sizeof(double);
+    settings.threads = threads;
+    settings.reduction = reduction;
+    simit::init(settings);
+
+    Set points;
+    Set springs(points, points);
+    FieldRef<double,3> x     = points.addField<double,3>("x");
+    FieldRef<double,3> v     = points.addField<double,3>("v");
+    FieldRef<double>   m     = points.addField<double>("m");
+    FieldRef<bool>     fixed = points.addField<bool>("fixed");
+    FieldRef<double>   k     = springs.addField<double>("k");
+    FieldRef<double>   l0    = springs.addField<double>("l0");
+
+    std::vector<ElementRef> pointRefs;
+    for (auto vertex : mesh.v) {
+      ElementRef point = points.add();
+      pointRefs.push_back(point);
+      x.set(point, vertex);
+      v.set(point, {0.0, 0.0, 0.0});
+      m.set(point, 1.0);
+      fixed.set(point, false);
+    }
+    for (auto e : mesh.edges) {
+      ElementRef spring = springs.add(pointRefs[e[0]], pointRefs[e[1]]);
+      double dist = 0.0;
+      for (int i = 0; i < 3; ++i) {
+        double dx = mesh.v[e[1]][i] - mesh.v[e[0]][i];
+        dist += dx*dx;
+      }
+      l0.set(spring, std::sqrt(dist));
+      k.set(spring, 1e4);
+    }
+
+    Program program;
+    program.loadFile(codefile);
+    Function timestep = program.compile("timestep");
+    timestep.bind("points",  &points);
+    timestep.bind("springs", &springs);
+    report("springs", reduction, threads, timeRuns(timestep, 100));
+  }
+}
+
+static void benchPagerank(const std::string &codefile, int numPages,
+                          int threads) {
+  // Generate a graph with a power-law in-degree distribution, by linking each
+  // page to pages that were picked with a probability proportional to the
+  // number of links to them (preferential attachment)
+  const int linksPerPage = 8;
+  std::mt19937 random(0);
+  std::vector<std::pair<int,int>> links;
+  std::vector<int> targets = {0};
+  std::vector<int> outlinkCounts(numPages, 0);
+  for (int page = 1; page < numPages; ++page) {
+    for (int l = 0; l < linksPerPage; ++l) {
+      int target = targets[random() % targets.size()];
+      links.push_back({page, target});
+      targets.push_back(target);
+      ++outlinkCounts[page];
+    }
+    targets.push_back(page);
+  }
+
+  for (const std::string &reduction : reductions) {
+    simit::Settings settings;
+    settings.floatSize = sizeof(double);
+    settings.threads = threads;
+    settings.reduction = reduction;
+    simit::init(settings);
+
+    Set pages;
+    Set linkSet(pages, pages);
+    FieldRef<double> outlinks = pages.addField<double>("outlinks");
+    FieldRef<double> pr       = pages.addField<double>("pr");
+    std::vector<ElementRef> pageRefs;
+    for (int page = 0; page < numPages; ++page) {
+      ElementRef pageRef = pages.add();
+      pageRefs.push_back(pageRef);
+      outlinks.set(pageRef, std::max(outlinkCounts[page], 1));
+      pr.set(pageRef, 0.0);
+    }
+    for (auto &link : links) {
+      linkSet.add(pageRefs[link.first], pageRefs[link.second]);
+    }
+
+    Program program;
+    program.loadFile(codefile);
+    Function main = program.compile("main");
+    main.bind("pages", &pages);
+    main.bind("links", &linkSet);
+    report("pagerank", reduction, threads, timeRuns(main, 10));
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4 || argc > 6) {
+    std::cerr << "Usage: reductions <path to springs code> <path to data> "
+              << "<path to pagerank code> [threads] [pages]" << std::endl;
+    return -1;
+  }
+  int threads = (argc >= 5) ? std::stoi(argv[4]) : 4;
+  int numPages = (argc >= 6) ? std::stoi(argv[5]) : 100000;
+
+  benchSprings(argv[1], argv[2], threads);
+  benchPagerank(argv[3], numPages, threads);
+}
@@ -0,0 +1,129 @@
+#include "graph.h"
+#include "mesh.h"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+using namespace simit;
+
+typedef std::chrono::duration<double,std::milli> Milliseconds;
+
+// Returns the time it takes to run `load`, in milliseconds
+template <typename Load>
+static double time(Load load) {
+  auto start = std::chrono::high_resolution_clock::now();
+  load();
+  Milliseconds time = std::chrono::high_resolution_clock::now() - start;
+  return time.count();
+}
+
+static void report(const std::string &path, int elements, double time) {
+  std::cout << std::left << std::setw(25) << path << std::setw(12) << elements
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << time << " ms" << std::endl;
+}
+
+// A n x n x n grid of cubes, each split into five tets
+static void createTetGrid(MeshVol *mesh, int n) {
+  auto node = [n](int x, int y, int z) {return (x*(n+1) + y)*(n+1) + z;};
+  for (int x = 0; x <= n; ++x) {
+    for (int y = 0; y <= n; ++y) {
+      for (int z = 0; z <= n; ++z) {
+        mesh->v.push_back({{(double)x, (double)y, (double)z}});
+      }
+    }
+  }
+  for (int x = 0; x < n; ++x) {
+    for (int y = 0; y < n; ++y) {
+      for (int z = 0; z < n; ++z) {
+        int c[8] = {node(x,y,z),   node(x+1,y,z),   node(x,y+1,z),
+                    node(x+1,y+1,z), node(x,y,z+1), node(x+1,y,z+1),
+                    node(x,y+1,z+1), node(x+1,y+1,z+1)};
+        mesh->e.push_back({c[0], c[1], c[2], c[4]});
+        mesh->e.push_back({c[1], c[3], c[2], c[7]});
+        mesh->e.push_back({c[1], c[4], c[5], c[7]});
+        mesh->e.push_back({c[2], c[4], c[7], c[6]});
+        mesh->e.push_back({c[1], c[2], c[4], c[7]});
+      }
+    }
+  }
+}
+
+// Load the mesh element by element with Set::add
+static void loadByElement(const MeshVol &mesh, bool reserve) {
+  Set verts;
+  Set tets(verts, verts, verts, verts);
+  FieldRef<double,3> x = verts.addField<double,3>("x");
+  FieldRef<double,3> v = verts.addField<double,3>("v");
+  FieldRef<double>   m = verts.addField<double>("m");
+  FieldRef<double>   W = tets.addField<double>("W");
+  FieldRef<double,3,3> B = tets.addField<double,3,3>("B");
+  if (reserve) {
+    verts.reserve(mesh.v.size());
+    tets.reserve(mesh.e.size());
+  }
+
+  std::vector<ElementRef> vertRefs;
+  for (auto &vertex : mesh.v) {
+    ElementRef vert = verts.add();
+    vertRefs.push_back(vert);
+    x.set(vert, vertex);
+  }
+  for (auto &e : mesh.e) {
+    tets.add(vertRefs[e[0]], vertRefs[e[1]], vertRefs[e[2]], vertRefs[e[3]]);
+  }
+}
+
+// Load the mesh with Set::addElements and Set::addEdges
+static void loadInBulk(const MeshVol &mesh) {
+  Set verts;
+  Set tets(verts, verts, verts, verts);
+  FieldRef<double,3> x = verts.addField<double,3>("x");
+  FieldRef<double,3> v = verts.addField<double,3>("v");
+  FieldRef<double>   m = verts.addField<double>("m");
+  FieldRef<double>   W = tets.addField<double>("W");
+  FieldRef<double,3,3> B = tets.addField<double,3,3>("B");
+
+  verts.addElements(mesh.v.size());
+  double *xData = (double*)verts.getFieldData("x");
+  for (size_t i = 0; i < mesh.v.size(); ++i) {
+    std::copy(mesh.v[i].begin(), mesh.v[i].end(), &xData[i*3]);
+  }
+  std::vector<int> endpoints(mesh.e.size()*4);
+  for (size_t i = 0; i < mesh.e.size(); ++i) {
+    std::copy(mesh.e[i].begin(), mesh.e[i].end(), &endpoints[i*4]);
+  }
+  tets.addEdges(endpoints.data(), mesh.e.size());
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2) {
+    std::cerr << "Usage: set_loading [grid size | tetgen mesh path]"
+              << std::endl;
+    return -1;
+  }
+
+  MeshVol mesh;
+  std::string arg = (argc >= 2) ? argv[1] : "100";
+  if (arg.find_first_not_of("0123456789") == std::string::npos) {
+    createTetGrid(&mesh, std::stoi(arg));
+  }
+  else if (mesh.loadTet(arg+".node", arg+".ele") != 0) {
+    std::cerr << "Could not load " << arg << std::endl;
+    return -1;
+  }
+
+  int n = mesh.e.size();
+  report("add", n, time([&]() {loadByElement(mesh, false);}));
+  report("reserve + add", n, time([&]() {loadByElement(mesh, true);}));
+  report("addElements + addEdges", n, time([&]() {loadInBulk(mesh);}));
+
+  int side = std::cbrt(mesh.v.size());
+  report("createBox", side*side*side, time([&]() {
+    Set points;
+    Set springs(points, points);
+    points.addField<double,3>("x");
+    springs.addField<double>("k");
+    createBox(&points, &springs, side, side, side);
+  }));
+}
@@ -0,0 +1,114 @@
+#include "graph.h"
+#include "program.h"
+#include <chrono>
+#include <iomanip>
+
+using namespace simit;
+
+typedef std::chrono::duration<double,std::milli> Milliseconds;
+
+// Number of residuals that each function of spmv_epilogue.sim computes
+static const int residualsPerRun = 20;
+
+// Average run time of the function
+static double runTime(Program &program, const std::string &function, Set &verts,
+                   Set &edges, int runs) {
+  Function func = program.compile(function);
+  func.bind("verts", &verts);
+  func.bind("edges", &edges);
+  func.init();
+  func.mapArgs();
+  func.run();
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < runs; ++i) {
+    func.run();
+  }
+  Milliseconds run = std::chrono::high_resolution_clock::now() - start;
+  func.unmapArgs();
+  return run.count() / runs;
+}
+
+// Times the residuals `r = b - A*x` of a function, without the assembly of the
+// matrix. The bandwidth is of the traffic that the residual can't avoid: the
+// matrix, its index, and the vectors x, b and r. Storing the product adds a
+// write and a read of another vector, which are not counted.
+static void bench(Program &program, const std::string &function,
+                  const std::string &assembly, Set &verts, Set &edges,
+                  int blockSize, int runs) {
+  double assemble = runTime(program, assembly, verts, edges, runs);
+  double total = runTime(program, function, verts, edges, runs);
+  double residual = (total - assemble) / residualsPerRun;
+
+  double rows = verts.getSize();
+  double blocks = rows + 2.0*edges.getSize();
+  double bytes = blocks * (blockSize*blockSize*sizeof(double) + sizeof(int)) +
+                 (rows+1) * sizeof(int) +
+                 3 * rows * blockSize * sizeof(double);
+  double bandwidth = bytes / (residual * 1e6);
+
+  std::cout << std::left << std::setw(26) << function << std::right
+            << std::fixed << std::setprecision(3)
+            << std::setw(12) << residual << " ms"
+            << std::setw(12) << bandwidth << " GB/s" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: spmv_epilogue <path to spmv_epilogue code> "
+              << "[grid size] [runs]" << std::endl;
+    return -1;
+  }
+  int n = (argc >= 3) ? std::stoi(argv[2]) : 50;
+  int runs = (argc >= 4) ? std::stoi(argv[3]) : 10;
+
+  simit::Settings settings;
+  settings.floatSize = sizeof(double);
+  simit::init(settings);
+
+  // A n x n x n grid, where each vertex is connected to its six neighbors
+  Set verts;
+  Set edges(verts, verts);
+  FieldRef<double>   b  = verts.addField<double>("b");
+  FieldRef<double>   x  = verts.addField<double>("x");
+  verts.addField<double>("r");
+  verts.addField<double>("t");
+  FieldRef<double,3> b3 = verts.addField<double,3>("b3");
+  FieldRef<double,3> x3 = verts.addField<double,3>("x3");
+  verts.addField<double,3>("r3");
+  verts.addField<double,3>("t3");
+  FieldRef<double>   k  = edges.addField<double>("k");
+
+  std::vector<ElementRef> vertRefs;
+  for (int i = 0; i < n*n*n; ++i) {
+    ElementRef vert = verts.add();
+    vertRefs.push_back(vert);
+    b.set(vert, 1.0);
+    x.set(vert, 2.0);
+    b3.set(vert, {1.0, 2.0, 3.0});
+    x3.set(vert, {3.0, 2.0, 1.0});
+  }
+  for (int iz = 0; iz < n; ++iz) {
+    for (int iy = 0; iy < n; ++iy) {
+      for (int ix = 0; ix < n; ++ix) {
+        int i = (iz*n + iy)*n + ix;
+        if (ix+1 < n) k.set(edges.add(vertRefs[i], vertRefs[i+1]), 1.0);
+        if (iy+1 < n) k.set(edges.add(vertRefs[i], vertRefs[i+n]), 1.0);
+        if (iz+1 < n) k.set(edges.add(vertRefs[i], vertRefs[i+n*n]), 1.0);
+      }
+    }
+  }
+
+  Program program;
+  program.loadFile(argv[1]);
+  std::cout << "grid " << n << "^3, " << verts.getSize() << " vertices, "
+            << edges.getSize() << " edges" << std::endl;
+  std::cout << std::left << std::setw(26) << "function" << std::right
+            << std::setw(15) << "residual" << std::setw(17) << "bandwidth"
+            << std::endl;
+  bench(program, "residual", "assemble", verts, edges, 1, runs);
+  bench(program, "residual_stored", "assemble", verts, edges, 1, runs);
+  bench(program, "residual_blocked", "assemble_blocked", verts, edges, 3, runs);
+  bench(program, "residual_blocked_stored", "assemble_blocked", verts, edges, 3,
+        runs);
+}
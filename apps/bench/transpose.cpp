@@ -0,0 +1,128 @@
+#include "graph.h"
+#include "program.h"
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+using namespace simit;
+
+typedef std::chrono::duration<double,std::milli> Milliseconds;
+
+// Returns the endpoints of a graph with a power-law degree distribution, by
+// linking each vertex to vertices that were picked with a probability
+// proportional to their degree (preferential attachment). The hubs have very
+// long matrix rows.
+static std::vector<int> powerLawEdges(int numVertices, int edgesPerVertex) {
+  std::mt19937 random(0);
+  std::vector<int> endpoints;
+  std::vector<int> targets = {0};
+  for (int v = 1; v < numVertices; ++v) {
+    for (int e = 0; e < edgesPerVertex; ++e) {
+      int target = targets[random() % targets.size()];
+      endpoints.push_back(v);
+      endpoints.push_back(target);
+      targets.push_back(target);
+    }
+    targets.push_back(v);
+  }
+  return endpoints;
+}
+
+// Times the initialization of the function, which assembles the matrix indices,
+// and the average run
+static void bench(const std::string &codefile, Set &V, Set &E, int runs) {
+  Program program;
+  program.loadFile(codefile);
+  Function main = program.compile("main");
+  main.bind("V", &V);
+  main.bind("E", &E);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  main.init();
+  Milliseconds init = std::chrono::high_resolution_clock::now() - start;
+
+  main.mapArgs();
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < runs; ++i) {
+    main.run();
+  }
+  Milliseconds run = std::chrono::high_resolution_clock::now() - start;
+  main.unmapArgs();
+
+  std::string name = codefile.substr(codefile.find_last_of('/')+1);
+  std::cout << std::left << std::setw(28) << name << std::setw(10)
+            << V.getSize() << std::setw(10) << E.getSize()
+            << std::right << std::fixed << std::setprecision(3)
+            << std::setw(12) << init.count() << " ms"
+            << std::setw(12) << run.count() / runs << " ms" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: transpose <path to test/input/system> [vertices] "
+              << "[runs]" << std::endl;
+    return -1;
+  }
+  std::string dir = argv[1];
+  int numVertices = (argc >= 3) ? std::stoi(argv[2]) : 100000;
+  int runs = (argc >= 4) ? std::stoi(argv[3]) : 10;
+  const int edgesPerVertex = 8;
+
+  simit::Settings settings;
+  simit::init(settings);
+
+  std::vector<int> endpoints = powerLawEdges(numVertices, edgesPerVertex);
+  int numEdges = endpoints.size() / 2;
+
+  std::cout << std::left << std::setw(28) << "program" << std::setw(10)
+            << "vertices" << std::setw(10) << "edges" << std::right
+            << std::setw(15) << "init" << std::setw(15) << "run" << std::endl;
+
+  {
+    Set V;
+    Set E(V,V);
+    V.addField<int>("b");
+    V.addField<int>("c");
+    V.addElements(numVertices);
+    E.addEdges(endpoints.data(), numEdges);
+    FieldRef<int> b = V.getField<int>("b");
+    for (ElementRef v : V) {
+      b.set(v, 1);
+    }
+    bench(dir + "/transpose.sim", V, E, runs);
+  }
+
+  {
+    Set V;
+    Set E(V,V);
+    V.addField<int,2>("b");
+    V.addField<int,3>("c");
+    V.addElements(numVertices);
+    E.addEdges(endpoints.data(), numEdges);
+    FieldRef<int,2> b = V.getField<int,2>("b");
+    for (ElementRef v : V) {
+      b.set(v, {1, 2});
+    }
+    bench(dir + "/transpose_blocked.sim", V, E, runs);
+  }
+
+  // Each edge of the rectangular matrix links one vertex, which are picked
+  // from the endpoints of the power-law graph
+  {
+    Set V;
+    Set E(V);
+    V.addField<int>("b");
+    E.addField<int>("a");
+    V.addElements(numVertices);
+    std::vector<int> sinks;
+    for (int e = 0; e < numEdges; ++e) {
+      sinks.push_back(endpoints[2*e+1]);
+    }
+    E.addEdges(sinks.data(), numEdges);
+    FieldRef<int> a = E.getField<int>("a");
+    for (ElementRef e : E) {
+      a.set(e, 1);
+    }
+    bench(dir + "/transpose_rectangular.sim", V, E, runs);
+  }
+}
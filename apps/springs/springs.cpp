@@ -2,19 +2,24 @@
 #include "program.h"
 #include "mesh.h"
 #include <cmath>
+#include <chrono>
 
 using namespace simit;
 
 int main(int argc, char **argv)
 {
-  if (argc != 3) {
-    std::cerr << "Usage: springs <path to simit code> <path to data>" << std::endl;
+  if (argc != 3 && argc != 4) {
+    std::cerr << "Usage: springs <path to simit code> <path to data> [threads]"
+              << std::endl;
     return -1;
   }
   std::string codefile = argv[1];
   std::string datafile = argv[2];
 
-  simit::init("cpu", sizeof(double));
+  simit::Settings settings;
+  settings.floatSize = sizeof(double);
+  settings.threads = (argc == 4) ? std::stoi(argv[3]) : 1;
+  simit::init(settings);
 
   // Load mesh data using Simit's mesh loader.
   MeshVol mesh;
@@ -101,12 +106,15 @@ int main(int argc, char **argv)
   timestep.init();
 
   // Take 100 time steps
+  std::chrono::duration<double> runTime(0);
   for (int i = 1; i <= 100; ++i) {
     std::cout << "timestep " << i << std::endl;
 
+    auto start = std::chrono::high_resolution_clock::now();
     timestep.unmapArgs(); // Move data to compute memory space (e.g. GPU)
     timestep.run();       // Run the timestep function
     timestep.mapArgs();   // Move data back to this memory space
+    runTime += std::chrono::high_resolution_clock::now() - start;
 
     // Copy the x field to the mesh and save it to an obj file
     int vi = 0;
@@ -119,4 +127,6 @@ int main(int argc, char **argv)
     mesh.updateSurfVert();
     mesh.saveTetObj(std::to_string(i)+".obj");
   }
+  std::cout << "time: " << runTime.count() << " s (" << settings.threads
+            << " threads)" << std::endl;
 }
@@ -12,7 +12,7 @@ elseif exists("b:current_syntax")
   finish
 endif
 
-syn keyword simitType         float int bool vector matrix tensor string set inout
+syn keyword simitType         float float32 float64 int bool vector matrix tensor string set inout
 syn keyword simitStatement    element func proc export
 syn keyword simitConditional  if elif else end
 syn keyword simitRepeat       for in while do
@@ -40,6 +40,19 @@ Backend::~Backend() {
   delete pimpl;
 }
 
+void Backend::setKeepMachineCode(bool keep) {
+  pimpl->setKeepMachineCode(keep);
+}
+
+void Backend::setFieldLayout(const std::string& elementType,
+                             const std::string& field, Set::Layout layout,
+                             int blockWidth) {
+  uassert(layout != Set::AoSoA || (blockWidth > 0 &&
+                                   (blockWidth & (blockWidth-1)) == 0))
+      << "The block width of field " << field << " must be a power of two";
+  pimpl->setFieldLayout(elementType, field, layout, blockWidth);
+}
+
 backend::Function* Backend::compile(const ir::Func& func) {
   return compile(func, Storage());
 }
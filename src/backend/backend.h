@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include "graph.h"
 #include "interfaces/uncopyable.h"
 
 namespace simit {
@@ -50,6 +51,17 @@ public:
   ///                  Remember to also delete Var forward decl.
   backend::Function* compile(const ir::Stmt& stmt, std::vector<ir::Var> output);
 
+  /// Keep a copy of the optimized code of the functions that are compiled from
+  /// now on, so that their machine code can be printed and emitted as object
+  /// code. Other functions do not keep it, to save memory.
+  void setKeepMachineCode(bool keep);
+
+  /// Compile the functions from now on to locate the components of the field
+  /// `field` of sets of `elementType` by `layout` (see Set::Layout), and to
+  /// bind only sets whose field has that layout. Fields default to AoS.
+  void setFieldLayout(const std::string& elementType, const std::string& field,
+                      Set::Layout layout, int blockWidth=8);
+
 protected:
   BackendImpl* pimpl;
 };
@@ -67,6 +67,14 @@ Function::~Function() {
   delete environment;
 }
 
+void Function::emitObject(const std::string& filename) const {
+  not_supported_yet << "this backend cannot emit object code";
+}
+
+void Function::printHeader(std::ostream &os) const {
+  not_supported_yet << "this backend cannot emit object code";
+}
+
 bool Function::hasArg(std::string arg) const {
   return util::contains(argumentTypes, arg);
 }
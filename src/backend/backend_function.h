@@ -6,9 +6,11 @@
 #include <map>
 #include <functional>
 #include <set>
+#include <string>
 
 #include "interfaces/printable.h"
 #include "interfaces/uncopyable.h"
+#include "util/arena.h"
 
 namespace simit {
 class Set;
@@ -54,13 +56,26 @@ public:
   virtual void mapArgs() {}
   virtual void unmapArgs(bool updated=true) {}
 
+  /// Returns the allocation counts of the temporaries of the function's runs.
+  virtual AllocationStats getAllocationStats() const {return AllocationStats();}
+
   /// Write the function to the stream. The output depends on the backend,
   /// for example the LLVM backend will write LLVM IR.
   virtual void print(std::ostream &os) const = 0;
 
-  /// Print the function as machine assembly code to the stream.
+  /// Print the function as machine assembly code to the stream. Requires that
+  /// the backend kept the function's machine code.
   virtual void printMachine(std::ostream &os) const = 0;
 
+  /// Write the function as native object code to the file, so that it can be
+  /// linked into programs and called without compiling it at runtime.
+  /// Requires that the backend kept the function's machine code.
+  virtual void emitObject(const std::string& filename) const;
+
+  /// Write a C header to the stream that declares the functions and globals
+  /// in the object code written by emitObject, and the layout of their data.
+  virtual void printHeader(std::ostream &os) const;
+
   bool hasArg(std::string arg) const;
   const std::vector<std::string>& getArgs() const;
   const ir::Type& getArgType(std::string arg) const;
@@ -1,7 +1,10 @@
 #ifndef SIMIT_BACKEND_IMPL_H
 #define SIMIT_BACKEND_IMPL_H
 
+#include <map>
 #include <set>
+#include <string>
+#include "graph.h"
 #include "interfaces/uncopyable.h"
 
 namespace simit {
@@ -13,12 +16,36 @@ class Storage;
 namespace backend {
 class Function;
 
+/// The layout that compiled functions locate the components of a set field
+/// by, and the number of elements in its blocks if it is AoSoA.
+struct FieldLayout {
+  Set::Layout layout;
+  int blockWidth;
+};
+
+/// Field layouts by element type name and field name. Fields that are not
+/// listed have the AoS layout.
+typedef std::map<std::string, std::map<std::string, FieldLayout>> FieldLayouts;
+
 class BackendImpl : simit::interfaces::Uncopyable {
 public:
+  BackendImpl() : keepMachineCode(false) {}
   virtual ~BackendImpl() {}
 
   /// Compile the closure consisting of the function and a context.
   virtual Function* compile(ir::Func func, const ir::Storage& storage) = 0;
+
+  void setKeepMachineCode(bool keep) {keepMachineCode = keep;}
+
+  void setFieldLayout(const std::string& elementType, const std::string& field,
+                      Set::Layout layout, int blockWidth) {
+    fieldLayouts[elementType][field] =
+        {layout, (layout == Set::AoSoA) ? blockWidth : 1};
+  }
+
+protected:
+  bool keepMachineCode;
+  FieldLayouts fieldLayouts;
 };
 
 }}
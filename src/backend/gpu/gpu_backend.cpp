@@ -48,6 +48,15 @@ namespace simit {
 namespace backend {
 
 Function* GPUBackend::compile(ir::Func irFunc, const ir::Storage& storage) {
+  // GPU kernels index fields as arrays of structures (see pushSetData)
+  for (auto& elemLayouts : fieldLayouts) {
+    for (auto& layout : elemLayouts.second) {
+      uassert(layout.second.layout == Set::AoS)
+          << "Field " << layout.first << " of " << elemLayouts.first
+          << " must have the AoS layout, which GPU functions require";
+    }
+  }
+
   std::ofstream irFile("simit.sim", std::ofstream::trunc);
   irFile << irFunc;
   irFile.close();
@@ -255,6 +255,9 @@ GPUFunction::SetData GPUFunction::pushSetData(
     ir::Type ftype = field.type;
     iassert(ftype.isTensor()) << "Element field must be tensor type";
     const ir::TensorType *ttype = ftype.toTensor();
+    uassert(set->getFieldLayout(field.name) == Set::AoS)
+        << "Field " << field.name << " of set " << set->getName()
+        << " does not have the AoS layout, which GPU functions require";
     void *fieldData = set->getFieldData(field.name);
     size_t size = set->getSize() * ttype->size() * ttype->getComponentType().bytes();
     iassert(size != 0)
@@ -456,6 +459,11 @@ llvm::Value *GPUFunction::pushArg(std::string name, ir::Type& argType, Actual* a
           *(pushedData.fields[i]->devBuffer))));
       fieldHandles.push_back(pushedData.fields[i]);
     }
+    // Component strides of SoA fields, which pushed fields are not (see
+    // pushSetData)
+    for (size_t i = 0; i < etype->fields.size(); ++i) {
+      setData.push_back(llvmInt(1));
+    }
 
     argBufMap.emplace(name, fieldHandles);
     return llvm::ConstantStruct::get(llvmSetType, setData);
@@ -701,7 +709,8 @@ GPUFunction::init() {
       std::vector<DeviceDataHandle*> handleVec;
       
       size_t expectedSize = sizeof(int) // setSize
-          + pushedData.fields.size() * sizeof(void*); // fields
+          + pushedData.fields.size() * sizeof(void*) // fields
+          + pushedData.fields.size() * sizeof(int); // field strides
       if (setType->getCardinality() > 0) {
         expectedSize += 3*sizeof(void*); // endpoints and indices arrays
       }
@@ -732,6 +741,11 @@ GPUFunction::init() {
         globalPtrHost = ((void**)globalPtrHost)+1;
         handleVec.push_back(fieldHandle);
       }
+      // Pushed fields are AoS, with unit component strides
+      for (size_t i = 0; i < pushedData.fields.size(); ++i) {
+        *(int*)globalPtrHost = 1;
+        globalPtrHost = ((int*)globalPtrHost)+1;
+      }
       argBufMap.emplace(bufVar.getName(), handleVec);
     }
   }
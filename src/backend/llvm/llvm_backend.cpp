@@ -11,6 +11,7 @@
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
@@ -26,6 +27,12 @@
 #include "llvm/ExecutionEngine/MCJIT.h"
 
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #if LLVM_MAJOR_VERSION <=3 && LLVM_MINOR_VERSION <= 6
@@ -49,11 +56,16 @@
 #include "ir_transforms.h"
 #include "ir_rewriter.h" // TODO: Remove this header
 #include "environment.h"
+#include "graph.h"
+#include "init.h"
 #include "tensor_index.h"
 #include "llvm_function.h"
+#include "llvm_object_cache.h"
+#include "lower/lower_parallel_loops.h"
 #include "macros.h"
 #include "path_expressions.h"
 #include "util/collections.h"
+#include "util/util.h"
 
 using namespace std;
 using namespace simit::ir;
@@ -68,6 +80,54 @@ const std::string LEN_SUFFIX(".len");
 // class LLVMBackend
 bool LLVMBackend::llvmInitialized = false;
 
+// Split the index of a component of a set field into the element and the
+// component of the element's tensor, if it has the form
+// `element*blockSize + component` that field accesses are lowered to.
+static bool splitFieldIndex(const Expr &index, int blockSize,
+                            Expr *element, Expr *component) {
+  int size;
+  if (isa<Mul>(index)) {
+    const Mul *mul = to<Mul>(index);
+    if (getConstant(mul->b, &size) && size == blockSize) {
+      *element = mul->a;
+    }
+    else if (getConstant(mul->a, &size) && size == blockSize) {
+      *element = mul->b;
+    }
+    else {
+      return false;
+    }
+    *component = Literal::make(0);
+    return true;
+  }
+  if (isa<Add>(index)) {
+    const Add *add = to<Add>(index);
+    Expr blockComponent;
+    if (splitFieldIndex(add->a, blockSize, element, &blockComponent)) {
+      *component = Add::make(blockComponent, add->b);
+      return true;
+    }
+    if (splitFieldIndex(add->b, blockSize, element, &blockComponent)) {
+      *component = Add::make(add->a, blockComponent);
+      return true;
+    }
+  }
+  return false;
+}
+
+static llvm::CodeGenOpt::Level getCodeGenOptLevel(int optLevel) {
+  switch (optLevel) {
+    case 0:
+      return llvm::CodeGenOpt::None;
+    case 1:
+      return llvm::CodeGenOpt::Less;
+    case 2:
+      return llvm::CodeGenOpt::Default;
+    default:
+      return llvm::CodeGenOpt::Aggressive;
+  }
+}
+
 shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module) {
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
   shared_ptr<llvm::EngineBuilder> engineBuilder(new llvm::EngineBuilder(module));
@@ -75,6 +135,36 @@ shared_ptr<llvm::EngineBuilder> createEngineBuilder(llvm::Module *module) {
   shared_ptr<llvm::EngineBuilder> engineBuilder(new llvm::EngineBuilder(
       unique_ptr<llvm::Module>(module)));
 #endif
+
+  // Target the configured CPU, with the host's features if it is native, and
+  // the configured features on top
+  string cpu = kCPU;
+  vector<string> features;
+  if (cpu == "native") {
+    cpu = llvm::sys::getHostCPUName().str();
+    llvm::StringMap<bool> hostFeatures;
+    if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+      for (auto& feature : hostFeatures) {
+        features.push_back((feature.getValue() ? "+" : "-") +
+                           feature.getKey().str());
+      }
+    }
+  }
+  for (const string& feature : util::split(kCPUFeatures, ",")) {
+    if (util::trim(feature) != "") {
+      features.push_back(util::trim(feature));
+    }
+  }
+  engineBuilder->setMCPU(cpu);
+  engineBuilder->setMAttrs(features);
+  engineBuilder->setOptLevel(getCodeGenOptLevel(kOptLevel));
+
+  llvm::TargetOptions options;
+  if (kFastMath) {
+    options.UnsafeFPMath = true;
+    options.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+  }
+  engineBuilder->setTargetOptions(options);
   return engineBuilder;
 }
 
@@ -131,9 +221,26 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
 
   this->dataLayout.reset(new llvm::DataLayout(module));
 
+  // Let floating-point operations be reassociated and contracted
+  llvm::FastMathFlags fastMathFlags;
+  if (kFastMath) {
+#if LLVM_MAJOR_VERSION <= 5
+    fastMathFlags.setUnsafeAlgebra();
+#else
+    fastMathFlags.setFast();
+#endif
+  }
+#if LLVM_MAJOR_VERSION <= 3
+  builder->SetFastMathFlags(fastMathFlags);
+#else
+  builder->setFastMathFlags(fastMathFlags);
+#endif
+
   this->symtable.clear();
   this->buffers.clear();
   this->globals.clear();
+  this->bindableSets.clear();
+  this->edgeReductions.clear();
   this->storage = storage;
 
   // This backend stores dense tensors and sparse tensors with path expressions
@@ -143,10 +250,26 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
   this->environment = &func.getEnvironment();
   emitGlobals(*this->environment);
 
+  for (const Var& arg : func.getArguments()) {
+    if (arg.getType().isSet()) {
+      bindableSets.insert(arg);
+    }
+  }
+  for (const Var& ext : environment->getExternVars()) {
+    if (ext.getType().isSet()) {
+      bindableSets.insert(ext);
+    }
+  }
+
   // Create compute functions
   vector<Func> callTree = getCallTree(func);
   std::reverse(callTree.begin(), callTree.end());
 
+  this->temporaries.clear();
+  this->temporaries.insert(environment->getTemporaries().begin(),
+                           environment->getTemporaries().end());
+  emitAliasScopes(callTree);
+
   llvm::Function *llvmFunc = nullptr;
   for (auto &f : callTree) {
     if (f.getKind() != Func::Internal) {
@@ -234,46 +357,74 @@ Function* LLVMBackend::compile(ir::Func func, const ir::Storage& storage) {
 
   auto engineBuilder = createEngineBuilder(module);
 
-#ifndef SIMIT_DEBUG
-  // Run LLVM optimization passes on the function
-  // We use the built-in PassManagerBuilder to build
-  // the set of passes that are similar to clang's -O3
+  // Look up the module's object code in the cache, in which case the module is
+  // neither optimized nor compiled by MCJIT
+  bool cached = false;
+  if (!kCacheDir.empty()) {
+    LLVMObjectCache& objectCache = LLVMObjectCache::getInstance();
+    string key = objectCache.getKey(module);
+    module->setModuleIdentifier(key);
+    cached = objectCache.contains(key);
+  }
+
+  if (!cached && kOptLevel > 0) {
+    // Run LLVM optimization passes on the function
+    // We use the built-in PassManagerBuilder to build
+    // the set of passes that are similar to clang's -O<optLevel>
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 6
-  llvm::FunctionPassManager fpm(module);
-  llvm::PassManager mpm;
+    llvm::FunctionPassManager fpm(module);
+    llvm::PassManager mpm;
 #else
-  llvm::legacy::FunctionPassManager fpm(module);
-  llvm::legacy::PassManager mpm;
+    llvm::legacy::FunctionPassManager fpm(module);
+    llvm::legacy::PassManager mpm;
 #endif
-  llvm::PassManagerBuilder pmBuilder;
-  
-  pmBuilder.OptLevel = 3;
+    llvm::PassManagerBuilder pmBuilder;
+
+    pmBuilder.OptLevel = kOptLevel;
 
-  pmBuilder.BBVectorize = 1;
-  pmBuilder.LoopVectorize = 1;
-//  pmBuilder.LoadCombine = 1;
-  pmBuilder.SLPVectorize = 1;
+    pmBuilder.BBVectorize = 1;
+    pmBuilder.LoopVectorize = 1;
+//    pmBuilder.LoadCombine = 1;
+    pmBuilder.SLPVectorize = 1;
 
-  llvm::DataLayout dataLayout(module);
+    llvm::DataLayout dataLayout(module);
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
-  fpm.add(new llvm::DataLayout(dataLayout));
+    fpm.add(new llvm::DataLayout(dataLayout));
 #elif LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 6
-  fpm.add(new llvm::DataLayoutPass(dataLayout));
+    fpm.add(new llvm::DataLayoutPass(dataLayout));
 #else
-  module->setDataLayout(dataLayout);
+    module->setDataLayout(dataLayout);
 #endif
 
-  pmBuilder.populateFunctionPassManager(fpm);
-  pmBuilder.populateModulePassManager(mpm);
-
-  fpm.doInitialization();
-  fpm.run(*llvmFunc);
-  fpm.doFinalization();
-  
-  mpm.run(*module);
+    // Give the vectorizers and cost models the target's vector units
+    unique_ptr<llvm::TargetMachine> target(engineBuilder->selectTarget());
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 6
+    target->addAnalysisPasses(fpm);
+    target->addAnalysisPasses(mpm);
+#else
+    fpm.add(llvm::createTargetTransformInfoWrapperPass(
+        target->getTargetIRAnalysis()));
+    mpm.add(llvm::createTargetTransformInfoWrapperPass(
+        target->getTargetIRAnalysis()));
 #endif
 
-  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder);
+    pmBuilder.populateFunctionPassManager(fpm);
+    pmBuilder.populateModulePassManager(mpm);
+
+    fpm.doInitialization();
+    fpm.run(*llvmFunc);
+    fpm.doFinalization();
+
+    mpm.run(*module);
+  }
+
+  map<string, vector<ParallelReduction>> parallelReductions;
+  for (auto &edgeReduction : edgeReductions) {
+    parallelReductions.insert({edgeReduction.first.getName(),
+                               edgeReduction.second.supported});
+  }
+  return new LLVMFunction(func, storage, llvmFunc, module, engineBuilder,
+                          parallelReductions, fieldLayouts, keepMachineCode);
 }
 
 void LLVMBackend::compile(const ir::Literal& literal) {
@@ -289,7 +440,8 @@ void LLVMBackend::compile(const ir::Literal& literal) {
         break;
       }
       case ScalarType::Float: {
-        iassert(ctype.bytes() == ScalarType::floatBytes)
+        iassert(ctype.bytes() == ScalarType::floatBytes ||
+                ctype.hasStoragePrecision())
             << "Only " << ScalarType::floatBytes
             << "-byte float mode allowed by current float setting";
         val = llvmFP(literal.getFloatVal(0));
@@ -318,9 +470,7 @@ void LLVMBackend::compile(const ir::Literal& literal) {
     }
   }
   else {
-    // TODO: This should become a reference to a global literal
-    // (unify with GPUBackend).
-    val = llvmPtr(literal);
+    val = emitGlobalLiteral(literal);
   }
   iassert(val);
 }
@@ -354,23 +504,33 @@ void LLVMBackend::compile(const ir::VarExpr& varExpr) {
     iassert(!isString(varExpr.type) || val->getType()->isPointerTy());
     if (val->getType()->isPointerTy() && (!isString(varExpr.type) || 
         val->getType()->getContainedType(0)->isPointerTy())) {
-      val = builder->CreateLoad(val, valName);
+      val = emitComputePrecision(builder->CreateLoad(val, valName));
     }
   }
 }
 
 void LLVMBackend::compile(const ir::Load& load) {
-  llvm::Value *buffer = compile(load.buffer);
-  llvm::Value *index = compile(load.index);
+  llvm::Value *buffer;
+  llvm::Value *index;
+  emitBufferIndex(load.buffer, load.index, &buffer, &index);
 
   string locName = string(buffer->getName()) + PTR_SUFFIX;
   llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
 
   string valName = string(buffer->getName()) + VAL_SUFFIX;
-  val = builder->CreateLoad(bufferLoc, valName);
+  llvm::LoadInst *loadInst = builder->CreateLoad(bufferLoc, valName);
+  emitAccessMetadata(loadInst, load.buffer);
+  val = emitComputePrecision(loadInst);
 }
 
 void LLVMBackend::compile(const ir::FieldRead& fieldRead) {
+  // Loads, stores and copies locate the components of a field by its layout,
+  // but other uses of the whole field index it as an array of structures
+  uassert(!hasFieldLayout(&fieldRead))
+      << "Field " << fieldRead.fieldName << " of "
+      << fieldRead.elementOrSet.type().toSet()->elementType.toElement()->name
+      << " must have the AoS layout, since the function uses the whole field, "
+      << "for instance as an argument of a runtime call";
   val = emitFieldRead(fieldRead.elementOrSet, fieldRead.fieldName);
 }
 
@@ -665,8 +825,16 @@ void LLVMBackend::compile(const ir::VarDecl& varDecl) {
     else {
       auto tensorStorage = storage.getStorage(varDecl.var);
 
+      // Iterations of parallel loops need private storage, so dense local
+      // tensors in parallel loops are stored on the stack
+      if (inParallelLoop && tensorStorage.getKind() == TensorStorage::Dense) {
+        const TensorType *ttype = type.toTensor();
+        llvmVar = builder->CreateAlloca(llvmType(*ttype)->getElementType(),
+                                        emitComputeLen(ttype, tensorStorage),
+                                        var.getName());
+      }
       // Sparse matrices with path expressions are stored globally
-      if (tensorStorage.getKind() != TensorStorage::Indexed ||
+      else if (tensorStorage.getKind() != TensorStorage::Indexed ||
           tensorStorage.getTensorIndex().getPathExpression().defined()) {
         llvmVar = makeGlobalTensor(varDecl.var);
       }
@@ -852,6 +1020,12 @@ LLVMBackend::emitResult(ir::Var result, bool excludeStaticTypes,
       }
       resultValues.push_back(compile(result));
     }
+    // Scalars are returned through their stack locations
+    else if (tensorType->order() == 0) {
+      llvm::Value *resultPtr = symtable.get(result);
+      iassert(resultPtr->getType()->isPointerTy());
+      resultValues.push_back(resultPtr);
+    }
   }
   else if (type.isOpaque()) {
     resultValues.push_back(compile(result));
@@ -883,6 +1057,17 @@ void LLVMBackend::emitInternalCall(const ir::CallStmt& callStmt) {
     }
 
     llvm::Function* fun = module->getFunction(callStmt.callee.getName());
+    auto param = fun->arg_begin();
+    for (size_t i = 0; i < args.size(); ++i, ++param) {
+      llvm::Type *argType = args[i]->getType();
+      llvm::Type *paramType = param->getType();
+      uassert(argType == paramType || !argType->isPointerTy() ||
+              !paramType->isPointerTy() ||
+              !argType->getPointerElementType()->isFloatingPointTy() ||
+              !paramType->getPointerElementType()->isFloatingPointTy())
+          << "function " << callStmt.callee.getName() << " called with "
+          << "a tensor whose storage precision differs from its argument";
+    }
     builder->CreateCall(fun, args);
   }
   else {
@@ -891,7 +1076,28 @@ void LLVMBackend::emitInternalCall(const ir::CallStmt& callStmt) {
   }
 }
 
+// Runtime and external functions take tensors with the global float precision,
+// so tensors with a storage precision can not be passed to them
+static void checkComputePrecision(const ir::CallStmt& callStmt) {
+  vector<Type> types;
+  for (const Expr& actual : callStmt.actuals) {
+    types.push_back(actual.type());
+  }
+  for (const Var& result : callStmt.results) {
+    types.push_back(result.getType());
+  }
+  for (const Type& type : types) {
+    uassert(!type.isTensor() || isScalar(type) ||
+            !type.toTensor()->getComponentType().hasStoragePrecision())
+        << "tensors of type " << type << " can not be passed to "
+        << callStmt.callee.getName() << ", as it computes with "
+        << ScalarType::floatBytes << "-byte floats";
+  }
+}
+
 void LLVMBackend::emitExternCall(const ir::CallStmt& callStmt) {
+  checkComputePrecision(callStmt);
+
   // ensure it is called with the correct number of arguments.
   uassert(callStmt.actuals.size() == callStmt.callee.getArguments().size()) <<
       "External function '" << callStmt.callee.getName() << "' called with " <<
@@ -926,7 +1132,38 @@ void LLVMBackend::emitExternCall(const ir::CallStmt& callStmt) {
   }
 }
 
+// Returns the name of the type of the components of a tensor, as they are
+// stored, which names the runtime kernels that take the tensor
+static std::string componentTypeName(const Expr& tensor) {
+  ScalarType componentType = tensor.type().toTensor()->getComponentType();
+  if (componentType.kind == ScalarType::Int) {
+    return "_i32";
+  }
+  return (componentType.bytes() == sizeof(float)) ? "_f32" : "_f64";
+}
+
+// Returns the suffix of the runtime sparse matrix-vector multiply kernel for
+// the matrix, vector and result of a call to spmv or spmvt: the type of their
+// components if they are ints or floats of the compute precision, or each of
+// their types for the mixed-precision kernels, which accumulate in double
+static std::string spmvTypeSuffix(const ir::CallStmt& callStmt) {
+  std::string matrixType = componentTypeName(callStmt.actuals[0]);
+  std::string vectorType = componentTypeName(callStmt.actuals[1]);
+  std::string resultType = componentTypeName(callStmt.actuals[2]);
+  std::string computeType = ir::ScalarType::singleFloat() ? "_f32" : "_f64";
+  if (matrixType == vectorType && vectorType == resultType &&
+      (matrixType == "_i32" || matrixType == computeType)) {
+    return matrixType;
+  }
+  return matrixType + vectorType + resultType;
+}
+
 void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
+  // The sparse matrix-vector multiply kernels have mixed-precision variants
+  if (callStmt.callee != ir::intrinsics::spmv() &&
+      callStmt.callee != ir::intrinsics::spmvt()) {
+    checkComputePrecision(callStmt);
+  }
   auto args = emitArguments(callStmt.actuals, true);
 
   llvm::Function *fun = nullptr;
@@ -957,13 +1194,20 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
                                           {overloadType});
     call = builder->CreateCall(fun, args);
   }
-  // is it an intrinsic from libm?
+  // is it an intrinsic from libm? The calls are to the libm functions, which
+  // LLVM knows, and do not access memory, so they do not prevent the
+  // optimization of the loops that contain them.
   else if (callStmt.callee == ir::intrinsics::atan2() ||
            callStmt.callee == ir::intrinsics::tan()   ||
            callStmt.callee == ir::intrinsics::asin()  ||
            callStmt.callee == ir::intrinsics::acos()) {
-    std::string fname = callStmt.callee.getName() + floatTypeName;
-    call = emitCall(fname, args, llvmFloatType());
+    std::string fname = callStmt.callee.getName() +
+                        (ir::ScalarType::singleFloat() ? "f" : "");
+    llvm::CallInst *libmCall =
+        llvm::cast<llvm::CallInst>(emitCall(fname, args, llvmFloatType()));
+    libmCall->setDoesNotAccessMemory();
+    libmCall->setDoesNotThrow();
+    call = libmCall;
   }
   else if (callStmt.callee == ir::intrinsics::mod()) {
     iassert(callStmt.actuals.size() == 2) << "mod takes two inputs, got"
@@ -977,10 +1221,12 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
   else if (callStmt.callee == ir::intrinsics::free()) {
     auto arg = args[args.size()-1];
     arg = builder->CreateCast(llvm::Instruction::CastOps::BitCast, arg, LLVM_INT8_PTR);
-    call = emitCall("free", {arg}, LLVM_VOID);
+    call = emitCall("simit_free", {arg}, LLVM_VOID);
   }
   else if (callStmt.callee == ir::intrinsics::malloc()) {
-    call = emitCall("malloc", args, LLVM_INT8_PTR);
+    iassert(args.size() == 1);
+    llvm::Value* size = builder->CreateZExt(args[0], LLVM_INT64);
+    call = emitCall("simit_malloc", {size}, LLVM_INT8_PTR);
   }
   else if (callStmt.callee == ir::intrinsics::strcmp()) {
     call = emitCall("strcmp", args, LLVM_INT);
@@ -1002,27 +1248,57 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
   }
   else if (callee == ir::intrinsics::det()) {
     iassert(args.size() == 1);
-    std::string fname = callStmt.callee.getName() + "3" + floatTypeName;
-    call = emitCall(fname, args, llvmFloatType());
+    call = emitDet3(args[0]);
   }
   else if (callee == ir::intrinsics::inv()) {
     iassert(args.size() == 1);
 
     Var result = callStmt.results[0];
     llvm::Value *llvmResult = symtable.get(result);
-    args.push_back(llvmResult);
-
-    std::string fname = callStmt.callee.getName() + "3" + floatTypeName;
-    call = emitCall(fname, args);
+    emitInv3(args[0], llvmResult);
+    return;
   }
   else if (callStmt.callee == ir::intrinsics::solve()) {
     std::string fname = "cMatSolve" + floatTypeName;
     call = emitCall(fname, args);
   }
+  else if (callStmt.callee == ir::intrinsics::spmv()) {
+    // Arguments: n, m, rowptr, colidx, nn, mm, A, x, y
+    iassert(args.size() == 9);
+    Type blockType = callStmt.actuals[0].type().toTensor()->getBlockType();
+    unsigned blockSize = isScalar(blockType)
+        ? 1 : blockType.toTensor()->getOuterDimensions()[0].getSize();
+
+    std::string fname = "spmv" + std::to_string(blockSize) +
+                        spmvTypeSuffix(callStmt);
+    llvm::Value *rows = builder->CreateSDiv(args[0], args[4]);
+    call = emitCall(fname, {rows, args[2], args[3], args[6], args[7], args[8]});
+  }
+  else if (callStmt.callee == ir::intrinsics::spmvt()) {
+    // Arguments: n, m, rowptr, colidx, nn, mm, A, x, y
+    iassert(args.size() == 9);
+    const TensorType* type = callStmt.actuals[0].type().toTensor();
+    Type blockType = type->getBlockType();
+    unsigned blockRows = 1;
+    unsigned blockCols = 1;
+    if (!isScalar(blockType)) {
+      blockRows = blockType.toTensor()->getOuterDimensions()[0].getSize();
+      blockCols = blockType.toTensor()->getOuterDimensions()[1].getSize();
+    }
+    std::string fname = "spmvt" + std::to_string(blockRows) + "x" +
+                        std::to_string(blockCols) + spmvTypeSuffix(callStmt);
+    llvm::Value *rows = builder->CreateSDiv(args[0], args[4]);
+    llvm::Value *cols = builder->CreateSDiv(args[1], args[5]);
+    call = emitCall(fname, {rows, cols, args[2], args[3], args[6], args[7],
+                            args[8]});
+  }
   else if (callStmt.callee == ir::intrinsics::complexNorm()) {
-    std::string fname = "complexNorm" + floatTypeName;
-    call = emitCall(fname, {builder->ComplexGetReal(args[0]),
-      builder->ComplexGetImag(args[0])}, llvmFloatType());
+    llvm::Value *real = builder->ComplexGetReal(args[0]);
+    llvm::Value *imag = builder->ComplexGetImag(args[0]);
+    fun = llvm::Intrinsic::getDeclaration(module, llvm::Intrinsic::sqrt,
+                                          {llvmFloatType()});
+    call = builder->CreateCall(fun, builder->CreateFAdd(
+        builder->CreateFMul(real, real), builder->CreateFMul(imag, imag)));
   }
   else if (callStmt.callee == ir::intrinsics::createComplex()) {
     call = builder->CreateComplex(args[0], args[1]);
@@ -1047,7 +1323,7 @@ void LLVMBackend::emitIntrinsicCall(const ir::CallStmt& callStmt) {
     iassert(callStmt.results.size() == 1);
     Var var = callStmt.results[0];
     llvm::Value *llvmVar = symtable.get(var);
-    builder->CreateStore(call, llvmVar);
+    builder->CreateStore(emitStoragePrecision(call, llvmVar), llvmVar);
   }
 }
 
@@ -1066,8 +1342,19 @@ void LLVMBackend::compile(const ir::CallStmt& callStmt) {
 }
 
 void LLVMBackend::compile(const ir::Store& store) {
-  llvm::Value *buffer = compile(store.buffer);
-  llvm::Value *index = compile(store.index);
+  if (store.cop == CompoundOperator::Add && isa<VarExpr>(store.buffer) &&
+      util::contains(atomicBuffers, to<VarExpr>(store.buffer)->var)) {
+    llvm::Value *buffer = compile(store.buffer);
+    llvm::Value *index = compile(store.index);
+    string locName = string(buffer->getName()) + PTR_SUFFIX;
+    llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
+    emitAtomicAdd(bufferLoc, emitComputePrecision(compile(store.value)));
+    return;
+  }
+
+  llvm::Value *buffer;
+  llvm::Value *index;
+  emitBufferIndex(store.buffer, store.index, &buffer, &index);
   llvm::Value *value;
   switch (store.cop) {
     case CompoundOperator::None: {
@@ -1084,7 +1371,9 @@ void LLVMBackend::compile(const ir::Store& store) {
 
   string locName = string(buffer->getName()) + PTR_SUFFIX;
   llvm::Value *bufferLoc = builder->CreateInBoundsGEP(buffer, index, locName);
-  builder->CreateStore(value, bufferLoc);
+  llvm::StoreInst *storeInst =
+      builder->CreateStore(emitStoragePrecision(value, bufferLoc), bufferLoc);
+  emitAccessMetadata(storeInst, store.buffer);
 }
 
 void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
@@ -1096,6 +1385,7 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
 
   Type fieldType = getFieldType(fieldWrite.elementOrSet, fieldWrite.fieldName);
   Type valueType = fieldWrite.value.type();
+  Expr field = FieldRead::make(fieldWrite.elementOrSet, fieldWrite.fieldName);
 
   // Assigning a scalar to an n-order tensor
   if (fieldType.toTensor()->order() > 0 && valueType.toTensor()->order() == 0) {
@@ -1115,7 +1405,12 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
       unsigned compSize = tensorFieldType->getComponentType().bytes();
       llvm::Value *fieldSize = builder->CreateMul(fieldLen,llvmInt(compSize));
 
-      emitMemSet(fieldPtr, llvmInt(0,8), fieldSize, compSize);
+      if (hasFieldLayout(field)) {
+        emitFieldCopy(fieldPtr, field, nullptr, Expr(), fieldLen);
+      }
+      else {
+        emitMemSet(fieldPtr, llvmInt(0,8), fieldSize, compSize);
+      }
     }
     else {
       not_supported_yet;
@@ -1126,9 +1421,18 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
     llvm::Value *fieldPtr = emitFieldRead(fieldWrite.elementOrSet,
                                           fieldWrite.fieldName);
     llvm::Value *valuePtr;
+    bool valueLayout = false;
     switch (fieldWrite.cop) {
       case ir::CompoundOperator::None: {
-        valuePtr = compile(fieldWrite.value);
+        valueLayout = hasFieldLayout(fieldWrite.value);
+        if (valueLayout) {
+          const FieldRead *valueField = to<FieldRead>(fieldWrite.value);
+          valuePtr = emitFieldRead(valueField->elementOrSet,
+                                   valueField->fieldName);
+        }
+        else {
+          valuePtr = compile(fieldWrite.value);
+        }
         break;
       }
       case ir::CompoundOperator::Add: {
@@ -1148,7 +1452,16 @@ void LLVMBackend::compile(const ir::FieldWrite& fieldWrite) {
     unsigned elemSize = tensorFieldType->getComponentType().bytes();
     llvm::Value *fieldSize = builder->CreateMul(fieldLen, llvmInt(elemSize));
 
-    emitMemCpy(fieldPtr, valuePtr, fieldSize, elemSize);
+    if (hasFieldLayout(field) || valueLayout) {
+      emitFieldCopy(fieldPtr, field, valuePtr,
+                    valueLayout ? fieldWrite.value : Expr(), fieldLen);
+    }
+    else if (fieldPtr->getType() != valuePtr->getType()) {
+      emitPrecisionCopy(fieldPtr, valuePtr, fieldLen);
+    }
+    else {
+      emitMemCpy(fieldPtr, valuePtr, fieldSize, elemSize);
+    }
   }
 }
 
@@ -1230,6 +1543,19 @@ void LLVMBackend::compile(const ir::ForRange& forLoop) {
 }
 
 void LLVMBackend::compile(const ir::For& forLoop) {
+  if (forLoop.kind == For::Parallel) {
+    emitParallelFor(forLoop);
+    return;
+  }
+  if (forLoop.kind == For::Colored) {
+    EdgeReduction *edgeReduction =
+        getEdgeReduction(forLoop.domain.indexSet.getSet());
+    if (edgeReduction != nullptr) {
+      emitColoredFor(forLoop, edgeReduction);
+      return;
+    }
+  }
+
   std::string iName = forLoop.var.getName();
   ForDomain domain = forLoop.domain;
 
@@ -1289,6 +1615,599 @@ void LLVMBackend::compile(const ir::For& forLoop) {
   builder->SetInsertPoint(loopEnd);
 }
 
+void LLVMBackend::emitColoredFor(const ir::For& forLoop,
+                                 EdgeReduction *edgeReduction) {
+  // Loops whose iterations only conflict through accumulations into buffers
+  // can also use private copies of the buffers, or atomic updates to them
+  vector<Var> reductionBuffers;
+  bool atomics = getReductionBuffers(&forLoop, &reductionBuffers);
+  bool privatization = atomics;
+  for (const Var& buffer : reductionBuffers) {
+    ScalarType ctype = buffer.getType().toTensor()->getComponentType();
+    if (ctype.kind != ScalarType::Int && ctype.kind != ScalarType::Float) {
+      atomics = false;
+      privatization = false;
+    }
+    // Private copies are allocated with the length of the buffer
+    if (!storage.hasStorage(buffer) ||
+        (storage.getStorage(buffer).getKind() != TensorStorage::Dense &&
+         storage.getStorage(buffer).getKind() != TensorStorage::Indexed)) {
+      privatization = false;
+    }
+  }
+
+  vector<ParallelReduction> supported = {ColoredReduction};
+  if (privatization) {
+    supported.push_back(PrivatizedReduction);
+  }
+  if (atomics) {
+    supported.push_back(AtomicReduction);
+  }
+  vector<ParallelReduction> setSupported;
+  for (ParallelReduction reduction : edgeReduction->supported) {
+    if (util::contains(supported, reduction)) {
+      setSupported.push_back(reduction);
+    }
+  }
+  edgeReduction->supported = setSupported;
+
+  // Dispatch on the reduction chosen for the set
+  std::string iName = forLoop.var.getName();
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *loopEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_reduction_end", llvmFunc);
+  llvm::BasicBlock *coloredBlock =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_colored", llvmFunc);
+  llvm::Value *reduction = builder->CreateLoad(edgeReduction->reduction);
+  llvm::SwitchInst *reductionSwitch =
+      builder->CreateSwitch(reduction, coloredBlock, supported.size()-1);
+
+  for (ParallelReduction loopReduction : supported) {
+    llvm::BasicBlock *reductionBlock = coloredBlock;
+    if (loopReduction != ColoredReduction) {
+      string blockName = (loopReduction == PrivatizedReduction)
+                         ? "_privatized" : "_atomic";
+      reductionBlock = llvm::BasicBlock::Create(LLVM_CTX, iName+blockName,
+                                                llvmFunc);
+      reductionSwitch->addCase(llvmInt(loopReduction), reductionBlock);
+    }
+    builder->SetInsertPoint(reductionBlock);
+    emitParallelFor(forLoop, edgeReduction, loopReduction, reductionBuffers);
+    builder->CreateBr(loopEnd);
+  }
+  builder->SetInsertPoint(loopEnd);
+}
+
+void LLVMBackend::emitParallelFor(const ir::For& forLoop,
+                                  const EdgeReduction *edgeReduction,
+                                  ParallelReduction reduction,
+                                  const std::vector<ir::Var>& reductionBuffers) {
+  iassert(forLoop.domain.kind == ForDomain::IndexSet)
+      << "only loops over index sets can be parallel";
+  bool colored = (edgeReduction != nullptr && reduction == ColoredReduction);
+  bool privatized = (edgeReduction != nullptr &&
+                     reduction == PrivatizedReduction);
+  bool atomic = (edgeReduction != nullptr && reduction == AtomicReduction);
+
+  std::string iName = forLoop.var.getName();
+  llvm::Value *iNum = colored ? nullptr
+                              : emitComputeLen(forLoop.domain.indexSet);
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock &entryBlock = llvmFunc->getEntryBlock();
+
+  // Capture the values of the enclosing function that the loop body can see.
+  // Module-level values, such as globals and constants, are used directly.
+  vector<pair<Var,llvm::Value*>> captures;
+  set<Var> seenVars;
+  for (auto &scope : symtable) {
+    for (auto &symbol : scope) {
+      llvm::Value *value = symbol.second;
+      bool isLocal =
+          (llvm::isa<llvm::Instruction>(value) &&
+           llvm::cast<llvm::Instruction>(value)->getParent()->getParent() ==
+               llvmFunc) ||
+          (llvm::isa<llvm::Argument>(value) &&
+           llvm::cast<llvm::Argument>(value)->getParent() == llvmFunc);
+      if (isLocal && !util::contains(seenVars, symbol.first)) {
+        captures.push_back(symbol);
+      }
+      seenVars.insert(symbol.first);
+    }
+  }
+
+  vector<llvm::Type*> captureTypes;
+  for (auto &capture : captures) {
+    captureTypes.push_back(capture.second->getType());
+  }
+  llvm::StructType *closureType = llvm::StructType::get(LLVM_CTX,captureTypes);
+
+  // Allocate the closure, and the reduction buffer arrays of privatized loops,
+  // in the entry block, so that parallel loops nested in serial loops do not
+  // grow the stack
+  auto loopIP = builder->saveIP();
+  builder->SetInsertPoint(&entryBlock, entryBlock.begin());
+  llvm::Value *closure = builder->CreateAlloca(closureType, nullptr,
+                                               iName+"_closure");
+  llvm::Value *buffers = nullptr;
+  llvm::Value *lengths = nullptr;
+  llvm::Value *components = nullptr;
+  if (privatized) {
+    llvm::Value *numBuffers = llvmInt(reductionBuffers.size());
+    buffers = builder->CreateAlloca(LLVM_INT8_PTR, numBuffers,
+                                    iName+"_buffers");
+    lengths = builder->CreateAlloca(LLVM_INT32, numBuffers, iName+"_lengths");
+    components = builder->CreateAlloca(LLVM_INT32, numBuffers,
+                                       iName+"_components");
+  }
+  builder->restoreIP(loopIP);
+
+  llvm::Value *closureVal = llvm::UndefValue::get(closureType);
+  for (size_t i = 0; i < captures.size(); ++i) {
+    closureVal = builder->CreateInsertValue(closureVal, captures[i].second,
+                                            {(unsigned)i});
+  }
+  builder->CreateStore(closureVal, closure);
+  closure = builder->CreateBitCast(closure, LLVM_INT8_PTR);
+
+  // Store the reduction buffers of a privatized loop, which the runtime passes
+  // to the body together with private copies of them
+  if (privatized) {
+    for (size_t b = 0; b < reductionBuffers.size(); ++b) {
+      const Var& buffer = reductionBuffers[b];
+      const TensorType *type = buffer.getType().toTensor();
+      llvm::Value *bufferPtr = builder->CreateBitCast(
+          compile(VarExpr::make(buffer)), LLVM_INT8_PTR);
+      builder->CreateStore(bufferPtr,
+                           builder->CreateInBoundsGEP(buffers, llvmInt(b)));
+      llvm::Value *len = emitComputeLen(type, storage.getStorage(buffer));
+      builder->CreateStore(len, builder->CreateInBoundsGEP(lengths,
+                                                           llvmInt(b)));
+      // See PrivatizedComponent in the runtime
+      int component = (type->getComponentType().kind == ScalarType::Int)
+                      ? 0 : (type->getComponentType().bytes() == 4) ? 1 : 2;
+      builder->CreateStore(llvmInt(component),
+                           builder->CreateInBoundsGEP(components, llvmInt(b)));
+    }
+  }
+  loopIP = builder->saveIP();
+
+  // Outline the loop body into a function that executes the iterations in
+  // [start, end)
+  vector<string> argNames = {"start", "end", "closure"};
+  vector<llvm::Type*> argTypes = {LLVM_INT32, LLVM_INT32, LLVM_INT8_PTR};
+  if (privatized) {
+    argNames.push_back("buffers");
+    argTypes.push_back(LLVM_INT8_PTR->getPointerTo());
+  }
+  llvm::Function *bodyFunc =
+      createPrototypeLLVM(string(llvmFunc->getName())+"_"+iName+"_body",
+                          argNames, argTypes, module, false);
+  auto argIt = bodyFunc->getArgumentList().begin();
+  llvm::Value *start = &(*argIt++);
+  llvm::Value *end = &(*argIt++);
+  llvm::Value *closureArg = &(*argIt++);
+  llvm::Value *buffersArg = privatized ? &(*argIt) : nullptr;
+
+  llvm::BasicBlock *bodyEntry = llvm::BasicBlock::Create(LLVM_CTX, "entry",
+                                                         bodyFunc);
+  builder->SetInsertPoint(bodyEntry);
+
+  symtable.scope();
+  llvm::Value *closurePtr =
+      builder->CreateBitCast(closureArg, closureType->getPointerTo());
+  llvm::Value *closureStruct = builder->CreateLoad(closurePtr);
+  for (size_t i = 0; i < captures.size(); ++i) {
+    llvm::Value *capture = builder->CreateExtractValue(closureStruct,
+                                                       {(unsigned)i});
+    capture->setName(captures[i].second->getName());
+    symtable.insert(captures[i].first, capture);
+  }
+
+  // The iterations of a privatized loop accumulate into the buffers they are
+  // given by the runtime
+  for (size_t b = 0; privatized && b < reductionBuffers.size(); ++b) {
+    const Var& buffer = reductionBuffers[b];
+    llvm::Value *bufferPtr = builder->CreateLoad(
+        builder->CreateInBoundsGEP(buffersArg, llvmInt(b)));
+    bufferPtr = builder->CreateBitCast(bufferPtr, llvmType(buffer.getType()),
+                                       buffer.getName());
+    // Globals are stored as pointer-pointers
+    if (util::contains(globals, buffer)) {
+      llvm::Value *bufferPtrPtr = builder->CreateAlloca(bufferPtr->getType());
+      builder->CreateStore(bufferPtr, bufferPtrPtr);
+      bufferPtr = bufferPtrPtr;
+    }
+    symtable.insert(buffer, bufferPtr);
+  }
+
+  // Compile the var decls of the body in the entry block, so that every thread
+  // allocates the storage of the iteration-private variables once
+  bool wasInParallelLoop = inParallelLoop;
+  inParallelLoop = true;
+  if (atomic) {
+    atomicBuffers.insert(reductionBuffers.begin(), reductionBuffers.end());
+  }
+  pair<Stmt,vector<Stmt>> body = removeVarDecls(forLoop.body);
+  for (auto &varDecl : body.second) {
+    compile(varDecl);
+  }
+
+  // The edges of a colored loop are stored after the color offsets
+  llvm::Value *coloredEdges = nullptr;
+  if (colored) {
+    llvm::Value *coloringPtr = builder->CreateLoad(edgeReduction->coloring);
+    llvm::Value *numColors = builder->CreateLoad(coloringPtr);
+    coloredEdges = builder->CreateInBoundsGEP(
+        coloringPtr, builder->CreateAdd(numColors, llvmInt(2)),
+        iName+"_edges");
+  }
+
+  // Loop Header
+  llvm::BasicBlock *loopEntry = builder->GetInsertBlock();
+  llvm::BasicBlock *loopBodyStart =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_body", bodyFunc);
+  llvm::BasicBlock *loopEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, iName+"_loop_end", bodyFunc);
+  llvm::Value *firstCmp = builder->CreateICmpSLT(start, end);
+  builder->CreateCondBr(firstCmp, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopBodyStart);
+
+  llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, iName);
+  i->addIncoming(start, loopEntry);
+
+  // Loop Body
+  llvm::Value *element = i;
+  if (coloredEdges != nullptr) {
+    element = builder->CreateLoad(builder->CreateInBoundsGEP(coloredEdges, i),
+                                  iName+"_edge");
+  }
+  symtable.insert(forLoop.var, element);
+  compile(body.first);
+
+  // Loop Footer
+  llvm::BasicBlock *loopBodyEnd = builder->GetInsertBlock();
+  llvm::Value *i_nxt = builder->CreateAdd(i, builder->getInt32(1),
+                                          iName+"_nxt", false, true);
+  i->addIncoming(i_nxt, loopBodyEnd);
+
+  llvm::Value *exitCond = builder->CreateICmpSLT(i_nxt, end, iName+"_cmp");
+  builder->CreateCondBr(exitCond, loopBodyStart, loopEnd);
+  builder->SetInsertPoint(loopEnd);
+  builder->CreateRetVoid();
+
+  inParallelLoop = wasInParallelLoop;
+  atomicBuffers.clear();
+  symtable.unscope();
+
+  // Dispatch the iterations to the thread pool
+  builder->restoreIP(loopIP);
+  if (colored) {
+    emitCall("simitColoredParallelFor",
+             {bodyFunc, closure, builder->CreateLoad(edgeReduction->coloring)});
+  }
+  else if (privatized) {
+    emitCall("simitPrivatizedParallelFor",
+             {bodyFunc, closure, iNum, llvmInt(reductionBuffers.size()),
+              buffers, lengths, components});
+  }
+  else {
+    emitCall("simitParallelFor", {bodyFunc, closure, iNum});
+  }
+}
+
+LLVMBackend::EdgeReduction *LLVMBackend::getEdgeReduction(const ir::Expr& set) {
+  if (!isa<VarExpr>(set) ||
+      !util::contains(bindableSets, to<VarExpr>(set)->var)) {
+    return nullptr;
+  }
+  const Var& setVar = to<VarExpr>(set)->var;
+  if (!util::contains(edgeReductions, setVar)) {
+    // The reduction and the coloring are stored when the function is
+    // initialized
+    EdgeReduction edgeReduction;
+    edgeReduction.reduction =
+        new llvm::GlobalVariable(*module, LLVM_INT32,
+                                 false, llvm::GlobalValue::ExternalLinkage,
+                                 llvmInt(ColoredReduction),
+                                 setVar.getName()+".reduction", nullptr,
+                                 llvm::GlobalVariable::NotThreadLocal,
+                                 globalAddrspace(), true);
+    edgeReduction.coloring =
+        new llvm::GlobalVariable(*module, LLVM_INT_PTR,
+                                 false, llvm::GlobalValue::ExternalLinkage,
+                                 llvm::ConstantPointerNull::get(LLVM_INT_PTR),
+                                 setVar.getName()+".coloring", nullptr,
+                                 llvm::GlobalVariable::NotThreadLocal,
+                                 globalAddrspace(), true);
+    edgeReduction.coloring->setAlignment(8);
+    edgeReduction.supported = {ColoredReduction, PrivatizedReduction,
+                               AtomicReduction};
+    edgeReductions.insert({setVar, edgeReduction});
+  }
+  return &edgeReductions.at(setVar);
+}
+
+void LLVMBackend::emitAliasScopes(const vector<Func>& callTree) {
+  aliasScopes.clear();
+  tbaaTags.clear();
+  tbaaRoot = nullptr;
+
+  // Fields are scoped by name, so that sets that are bound to several
+  // arguments share their scopes
+  set<string> keys;
+  auto addSetFields = [&keys](const Var& var) {
+    if (var.getType().isSet()) {
+      const ElementType *elemType =
+          var.getType().toSet()->elementType.toElement();
+      for (const Field& field : elemType->fields) {
+        keys.insert("field:" + field.name);
+      }
+    }
+  };
+  for (const Func& f : callTree) {
+    for (const Var& arg : f.getArguments()) {
+      addSetFields(arg);
+    }
+    for (const Var& res : f.getResults()) {
+      addSetFields(res);
+    }
+  }
+  for (const Var& ext : environment->getExternVars()) {
+    addSetFields(ext);
+  }
+  for (const Var& tmp : temporaries) {
+    keys.insert("tmp:" + tmp.getName());
+  }
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+  for (const string& key : keys) {
+    aliasScopes[key] = {nullptr, nullptr};
+  }
+#else
+  llvm::MDBuilder md(LLVM_CTX);
+  llvm::MDNode *domain = md.createAnonymousAliasScopeDomain("simit");
+  map<string, llvm::MDNode*> scopes;
+  for (const string& key : keys) {
+    scopes[key] = md.createAnonymousAliasScope(domain, key);
+  }
+  for (auto& scope : scopes) {
+    vector<llvm::Metadata*> others;
+    for (auto& other : scopes) {
+      if (other.first != scope.first) {
+        others.push_back(other.second);
+      }
+    }
+    vector<llvm::Metadata*> scopeList = {scope.second};
+    aliasScopes[scope.first] = {llvm::MDNode::get(LLVM_CTX, scopeList),
+                                llvm::MDNode::get(LLVM_CTX, others)};
+  }
+#endif
+}
+
+void LLVMBackend::emitAccessMetadata(llvm::Instruction *access,
+                                     const ir::Expr& buffer) {
+  string key;
+  if (isa<FieldRead>(buffer) &&
+      to<FieldRead>(buffer)->elementOrSet.type().isSet()) {
+    key = "field:" + to<FieldRead>(buffer)->fieldName;
+  }
+  else if (isa<VarExpr>(buffer) &&
+           util::contains(temporaries, to<VarExpr>(buffer)->var)) {
+    key = "tmp:" + to<VarExpr>(buffer)->var.getName();
+  }
+  if (!util::contains(aliasScopes, key)) {
+    return;
+  }
+
+  // Buffers of scalars are only accessed as their scalar type, while complex
+  // values are also accessed through their parts
+  llvm::Type *type = isa<llvm::StoreInst>(access)
+      ? llvm::cast<llvm::StoreInst>(access)->getValueOperand()->getType()
+      : access->getType();
+  if (type->isFloatingPointTy() || type->isIntegerTy()) {
+    string typeName;
+    llvm::raw_string_ostream typeNameStream(typeName);
+    type->print(typeNameStream);
+    typeNameStream.flush();
+    if (!util::contains(tbaaTags, typeName)) {
+      llvm::MDBuilder md(LLVM_CTX);
+      if (tbaaRoot == nullptr) {
+        tbaaRoot = md.createTBAARoot("simit");
+      }
+      llvm::MDNode *typeNode = md.createTBAAScalarTypeNode(typeName, tbaaRoot);
+      tbaaTags[typeName] = md.createTBAAStructTagNode(typeNode, typeNode, 0);
+    }
+    access->setMetadata(llvm::LLVMContext::MD_tbaa, tbaaTags.at(typeName));
+  }
+
+#if !(LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5)
+  const pair<llvm::MDNode*,llvm::MDNode*>& scopes = aliasScopes.at(key);
+  access->setMetadata(llvm::LLVMContext::MD_alias_scope, scopes.first);
+  access->setMetadata(llvm::LLVMContext::MD_noalias, scopes.second);
+#endif
+}
+
+void LLVMBackend::emitAtomicAdd(llvm::Value *ptr, llvm::Value *value) {
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 8
+  const llvm::AtomicOrdering ordering = llvm::Monotonic;
+#else
+  const llvm::AtomicOrdering ordering = llvm::AtomicOrdering::Monotonic;
+#endif
+  llvm::Type *type = value->getType();
+  if (type->isIntegerTy()) {
+    builder->CreateAtomicRMW(llvm::AtomicRMWInst::Add, ptr, value, ordering);
+    return;
+  }
+
+  // Floating point adds are compare-and-swap loops on integers of the same
+  // width as the stored values, which are added with the compute precision
+  iassert(type->isFloatingPointTy());
+  type = ptr->getType()->getPointerElementType();
+  llvm::Type *intType = llvm::IntegerType::get(LLVM_CTX,
+                                               type->getPrimitiveSizeInBits());
+  llvm::Value *intPtr = builder->CreateBitCast(
+      ptr, intType->getPointerTo(ptr->getType()->getPointerAddressSpace()));
+  llvm::Value *initial = builder->CreateLoad(intPtr);
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *entry = builder->GetInsertBlock();
+  llvm::BasicBlock *casLoop =
+      llvm::BasicBlock::Create(LLVM_CTX, "atomic_add", llvmFunc);
+  llvm::BasicBlock *casEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, "atomic_add_end", llvmFunc);
+  builder->CreateBr(casLoop);
+  builder->SetInsertPoint(casLoop);
+
+  llvm::PHINode *old = builder->CreatePHI(intType, 2);
+  old->addIncoming(initial, entry);
+  llvm::Value *sum = builder->CreateFAdd(
+      emitComputePrecision(builder->CreateBitCast(old, type)), value);
+  sum = emitStoragePrecision(sum, ptr);
+  llvm::Value *sumBits = builder->CreateBitCast(sum, intType);
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
+  llvm::Value *loaded = builder->CreateAtomicCmpXchg(intPtr, old, sumBits,
+                                                     ordering);
+  llvm::Value *success = builder->CreateICmpEQ(loaded, old);
+#else
+  llvm::Value *result = builder->CreateAtomicCmpXchg(intPtr, old, sumBits,
+                                                     ordering, ordering);
+  llvm::Value *loaded = builder->CreateExtractValue(result, {0});
+  llvm::Value *success = builder->CreateExtractValue(result, {1});
+#endif
+  old->addIncoming(loaded, casLoop);
+  builder->CreateCondBr(success, casEnd, casLoop);
+  builder->SetInsertPoint(casEnd);
+}
+
+llvm::Value *LLVMBackend::emitDet3(llvm::Value *a) {
+  llvm::Value *m[9];
+  for (int i = 0; i < 9; ++i) {
+    m[i] = builder->CreateLoad(builder->CreateInBoundsGEP(a, llvmInt(i)));
+  }
+  auto minor = [&](int i, int j, int k, int l) {
+    return builder->CreateFSub(builder->CreateFMul(m[i], m[j]),
+                               builder->CreateFMul(m[k], m[l]));
+  };
+  llvm::Value *det = builder->CreateFMul(m[0], minor(4,8, 5,7));
+  det = builder->CreateFSub(det, builder->CreateFMul(m[1], minor(3,8, 5,6)));
+  det = builder->CreateFAdd(det, builder->CreateFMul(m[2], minor(3,7, 4,6)));
+  return det;
+}
+
+void LLVMBackend::emitInv3(llvm::Value *a, llvm::Value *inv) {
+  llvm::Value *m[9];
+  for (int i = 0; i < 9; ++i) {
+    m[i] = builder->CreateLoad(builder->CreateInBoundsGEP(a, llvmInt(i)));
+  }
+  auto minor = [&](int i, int j, int k, int l) {
+    return builder->CreateFSub(builder->CreateFMul(m[i], m[j]),
+                               builder->CreateFMul(m[k], m[l]));
+  };
+
+  // The cofactors, transposed into the adjugate
+  llvm::Value *adj[9] = {minor(4,8, 5,7), minor(2,7, 1,8), minor(1,5, 2,4),
+                         minor(5,6, 3,8), minor(0,8, 2,6), minor(2,3, 0,5),
+                         minor(3,7, 4,6), minor(1,6, 0,7), minor(0,4, 1,3)};
+  llvm::Value *det = builder->CreateFMul(m[0], adj[0]);
+  det = builder->CreateFAdd(det, builder->CreateFMul(m[1], adj[3]));
+  det = builder->CreateFAdd(det, builder->CreateFMul(m[2], adj[6]));
+  llvm::Value *detInv = builder->CreateFDiv(llvmFP(1.0), det);
+  for (int i = 0; i < 9; ++i) {
+    builder->CreateStore(builder->CreateFMul(adj[i], detInv),
+                         builder->CreateInBoundsGEP(inv, llvmInt(i)));
+  }
+}
+
+llvm::Value *LLVMBackend::emitComputePrecision(llvm::Value *value) {
+  if (value->getType()->isFloatingPointTy() &&
+      value->getType() != llvmFloatType()) {
+    return builder->CreateFPCast(value, llvmFloatType());
+  }
+  return value;
+}
+
+llvm::Value *LLVMBackend::emitStoragePrecision(llvm::Value *value,
+                                               llvm::Value *ptr) {
+  llvm::Type *type = ptr->getType()->getPointerElementType();
+  if (value->getType()->isFloatingPointTy() && value->getType() != type) {
+    return builder->CreateFPCast(value, type);
+  }
+  return value;
+}
+
+void LLVMBackend::emitPrecisionCopy(llvm::Value *dst, llvm::Value *src,
+                                    llvm::Value *len) {
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *copyBody =
+      llvm::BasicBlock::Create(LLVM_CTX, "copy_body", llvmFunc);
+  llvm::BasicBlock *copyEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, "copy_end", llvmFunc);
+  builder->CreateCondBr(builder->CreateICmpSLT(llvmInt(0), len),
+                        copyBody, copyEnd);
+  builder->SetInsertPoint(copyBody);
+
+  llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, "i");
+  i->addIncoming(llvmInt(0), entryBlock);
+  llvm::Value *component =
+      builder->CreateLoad(builder->CreateInBoundsGEP(src, i));
+  llvm::Value *dstLoc = builder->CreateInBoundsGEP(dst, i);
+  builder->CreateStore(emitStoragePrecision(component, dstLoc), dstLoc);
+
+  llvm::Value *i_nxt = builder->CreateAdd(i, builder->getInt32(1), "i_nxt",
+                                          false, true);
+  i->addIncoming(i_nxt, copyBody);
+  builder->CreateCondBr(builder->CreateICmpSLT(i_nxt, len), copyBody, copyEnd);
+  builder->SetInsertPoint(copyEnd);
+}
+
+void LLVMBackend::emitFieldCopy(llvm::Value *dst, const ir::Expr &dstBuffer,
+                                llvm::Value *src, const ir::Expr &srcBuffer,
+                                llvm::Value *len) {
+  iassert(hasFieldLayout(dstBuffer) || hasFieldLayout(srcBuffer));
+  const FieldRead *field = hasFieldLayout(dstBuffer) ? to<FieldRead>(dstBuffer)
+                                                     : to<FieldRead>(srcBuffer);
+  const SetType *setType = field->elementOrSet.type().toSet();
+  const ElementType *elemType = setType->elementType.toElement();
+  int blockSize = elemType->field(field->fieldName).type.toTensor()->size();
+
+  llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
+  llvm::BasicBlock *entryBlock = builder->GetInsertBlock();
+  llvm::BasicBlock *copyBody =
+      llvm::BasicBlock::Create(LLVM_CTX, "copy_body", llvmFunc);
+  llvm::BasicBlock *copyEnd =
+      llvm::BasicBlock::Create(LLVM_CTX, "copy_end", llvmFunc);
+  builder->CreateCondBr(builder->CreateICmpSLT(llvmInt(0), len),
+                        copyBody, copyEnd);
+  builder->SetInsertPoint(copyBody);
+
+  llvm::PHINode *i = builder->CreatePHI(LLVM_INT32, 2, "i");
+  i->addIncoming(llvmInt(0), entryBlock);
+  llvm::Value *element = builder->CreateUDiv(i, llvmInt(blockSize));
+  llvm::Value *component = builder->CreateURem(i, llvmInt(blockSize));
+
+  llvm::Value *value;
+  if (src == nullptr) {
+    value = llvm::Constant::getNullValue(dst->getType()->getPointerElementType());
+  }
+  else {
+    llvm::Value *srcIndex = hasFieldLayout(srcBuffer)
+        ? emitFieldIndex(*to<FieldRead>(srcBuffer), element, component) : i;
+    value = builder->CreateLoad(builder->CreateInBoundsGEP(src, srcIndex));
+  }
+  llvm::Value *dstIndex = hasFieldLayout(dstBuffer)
+      ? emitFieldIndex(*to<FieldRead>(dstBuffer), element, component) : i;
+  llvm::Value *dstLoc = builder->CreateInBoundsGEP(dst, dstIndex);
+  builder->CreateStore(emitStoragePrecision(value, dstLoc), dstLoc);
+
+  llvm::Value *i_nxt = builder->CreateAdd(i, builder->getInt32(1), "i_nxt",
+                                          false, true);
+  i->addIncoming(i_nxt, builder->GetInsertBlock());
+  builder->CreateCondBr(builder->CreateICmpSLT(i_nxt, len), copyBody, copyEnd);
+  builder->SetInsertPoint(copyEnd);
+}
+
 void LLVMBackend::compile(const ir::While& whileLoop) {
   llvm::Function *llvmFunc = builder->GetInsertBlock()->getParent();
 
@@ -1396,8 +2315,105 @@ llvm::Value *LLVMBackend::emitFieldRead(const Expr &elemOrSet,
   
   assert(elemType->hasField(fieldName));
   unsigned fieldLoc = fieldsOffset + elemType->fieldNames.at(fieldName);
-  return builder->CreateExtractValue(setOrElemValue, {fieldLoc},
-                                     setOrElemValue->getName()+"."+fieldName);
+  llvm::Value *field =
+      builder->CreateExtractValue(setOrElemValue, {fieldLoc},
+                                  setOrElemValue->getName()+"."+fieldName);
+  return field;
+}
+
+FieldLayout LLVMBackend::getFieldLayout(const ir::FieldRead &field) const {
+  const SetType *setType = field.elementOrSet.type().toSet();
+  const string &elemTypeName = setType->elementType.toElement()->name;
+  if (util::contains(fieldLayouts, elemTypeName) &&
+      util::contains(fieldLayouts.at(elemTypeName), field.fieldName)) {
+    return fieldLayouts.at(elemTypeName).at(field.fieldName);
+  }
+  return {Set::AoS, 1};
+}
+
+bool LLVMBackend::hasFieldLayout(const ir::Expr &buffer) const {
+  if (!isa<FieldRead>(buffer) ||
+      !to<FieldRead>(buffer)->elementOrSet.type().isSet()) {
+    return false;
+  }
+  // The layouts store the tensors of one component elements alike
+  const FieldRead *field = to<FieldRead>(buffer);
+  const SetType *setType = field->elementOrSet.type().toSet();
+  Type fieldType = setType->elementType.toElement()->field(field->fieldName).type;
+  return fieldType.toTensor()->size() > 1 &&
+         getFieldLayout(*field).layout != Set::AoS;
+}
+
+llvm::Value *LLVMBackend::emitFieldIndex(const ir::FieldRead &field,
+                                         const ir::Expr &index) {
+  const SetType *setType = field.elementOrSet.type().toSet();
+  const ElementType *elemType = setType->elementType.toElement();
+  int blockSize = elemType->field(field.fieldName).type.toTensor()->size();
+
+  Expr element;
+  Expr component;
+  if (splitFieldIndex(index, blockSize, &element, &component)) {
+    return emitFieldIndex(field, compile(element), compile(component));
+  }
+  llvm::Value *indexVal = compile(index);
+  return emitFieldIndex(field,
+                        builder->CreateUDiv(indexVal, llvmInt(blockSize)),
+                        builder->CreateURem(indexVal, llvmInt(blockSize)));
+}
+
+llvm::Value *LLVMBackend::emitFieldIndex(const ir::FieldRead &field,
+                                         llvm::Value *element,
+                                         llvm::Value *component) {
+  const SetType *setType = field.elementOrSet.type().toSet();
+  const ElementType *elemType = setType->elementType.toElement();
+  int blockSize = elemType->field(field.fieldName).type.toTensor()->size();
+
+  FieldLayout layout = getFieldLayout(field);
+  iassert(layout.layout != Set::AoS);
+
+  string name = field.fieldName;
+  if (layout.layout == Set::SoA) {
+    // The components of a tensor are a capacity apart, which the set struct
+    // stores after the field pointers
+    llvm::Value *setValue = compile(field.elementOrSet);
+    std::shared_ptr<SetLayout> setLayout =
+        getSetLayout(field.elementOrSet, setValue, builder.get());
+    unsigned strideLoc = setLayout->getFieldStridesOffset() +
+                         elemType->fieldNames.at(field.fieldName);
+    name = string(setValue->getName()) + "." + name;
+    llvm::Value *stride =
+        builder->CreateExtractValue(setValue, {strideLoc}, name+".stride");
+    return builder->CreateAdd(element, builder->CreateMul(component, stride),
+                              name+".index");
+  }
+
+  // The elements are grouped in blocks of blockWidth elements that are stored
+  // as structures of arrays
+  iassert(layout.layout == Set::AoSoA);
+  llvm::Value *blockStart = builder->CreateMul(
+      builder->CreateAnd(element, llvmInt(~(layout.blockWidth-1))),
+      llvmInt(blockSize));
+  llvm::Value *elementStart = builder->CreateAdd(
+      blockStart, builder->CreateAnd(element, llvmInt(layout.blockWidth-1)));
+  return builder->CreateAdd(elementStart,
+                            builder->CreateMul(component,
+                                               llvmInt(layout.blockWidth)),
+                            name+".index");
+}
+
+void LLVMBackend::emitBufferIndex(const ir::Expr &buffer,
+                                  const ir::Expr &index,
+                                  llvm::Value **bufferVal,
+                                  llvm::Value **indexVal) {
+  if (hasFieldLayout(buffer)) {
+    const FieldRead *field = to<FieldRead>(buffer);
+    *bufferVal = emitFieldRead(field->elementOrSet, field->fieldName);
+    *indexVal = emitFieldIndex(*field, index);
+  }
+  else {
+    *bufferVal = compile(buffer);
+    *indexVal = compile(index);
+  }
 }
 
 llvm::Value *LLVMBackend::emitComputeLen(const TensorType *tensorType,
@@ -1550,6 +2566,24 @@ llvm::Constant *LLVMBackend::emitGlobalString(const std::string& str) {
 #endif
 }
 
+llvm::Constant *LLVMBackend::emitGlobalLiteral(const ir::Literal& literal) {
+  // The data is part of the module, rather than a pointer into this process'
+  // memory, so that the module text, by which the object cache keys compiled
+  // code, is the same in every process, and so that emitted object code does
+  // not refer to this process
+  auto dataValue = llvm::ConstantDataArray::get(
+      LLVM_CTX, llvm::ArrayRef<uint8_t>((const uint8_t*)literal.data,
+                                        literal.size));
+
+  llvm::GlobalVariable *dataGlobal =
+      new llvm::GlobalVariable(*module, dataValue->getType(), true,
+                               llvm::GlobalValue::PrivateLinkage, dataValue,
+                               "_literal");
+  dataGlobal->setAlignment(8);
+  return llvm::ConstantExpr::getBitCast(dataGlobal,
+                                        llvmType(*literal.type.toTensor()));
+}
+
 llvm::Function *LLVMBackend::emitEmptyFunction(const string &name,
                                                const vector<ir::Var> &arguments,
                                                const vector<ir::Var> &results,
@@ -1662,6 +2696,16 @@ void LLVMBackend::emitGlobals(const ir::Environment& env) {
       this->globals.insert(colidx);
     }
   }
+
+  // Emit global transpositions
+  for (const Transposition& transposition : env.getTranspositions()) {
+    const Var& locations = transposition.getLocations();
+    llvm::GlobalVariable* locationsPtr =
+        createGlobal(module, locations, llvm::GlobalValue::ExternalLinkage,
+                     globalAddrspace());
+    this->symtable.insert(locations, locationsPtr);
+    this->globals.insert(locations);
+  }
 }
 
 void LLVMBackend::emitAssign(Var var, const Expr& value) {
@@ -1670,7 +2714,12 @@ void LLVMBackend::emitAssign(Var var, const Expr& value) {
   ///       in the backend. Probably requires copy and memset intrinsics.
 //  iassert(isScalar(value.type()) &&
 //         "assignment non-scalars should have been lowered by now");
-  llvm::Value *valuePtr = compile(value);
+  // Copies of fields locate the components by the fields' layouts
+  bool valueLayout = hasFieldLayout(value);
+  llvm::Value *valuePtr = valueLayout
+      ? emitFieldRead(to<FieldRead>(value)->elementOrSet,
+                      to<FieldRead>(value)->fieldName)
+      : compile(value);
 
   iassert(var.getType().isTensor() && value.type().isTensor());
   std::string varName = var.getName();
@@ -1690,7 +2739,7 @@ void LLVMBackend::emitAssign(Var var, const Expr& value) {
 
   // Assigning a scalar to a scalar
   if (varType->order() == 0 && valType->order() == 0) {
-    builder->CreateStore(valuePtr, varPtr);
+    builder->CreateStore(emitStoragePrecision(valuePtr, varPtr), varPtr);
     valuePtr->setName(varName + VAL_SUFFIX);
   }
   // Assign to n-order tensors
@@ -1730,7 +2779,15 @@ void LLVMBackend::emitAssign(Var var, const Expr& value) {
     else {
       iassert(var.getType() == value.type())
           << "variable and value types don't match";
-      emitMemCpy(varPtr, valuePtr, size, componentSize);
+      if (valueLayout) {
+        emitFieldCopy(varPtr, Expr(), valuePtr, value, len);
+      }
+      else if (varPtr->getType() != valuePtr->getType()) {
+        emitPrecisionCopy(varPtr, valuePtr, len);
+      }
+      else {
+        emitMemCpy(varPtr, valuePtr, size, componentSize);
+      }
     }
   }
 }
@@ -1749,7 +2806,7 @@ llvm::Value *LLVMBackend::makeGlobalTensor(ir::Var var) {
   // Allocate buffer for local variable in global storage.
   // TODO: We should allocate small local dense tensors on the stack
   iassert(var.getType().isTensor());
-  llvm::Type *ctype = llvmType(var.getType().toTensor()->getComponentType());
+  llvm::Type *ctype = llvmType(*var.getType().toTensor())->getElementType();
   llvm::PointerType *globalType = llvm::PointerType::get(ctype, globalAddrspace());
 
   llvm::GlobalVariable* buffer =
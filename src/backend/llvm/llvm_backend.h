@@ -9,6 +9,7 @@
 
 #include "backend/backend_impl.h"
 
+#include "coloring.h"
 #include "storage.h"
 #include "var.h"
 #include "backend/backend_visitor.h"
@@ -27,7 +28,9 @@ class Type;
 class Value;
 class Instruction;
 class Function;
+class GlobalVariable;
 class DataLayout;
+class MDNode;
 }
 
 
@@ -69,6 +72,36 @@ protected:
   std::unique_ptr<llvm::DataLayout> dataLayout;
   std::unique_ptr<SimitIRBuilder> builder;
 
+  // True while compiling the body of a parallel loop
+  bool inParallelLoop = false;
+
+  /// The globals that hold the parallel reduction chosen for an edge set with
+  /// colored loops and the set's coloring, and the reductions that every
+  /// colored loop over the set supports.
+  struct EdgeReduction {
+    llvm::GlobalVariable *reduction;
+    llvm::GlobalVariable *coloring;
+    std::vector<ParallelReduction> supported;
+  };
+
+  // Sets that are bound to the compiled function by name, and the edge
+  // reductions of the bound edge sets with colored loops
+  std::set<ir::Var> bindableSets;
+  std::map<ir::Var, EdgeReduction> edgeReductions;
+
+  // Reduction buffers that the parallel loop being compiled updates atomically
+  std::set<ir::Var> atomicBuffers;
+
+  // Temporaries of the environment, whose buffers the function allocates
+  std::set<ir::Var> temporaries;
+
+  // The alias scope of the accesses to each set field ("field:" + name) and
+  // temporary ("tmp:" + name), paired with the list of the other scopes, and
+  // the type-based alias tags of the scalar types that are accessed
+  std::map<std::string, std::pair<llvm::MDNode*,llvm::MDNode*>> aliasScopes;
+  std::map<std::string, llvm::MDNode*> tbaaTags;
+  llvm::MDNode *tbaaRoot = nullptr;
+
   using BackendImpl::compile;
   virtual Function* compile(ir::Func func, const ir::Storage& storage);
 
@@ -113,6 +146,30 @@ protected:
   /// Get a pointer to the given field
   llvm::Value *emitFieldRead(const ir::Expr &elemOrSet, std::string fieldName);
 
+  /// Get the layout that the function locates the components of a set field
+  /// by (see BackendImpl::setFieldLayout).
+  FieldLayout getFieldLayout(const ir::FieldRead &field) const;
+
+  /// True if the buffer is a set field whose element tensors have several
+  /// components and whose layout is not AoS, so that its components are not
+  /// at their AoS locations.
+  bool hasFieldLayout(const ir::Expr &buffer) const;
+
+  /// Get the location in the buffer of a set field of its component `index`,
+  /// which is the location of the component in an AoS buffer. The location
+  /// follows the layout of the field (see Set::Layout).
+  llvm::Value *emitFieldIndex(const ir::FieldRead &field, const ir::Expr &index);
+
+  /// Get the location in the buffer of a set field of `component` of the
+  /// tensor of `element`.
+  llvm::Value *emitFieldIndex(const ir::FieldRead &field, llvm::Value *element,
+                              llvm::Value *component);
+
+  /// Compile the buffer and index of a load or store. The components of set
+  /// fields are located by their layouts.
+  void emitBufferIndex(const ir::Expr &buffer, const ir::Expr &index,
+                       llvm::Value **bufferVal, llvm::Value **indexVal);
+
   /// Get the number of components in the tensor
   llvm::Value *emitComputeLen(const ir::TensorType*, const ir::TensorStorage &);
 
@@ -132,6 +189,10 @@ protected:
   /// Build a global string and return a constant pointer to it
   llvm::Constant *emitGlobalString(const std::string& str);
 
+  /// Build a constant global with the data of a tensor literal and return a
+  /// constant pointer to it
+  llvm::Constant *emitGlobalLiteral(const ir::Literal& literal);
+
   /// Gets a reference to a named built-in
   llvm::Function* getBuiltIn(std::string name,
                              llvm::Type *retTy,
@@ -148,6 +209,66 @@ protected:
 
   void emitAssign(ir::Var var, const ir::Expr& value);
 
+  /// Emit a parallel loop. The loop body is outlined into a function that
+  /// executes a range of iterations, and the runtime calls that function from
+  /// several threads. Values of the enclosing function that the body may
+  /// reference are passed to it in a closure struct.
+  ///
+  /// Colored loops are given their `edgeReduction`, and are emitted with the
+  /// given `reduction`: by iterating over the edges of the set's coloring one
+  /// color at a time, or by accumulating into private copies of the
+  /// `reductionBuffers` or atomically into them.
+  void emitParallelFor(const ir::For& forLoop,
+                       const EdgeReduction *edgeReduction=nullptr,
+                       ParallelReduction reduction=ColoredReduction,
+                       const std::vector<ir::Var>& reductionBuffers={});
+
+  /// Emit a colored loop that executes with the parallel reduction chosen for
+  /// its edge set when the function is initialized.
+  void emitColoredFor(const ir::For& forLoop, EdgeReduction *edgeReduction);
+
+  /// Returns the edge reduction of `set`, or nullptr if the set is not bound
+  /// to the function so that its loops can not be executed by color.
+  EdgeReduction *getEdgeReduction(const ir::Expr& set);
+
+  /// Create an alias scope for every field of the sets that the call tree of
+  /// `func` accesses and for every temporary of its environment. The field
+  /// buffers of different sets and the temporaries are allocated separately,
+  /// so accesses to them do not alias.
+  void emitAliasScopes(const std::vector<ir::Func>& callTree);
+
+  /// Attach alias scope and type-based alias metadata to a load or store of an
+  /// element of `buffer`, if the buffer is a set field or a temporary.
+  void emitAccessMetadata(llvm::Instruction *access, const ir::Expr& buffer);
+
+  /// Emit an atomic `*ptr += value`.
+  void emitAtomicAdd(llvm::Value *ptr, llvm::Value *value);
+
+  /// Emit the determinant of the row-major 3x3 matrix `a` inline, so that it
+  /// can be optimized and vectorized together with the calling kernel.
+  llvm::Value *emitDet3(llvm::Value *a);
+
+  /// Emit the inverse of the row-major 3x3 matrix `a` into `inv` inline.
+  void emitInv3(llvm::Value *a, llvm::Value *inv);
+
+  /// Widen or narrow a float value that was loaded from a tensor with a
+  /// storage precision (see ir::ScalarType) to the global float precision.
+  llvm::Value *emitComputePrecision(llvm::Value *value);
+
+  /// Widen or narrow a float value to the precision of the elements of `ptr`.
+  llvm::Value *emitStoragePrecision(llvm::Value *value, llvm::Value *ptr);
+
+  /// Copy `len` components from `src` to `dst`, whose components are stored
+  /// with different precisions.
+  void emitPrecisionCopy(llvm::Value *dst, llvm::Value *src, llvm::Value *len);
+
+  /// Copy `len` components from `src` to `dst`, or zero them if `src` is null,
+  /// where `dstBuffer` or `srcBuffer` is a set field whose components are
+  /// located by its layout.
+  void emitFieldCopy(llvm::Value *dst, const ir::Expr &dstBuffer,
+                     llvm::Value *src, const ir::Expr &srcBuffer,
+                     llvm::Value *len);
+
   /// Produce LLVM globals for everything in `env` and store in `globals`
   /// and in `symtable` appropriately.
   virtual void emitGlobals(const ir::Environment& env);
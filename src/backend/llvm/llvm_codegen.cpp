@@ -77,11 +77,15 @@ llvm::Constant* llvmVal(const TensorType& type, const void *data) {
     case ScalarType::Int:
       return llvmInt(static_cast<const int*>(data)[0]);
     case ScalarType::Float:
-      if (ir::ScalarType::singleFloat()) {
-        return llvmFP(static_cast<const float*>(data)[0], componentType.bytes());
+      // The value is read with its storage precision and computed with the
+      // global float precision
+      if (componentType.bytes() == sizeof(float)) {
+        return llvmFP(static_cast<const float*>(data)[0],
+                      ScalarType::floatBytes);
       }
       else {
-        return llvmFP(static_cast<const double*>(data)[0], componentType.bytes());
+        return llvmFP(static_cast<const double*>(data)[0],
+                      ScalarType::floatBytes);
       }
     case ScalarType::Boolean:
       return llvmBool(static_cast<const bool*>(data)[0]);
@@ -1,5 +1,8 @@
 #include "llvm_data_layouts.h"
 
+#include <cstring>
+#include <vector>
+
 #include "init.h"
 #include "ir.h"
 #include "llvm_codegen.h"
@@ -13,6 +16,22 @@
 namespace simit {
 namespace backend {
 
+/// Write the field pointers of a set struct to `members`, followed by the
+/// component stride of each field, which generated code locates the
+/// components of SoA fields by. It does not assume that fields are aligned,
+/// since they may be stored in buffers provided by the caller.
+static void writeFieldMembers(Set *actual, const ir::ElementType *elemType,
+                              void **members) {
+  const size_t numFields = elemType->fields.size();
+  for (size_t i = 0; i < numFields; ++i) {
+    const ir::Field &field = elemType->fields[i];
+    iassert(field.type.isTensor());
+    members[i] = actual->getFieldData(field.name);
+    *(int*)&members[numFields + i] =
+        actual->getFieldComponentStride(field.name);
+  }
+}
+
 llvm::Value* UnstructuredSetLayout::getSize(unsigned i) {
   iassert(i == 0) << "Only 1 explicit dimension for unstructured sets";
   return builder->CreateExtractValue(
@@ -29,41 +48,23 @@ int UnstructuredSetLayout::getFieldsOffset() {
   return 1;
 }
 
-llvm::Value* UnstructuredSetLayout::makeSet(Set *actual, ir::Type type) {
-  iassert(actual->getKind() == Set::Unstructured);
-  iassert(actual->getCardinality() == 0);
-
-  const ir::UnstructuredSetType *setType = type.toUnstructuredSet();
-  llvm::StructType *llvmSetType = llvmType(*setType);
-  vector<llvm::Constant*> setData;
-
-  // Set size
-  setData.push_back(llvmInt(actual->getSize()));
-  // Fields
-  for (auto &field : setType->elementType.toElement()->fields) {
-    assert(field.type.isTensor());
-    setData.push_back(llvmPtr(*field.type.toTensor(),
-                              actual->getFieldData(field.name)));
-  }
-  return llvm::ConstantStruct::get(llvmSetType, setData);
+int UnstructuredSetLayout::getFieldStridesOffset() {
+  // Must skip fields
+  return getFieldsOffset() +
+         set.type().toSet()->elementType.toElement()->fields.size();
 }
 
-void UnstructuredSetLayout::writeSet(
-    Set *actual, ir::Type type, void *externPtr) {
+void UnstructuredSetLayout::writeMembers(Set *actual, ir::Type type,
+                                         void **members) {
   iassert(actual->getKind() == Set::Unstructured);
   iassert(actual->getCardinality() == 0);
 
-  const ir::SetType *setType = type.toSet();
+  const ir::UnstructuredSetType *setType = type.toUnstructuredSet();
 
   // Set size
-  ((int*)externPtr)[0] = actual->getSize();
-  void **externPtrCast = (void**)(((int*)externPtr)+1);
+  *(int*)&members[0] = actual->getSize();
   // Fields
-  for (auto &field : setType->elementType.toElement()->fields) {
-    assert(field.type.isTensor());
-    *externPtrCast = actual->getFieldData(field.name);
-    externPtrCast++;
-  }
+  writeFieldMembers(actual, setType->elementType.toElement(), &members[1]);
 }
 
 llvm::Value* UnstructuredEdgeSetLayout::getEpsArray() {
@@ -76,48 +77,20 @@ int UnstructuredEdgeSetLayout::getFieldsOffset() {
   return 2;
 }
 
-llvm::Value* UnstructuredEdgeSetLayout::makeSet(Set *actual, ir::Type type) {
+void UnstructuredEdgeSetLayout::writeMembers(Set *actual, ir::Type type,
+                                             void **members) {
   iassert(actual->getKind() == Set::Unstructured);
 
   const ir::UnstructuredSetType *setType = type.toUnstructuredSet();
-  llvm::StructType *llvmSetType = llvmType(*setType);
-  vector<llvm::Constant*> setData;
 
   // Set size
-  setData.push_back(llvmInt(actual->getSize()));
+  *(int*)&members[0] = actual->getSize();
 
   // Endpoints index
-  setData.push_back(llvmPtr(LLVM_INT_PTR, actual->getEndpointsData()));
+  members[1] = actual->getEndpointsData();
 
   // Fields
-  for (auto &field : setType->elementType.toElement()->fields) {
-    iassert(field.type.isTensor());
-    setData.push_back(llvmPtr(*field.type.toTensor(),
-                              actual->getFieldData(field.name)));
-  }
-  return llvm::ConstantStruct::get(llvmSetType, setData);
-}
-
-void UnstructuredEdgeSetLayout::writeSet(Set *actual, ir::Type type,
-                                         void *externPtr) {
-  iassert(actual->getKind() == Set::Unstructured);
-
-  const ir::SetType *setType = type.toSet();
-
-  // Set size
-  ((int*)externPtr)[0] = actual->getSize();
-  int **externPtrCast = (int**)(((int*)externPtr)+1);
-
-  // Endpoints index
-  externPtrCast[0] = actual->getEndpointsData();
-
-  // Fields
-  void **externPtrFieldCast = (void**)(externPtrCast+3);
-  for (auto &field : setType->elementType.toElement()->fields) {
-    iassert(field.type.isTensor());
-    *externPtrFieldCast = actual->getFieldData(field.name);
-    externPtrFieldCast++;
-  }
+  writeFieldMembers(actual, setType->elementType.toElement(), &members[2]);
 }
 
 llvm::Value* LatticeEdgeSetLayout::getSize(unsigned i) {
@@ -152,12 +125,17 @@ int LatticeEdgeSetLayout::getFieldsOffset() {
   return 2;
 }
 
-llvm::Value* LatticeEdgeSetLayout::makeSet(Set *actual, ir::Type type) {
+int LatticeEdgeSetLayout::getFieldStridesOffset() {
+  // Must skip size, eps, fields
+  return getFieldsOffset() +
+         set.type().toSet()->elementType.toElement()->fields.size();
+}
+
+void LatticeEdgeSetLayout::writeMembers(Set *actual, ir::Type type,
+                                        void **members) {
   iassert(actual->getKind() == Set::LatticeLink);
 
   const ir::LatticeLinkSetType *setType = type.toLatticeLinkSet();
-  llvm::StructType *llvmSetType = llvmType(*setType);
-  vector<llvm::Constant*> setData;
 
   // Set sizes
   unsigned ndims = setType->dimensions;
@@ -166,59 +144,21 @@ llvm::Value* LatticeEdgeSetLayout::makeSet(Set *actual, ir::Type type) {
       << "Lattice link set with wrong number of dimensions: "
       << dimensions.size() << " passed, but " << ndims
       << " required";
-  setData.push_back(llvmPtr(LLVM_INT_PTR, dimensions.data()));
-    
-  // CSR data: only set if kIndexlessStencils is false, otherwise
-  // we set these to NULL.
-  if (kIndexlessStencils) {
-    // NULL pointers for endpoints
-    setData.push_back(llvmPtr(LLVM_INT_PTR, NULL));
-  }
-  else {
-    // Endpoints index
-    setData.push_back(llvmPtr(LLVM_INT_PTR, actual->getEndpointsData()));
-  }
-    
-  // Fields
-  for (auto &field : setType->elementType.toElement()->fields) {
-    assert(field.type.isTensor());
-    setData.push_back(llvmPtr(*field.type.toTensor(),
-                              actual->getFieldData(field.name)));
-  }
-  return llvm::ConstantStruct::get(llvmSetType, setData);
-}
-
-void LatticeEdgeSetLayout::writeSet(Set *actual, ir::Type type, void *externPtr) {
-  iassert(actual->getKind() == Set::LatticeLink);
-
-  const ir::SetType *setType = type.toSet();
-  int** externPtrCast = (int**)externPtr;
+  members[0] = (void*)dimensions.data();
 
-  // Set sizes
-  const vector<int> &dimensions = actual->getDimensions();
-  ((const int**)externPtrCast)[0] = dimensions.data();
-    
   // CSR data: only set if kIndexlessStencils is false, otherwise
   // we set these to NULL.
   if (kIndexlessStencils) {
-    // Three NULL pointers for endpoints, nbrs_start, and nbrs
-    externPtrCast[1] = NULL;
-    externPtrCast[2] = NULL;
-    externPtrCast[3] = NULL;
+    // NULL pointers for endpoints
+    members[1] = NULL;
   }
   else {
     // Endpoints index
-    externPtrCast[1] = actual->getEndpointsData();
+    members[1] = actual->getEndpointsData();
   }
 
-  void **externPtrFieldCast = (void**)(externPtrCast+4);
   // Fields
-  for (auto &field : setType->elementType.toElement()->fields) {
-    assert(field.type.isTensor());
-
-    *externPtrFieldCast = actual->getFieldData(field.name);
-    externPtrFieldCast++;
-  }
+  writeFieldMembers(actual, setType->elementType.toElement(), &members[2]);
 }
 
 std::shared_ptr<SetLayout> getSetLayout(
@@ -244,42 +184,40 @@ std::shared_ptr<SetLayout> getSetLayout(
   }
 }
 
-/// Build llvm set struct from runtime Set object
-llvm::Value* makeSet(Set *actual, ir::Type type) {
+/// Write the llvm set struct members of a runtime Set object
+void writeSetMembers(Set *actual, ir::Type type, void **members) {
   iassert(type.isSet());
   if (type.isUnstructuredSet()) {
     if (type.toUnstructuredSet()->getCardinality() == 0) {
-      return UnstructuredSetLayout::makeSet(actual, type);
+      UnstructuredSetLayout::writeMembers(actual, type, members);
     }
     else {
-      return UnstructuredEdgeSetLayout::makeSet(actual, type);
+      UnstructuredEdgeSetLayout::writeMembers(actual, type, members);
     }
   }
   else if (type.isLatticeLinkSet()) {
-    return LatticeEdgeSetLayout::makeSet(actual, type);
+    LatticeEdgeSetLayout::writeMembers(actual, type, members);
   }
   else {
     unreachable;
-    return nullptr;
   }
 }
 
 /// Write set pointers to extern pointer structure
 void writeSet(Set *actual, ir::Type type, void *externPtr) {
   iassert(type.isSet());
-  if (type.isUnstructuredSet()) {
-    if (type.toUnstructuredSet()->getCardinality() == 0) {
-      return UnstructuredSetLayout::writeSet(actual, type, externPtr);
-    }
-    else {
-      return UnstructuredEdgeSetLayout::writeSet(actual, type, externPtr);
-    }
-  }
-  else if (type.isLatticeLinkSet()) {
-    return LatticeEdgeSetLayout::writeSet(actual, type, externPtr);
-  }
-  else {
-    unreachable;
+
+  // Extern set structs are packed, so each member is written with its size
+  llvm::StructType *llvmSetType = llvmType(type.toSet(), 0, true);
+  std::vector<void*> members(llvmSetType->getNumElements(), nullptr);
+  writeSetMembers(actual, type, members.data());
+
+  char *externPtrCast = (char*)externPtr;
+  for (unsigned i = 0; i < members.size(); ++i) {
+    size_t memberSize = llvmSetType->getElementType(i)->isPointerTy()
+                        ? sizeof(void*) : sizeof(int);
+    memcpy(externPtrCast, &members[i], memberSize);
+    externPtrCast += memberSize;
   }
 }
 
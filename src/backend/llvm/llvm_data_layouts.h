@@ -30,10 +30,13 @@ public:
   virtual llvm::Value* getEpsArray() = 0;
   /// Get the offset to the fields pointers
   virtual int getFieldsOffset() = 0;
+  /// Get the offset to the component strides of the fields, which follow the
+  /// field pointers. Only SoA fields are located by their strides.
+  virtual int getFieldStridesOffset() = 0;
 };
 
 /// Unstructured set layout (cardinality 0):
-/// <size> <f1> <f2> ...
+/// <size> <f1> <f2> ... <f1 stride> <f2 stride> ...
 class UnstructuredSetLayout : public SetLayout {
 public:
   virtual llvm::Value* getSize(unsigned i);
@@ -42,9 +45,9 @@ public:
   inline virtual llvm::Value* getEpsArray() {unreachable; return nullptr;}
 
   virtual int getFieldsOffset();
+  virtual int getFieldStridesOffset();
 
-  static llvm::Value* makeSet(Set *actual, ir::Type type);
-  static void writeSet(Set *actual, ir::Type type, void *externPtr);
+  static void writeMembers(Set *actual, ir::Type type, void **members);
 
   UnstructuredSetLayout(ir::Expr set, llvm::Value *value, SimitIRBuilder *builder)
       : set(set), value(value), builder(builder) {
@@ -58,15 +61,14 @@ private:
 
 
 /// Unstructured edge set layout:
-/// <size> <eps_ptr> <nbrs_start_ptr> <nbrs_ptr> <f1> <f2> ...
+/// <size> <eps_ptr> <f1> <f2> ... <f1 stride> <f2 stride> ...
 class UnstructuredEdgeSetLayout : public UnstructuredSetLayout {
 public:
   virtual llvm::Value* getEpsArray();
 
   virtual int getFieldsOffset();
 
-  static llvm::Value* makeSet(Set *actual, ir::Type type);
-  static void writeSet(Set *actual, ir::Type type, void *externPtr);
+  static void writeMembers(Set *actual, ir::Type type, void **members);
 
   UnstructuredEdgeSetLayout(ir::Expr set, llvm::Value *value,
                             SimitIRBuilder *builder)
@@ -81,17 +83,17 @@ private:
 };
 
 /// Lattice edge set layout:
-/// <sizes_ptr> <eps_ptr> <nbrs_start_ptr> <nbrs_ptr> <f1> <f2> ...
+/// <sizes_ptr> <eps_ptr> <f1> <f2> ... <f1 stride> <f2 stride> ...
 class LatticeEdgeSetLayout : public SetLayout {
 public:
   virtual llvm::Value* getSize(unsigned i);
   virtual llvm::Value* getTotalSize();
   virtual llvm::Value* getEpsArray();
   virtual int getFieldsOffset();
+  virtual int getFieldStridesOffset();
+
+  static void writeMembers(Set *actual, ir::Type type, void **members);
 
-  static llvm::Value* makeSet(Set *actual, ir::Type type);
-  static void writeSet(Set *actual, ir::Type type, void *externPtr);
-  
   LatticeEdgeSetLayout(ir::Expr set, llvm::Value *value, SimitIRBuilder *builder)
       : set(set), value(value), builder(builder) {}
 
@@ -104,10 +106,13 @@ private:
 std::shared_ptr<SetLayout> getSetLayout(
     ir::Expr set, llvm::Value *value, SimitIRBuilder *builder);
 
-/// Build llvm set struct from runtime Set object
-llvm::Value* makeSet(Set *actual, ir::Type type);
+/// Write the members of the llvm set struct of a runtime Set object to
+/// `members`, which has a pointer-sized slot for each member. Sizes are stored
+/// at the start of their slot.
+void writeSetMembers(Set *actual, ir::Type type, void **members);
 
-/// Write set pointers to extern pointer structure
+/// Write the members of the llvm set struct of a runtime Set object to the
+/// packed struct of a set extern
 void writeSet(Set *actual, ir::Type type, void *externPtr);
 
 }} // namespace simit::backend
@@ -1,14 +1,29 @@
 #include "llvm_function.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <set>
 #include <string>
 #include <vector>
 
+#include "llvm/ADT/SmallString.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormattedStream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#if LLVM_MAJOR_VERSION <=3 && LLVM_MINOR_VERSION <= 6
+#include "llvm/PassManager.h"
+#else
+#include "llvm/IR/LegacyPassManager.h"
+#endif
 
 #if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 4
 #include "llvm/Analysis/Verifier.h"
@@ -21,25 +36,74 @@
 #include "llvm_data_layouts.h"
 
 #include "backend/actual.h"
+#include "coloring.h"
 #include "graph.h"
 #include "tensor_index.h"
 #include "path_indices.h"
 #include "util/collections.h"
+#include "util/memory.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 #include "llvm_util.h"
+#include "llvm_object_cache.h"
 
 using namespace std;
 using namespace simit::ir;
 
 namespace simit {
+extern std::string kReduction;
+extern size_t kArenaLimit;
+
 namespace backend {
 
 typedef void (*FuncPtrType)();
 
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 6
+typedef llvm::raw_ostream MachineCodeStream;
+#else
+typedef llvm::raw_pwrite_stream MachineCodeStream;
+#endif
+
+static llvm::Module* cloneModule(const llvm::Module& module) {
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 7
+  return llvm::CloneModule(&module);
+#elif LLVM_MAJOR_VERSION <= 6
+  return llvm::CloneModule(&module).release();
+#else
+  return llvm::CloneModule(module).release();
+#endif
+}
+
+/// Generate code for the module with the target machine, and write it to the
+/// stream. Code generation modifies the module, so it runs on a copy.
+static void emitMachineCode(const llvm::Module& module,
+                            llvm::TargetMachine* target,
+                            llvm::TargetMachine::CodeGenFileType fileType,
+                            MachineCodeStream& os) {
+  unique_ptr<llvm::Module> copy(cloneModule(module));
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 6
+  llvm::PassManager pm;
+  llvm::formatted_raw_ostream out(os);
+  bool failed = target->addPassesToEmitFile(pm, out, fileType);
+#else
+  llvm::legacy::PassManager pm;
+  bool failed = target->addPassesToEmitFile(pm, os, fileType);
+#endif
+  uassert(!failed) << "the target cannot emit machine code";
+  pm.run(*copy);
+}
+
 LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
                            llvm::Function* llvmFunc, llvm::Module* module,
-                           std::shared_ptr<llvm::EngineBuilder> engineBuilder)
-    : Function(func), initialized(false), llvmFunc(llvmFunc), module(module),
+                           std::shared_ptr<llvm::EngineBuilder> engineBuilder,
+                           const std::map<std::string,
+                                          std::vector<ParallelReduction>>&
+                               parallelReductions,
+                           const FieldLayouts& fieldLayouts,
+                           bool keepMachineModule)
+    : Function(func), initialized(false),
+      pathIndexBuilder(new pe::PathIndexBuilder()),
+      llvmFunc(llvmFunc), module(module),
       harnessModule(new llvm::Module("simit_harness", LLVM_CTX)),
       storage(storage),
       engineBuilder(engineBuilder),
@@ -56,7 +120,24 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
           unique_ptr<llvm::Module>(harnessModule))),
       harnessExecEngine(harnessEngineBuilder->create()),
 #endif
-      deinit(nullptr) {
+      parallelReductions(parallelReductions), fieldLayouts(fieldLayouts),
+      deinit(nullptr), arena(kArenaLimit) {
+
+  // Load the object code from the cache, or add it to the cache once MCJIT
+  // has generated it. The backend keyed the module by its identifier.
+  bool cached = false;
+  if (!kCacheDir.empty() && kBackend == "cpu") {
+    LLVMObjectCache& objectCache = LLVMObjectCache::getInstance();
+    cached = objectCache.contains(module->getModuleIdentifier());
+    executionEngine->setObjectCache(&objectCache);
+  }
+
+  // MCJIT code generation modifies the module, so keep a copy of the
+  // optimized module to print and emit machine code from, if asked to. Cached
+  // modules were not optimized.
+  if (keepMachineModule && !cached) {
+    machineModule.reset(cloneModule(*module));
+  }
 
   // Finalize existing module so we can get global pointer hooks
   // from the LLVM memory manager.
@@ -116,6 +197,30 @@ LLVMFunction::LLVMFunction(ir::Func func, const ir::Storage &storage,
       not_supported_yet;
     }
   }
+
+  // Initialize transposition pointers
+  for (const Transposition& transposition : env.getTranspositions()) {
+    const string& name = transposition.getLocations().getName();
+    uint64_t addr = executionEngine->getGlobalValueAddress(name);
+    const uint32_t** locationsPtr = (const uint32_t**)addr;
+    *locationsPtr = nullptr;
+    transpositionPtrs.insert({name, locationsPtr});
+  }
+
+  // Initialize parallel reduction and edge coloring pointers
+  for (auto& parallelReduction : parallelReductions) {
+    const string& setName = parallelReduction.first;
+    uint64_t addr =
+        executionEngine->getGlobalValueAddress(setName+".reduction");
+    int* reductionPtr = (int*)addr;
+    *reductionPtr = ColoredReduction;
+    reductionPtrs.insert({setName, reductionPtr});
+
+    addr = executionEngine->getGlobalValueAddress(setName+".coloring");
+    const int** coloringPtr = (const int**)addr;
+    *coloringPtr = nullptr;
+    coloringPtrs.insert({setName, coloringPtr});
+  }
 }
 
 LLVMFunction::~LLVMFunction() {
@@ -146,10 +251,14 @@ void LLVMFunction::bind(const std::string& name, simit::Set* set) {
     else {
       not_supported_yet;
     }
+    checkFieldLayouts(name, set);
+    checkFieldOverlaps(name, set);
     arguments[name] = std::unique_ptr<Actual>(new SetActual(set));
+    pathIndexBuilder.reset(new pe::PathIndexBuilder());
     initialized = false;
   }
   else {
+    checkFieldOverlaps(name, set);
     globals[name] = std::unique_ptr<Actual>(new SetActual(set));
     Type globalType = getGlobalType(name);
 
@@ -170,6 +279,7 @@ void LLVMFunction::bind(const std::string& name, simit::Set* set) {
     else {
       not_supported_yet;
     }
+    checkFieldLayouts(name, set);
 
     // Write set values and pointers to the relevant extern
     iassert(util::contains(externPtrs, name) && externPtrs.at(name).size()==1);
@@ -242,24 +352,285 @@ size_t LLVMFunction::size(const ir::IndexDomain& dimension) {
   return result;
 }
 
+bool LLVMFunction::isInitialized() {
+  if (!initialized) {
+    return false;
+  }
+  for (auto& setVersion : setVersions) {
+    if (setVersion.first->getVersion() != setVersion.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Function::FuncType LLVMFunction::init() {
-  pe::PathIndexBuilder piBuilder;
+  // A function whose bound sets were modified keeps its harness, and only
+  // refreshes what depends on the modified sets
+  if (initialized) {
+    update();
+    return func;
+  }
 
+  // Free the memory allocated by the previous initialization
+  if (deinit) {
+    deinit();
+    deinit = nullptr;
+  }
+
+  setVersions.clear();
+  setSizes.clear();
   for (auto& pair : arguments) {
     string name = pair.first;
     Actual* actual = pair.second.get();
     if (isa<SetActual>(actual)) {
       Set* set = to<SetActual>(actual)->getSet();
-      piBuilder.bind(name,set);
+      pathIndexBuilder->bind(name,set);
+      setVersions[set] = set->getVersion();
+      setSizes[set] = set->getSize();
     }
   }
 
+  // Global sets may have been modified since they were bound
+  for (auto& pair : globals) {
+    string name = pair.first;
+    Actual* actual = pair.second.get();
+    if (isa<SetActual>(actual)) {
+      Set* set = to<SetActual>(actual)->getSet();
+      writeSet(set, getGlobalType(name), externPtrs.at(name)[0]);
+      setVersions[set] = set->getVersion();
+      setSizes[set] = set->getSize();
+    }
+  }
+
+  // Initialize indices. The builder updates the indices of the previous
+  // initialization that are over modified sets.
   const Environment& environment = getEnvironment();
+  std::set<pe::PathExpression> updatedIndices =
+      initIndices(*pathIndexBuilder, environment);
+  initColorings(nullptr);
+  initTemporaries(nullptr, updatedIndices);
+
+  // Compile a harness void function without arguments that calls the simit
+  // llvm function with pointers to the arguments.
+  initialized = true;
+  vector<string> formals = getArgs();
+  iassert(formals.size() == llvmFunc->getArgumentList().size());
+  if (llvmFunc->getArgumentList().size() == 0) {
+    llvm::Function *initFunc = getInitFunc();
+    llvm::Function *deinitFunc = getDeinitFunc();
+    uint64_t addr = executionEngine->getFunctionAddress(initFunc->getName());
+    FuncPtrType initPtr = reinterpret_cast<decltype(initPtr)>(addr);
+    initBuffers = initPtr;
+    addr = executionEngine->getFunctionAddress(deinitFunc->getName());
+    FuncPtrType deinitPtr = reinterpret_cast<decltype(deinitPtr)>(addr);
+    deinit = deinitPtr;
+    addr = executionEngine->getFunctionAddress(llvmFunc->getName());
+    FuncPtrType funcPtr = reinterpret_cast<decltype(funcPtr)>(addr);
+    func = funcPtr;
+  }
+  else {
+    // Set arguments are loaded from their members, which update rewrites when
+    // the sets are modified
+    setMembers.clear();
+    for (const std::string& formal : formals) {
+      uassert(util::contains(arguments, formal))
+          << "Could not find formal argument " << formal <<  " in "
+          << llvmFunc->getName().str();
+      Actual* actual = arguments.at(formal).get();
+      if (isa<SetActual>(actual)) {
+        Type type = getArgType(formal);
+        vector<void*>& members = setMembers[formal];
+        members.resize(llvmType(type.toSet())->getNumElements(), nullptr);
+        writeSetMembers(to<SetActual>(actual)->getSet(), type, members.data());
+      }
+    }
+
+    const std::string initFuncName = string(llvmFunc->getName())+"_init";
+    const std::string deinitFuncName = string(llvmFunc->getName())+"_deinit";
+    const std::string funcName = llvmFunc->getName();
+
+    // Calling main module functions from the harness requires the
+    // symbols to be loaded into the memory manager ahead of finalization
+    llvm::sys::DynamicLibrary::AddSymbol(
+        initFuncName,
+        (void*) executionEngine->getFunctionAddress(initFuncName));
+    llvm::sys::DynamicLibrary::AddSymbol(
+        deinitFuncName,
+        (void*) executionEngine->getFunctionAddress(deinitFuncName));
+    llvm::sys::DynamicLibrary::AddSymbol(
+        funcName,
+        (void*) executionEngine->getFunctionAddress(funcName));
+
+    // Create Init/deinit function harnesses. The tensor arguments are
+    // compiled into the harness, so a harness for previous arguments is
+    // replaced.
+    if (harnessModule->getFunction(funcName) != nullptr) {
+      resetHarness();
+    }
+    createHarness(initFuncName);
+    createHarness(deinitFuncName);
+    createHarness(funcName);
+
+    // Finalize harness module
+    harnessExecEngine->finalizeObject();
+
+    // Fetch hard addresses from ExecutionEngine
+    initBuffers = getHarnessFunctionAddress(initFuncName);
+    deinit = getHarnessFunctionAddress(deinitFuncName);
 
-  // Initialize indices
-  initIndices(piBuilder, environment);
+    // Compute function
+    func = getHarnessFunctionAddress(funcName);
+    iassert(!llvm::verifyModule(*module))
+        << "LLVM module does not pass verification";
+    iassert(!llvm::verifyModule(*harnessModule))
+        << "LLVM harness module does not pass verification";
+  }
+  initBuffers();
+
+  // Serve the temporaries of runs from the arena, which deinit clears
+  FuncType run = func;
+  func = [this, run]() {
+    util::Arena::Scope scope(&arena);
+    run();
+  };
+  FuncType deinitFunc = deinit;
+  deinit = [this, deinitFunc]() {
+    {
+      util::Arena::Scope scope(&arena);
+      deinitFunc();
+    }
+    arena.clear();
+  };
+  return func;
+}
+
+void LLVMFunction::update() {
+  // Write the sizes and pointers of the modified sets. A set may be bound to
+  // several names, so their versions are recorded once all are written.
+  std::set<std::string> modified;
+  vector<Set*> modifiedSets;
+  bool resized = false;
+  auto isModified = [this](Set* set) {
+    // Global sets that were bound after the initialization are new to it
+    if (!util::contains(setVersions, (const Set*)set)) {
+      setVersions[set] = 0;
+      setSizes[set] = -1;
+    }
+    return set->getVersion() != setVersions.at(set);
+  };
+  for (auto& pair : arguments) {
+    Actual* actual = pair.second.get();
+    if (isa<SetActual>(actual)) {
+      Set* set = to<SetActual>(actual)->getSet();
+      if (isModified(set)) {
+        modified.insert(pair.first);
+        modifiedSets.push_back(set);
+        resized |= (set->getSize() != setSizes.at(set));
+        if (util::contains(setMembers, pair.first)) {
+          writeSetMembers(set, getArgType(pair.first),
+                          setMembers.at(pair.first).data());
+        }
+      }
+    }
+  }
+  for (auto& pair : globals) {
+    Actual* actual = pair.second.get();
+    if (isa<SetActual>(actual)) {
+      Set* set = to<SetActual>(actual)->getSet();
+      if (isModified(set)) {
+        modified.insert(pair.first);
+        modifiedSets.push_back(set);
+        resized |= (set->getSize() != setSizes.at(set));
+        writeSet(set, getGlobalType(pair.first), externPtrs.at(pair.first)[0]);
+      }
+    }
+  }
+  if (modified.empty()) {
+    return;
+  }
+  for (Set* set : modifiedSets) {
+    setVersions[set] = set->getVersion();
+    setSizes[set] = set->getSize();
+  }
+
+  std::set<pe::PathExpression> updatedIndices =
+      initIndices(*pathIndexBuilder, getEnvironment());
+  initColorings(&modified);
+  initTemporaries(&modified, updatedIndices);
+
+  // The buffers that the init function allocates are sized by the sets and
+  // by the path indices
+  if (resized || !updatedIndices.empty()) {
+    deinit();
+    initBuffers();
+  }
+}
+
+void LLVMFunction::initColorings(const std::set<std::string>* modified) {
+  // Choose how the colored loops over each edge set execute in parallel, and
+  // color the sets whose loops execute by color
+  for (auto& parallelReduction : parallelReductions) {
+    const string& name = parallelReduction.first;
+    const vector<ParallelReduction>& supported = parallelReduction.second;
+    if (modified != nullptr && !util::contains(*modified, name)) {
+      continue;
+    }
+    iassert(util::contains(arguments, name) || util::contains(globals, name));
+    Actual* setActual = util::contains(arguments, name)
+                        ? arguments.at(name).get()
+                        : globals.at(name).get();
+    iassert(isa<SetActual>(setActual));
+    Set* set = to<SetActual>(setActual)->getSet();
+
+    ParallelReduction reduction = ColoredReduction;
+    if (kReduction == "auto") {
+      reduction = chooseParallelReduction(
+          *set, supported, util::ThreadPool::getInstance().getNumThreads());
+    }
+    else if (kReduction == "privatization" &&
+             util::contains(supported, PrivatizedReduction)) {
+      reduction = PrivatizedReduction;
+    }
+    else if (kReduction == "atomics" &&
+             util::contains(supported, AtomicReduction)) {
+      reduction = AtomicReduction;
+    }
+    *reductionPtrs.at(name) = reduction;
+
+    if (reduction == ColoredReduction) {
+      colorings[name] = colorEdges(*set);
+      *coloringPtrs.at(name) = colorings.at(name).data();
+    }
+    else {
+      colorings.erase(name);
+      *coloringPtrs.at(name) = nullptr;
+    }
+  }
+}
+
+void LLVMFunction::initTemporaries(
+    const std::set<std::string>* modified,
+    const std::set<pe::PathExpression>& updatedIndices) {
+  // True if the size of the index domain depends on a modified set
+  auto isModified = [modified](const IndexDomain& dimension) {
+    if (modified == nullptr) {
+      return true;
+    }
+    for (const ir::IndexSet& indexSet : dimension.getIndexSets()) {
+      if (indexSet.getKind() == ir::IndexSet::Set &&
+          ir::isa<ir::VarExpr>(indexSet.getSet())) {
+        string setName = ir::to<ir::VarExpr>(indexSet.getSet())->var.getName();
+        if (util::contains(*modified, setName)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
 
   // Allocate memory for temporaries
+  const Environment& environment = getEnvironment();
   for (const Var& tmp : environment.getTemporaries()) {
     iassert(util::contains(temporaryPtrs, tmp.getName()));
     const Type& type = tmp.getType();
@@ -272,11 +643,14 @@ Function::FuncType LLVMFunction::init() {
       if (order == 1) {
         // Vectors are currently always dense
         IndexDomain vecDimension = tensorType->getDimensions()[0];
+        if (!isModified(vecDimension)) {
+          continue;
+        }
         Type blockType = tensorType->getBlockType();
         size_t blockSize = blockType.toTensor()->size();
         size_t componentSize = tensorType->getComponentType().bytes();
-        *temporaryPtrs.at(tmp.getName()) =
-            calloc(size(vecDimension) *blockSize, componentSize);
+        allocateTemporary(tmp.getName(),
+                          size(vecDimension) * blockSize * componentSize, true);
       }
       else if (order == 2) {
         Type blockType = tensorType->getBlockType();
@@ -288,21 +662,27 @@ Function::FuncType LLVMFunction::init() {
 
         if (ti.getKind() == TensorIndex::PExpr) {
           const pe::PathExpression& pexpr = ti.getPathExpression();
+          if (modified != nullptr && !util::contains(updatedIndices, pexpr)) {
+            continue;
+          }
           iassert(util::contains(pathIndices, pexpr));
           size_t matSize = pathIndices.at(pexpr).numNeighbors() *
               blockSize * componentSize;
-          *temporaryPtrs.at(tmp.getName()) = malloc(matSize);
+          allocateTemporary(tmp.getName(), matSize, false);
         }
         else if (ti.getKind() == TensorIndex::Sten) {
           auto iss = tensorType->getOuterDimensions();
           iassert(iss.size() == 2);
           iassert(iss[0] == iss[1])
               << "Stencil tensor index must be for a homogeneous matrix";
+          if (!isModified(iss[0])) {
+            continue;
+          }
           size_t latticeSize = size(iss[0]);
           const StencilLayout& stencil = ti.getStencilLayout();
           size_t stensize = stencil.getLayout().size();
           size_t matSize = stensize * latticeSize * blockSize * componentSize;
-          *temporaryPtrs.at(tmp.getName()) = malloc(matSize);
+          allocateTemporary(tmp.getName(), matSize, false);
         }
         else {
           not_supported_yet;
@@ -314,131 +694,322 @@ Function::FuncType LLVMFunction::init() {
                   << util::quote(tmp);
     }
   }
+}
 
-  // Compile a harness void function without arguments that calls the simit
-  // llvm function with pointers to the arguments.
-  Function::FuncType func;
-  initialized = true;
-  vector<string> formals = getArgs();
-  iassert(formals.size() == llvmFunc->getArgumentList().size());
-  if (llvmFunc->getArgumentList().size() == 0) {
-    llvm::Function *initFunc = getInitFunc();
-    llvm::Function *deinitFunc = getDeinitFunc();
-    uint64_t addr = executionEngine->getFunctionAddress(initFunc->getName());
-    FuncPtrType init = reinterpret_cast<decltype(init)>(addr);
-    init();
-    addr = executionEngine->getFunctionAddress(deinitFunc->getName());
-    FuncPtrType deinitPtr = reinterpret_cast<decltype(deinitPtr)>(addr);
-    deinit = deinitPtr;
-    addr = executionEngine->getFunctionAddress(llvmFunc->getName());
-    FuncPtrType funcPtr = reinterpret_cast<decltype(funcPtr)>(addr);
-    func = funcPtr;
-  }
-  else {
-    llvm::SmallVector<llvm::Value*, 8> args;
-    auto llvmArgIt = llvmFunc->getArgumentList().begin();
-    for (const std::string& formal : formals) {
-      uassert(util::contains(arguments, formal))
-          << "Could not find formal argument " << formal <<  " in "
-          << llvmFunc->getName().str();
+AllocationStats LLVMFunction::getAllocationStats() const {
+  return arena.getStats();
+}
 
-      llvm::Argument* llvmFormal = &(*llvmArgIt);
-      ++llvmArgIt;
-      Actual* actual = arguments.at(formal).get();
-      ir::Type type = getArgType(formal);
-      iassert(type.kind() == ir::Type::Set || type.kind() == ir::Type::Tensor);
-
-      class InitActual : public ActualVisitor {
-      public:
-        llvm::Value* result;
-        Type type;
-        llvm::Argument* llvmFormal;
-        llvm::Value* init(Actual* a, const Type& t, llvm::Argument* f) {
-          this->type = t;
-          this->llvmFormal = f;
-          a->accept(this);
-          return result;
-        }
+void LLVMFunction::print(std::ostream &os) const {
+  std::string fstr;
+  llvm::raw_string_ostream rsos(fstr);
+  module->print(rsos, nullptr);
+  os << rsos.str();
+}
 
-        void visit(SetActual* actual) {
-          result = makeSet(actual->getSet(), type);
-        }
+void LLVMFunction::printMachine(std::ostream &os) const {
+  uassert(machineModule != nullptr)
+      << "cannot print the machine code of " << llvmFunc->getName().str()
+      << ", since the backend did not keep it or it was loaded from the "
+      << "object cache";
+  unique_ptr<llvm::TargetMachine> target(engineBuilder->selectTarget());
 
-        void visit(TensorActual* actual) {
-          const ir::TensorType* tensorType = type.toTensor();
-          void* tensorData = actual->getData();
-          result = (llvmFormal->getType()->isPointerTy())
-                   ? llvmPtr(*tensorType, tensorData)
-                   : llvmVal(*tensorType, tensorData);
-        }
-      };
-      llvm::Value* llvmActual = InitActual().init(actual, type, llvmFormal);
-      args.push_back(llvmActual);
-    }
+  llvm::SmallString<4096> assembly;
+  llvm::raw_svector_ostream assemblyStream(assembly);
+  emitMachineCode(*machineModule, target.get(),
+                  llvm::TargetMachine::CGFT_AssemblyFile, assemblyStream);
+  os << assemblyStream.str().str();
+}
 
-    const std::string initFuncName = string(llvmFunc->getName())+"_init";
-    const std::string deinitFuncName = string(llvmFunc->getName())+"_deinit";
-    const std::string funcName = llvmFunc->getName();
+void LLVMFunction::emitObject(const std::string& filename) const {
+  uassert(machineModule != nullptr)
+      << "cannot emit object code for " << llvmFunc->getName().str()
+      << ", since the backend did not keep it or it was loaded from the "
+      << "object cache";
 
-    // Calling main module functions from the harness requires the
-    // symbols to be loaded into the memory manager ahead of finalization
-    llvm::sys::DynamicLibrary::AddSymbol(
-        initFuncName,
-        (void*) executionEngine->getFunctionAddress(initFuncName));
-    llvm::sys::DynamicLibrary::AddSymbol(
-        deinitFuncName,
-        (void*) executionEngine->getFunctionAddress(deinitFuncName));
-    llvm::sys::DynamicLibrary::AddSymbol(
-        funcName,
-        (void*) executionEngine->getFunctionAddress(funcName));
+  // Position independent code can be linked into shared libraries
+  engineBuilder->setRelocationModel(llvm::Reloc::PIC_);
+  unique_ptr<llvm::TargetMachine> target(engineBuilder->selectTarget());
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 8
+  engineBuilder->setRelocationModel(llvm::Reloc::Default);
+#endif
 
-    // Create Init/deinit function harnesses
-    createHarness(initFuncName, args);
-    createHarness(deinitFuncName, args);
-    createHarness(funcName, args);
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+  std::string error;
+  llvm::raw_fd_ostream file(filename.c_str(), error, llvm::sys::fs::F_None);
+  uassert(error.empty()) << "could not open " << filename << ": " << error;
+#else
+  std::error_code error;
+  llvm::raw_fd_ostream file(filename, error, llvm::sys::fs::F_None);
+  uassert(!error) << "could not open " << filename << ": "
+                  << error.message();
+#endif
+  emitMachineCode(*machineModule, target.get(),
+                  llvm::TargetMachine::CGFT_ObjectFile, file);
+}
 
-    // Finalize harness module
-    harnessExecEngine->finalizeObject();
+/// Returns the name as a C identifier.
+static string cIdentifier(const string& name) {
+  string identifier = name;
+  for (char& c : identifier) {
+    if (!isalnum(c) && c != '_') {
+      c = '_';
+    }
+  }
+  return identifier;
+}
 
-    // Fetch hard addresses from ExecutionEngine
-    auto init = getHarnessFunctionAddress(initFuncName);
-    init();
-    deinit = getHarnessFunctionAddress(deinitFuncName);
+/// Returns a C declarator for the symbol with the given name. Symbols whose
+/// names are not C identifiers are declared with an assembler label.
+static string cSymbol(const string& name) {
+  string identifier = cIdentifier(name);
+  return (identifier == name)
+         ? name
+         : identifier + " SIMIT_SYMBOL(\"" + name + "\")";
+}
 
-    // Compute function
-    func = getHarnessFunctionAddress(funcName);
-    iassert(!llvm::verifyModule(*module))
-        << "LLVM module does not pass verification";
-    iassert(!llvm::verifyModule(*harnessModule))
-        << "LLVM harness module does not pass verification";
+static string cType(ScalarType type) {
+  switch (type.kind) {
+    case ScalarType::Int:
+      return "int32_t";
+    case ScalarType::Float:
+      return (type.bytes() == sizeof(float)) ? "float" : "double";
+    case ScalarType::Boolean:
+      return "bool";
+    case ScalarType::Complex:
+      return "simit_complex";
+    case ScalarType::String:
+      return "char*";
   }
-  return func;
+  unreachable;
+  return "";
 }
 
-void LLVMFunction::print(std::ostream &os) const {
-  std::string fstr;
-  llvm::raw_string_ostream rsos(fstr);
-  module->print(rsos, nullptr);
-  os << rsos.str();
+/// Returns the C type of tensors, arrays and opaque values, which are passed
+/// and stored as pointers to their components.
+static string cType(const Type& type) {
+  switch (type.kind()) {
+    case Type::Tensor:
+      return cType(type.toTensor()->getComponentType()) + "*";
+    case Type::Array:
+      return cType(type.toArray()->elementType) + "*";
+    case Type::Opaque:
+      return "void*";
+    default:
+      not_supported_yet << "no C type for " << type;
+  }
+  return "";
 }
 
-void LLVMFunction::printMachine(std::ostream &os) const {
-  // TODO: Make printMachine write to os, instead of stderr
-  llvm::TargetMachine *target = engineBuilder->selectTarget();
-  target->Options.PrintMachineCode = true;
-  llvm::ExecutionEngine *printee(engineBuilder->create(target));
-  printee->getFunctionAddress(llvmFunc->getName());
-  target->Options.PrintMachineCode = false;
+/// Print a C struct with the layout that the LLVM backend expects of sets.
+/// Sets that are globals are packed.
+static void printSetStruct(std::ostream &os, const string& name,
+                           const Type& type, bool packed,
+                           const FieldLayouts& fieldLayouts) {
+  iassert(type.isSet());
+  const ElementType* elemType =
+      type.toSet()->elementType.toElement();
+
+  os << "struct " << name << " {" << endl;
+  if (type.isUnstructuredSet()) {
+    os << "  int32_t size;" << endl;
+    size_t cardinality = type.toUnstructuredSet()->getCardinality();
+    if (cardinality > 0) {
+      os << "  int32_t* endpoints;  // " << cardinality
+         << " endpoints per element" << endl;
+    }
+  }
+  else if (type.isLatticeLinkSet()) {
+    os << "  int32_t* sizes;" << endl;
+    os << "  int32_t* endpoints;" << endl;
+  }
+  else {
+    not_supported_yet;
+  }
+  for (const Field& field : elemType->fields) {
+    os << "  " << cType(field.type) << " " << cIdentifier(field.name) << ";"
+       << "  // " << field.type << endl;
+  }
+  // Only the fields that the function was compiled to lay out as structures
+  // of arrays read their strides, so the strides of other fields may be 0
+  for (const Field& field : elemType->fields) {
+    FieldLayout layout = {Set::AoS, 1};
+    if (util::contains(fieldLayouts, elemType->name) &&
+        util::contains(fieldLayouts.at(elemType->name), field.name)) {
+      layout = fieldLayouts.at(elemType->name).at(field.name);
+    }
+    os << "  int32_t " << cIdentifier(field.name) << "_stride;  // ";
+    switch (layout.layout) {
+      case Set::AoS:
+        os << "unused, may be 0";
+        break;
+      case Set::SoA:
+        os << "SoA field: elements its buffer has room for";
+        break;
+      case Set::AoSoA:
+        os << "unused, AoSoA field with blocks of " << layout.blockWidth
+           << " elements";
+        break;
+    }
+    os << endl;
+  }
+  os << "}" << (packed ? " __attribute__((packed))" : "") << ";" << endl
+     << endl;
+}
+
+void LLVMFunction::printHeader(std::ostream &os) const {
+  const string name = llvmFunc->getName();
+  const string prefix = cIdentifier(name);
+  const Environment& env = getEnvironment();
+
+  string guard = "SIMIT_" + prefix + "_H";
+  std::transform(guard.begin(), guard.end(), guard.begin(), ::toupper);
+  os << "// Declarations of the compiled Simit function " << name << "." << endl
+     << "// Bind arguments and globals, and allocate temporaries, then call "
+     << name << "_init once" << endl
+     << "// before calling " << name << ", and " << name
+     << "_deinit when done. Link with the" << endl
+     << "// simit-runtime library, which provides the runtime functions."
+     << endl
+     << "// Field buffers hold arrays of structures unless the comment on the"
+     << endl
+     << "// field's stride says otherwise, and unused strides may be left 0."
+     << endl
+     << "#ifndef " << guard << endl
+     << "#define " << guard << endl
+     << endl
+     << "#include <stdbool.h>" << endl
+     << "#include <stdint.h>" << endl
+     << endl
+     << "#ifdef __cplusplus" << endl
+     << "extern \"C\" {" << endl
+     << "#endif" << endl
+     << endl
+     << "#ifndef SIMIT_SYMBOL" << endl
+     << "#define SIMIT_SYMBOL_STRING(x) SIMIT_SYMBOL_STRING_(x)" << endl
+     << "#define SIMIT_SYMBOL_STRING_(x) #x" << endl
+     << "#define SIMIT_SYMBOL(name) "
+     << "__asm__(SIMIT_SYMBOL_STRING(__USER_LABEL_PREFIX__) name)" << endl
+     << "#endif" << endl
+     << endl
+     << "#ifndef SIMIT_COMPLEX_DEFINED" << endl
+     << "#define SIMIT_COMPLEX_DEFINED" << endl
+     << "typedef struct { " << cType(ScalarType::Float) << " real; "
+     << cType(ScalarType::Float) << " imag; } simit_complex;" << endl
+     << "#endif" << endl
+     << endl;
+
+  // Set layouts
+  for (const string& arg : getArgs()) {
+    const Type& type = getArgType(arg);
+    if (type.isSet()) {
+      printSetStruct(os, prefix + "_" + cIdentifier(arg), type, false,
+                     fieldLayouts);
+    }
+  }
+  for (const VarMapping& externMapping : env.getExterns()) {
+    for (const Var& ext : externMapping.getMappings()) {
+      if (ext.getType().isSet()) {
+        printSetStruct(os, prefix + "_" + cIdentifier(ext.getName()),
+                       ext.getType(), true, fieldLayouts);
+      }
+    }
+  }
+
+  // Globals
+  for (const VarMapping& externMapping : env.getExterns()) {
+    os << "// Extern " << externMapping.getVar().getName() << endl;
+    for (const Var& ext : externMapping.getMappings()) {
+      string type = ext.getType().isSet()
+                    ? "struct " + prefix + "_" + cIdentifier(ext.getName())
+                    : cType(ext.getType());
+      os << "extern " << type << " " << cSymbol(ext.getName()) << ";" << endl;
+    }
+  }
+  for (const Var& tmp : env.getTemporaries()) {
+    os << "// Temporary " << tmp.getType() << endl
+       << "extern " << cType(tmp.getType()) << " " << cSymbol(tmp.getName())
+       << ";" << endl;
+  }
+  for (const TensorIndex& tensorIndex : env.getTensorIndices()) {
+    if (tensorIndex.getKind() == TensorIndex::PExpr) {
+      os << "// Index of " << tensorIndex.getPathExpression() << endl;
+      for (const Var& array : {tensorIndex.getRowptrArray(),
+                               tensorIndex.getColidxArray()}) {
+        os << "extern const uint32_t* " << cSymbol(array.getName()) << ";"
+           << endl;
+      }
+    }
+  }
+  for (const Transposition& transposition : env.getTranspositions()) {
+    const Var& locations = transposition.getLocations();
+    os << "// Locations of the non-zeros of "
+       << transposition.getSource().getPathExpression() << " in "
+       << transposition.getTarget().getPathExpression() << endl
+       << "extern const uint32_t* " << cSymbol(locations.getName()) << ";"
+       << endl;
+  }
+  for (auto& parallelReduction : parallelReductions) {
+    const string& setName = parallelReduction.first;
+    os << "// Parallel reduction of " << setName
+       << " (0: coloring, 1: privatization, 2: atomics)" << endl
+       << "extern int32_t " << cSymbol(setName + ".reduction") << ";" << endl
+       << "extern const int32_t* " << cSymbol(setName + ".coloring") << ";"
+       << endl;
+  }
+  os << endl;
+
+  // Functions
+  string params;
+  for (const string& arg : getArgs()) {
+    const Type& type = getArgType(arg);
+    if (!params.empty()) {
+      params += ", ";
+    }
+    if (type.isSet()) {
+      params += "struct " + prefix + "_" + cIdentifier(arg) + "*";
+    }
+    else if (isScalar(type)) {
+      params += cType(type.toTensor()->getComponentType());
+    }
+    else {
+      params += cType(type);
+    }
+    params += " " + cIdentifier(arg);
+  }
+  if (params.empty()) {
+    params = "void";
+  }
+  for (const string& suffix : {"_init", "", "_deinit"}) {
+    os << "void " << cSymbol(name + suffix) << "(" << params << ");" << endl;
+  }
+
+  os << endl
+     << "#ifdef __cplusplus" << endl
+     << "}" << endl
+     << "#endif" << endl
+     << endl
+     << "#endif" << endl;
 }
 
-void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
-                               const Environment& environment) {
-  // Initialize indices
+std::set<pe::PathExpression>
+LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
+                          const Environment& environment) {
+  // Initialize the indices that are not built over the current sets
+  std::set<pe::PathExpression> updated;
   for (const TensorIndex& tensorIndex : environment.getTensorIndices()) {
     if (tensorIndex.getKind() == TensorIndex::PExpr) {
       pe::PathExpression pexpr = tensorIndex.getPathExpression();
+      if (util::contains(pathIndices, pexpr) &&
+          piBuilder.isUpToDate(pexpr, 0)) {
+        continue;
+      }
+      // Drop the reference to the old path index, so that the builder may
+      // patch it in place
+      pathIndices.erase(pexpr);
       pe::PathIndex pidx = piBuilder.buildSegmented(pexpr, 0);
-      pathIndices.insert({pexpr, pidx});
+      pathIndices[pexpr] = pidx;
+      updated.insert(pexpr);
 
       pair<const uint32_t**,const uint32_t**> ptrPair=tensorIndexPtrs.at(pexpr);
 
@@ -458,11 +1029,136 @@ void LLVMFunction::initIndices(pe::PathIndexBuilder& piBuilder,
       not_supported_yet;
     }
   }
+
+  // Initialize the locations of transposed non-zeros of updated indices
+  for (const Transposition& transposition : environment.getTranspositions()) {
+    const pe::PathExpression& sourceExpr =
+        transposition.getSource().getPathExpression();
+    const pe::PathExpression& targetExpr =
+        transposition.getTarget().getPathExpression();
+    const string& name = transposition.getLocations().getName();
+    if (util::contains(transpositions, name) &&
+        !util::contains(updated, sourceExpr) &&
+        !util::contains(updated, targetExpr)) {
+      continue;
+    }
+    const pe::PathIndex& source = pathIndices.at(sourceExpr);
+    const pe::PathIndex& target = pathIndices.at(targetExpr);
+    vector<uint32_t>& locations = transpositions[name];
+    locations.resize(source.numNeighbors());
+    pe::computeTransposition(source, target, locations.data());
+    *transpositionPtrs.at(name) = locations.data();
+  }
+  return updated;
+}
+
+void LLVMFunction::resetHarness() {
+  harnessExecEngine.reset();
+  harnessEngineBuilder.reset();
+  harnessModule = new llvm::Module("simit_harness", LLVM_CTX);
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+  harnessEngineBuilder.reset(new llvm::EngineBuilder(harnessModule));
+  harnessExecEngine.reset(harnessEngineBuilder->setUseMCJIT(true).create());
+#else
+  harnessEngineBuilder.reset(new llvm::EngineBuilder(
+      unique_ptr<llvm::Module>(harnessModule)));
+  harnessExecEngine.reset(harnessEngineBuilder->create());
+#endif
+}
+
+void LLVMFunction::checkFieldLayouts(const std::string& name,
+                                     const Set* set) const {
+  const ir::ElementType* elemType =
+      getBindableType(name).toSet()->elementType.toElement();
+  for (const ir::Field& field : elemType->fields) {
+    FieldLayout layout = {Set::AoS, 1};
+    if (util::contains(fieldLayouts, elemType->name) &&
+        util::contains(fieldLayouts.at(elemType->name), field.name)) {
+      layout = fieldLayouts.at(elemType->name).at(field.name);
+    }
+    uassert(set->getFieldLayout(field.name) == layout.layout &&
+            set->getFieldBlockWidth(field.name) == layout.blockWidth)
+        << "Field " << field.name << " of the set bound to " << name
+        << " does not have the layout that the function was compiled for "
+        << "(see Program::setFieldLayout)";
+  }
+}
+
+void LLVMFunction::checkFieldOverlaps(const std::string& name,
+                                      Set* set) const {
+  // The buffers of the fields of the set, and of the other bound sets
+  struct FieldBuffer {
+    std::string bindable;
+    std::string field;
+    const char* begin;
+    const char* end;
+  };
+  auto fieldBuffers = [this](const std::string& bindable, Set* set) {
+    std::vector<FieldBuffer> buffers;
+    const ir::ElementType* elemType =
+        getBindableType(bindable).toSet()->elementType.toElement();
+    for (const ir::Field& field : elemType->fields) {
+      const char* begin = (const char*)set->getFieldData(field.name);
+      size_t size = set->getFieldBufferSize(field.name);
+      if (size > 0) {
+        buffers.push_back({bindable, field.name, begin, begin + size});
+      }
+    }
+    return buffers;
+  };
+  std::vector<FieldBuffer> buffers = fieldBuffers(name, set);
+  std::vector<FieldBuffer> others = buffers;
+  for (auto* actuals : {&arguments, &globals}) {
+    for (auto& pair : *actuals) {
+      if (pair.first != name && isa<SetActual>(pair.second.get())) {
+        Set* other = to<SetActual>(pair.second.get())->getSet();
+        std::vector<FieldBuffer> otherBuffers = fieldBuffers(pair.first, other);
+        others.insert(others.end(), otherBuffers.begin(), otherBuffers.end());
+      }
+    }
+  }
+
+  // Generated code scopes the accesses to fields by their names, and assumes
+  // that fields with different names do not alias (see
+  // LLVMBackend::emitAliasScopes)
+  for (const FieldBuffer& buffer : buffers) {
+    for (const FieldBuffer& other : others) {
+      uassert(buffer.field == other.field ||
+              buffer.end <= other.begin || other.end <= buffer.begin)
+          << "The buffer of field " << buffer.field << " of the set bound to "
+          << name << " overlaps the buffer of field " << other.field
+          << " of the set bound to " << other.bindable;
+    }
+  }
+}
+
+void LLVMFunction::allocateTemporary(const std::string& name, size_t size,
+                                     bool zero) {
+  void** tmpPtr = temporaryPtrs.at(name);
+  if (*tmpPtr == nullptr || temporarySizes.at(name) != size) {
+    free(*tmpPtr);
+    *tmpPtr = zero ? util::alignedCalloc(size, 1) : util::alignedMalloc(size);
+    temporarySizes[name] = size;
+  }
+  else if (zero) {
+    memset(*tmpPtr, 0, size);
+  }
+}
+
+/// Load a set struct of the given type from its members (see writeSetMembers)
+static llvm::Value* loadSet(llvm::StructType* type, void** members,
+                            llvm::IRBuilder<>* builder) {
+  llvm::Value* set = llvm::UndefValue::get(type);
+  for (unsigned i = 0; i < type->getNumElements(); ++i) {
+    llvm::Type* memberType = type->getElementType(i);
+    llvm::Value* member =
+        builder->CreateLoad(llvmPtr(memberType->getPointerTo(), &members[i]));
+    set = builder->CreateInsertValue(set, member, {i});
+  }
+  return set;
 }
 
-void LLVMFunction::createHarness(
-    const std::string &name,
-    const llvm::SmallVector<llvm::Value*,8> &args) {
+void LLVMFunction::createHarness(const std::string &name) {
   // Build prototype in harnass module as an extrnal linkage to the
   // function in the main module
   llvm::Function *llvmFunc = module->getFunction(name);
@@ -479,9 +1175,36 @@ void LLVMFunction::createHarness(
   llvm::Function *harness = createPrototype(
       harnessName, {}, {}, harnessModule, true);
   auto entry = llvm::BasicBlock::Create(LLVM_CTX, "entry", harness);
-  llvm::CallInst *call = llvm::CallInst::Create(llvmFuncProto, args, "", entry);
+  llvm::IRBuilder<> builder(entry);
+
+  // Tensor arguments are compiled into the harness, while set arguments are
+  // loaded from their members
+  llvm::SmallVector<llvm::Value*, 8> args;
+  auto llvmArgIt = llvmFunc->getArgumentList().begin();
+  for (const std::string& formal : getArgs()) {
+    llvm::Argument* llvmFormal = &(*llvmArgIt);
+    ++llvmArgIt;
+    Actual* actual = arguments.at(formal).get();
+    ir::Type type = getArgType(formal);
+    iassert(type.kind() == ir::Type::Set || type.kind() == ir::Type::Tensor);
+
+    if (isa<SetActual>(actual)) {
+      args.push_back(loadSet(llvmType(type.toSet()),
+                             setMembers.at(formal).data(), &builder));
+    }
+    else {
+      iassert(isa<TensorActual>(actual));
+      const ir::TensorType* tensorType = type.toTensor();
+      void* tensorData = to<TensorActual>(actual)->getData();
+      args.push_back((llvmFormal->getType()->isPointerTy())
+                     ? llvmPtr(*tensorType, tensorData)
+                     : llvmVal(*tensorType, tensorData));
+    }
+  }
+
+  llvm::CallInst *call = builder.CreateCall(llvmFuncProto, args);
   call->setCallingConv(llvmFunc->getCallingConv());
-  llvm::ReturnInst::Create(harnessModule->getContext(), entry);
+  builder.CreateRetVoid();
 }
 
 LLVMFunction::FuncType
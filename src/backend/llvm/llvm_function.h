@@ -5,14 +5,18 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <set>
 
 #include "llvm/IR/Module.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 
 #include "backend/backend_function.h"
+#include "backend/backend_impl.h"
+#include "coloring.h"
 #include "ir.h"
 #include "storage.h"
 #include "tensor_data.h"
+#include "util/arena.h"
 
 namespace llvm {
 class ExecutionEngine;
@@ -33,7 +37,11 @@ class LLVMFunction : public backend::Function {
  public:
   LLVMFunction(ir::Func func, const ir::Storage &storage,
                llvm::Function* llvmFunc, llvm::Module* module,
-               std::shared_ptr<llvm::EngineBuilder> engineBuilder);
+               std::shared_ptr<llvm::EngineBuilder> engineBuilder,
+               const std::map<std::string,std::vector<ParallelReduction>>&
+                   parallelReductions={},
+               const FieldLayouts& fieldLayouts={},
+               bool keepMachineModule=false);
   virtual ~LLVMFunction();
 
   virtual void bind(const std::string& name, simit::Set* set);
@@ -42,22 +50,37 @@ class LLVMFunction : public backend::Function {
 
   virtual FuncType init();
 
-  virtual bool isInitialized() {
-    return initialized;
-  }
+  /// False if the function has not been initialized with its current
+  /// bindings, or if a bound set has been modified since it was initialized.
+  virtual bool isInitialized();
 
   virtual void print(std::ostream &os) const;
   virtual void printMachine(std::ostream &os) const;
+  virtual void emitObject(const std::string& filename) const;
+  virtual void printHeader(std::ostream &os) const;
+
+  virtual AllocationStats getAllocationStats() const;
 
  protected:
   /// Get the number of elements in the index domains.
   size_t size(const ir::IndexDomain &dimension);
 
-  void initIndices(pe::PathIndexBuilder& piBuilder,
-                   const ir::Environment& environment);
+  /// Build the path indices that are not built over the current sets, and the
+  /// transpositions of their non-zeros. Returns the indices that were built.
+  std::set<pe::PathExpression> initIndices(pe::PathIndexBuilder& piBuilder,
+                                           const ir::Environment& environment);
 
   bool initialized;
 
+  /// The path index builder keeps the indices of the last initialization, so
+  /// that they are updated rather than rebuilt when the sets are modified.
+  std::unique_ptr<pe::PathIndexBuilder> pathIndexBuilder;
+
+  /// The versions and sizes of the bound sets when the function was
+  /// initialized or updated.
+  std::map<const Set*, unsigned long> setVersions;
+  std::map<const Set*, int>           setSizes;
+
   llvm::Function*                        llvmFunc;
   llvm::Module*                          module;
   llvm::Module*                          harnessModule;
@@ -75,24 +98,92 @@ class LLVMFunction : public backend::Function {
            std::pair<const uint32_t**,const uint32_t**>> tensorIndexPtrs;
   std::map<pe::PathExpression, pe::PathIndex>            pathIndices;
 
+  /// The locations of the transposed non-zeros of path indices, by the name of
+  /// their locations array
+  std::map<std::string, const uint32_t**>       transpositionPtrs;
+  std::map<std::string, std::vector<uint32_t>>  transpositions;
+
  private:
   std::shared_ptr<llvm::EngineBuilder>   engineBuilder;
   std::shared_ptr<llvm::ExecutionEngine> executionEngine;
   std::unique_ptr<llvm::EngineBuilder>   harnessEngineBuilder;
   std::unique_ptr<llvm::ExecutionEngine> harnessExecEngine;
 
-  /// Temporaries
-  std::map<std::string, void**> temporaryPtrs;
+  /// A copy of the optimized module that printMachine and emitObject generate
+  /// code for, since MCJIT has already generated code for the module. It is
+  /// only kept if the backend was asked to (see Backend::setKeepMachineCode).
+  std::unique_ptr<llvm::Module> machineModule;
 
+  /// Temporaries, and the sizes they were allocated with
+  std::map<std::string, void**> temporaryPtrs;
+  std::map<std::string, size_t> temporarySizes;
+
+  /// Parallel reductions of the edge sets with colored loops, which are chosen
+  /// when the function is initialized with new sets, and the reductions that
+  /// the loops support.
+  std::map<std::string, std::vector<ParallelReduction>> parallelReductions;
+  std::map<std::string, int*> reductionPtrs;
+
+  /// The layouts of the fields that the function was compiled for, which the
+  /// fields of bound sets must have.
+  FieldLayouts fieldLayouts;
+
+  /// Edge colorings of the sets whose loops execute by color.
+  std::map<std::string, const int**> coloringPtrs;
+  std::map<std::string, std::vector<int>> colorings;
+
+  /// The harness of the function, and the harnesses that allocate and free
+  /// its buffers.
+  FuncType func;
+  FuncType initBuffers;
   FuncType deinit;
 
+  /// The members of the set arguments (see writeSetMembers), which harnesses
+  /// load the sets from.
+  std::map<std::string, std::vector<void*>> setMembers;
+
+  /// Serves the temporaries that runs allocate through simit_malloc, such as
+  /// the sparse matrices computed by runtime functions, and keeps them for the
+  /// next run when they are freed. The arena is cleared by deinit.
+  util::Arena arena;
+
   // MCJIT does not allow module modification after code generation. Instead,
   // create all harness functions in the harness module first, then fetch
   // generated addresses using getHarnessFunctionAddress.
-  void createHarness(const std::string& name,
-                     const llvm::SmallVector<llvm::Value*,8>& args);
+  void createHarness(const std::string& name);
   FuncType getHarnessFunctionAddress(const std::string& name);
 
+  // Replace a finalized harness module with an empty one, to create harness
+  // functions for new arguments.
+  void resetHarness();
+
+  // Refresh the path indices, colorings and temporaries that depend on the
+  // bound sets that were modified since the last initialization or update,
+  // and write the modified sets to the arguments and externs.
+  void update();
+
+  // Choose the parallel reductions of colored loops and color their edge sets,
+  // for the sets in `modified` or for all sets if it is null.
+  void initColorings(const std::set<std::string>* modified);
+
+  // Allocate the temporaries whose sizes depend on the sets in `modified` or
+  // on the path indices in `updatedIndices`, or all of them if `modified` is
+  // null.
+  void initTemporaries(const std::set<std::string>* modified,
+                       const std::set<pe::PathExpression>& updatedIndices);
+
+  // Check that the fields of a set bound to `name` have the layouts that the
+  // function was compiled for.
+  void checkFieldLayouts(const std::string& name, const Set* set) const;
+
+  // Check that the field buffers of a set bound to `name` do not overlap the
+  // buffers of the fields with other names of the set and of the other bound
+  // sets, which the function assumes do not alias.
+  void checkFieldOverlaps(const std::string& name, Set* set) const;
+
+  // Allocate a temporary, reusing its memory if it has the same size.
+  void allocateTemporary(const std::string& name, size_t size, bool zero);
+
   llvm::Function* getInitFunc() const;
   llvm::Function* getDeinitFunc() const;
 };
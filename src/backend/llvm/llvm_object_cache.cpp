@@ -0,0 +1,142 @@
+#include "llvm_object_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "llvm/IR/Module.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "types.h"
+
+using namespace std;
+
+namespace simit {
+extern std::string kBackend;
+
+ObjectCacheStats getObjectCacheStats() {
+  return backend::LLVMObjectCache::getInstance().getStats();
+}
+
+namespace backend {
+
+LLVMObjectCache& LLVMObjectCache::getInstance() {
+  static LLVMObjectCache instance;
+  return instance;
+}
+
+std::string LLVMObjectCache::getKey(const llvm::Module* module) const {
+  std::string moduleString;
+  llvm::raw_string_ostream moduleStream(moduleString);
+  module->print(moduleStream, nullptr);
+  moduleStream.flush();
+
+  std::stringstream settings;
+  settings << LLVM_MAJOR_VERSION << "." << LLVM_MINOR_VERSION << ";"
+           << llvm::sys::getProcessTriple() << ";"
+           << std::string(llvm::sys::getHostCPUName()) << ";"
+           << kBackend << ";" << ir::ScalarType::floatBytes << ";"
+           << kIndexlessStencils << ";" << kThreads << ";" << kReduction << ";"
+           << kOptLevel << ";" << kCPU << ";" << kCPUFeatures << ";"
+           << kFastMath;
+
+  llvm::MD5 md5;
+  md5.update(settings.str());
+  md5.update(moduleString);
+  llvm::MD5::MD5Result result;
+  md5.final(result);
+  llvm::SmallString<32> key;
+  llvm::MD5::stringifyResult(result, key);
+  return std::string(key.begin(), key.end());
+}
+
+bool LLVMObjectCache::contains(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (objects.find(key) != objects.end()) {
+    return true;
+  }
+
+  std::ifstream file(getPath(key), std::ios::binary);
+  if (!file.good()) {
+    return false;
+  }
+  std::stringstream object;
+  object << file.rdbuf();
+  if (file.bad() || object.str().empty()) {
+    return false;
+  }
+  objects[key] = object.str();
+  return true;
+}
+
+ObjectCacheStats LLVMObjectCache::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           const llvm::MemoryBuffer* object) {
+  storeObject(module->getModuleIdentifier(), object->getBufferStart(),
+              object->getBufferSize());
+}
+
+llvm::MemoryBuffer* LLVMObjectCache::getObject(const llvm::Module* module) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto object = objects.find(module->getModuleIdentifier());
+  if (object == objects.end()) {
+    return nullptr;
+  }
+  ++stats.hits;
+  return llvm::MemoryBuffer::getMemBufferCopy(object->second);
+}
+#else
+void LLVMObjectCache::notifyObjectCompiled(const llvm::Module* module,
+                                           llvm::MemoryBufferRef object) {
+  storeObject(module->getModuleIdentifier(), object.getBufferStart(),
+              object.getBufferSize());
+}
+
+std::unique_ptr<llvm::MemoryBuffer>
+LLVMObjectCache::getObject(const llvm::Module* module) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto object = objects.find(module->getModuleIdentifier());
+  if (object == objects.end()) {
+    return nullptr;
+  }
+  ++stats.hits;
+  return llvm::MemoryBuffer::getMemBufferCopy(object->second);
+}
+#endif
+
+std::string LLVMObjectCache::getPath(const std::string& key) const {
+  return kCacheDir + "/" + key + ".o";
+}
+
+void LLVMObjectCache::storeObject(const std::string& key,
+                                  const char* data, size_t size) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ++stats.misses;
+  objects[key] = std::string(data, size);
+
+  // Write to a process-private file that is then renamed, so that processes
+  // sharing the cache directory never read partially written objects. The
+  // cache is only an optimization, so failures to write it are ignored.
+  mkdir(kCacheDir.c_str(), 0755);
+  std::string path = getPath(key);
+  std::string tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+  std::ofstream file(tmpPath, std::ios::binary);
+  file.write(data, size);
+  file.close();
+  if (!file.good() || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::remove(tmpPath.c_str());
+  }
+}
+
+}}
@@ -0,0 +1,66 @@
+#ifndef SIMIT_LLVM_OBJECT_CACHE_H
+#define SIMIT_LLVM_OBJECT_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+
+#include "init.h"
+
+namespace llvm {
+class Module;
+class MemoryBuffer;
+}
+
+namespace simit {
+namespace backend {
+
+/// A cache of the object code that MCJIT generates for Simit modules, which
+/// persists across processes in the directory given by Settings::cacheDir.
+/// Modules are looked up by their identifier, which the backend sets to the
+/// key returned by getKey, so that warm compiles skip optimization and code
+/// generation entirely.
+class LLVMObjectCache : public llvm::ObjectCache {
+public:
+  static LLVMObjectCache& getInstance();
+
+  /// Returns a key that identifies the object code of the unoptimized module.
+  /// The key hashes the module, the settings that affect code generation and
+  /// the host target.
+  std::string getKey(const llvm::Module* module) const;
+
+  /// Returns true if there is object code for the key, either in memory or in
+  /// the cache directory, in which case MCJIT will load it instead of
+  /// generating code for the module with the key as its identifier.
+  bool contains(const std::string& key);
+
+  ObjectCacheStats getStats() const;
+
+#if LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5
+  virtual void notifyObjectCompiled(const llvm::Module* module,
+                                    const llvm::MemoryBuffer* object);
+  virtual llvm::MemoryBuffer* getObject(const llvm::Module* module);
+#else
+  virtual void notifyObjectCompiled(const llvm::Module* module,
+                                    llvm::MemoryBufferRef object);
+  virtual std::unique_ptr<llvm::MemoryBuffer>
+  getObject(const llvm::Module* module);
+#endif
+
+private:
+  mutable std::mutex mutex;
+  std::map<std::string, std::string> objects;
+  ObjectCacheStats stats;
+
+  LLVMObjectCache() {}
+  LLVMObjectCache(const LLVMObjectCache&)  = delete;
+  void operator=(const LLVMObjectCache&) = delete;
+
+  std::string getPath(const std::string& key) const;
+  void storeObject(const std::string& key, const char* data, size_t size);
+};
+
+}}
+#endif
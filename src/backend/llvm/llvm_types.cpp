@@ -95,6 +95,10 @@ llvm::StructType *llvmType(const ir::UnstructuredSetType& setType,
   for (const Field &field : elemType->fields) {
     llvmFieldTypes.push_back(llvmType(field.type, addrspace));
   }
+
+  // Component strides of the fields, which SoA fields are located by
+  llvmFieldTypes.insert(llvmFieldTypes.end(), elemType->fields.size(),
+                        LLVM_INT);
   return llvm::StructType::get(LLVM_CTX, llvmFieldTypes, packed);
 }
 
@@ -116,6 +120,10 @@ llvm::StructType *llvmType(const ir::LatticeLinkSetType& setType,
   for (const Field &field : elemType->fields) {
     llvmFieldTypes.push_back(llvmType(field.type, addrspace));
   }
+
+  // Component strides of the fields, which SoA fields are located by
+  llvmFieldTypes.insert(llvmFieldTypes.end(), elemType->fields.size(),
+                        LLVM_INT);
   return llvm::StructType::get(LLVM_CTX, llvmFieldTypes, packed);
 }
 
@@ -159,6 +167,11 @@ llvm::PointerType *llvmPtrType(ScalarType stype, unsigned addrspace) {
     case ScalarType::Int:
       return llvm::Type::getInt32PtrTy(LLVM_CTX, addrspace);
     case ScalarType::Float:
+      if (stype.hasStoragePrecision()) {
+        return (stype.storageBytes == sizeof(float))
+            ? llvm::Type::getFloatPtrTy(LLVM_CTX, addrspace)
+            : llvm::Type::getDoublePtrTy(LLVM_CTX, addrspace);
+      }
       return llvmFloatPtrType(addrspace);
     case ScalarType::Boolean:
       return llvm::Type::getInt1PtrTy(LLVM_CTX, addrspace);
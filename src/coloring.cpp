@@ -0,0 +1,140 @@
+#include "coloring.h"
+
+#include <algorithm>
+#include <map>
+
+#include "graph.h"
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+
+/// Give the elements of each distinct endpoint set their own vertex keys, so
+/// that heterogeneous edge sets only conflict through shared elements. Returns
+/// the number of vertex keys.
+static int getEndpointOffsets(const Set &edgeSet, vector<int> *offsets) {
+  map<const Set*,int> setOffsets;
+  int numVertices = 0;
+  for (int k = 0; k < edgeSet.getCardinality(); ++k) {
+    const Set *endpointSet = edgeSet.getEndpointSet(k);
+    if (setOffsets.find(endpointSet) == setOffsets.end()) {
+      setOffsets[endpointSet] = numVertices;
+      numVertices += endpointSet->getSize();
+    }
+    offsets->push_back(setOffsets[endpointSet]);
+  }
+  return numVertices;
+}
+
+std::vector<int> colorEdges(Set &edgeSet) {
+  const int numEdges = edgeSet.getSize();
+  const int cardinality = edgeSet.getCardinality();
+  iassert(cardinality > 0) << "can only color edge sets";
+
+  vector<int> endpointOffsets;
+  const int numVertices = getEndpointOffsets(edgeSet, &endpointOffsets);
+
+  // Greedily assign each edge the smallest color not used by an edge that
+  // shares one of its endpoints
+  const int *endpoints = edgeSet.getEndpointsData();
+  vector<vector<int>> vertexColors(numVertices);
+  vector<int> forbidden;   // Stamped with the edge that forbade the color
+  vector<int> edgeColors(numEdges);
+  vector<int> colorSizes;
+  for (int e = 0; e < numEdges; ++e) {
+    for (int k = 0; k < cardinality; ++k) {
+      int vertex = endpointOffsets[k] + endpoints[e*cardinality + k];
+      for (int color : vertexColors[vertex]) {
+        forbidden[color] = e;
+      }
+    }
+
+    int color = 0;
+    while (color < (int)forbidden.size() && forbidden[color] == e) {
+      ++color;
+    }
+    if (color == (int)forbidden.size()) {
+      forbidden.push_back(-1);
+      colorSizes.push_back(0);
+    }
+    edgeColors[e] = color;
+    ++colorSizes[color];
+
+    for (int k = 0; k < cardinality; ++k) {
+      int vertex = endpointOffsets[k] + endpoints[e*cardinality + k];
+      vertexColors[vertex].push_back(color);
+    }
+  }
+
+  // Bucket the edges by color
+  const int numColors = colorSizes.size();
+  vector<int> coloring(2 + numColors + numEdges);
+  coloring[0] = numColors;
+  int *offsets = &coloring[1];
+  int *edges = &coloring[2 + numColors];
+  offsets[0] = 0;
+  for (int c = 0; c < numColors; ++c) {
+    offsets[c+1] = offsets[c] + colorSizes[c];
+  }
+  vector<int> next(offsets, offsets + numColors);
+  for (int e = 0; e < numEdges; ++e) {
+    edges[next[edgeColors[e]]++] = e;
+  }
+  return coloring;
+}
+
+// The minimum number of edges per thread and color, for coloring to keep the
+// threads busy
+static const int kMinEdgesPerThread = 256;
+
+// The maximum degree at which atomic updates rarely contend
+static const int kMaxAtomicDegree = 4;
+
+ParallelReduction chooseParallelReduction(
+    Set &edgeSet, const std::vector<ParallelReduction> &supported,
+    unsigned numThreads) {
+  const int numEdges = edgeSet.getSize();
+  const int cardinality = edgeSet.getCardinality();
+  iassert(cardinality > 0) << "can only reduce over edge sets";
+
+  vector<int> endpointOffsets;
+  const int numVertices = getEndpointOffsets(edgeSet, &endpointOffsets);
+  if (numThreads <= 1 || numEdges == 0 || numVertices == 0) {
+    return ColoredReduction;
+  }
+
+  const int *endpoints = edgeSet.getEndpointsData();
+  vector<int> degrees(numVertices, 0);
+  int maxDegree = 0;
+  for (int e = 0; e < numEdges; ++e) {
+    for (int k = 0; k < cardinality; ++k) {
+      int vertex = endpointOffsets[k] + endpoints[e*cardinality + k];
+      maxDegree = max(maxDegree, ++degrees[vertex]);
+    }
+  }
+  const double avgDegree = (double)numEdges * cardinality / numVertices;
+
+  // A coloring has at least maxDegree colors
+  bool fewEdgesPerColor =
+      (double)numEdges / maxDegree < (double)numThreads * kMinEdgesPerThread;
+
+  bool privatization = find(supported.begin(), supported.end(),
+                            PrivatizedReduction) != supported.end();
+  bool atomics = find(supported.begin(), supported.end(),
+                      AtomicReduction) != supported.end();
+
+  bool lowContention = maxDegree <= kMaxAtomicDegree;
+
+  // Merging the private copies costs about numVertices updates per thread
+  if (privatization && (avgDegree >= numThreads ||
+                        (fewEdgesPerColor && !lowContention))) {
+    return PrivatizedReduction;
+  }
+  if (atomics && (lowContention || fewEdgesPerColor)) {
+    return AtomicReduction;
+  }
+  return ColoredReduction;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef SIMIT_COLORING_H
+#define SIMIT_COLORING_H
+
+#include <vector>
+
+namespace simit {
+class Set;
+
+/// Colors the edges of an edge set so that no two edges of the same color
+/// share an endpoint. Edges of the same color can therefore accumulate into
+/// their endpoints' locations concurrently.
+///
+/// The coloring is laid out as a single array: the number of colors `c`,
+/// followed by `c+1` offsets, followed by the edges ordered by color. The edges
+/// of color `i` are stored in [offsets[i], offsets[i+1]) of the edge list, in
+/// their original order.
+std::vector<int> colorEdges(Set &edgeSet);
+
+/// Ways of executing a loop over an edge set, whose iterations accumulate into
+/// their endpoints' locations, in parallel:
+/// - ColoredReduction executes the edges one color at a time (see colorEdges).
+/// - PrivatizedReduction lets each thread accumulate into a private copy of the
+///   reduction buffers, and merges the copies once the loop has completed.
+/// - AtomicReduction accumulates into the reduction buffers with atomic adds.
+enum ParallelReduction {ColoredReduction, PrivatizedReduction, AtomicReduction};
+
+/// Pick the reduction that is expected to perform best on the edge set, among
+/// the `supported` ones, based on the set's size and endpoint degrees. Coloring
+/// is always supported, but serializes badly on high-degree graphs where each
+/// color only has a few edges. Private copies pay off when the average degree
+/// is high enough to amortize merging them, and atomics pay off when the
+/// degrees, and therefore the contention, are low.
+ParallelReduction chooseParallelReduction(
+    Set &edgeSet, const std::vector<ParallelReduction> &supported,
+    unsigned numThreads);
+
+}
+#endif
@@ -36,6 +36,8 @@ struct Environment::Content {
   map<StencilLayout,size_t>      locationOfTensorIndexStencil;
 
   map<Var,TensorIndex>           tensorIndexOfVar;
+
+  vector<Transposition>          transpositions;
 };
 
 Environment::Environment() : content(new Content) {
@@ -160,6 +162,10 @@ const TensorIndex& Environment::getTensorIndex(
       content->locationOfTensorIndexStencil.at(stencil)];
 }
 
+const std::vector<Transposition>& Environment::getTranspositions() const {
+  return content->transpositions;
+}
+
 void Environment::addConstant(const Var& var, const Expr& initializer) {
   content->constants.push_back({var, initializer});
 }
@@ -230,6 +236,26 @@ void Environment::addTensorIndex(const StencilLayout& stencil, const Var& var) {
   content->tensorIndexOfVar.insert({var, getTensorIndex(stencil)});
 }
 
+const Var& Environment::addTransposition(const TensorIndex& source,
+                                         const TensorIndex& target) {
+  iassert(source.getKind() == TensorIndex::PExpr &&
+          hasTensorIndex(source.getPathExpression()) &&
+          target.getKind() == TensorIndex::PExpr &&
+          hasTensorIndex(target.getPathExpression()))
+      << "Only pre-assembled tensor indices can be transposed";
+
+  for (const Transposition& transposition : content->transpositions) {
+    if (transposition.getSource() == source &&
+        transposition.getTarget() == target) {
+      return transposition.getLocations();
+    }
+  }
+  Var locations(names.getName(source.getName() + ".transposed"),
+                ArrayType::make(ScalarType::Int));
+  content->transpositions.push_back(Transposition(source, target, locations));
+  return content->transpositions.back().getLocations();
+}
+
 std::ostream& operator<<(std::ostream& os, const Environment& env) {
   bool somethingPrinted = false;
 
@@ -290,6 +316,17 @@ std::ostream& operator<<(std::ostream& os, const Environment& env) {
     }
     somethingPrinted = true;
   }
+
+  // Transpositions
+  for (auto& transposition : env.getTranspositions()) {
+    if (somethingPrinted) {
+      os << std::endl;
+    }
+    os << transposition.getLocations() << " : "
+       << transposition.getSource().getName() << " -> "
+       << transposition.getTarget().getName() << ";";
+    somethingPrinted = true;
+  }
   UNUSED(somethingPrinted);
 
   return os;
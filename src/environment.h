@@ -6,6 +6,7 @@
 #include <ostream>
 #include "var.h"
 #include "macros.h"
+#include "tensor_index.h"
 #include "util/name_generator.h"
 
 namespace simit {
@@ -14,7 +15,6 @@ class PathExpression;
 }
 namespace ir {
 class Expr;
-class TensorIndex;
 class StencilLayout;
 
 /// A VarMapping is a mapping from a Var to a vector of Vars that implement it.
@@ -36,6 +36,26 @@ private:
 
 std::ostream& operator<<(std::ostream&, const VarMapping&);
 
+/// A Transposition maps the non-zeros of a tensor index to their locations in
+/// the index of the transposed tensor. Transpositions of pre-assembled tensor
+/// indices are computed when a function is initialized, and stored in the
+/// locations array.
+class Transposition {
+public:
+  Transposition(const TensorIndex& source, const TensorIndex& target,
+                const Var& locations)
+      : source(source), target(target), locations(locations) {}
+
+  const TensorIndex& getSource() const {return source;}
+  const TensorIndex& getTarget() const {return target;}
+  const Var& getLocations() const {return locations;}
+
+private:
+  TensorIndex source;
+  TensorIndex target;
+  Var locations;
+};
+
 /// An Environment keeps track of global constants, externs and temporaries.
 /// It also keeps track of the data arrays and shared index arrays of tensors
 /// that have path expressions. (The latter are added to the environment as the
@@ -102,6 +122,9 @@ public:
   /// Retrieve the tensor index of the given stencil.
   const TensorIndex& getTensorIndex(const StencilLayout& stencil) const;
 
+  /// Retrieve all the transpositions in the environment.
+  const std::vector<Transposition>& getTranspositions() const;
+
   /// Insert a constant into the environment.
   void addConstant(const Var& var, const Expr& initializer);
 
@@ -129,6 +152,12 @@ public:
   /// and associate it with var.
   void addTensorIndex(const StencilLayout& stencil, const Var& var);
 
+  /// Add the transposition from the source to the target tensor index to the
+  /// environment, unless it is there already, and return its locations array.
+  /// Both tensor indices must be pre-assembled path expression indices.
+  const Var& addTransposition(const TensorIndex& source,
+                              const TensorIndex& target);
+
 private:
   struct Content;
   Content* content;
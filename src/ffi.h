@@ -9,15 +9,13 @@
 namespace simit {
 namespace ffi {
 
-extern "C" inline
-void* simit_malloc(std::size_t size) {
-  return malloc(size);
-}
+/// Allocate memory for the result of an external function. The memory is
+/// served by the arena of the function that is running, so that it is reused
+/// across runs, and by malloc outside of functions.
+extern "C" void* simit_malloc(std::size_t size);
 
-extern "C" inline
-void simit_free(void* ptr) {
-  return free(ptr);
-}
+/// Free memory that was allocated with simit_malloc or malloc.
+extern "C" void simit_free(void* ptr);
 
 /// Converts a Simit blocked matrix into a CSR matrix.
 template <typename Float>
@@ -188,6 +188,7 @@ void ScalarType::copy(FIRNode::Ptr node) {
   const auto scalarType = to<ScalarType>(node);
   TensorType::copy(scalarType);
   type = scalarType->type;
+  storageBytes = scalarType->storageBytes;
 }
 
 FIRNode::Ptr ScalarType::cloneNode() {
@@ -289,6 +289,10 @@ struct ScalarType : public TensorType {
   enum class Type {INT, FLOAT, BOOL, COMPLEX, STRING};
 
   Type type;
+
+  // The size of float values in memory if the type is 'float32' or 'float64',
+  // and 0 if it is 'float'. The type is a FLOAT regardless.
+  unsigned storageBytes = 0;
   
   typedef std::shared_ptr<ScalarType> Ptr;
  
@@ -210,6 +210,22 @@ std::vector<fir::FuncDecl::Ptr> createIntrinsics() {
                {opaqueType, nmMatrixType},
                {nmMatrixType},
                {N, M});
+  addIntrinsic(&intrinsics,
+               ir::intrinsics::cg().getName(),
+               {nnMatrixType, nVectorType, nVectorType,
+                makeTensorType(ScalarType::Type::FLOAT),
+                makeTensorType(ScalarType::Type::INT)},
+               {nVectorType, makeTensorType(ScalarType::Type::INT),
+                makeTensorType(ScalarType::Type::FLOAT)},
+               {N});
+  addIntrinsic(&intrinsics,
+               ir::intrinsics::pcg().getName(),
+               {nnMatrixType, nVectorType, nVectorType,
+                makeTensorType(ScalarType::Type::FLOAT),
+                makeTensorType(ScalarType::Type::INT)},
+               {nVectorType, makeTensorType(ScalarType::Type::INT),
+                makeTensorType(ScalarType::Type::FLOAT)},
+               {N});
 
   // Complex numbers
   addScalarIntrinsic(&intrinsics,
@@ -89,6 +89,9 @@ void FIRPrinter::visit(ScalarType::Ptr type) {
       break;
     case ScalarType::Type::FLOAT:
       oss << "float";
+      if (type->storageBytes != 0) {
+        oss << type->storageBytes*8;
+      }
       break;
     case ScalarType::Type::BOOL:
       oss << "bool";
@@ -74,7 +74,10 @@ void IREmitter::visit(ScalarType::Ptr type) {
       retType = ir::Int;
       break;
     case ScalarType::Type::FLOAT:
-      retType = ir::Float;
+      retType = (type->storageBytes != 0)
+                ? ir::TensorType::make(ir::ScalarType(ir::ScalarType::Float,
+                                                      type->storageBytes))
+                : ir::Float;
       break;
     case ScalarType::Type::BOOL:
       retType = ir::Boolean;
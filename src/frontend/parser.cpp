@@ -1312,6 +1312,8 @@ fir::Type::Ptr Parser::parseType() {
       break;
     case Token::Type::INT:
     case Token::Type::FLOAT:
+    case Token::Type::FLOAT32:
+    case Token::Type::FLOAT64:
     case Token::Type::BOOL:
     case Token::Type::COMPLEX:
     case Token::Type::STRING:
@@ -1444,6 +1446,8 @@ fir::TensorType::Ptr Parser::parseTensorType() {
   switch (peek().type) {
     case Token::Type::INT:
     case Token::Type::FLOAT:
+    case Token::Type::FLOAT32:
+    case Token::Type::FLOAT64:
     case Token::Type::BOOL:
     case Token::Type::COMPLEX:
     case Token::Type::STRING:
@@ -1557,7 +1561,8 @@ fir::NDTensorType::Ptr Parser::parseTensorBlockType() {
   return tensorType;
 }
 
-// tensor_component_type: 'int' | 'float' | 'bool' | 'complex'
+// tensor_component_type: 'int' | 'float' | 'float32' | 'float64' | 'bool'
+//                      | 'complex'
 fir::ScalarType::Ptr Parser::parseTensorComponentType() {
   auto scalarType = std::make_shared<fir::ScalarType>();
 
@@ -1573,6 +1578,16 @@ fir::ScalarType::Ptr Parser::parseTensorComponentType() {
       consume(Token::Type::FLOAT);
       scalarType->type = fir::ScalarType::Type::FLOAT;
       break;
+    case Token::Type::FLOAT32:
+      consume(Token::Type::FLOAT32);
+      scalarType->type = fir::ScalarType::Type::FLOAT;
+      scalarType->storageBytes = 4;
+      break;
+    case Token::Type::FLOAT64:
+      consume(Token::Type::FLOAT64);
+      scalarType->type = fir::ScalarType::Type::FLOAT;
+      scalarType->storageBytes = 8;
+      break;
     case Token::Type::BOOL:
       consume(Token::Type::BOOL);
       scalarType->type = fir::ScalarType::Type::BOOL;
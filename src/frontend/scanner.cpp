@@ -12,6 +12,8 @@ namespace internal {
 Token::Type Scanner::getTokenType(const std::string token) {
   if (token == "int") return Token::Type::INT;
   if (token == "float") return Token::Type::FLOAT;
+  if (token == "float32") return Token::Type::FLOAT32;
+  if (token == "float64") return Token::Type::FLOAT64;
   if (token == "bool") return Token::Type::BOOL;
   if (token == "complex") return Token::Type::COMPLEX;
   if (token == "string") return Token::Type::STRING;
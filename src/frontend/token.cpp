@@ -34,6 +34,10 @@ std::string Token::tokenTypeString(Token::Type type) {
       return "'int'";
     case Token::Type::FLOAT:
       return "'float'";
+    case Token::Type::FLOAT32:
+      return "'float32'";
+    case Token::Type::FLOAT64:
+      return "'float64'";
     case Token::Type::BOOL:
       return "'bool'";
     case Token::Type::COMPLEX:
@@ -21,6 +21,8 @@ struct Token {
     NEG,
     INT,
     FLOAT,
+    FLOAT32,
+    FLOAT64,
     BOOL,
     COMPLEX,
     STRING,
@@ -47,7 +47,8 @@ void Function::bind(const std::string& name, simit::Set *set) {
         setFieldTypeComponentType = ir::ScalarType(ir::ScalarType::Float);
         break;
       case ComponentType::Double:
-        iassert(ir::ScalarType::floatBytes == sizeof(double));
+        iassert(ir::ScalarType::floatBytes == sizeof(double) ||
+                elemFieldType->getComponentType().storageBytes != 0);
         setFieldTypeComponentType = ir::ScalarType(ir::ScalarType::Float);
         break;
       case ComponentType::Int:
@@ -72,6 +73,13 @@ void Function::bind(const std::string& name, simit::Set *set) {
             setFieldType->getOrder() == elemFieldType->order())
         << fieldTypeErrorString;
 
+    // Fields that are declared with a storage precision must be stored with it
+    const ir::ScalarType elemComponentType = elemFieldType->getComponentType();
+    uassert(elemComponentType.storageBytes == 0 ||
+            elemComponentType.bytes() ==
+                componentSize(setFieldType->getComponentType()))
+        << fieldTypeErrorString;
+
     const vector<ir::IndexDomain> &fieldDims = elemFieldType->getDimensions();
     for (size_t i=0; i < elemFieldType->order(); ++i) {
       uassert(fieldDims[i].getIndexSets().size() == 1)
@@ -138,6 +146,11 @@ void Function::unmapArgs(bool updated) {
   impl->unmapArgs(updated);
 }
 
+AllocationStats Function::getAllocationStats() const {
+  uassert(defined()) << "undefined function";
+  return impl->getAllocationStats();
+}
+
 void Function::print(std::ostream& os) const {
   if (defined()) {
     os << *impl;
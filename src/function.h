@@ -4,6 +4,7 @@
 #include <string>
 #include <functional>
 #include "tensor.h"
+#include "util/arena.h"
 
 namespace simit {
 class Set;
@@ -77,6 +78,11 @@ public:
   void mapArgs();
   void unmapArgs(bool updated=true);
 
+  /// Returns the allocation counts of the temporaries, such as sparse matrices
+  /// computed by solvers, that the function allocated while it ran. The
+  /// temporaries are reused across runs as long as their sizes repeat.
+  AllocationStats getAllocationStats() const;
+
   /// True if the function has been defined, false otherwise.
   bool defined() const {return impl != nullptr;}
 
@@ -84,7 +90,9 @@ public:
   /// example, the LLVM backend will print LLVM IR.
   void print(std::ostream& os) const;
 
-  /// Print the function to the stream as machine assembly code.
+  /// Print the function to the stream as machine assembly code. The backend
+  /// that compiled the function must have kept its machine code (see
+  /// backend::Backend::setKeepMachineCode).
   void printMachine(std::ostream& os) const;
 
 private:
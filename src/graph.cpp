@@ -1,31 +1,540 @@
 #include "graph.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <fstream>
 #include <iostream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "init.h"
+#include "path_expressions.h"
+#include "path_indices.h"
+
 using namespace std;
 
 namespace simit {
 
+// A Set snapshot starts with a header, followed by a table of the fields and by
+// the arrays that the header and the table refer to by their offsets in the
+// file. Arrays are aligned to cache lines, or to Settings::alignment if it is
+// larger, so that they can be used in place, and their numbers are in the byte
+// order of the machine that saved them.
+static const char     snapshotMagic[8] = {'S','I','M','I','T','S','E','T'};
+static const uint32_t snapshotFormat = 1;
+static const uint32_t snapshotByteOrder = 0x01020304;
+static const uint64_t snapshotAlignment = 64;
+
+struct SnapshotHeader {
+  char     magic[8];
+  uint32_t format;
+  uint32_t byteOrder;
+  uint64_t numElements;
+  uint32_t cardinality;
+  uint32_t numFields;
+  uint64_t fields;          // the field table
+  uint64_t endpoints;       // the endpoints of the elements
+  uint64_t neighborRows;    // the number of rows of the neighbor index
+  uint64_t neighborCoords;  // the neighbor index, or 0 if there is none
+  uint64_t neighborSinks;
+};
+
+struct SnapshotField {
+  uint64_t name;
+  uint64_t nameLength;
+  uint32_t componentType;
+  uint32_t order;
+  uint64_t dimensions;      // `order` dimensions
+  uint64_t data;
+};
+
+/// A snapshot that is mapped into memory, with the neighbor index it holds and
+/// the versions of the Set and of its endpoint set when it was loaded.
+struct Set::Snapshot {
+  char*  addr;
+  size_t size;
+  const uint32_t* neighborCoords;
+  const uint32_t* neighborSinks;
+  unsigned long version;
+  unsigned long endpointVersion;
+
+  bool contains(const void* ptr) const {
+    return ptr >= addr && ptr < addr + size;
+  }
+};
+
 Set::~Set() {
   for (auto f: fields) {
     delete f;
   }
-  free(endpoints);
+  if (snapshot == nullptr || !snapshot->contains(endpoints)) {
+    free(endpoints);
+  }
   free(latticePoints);
   free(latticeLinks);
+  if (snapshot != nullptr) {
+    munmap(snapshot->addr, snapshot->size);
+    delete snapshot;
+  }
+}
+
+ElementRef Set::addElements(int count) {
+  uassert(count >= 0) << "Cannot add a negative number of elements";
+  uassert(getCardinality() == 0)
+      << "Edges must be added with their endpoints using addEdges";
+  increaseCapacity(numElements+count);
+  ElementRef first(numElements);
+  modified(numElements, numElements+count);
+  numElements += count;
+  return first;
+}
+
+ElementRef Set::addEdges(const int* endpoints, int count) {
+  uassert(count >= 0) << "Cannot add a negative number of edges";
+  uassert(getCardinality() > 0)
+      << "Elements without endpoints must be added using addElements";
+  increaseCapacity(numElements+count);
+
+  const int cardinality = getCardinality();
+  int* dst = &this->endpoints[numElements*cardinality];
+  for (int i = 0; i < count; ++i) {
+    for (int j = 0; j < cardinality; ++j) {
+      int endpoint = endpoints[i*cardinality + j];
+      uassert(endpoint >= 0 && endpoint < endpointSets[j]->getSize())
+          << "Invalid member of set in addEdges";
+      dst[i*cardinality + j] = endpoint;
+    }
+  }
+
+  ElementRef first(numElements);
+  modified(numElements, numElements+count);
+  numElements += count;
+  return first;
+}
+
+unsigned long Set::newVersion() {
+  static std::atomic<unsigned long> lastVersion(0);
+  return ++lastVersion;
 }
 
-void Set::increaseCapacity() {
+void Set::modified(int begin, int end) {
+  // Consecutive additions extend the same range, unless the Set's version has
+  // been observed in between (see markVersionObserved), since the range would
+  // then include elements that were added before that version
+  bool extend = !versionSeen && !modifications.empty() &&
+                modifications.back().end == begin;
+  version = newVersion();
+  versionSeen = false;
+  if (extend) {
+    modifications.back().end = end;
+    modifications.back().version = version;
+    return;
+  }
+
+  // Forget the older half of the modifications when the log is full
+  if (modifications.size() == maxModifications) {
+    size_t forget = maxModifications / 2;
+    firstLoggedVersion = modifications[forget-1].version;
+    modifications.erase(modifications.begin(),
+                        modifications.begin() + forget);
+  }
+  modifications.push_back({version, begin, end});
+}
+
+bool Set::getModifiedRanges(unsigned long version,
+                            vector<pair<int,int>> *ranges) const {
+  if (version < firstLoggedVersion) {
+    return false;
+  }
+  for (const Modification &modification : modifications) {
+    if (modification.version > version) {
+      ranges->push_back({modification.begin, modification.end});
+    }
+  }
+  return true;
+}
+
+void Set::reserve(int size) {
+  if (size > capacity) {
+    setCapacity(size);
+  }
+}
+
+void Set::increaseCapacity(int size) {
+  if (size > capacity) {
+    setCapacity(std::max(size, 2*capacity));
+  }
+}
+
+void Set::setCapacity(int newCapacity) {
+  iassert(newCapacity >= numElements);
   for (auto f : fields) {
-    int typeSize = f->sizeOfType;
-    f->data = realloc(f->data, (capacity+capacityIncrement) * typeSize);
-    memset((char*)(f->data)+capacity*typeSize, 0, capacityIncrement*typeSize);
+    if (f->capacity >= newCapacity) {
+      continue;
+    }
+    size_t oldSize = f->bufferSize(f->capacity);
+    size_t newSize = f->bufferSize(newCapacity);
+    if (f->layout == SoA) {
+      // The arrays of the components move apart
+      size_t componentBytes = f->sizeOfType / f->type->getSize();
+      char* data = (char*)util::alignedCalloc(newSize, 1);
+      for (size_t i = 0; i < f->type->getSize(); ++i) {
+        memcpy(data + i*newCapacity*componentBytes,
+               (char*)f->data + i*f->capacity*componentBytes,
+               f->capacity*componentBytes);
+      }
+      if (f->ownsData) {
+        free(f->data);
+      }
+      f->data = data;
+      f->ownsData = true;
+    }
+    else {
+      if (f->ownsData) {
+        f->data = util::alignedRealloc(f->data, oldSize, newSize);
+      }
+      else {
+        void* data = util::alignedMalloc(newSize);
+        memcpy(data, f->data, oldSize);
+        f->data = data;
+        f->ownsData = true;
+      }
+      memset((char*)(f->data) + oldSize, 0, newSize - oldSize);
+    }
+    f->capacity = newCapacity;
 
     for (FieldRefBase *fieldRef : f->fieldReferences) {
       fieldRef->data = f->data;
     }
   }
-  capacity += capacityIncrement;
+  if (getCardinality() > 0) {
+    size_t endpointsSize = getCardinality() * sizeof(int);
+    if (snapshot != nullptr && snapshot->contains(endpoints)) {
+      int* data = (int*)util::alignedMalloc(newCapacity * endpointsSize);
+      memcpy(data, endpoints, min(capacity, newCapacity) * endpointsSize);
+      endpoints = data;
+    }
+    else {
+      endpoints = (int*)util::alignedRealloc(endpoints,
+                                             capacity * endpointsSize,
+                                             newCapacity * endpointsSize);
+    }
+  }
+  capacity = newCapacity;
+  releaseSnapshot();
+}
+
+void Set::addExternalField(FieldData *field, void *data, int capacity,
+                           Ownership ownership) {
+  uassert(data != nullptr) << "The buffer of field " << field->name
+                           << " is null";
+  uassert(capacity >= numElements)
+      << "The buffer of field " << field->name << " has room for " << capacity
+      << " elements, but the Set has " << numElements;
+  const char* begin = (const char*)data;
+  const char* end = begin + field->bufferSize(capacity);
+  for (const FieldData* other : fields) {
+    const char* otherBegin = (const char*)other->data;
+    const char* otherEnd = otherBegin + other->bufferSize(other->capacity);
+    uassert(begin == end || otherBegin == otherEnd ||
+            end <= otherBegin || otherEnd <= begin)
+        << "The buffer of field " << field->name
+        << " overlaps the buffer of field " << other->name;
+  }
+  field->data = data;
+  field->capacity = capacity;
+  field->ownsData = (ownership == Adopted);
+  fields.push_back(field);
+  fieldNames[field->name] = fields.size()-1;
+
+  // The Set grows before adding elements the buffer has no room for
+  this->capacity = std::min(this->capacity, capacity);
+}
+
+void Set::releaseSnapshot() {
+  if (snapshot == nullptr || snapshot->contains(endpoints)) {
+    return;
+  }
+  for (auto f : fields) {
+    if (snapshot->contains(f->data)) {
+      return;
+    }
+  }
+  munmap(snapshot->addr, snapshot->size);
+  delete snapshot;
+  snapshot = nullptr;
+}
+
+void Set::save(const std::string &filename, bool neighborIndex) const {
+  uassert(kind == Unstructured) << "Only unstructured sets can be saved";
+  for (const FieldData* field : fields) {
+    uassert(field->layout == AoS)
+        << "Field " << field->name << " can not be saved, since only fields "
+        << "with the AoS layout can be saved";
+  }
+  const int cardinality = getCardinality();
+
+  // Lay out the arrays of the snapshot, which are written in order
+  struct Array {
+    uint64_t offset;
+    const void* data;
+    uint64_t size;
+  };
+  vector<Array> arrays;
+  uint64_t size = 0;
+  const uint64_t alignment = max(snapshotAlignment, (uint64_t)kAlignment);
+  auto add = [&arrays, &size, alignment](const void* data, uint64_t bytes) {
+    uint64_t offset = (size + alignment-1) / alignment * alignment;
+    arrays.push_back({offset, data, bytes});
+    size = offset + bytes;
+    return offset;
+  };
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+  header.format = snapshotFormat;
+  header.byteOrder = snapshotByteOrder;
+  header.numElements = numElements;
+  header.cardinality = cardinality;
+  header.numFields = fields.size();
+  add(&header, sizeof(header));
+
+  vector<SnapshotField> table(fields.size());
+  vector<vector<uint32_t>> dimensions(fields.size());
+  header.fields = add(table.data(), table.size() * sizeof(SnapshotField));
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const FieldData* field = fields[i];
+    SnapshotField& entry = table[i];
+    for (size_t d = 0; d < field->type->getOrder(); ++d) {
+      dimensions[i].push_back(field->type->getDimension(d));
+    }
+    entry.name = add(field->name.data(), field->name.size());
+    entry.nameLength = field->name.size();
+    entry.componentType = (uint32_t)field->type->getComponentType();
+    entry.order = field->type->getOrder();
+    entry.dimensions = add(dimensions[i].data(),
+                           dimensions[i].size() * sizeof(uint32_t));
+    entry.data = add(field->data, (uint64_t)numElements * field->sizeOfType);
+  }
+  header.endpoints = add(endpoints,
+                         (uint64_t)numElements * cardinality * sizeof(int));
+
+  // The neighbor index is the path index of the endpoints that share an edge
+  pe::PathIndex index;
+  if (neighborIndex) {
+    uassert(cardinality > 0 && isHomogeneous())
+        << "Only edge sets with endpoints in one set have a neighbor index";
+    pe::Var u("u", pe::Set("V"));
+    pe::Var v("v", pe::Set("V"));
+    pe::Var e("e", pe::Set("E"));
+    pe::PathExpression ve = pe::Link::make(u, e, pe::Link::ve);
+    pe::PathExpression ev = pe::Link::make(e, v, pe::Link::ev);
+    pe::PathExpression vev = pe::And::make({u,v},
+                                           {{pe::QuantifiedVar::Exist,e}},
+                                           ve(u,e), ev(e,v));
+    pe::PathIndexBuilder builder;
+    builder.bind("V", getEndpointSet(0));
+    builder.bind("E", this);
+    index = builder.buildSegmented(vev, 0);
+    const pe::SegmentedPathIndex* segmented =
+        pe::to<pe::SegmentedPathIndex>(index);
+    header.neighborRows = segmented->numElements();
+    header.neighborCoords = add(segmented->getCoordData(),
+                                (header.neighborRows+1) * sizeof(uint32_t));
+    header.neighborSinks = add(segmented->getSinkData(),
+                               segmented->numNeighbors() * sizeof(uint32_t));
+  }
+
+  ofstream out(filename, ios::binary);
+  uassert(out.good()) << "Could not open " << filename;
+  const vector<char> padding(alignment);
+  uint64_t written = 0;
+  for (const Array& array : arrays) {
+    out.write(padding.data(), array.offset - written);
+    out.write((const char*)array.data, array.size);
+    written = array.offset + array.size;
+  }
+  uassert(out.good()) << "Could not write " << filename;
+}
+
+void Set::load(const std::string &filename) {
+  uassert(kind == Unstructured) << "Only unstructured sets can be loaded";
+  uassert(numElements == 0) << "Snapshots can only be loaded into empty sets";
+  releaseSnapshot();
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  uassert(fd != -1) << "Could not open " << filename;
+  struct stat status;
+  size_t fileSize = (fstat(fd, &status) == 0) ? status.st_size : 0;
+  uassert(fileSize >= sizeof(SnapshotHeader))
+      << filename << " is not a snapshot";
+
+  // Map the snapshot privately, so that the Set can modify the fields in place
+  // without writing to the file
+  void* addr = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+  close(fd);
+  uassert(addr != MAP_FAILED) << "Could not map " << filename;
+  char* base = (char*)addr;
+
+  // Returns the array at the offset, or null if it is empty
+  auto array = [&](uint64_t offset, uint64_t bytes) -> char* {
+    uassert(offset <= fileSize && bytes <= fileSize - offset)
+        << filename << " is not a valid snapshot";
+    return (bytes > 0) ? base + offset : nullptr;
+  };
+
+  // Returns the array at the offset like `array`, but copied to a buffer of its
+  // own if it is not aligned to Settings::alignment, which is the case if the
+  // snapshot was saved with a smaller alignment
+  auto alignedArray = [&](uint64_t offset, uint64_t bytes) -> char* {
+    char* data = array(offset, bytes);
+    if (data != nullptr && !util::isAligned(data)) {
+      char* copy = (char*)util::alignedMalloc(bytes);
+      memcpy(copy, data, bytes);
+      return copy;
+    }
+    return data;
+  };
+  auto isMapped = [&](const void* data) {
+    return data >= base && data < base + fileSize;
+  };
+
+  const SnapshotHeader* header = (const SnapshotHeader*)base;
+  uassert(memcmp(header->magic, snapshotMagic, sizeof(snapshotMagic)) == 0)
+      << filename << " is not a snapshot";
+  uassert(header->format == snapshotFormat &&
+          header->byteOrder == snapshotByteOrder)
+      << filename << " is a snapshot in an unsupported format or byte order";
+  uassert(header->cardinality == (uint32_t)getCardinality())
+      << filename << " holds elements with " << header->cardinality
+      << " endpoints, but the Set's elements have " << getCardinality();
+  uassert(header->numElements <= INT_MAX)
+      << filename << " holds too many elements";
+  const int count = header->numElements;
+  const int cardinality = getCardinality();
+
+  // Fields
+  const SnapshotField* table = (const SnapshotField*)array(
+      header->fields, header->numFields * sizeof(SnapshotField));
+  vector<bool> loaded(fields.size(), false);
+  for (uint32_t i = 0; i < header->numFields; ++i) {
+    const SnapshotField& entry = table[i];
+    string name(array(entry.name, entry.nameLength), entry.nameLength);
+    const uint32_t* dims = (const uint32_t*)array(
+        entry.dimensions, entry.order * sizeof(uint32_t));
+    ComponentType componentType = (ComponentType)entry.componentType;
+    vector<int> dimensions(dims, dims + entry.order);
+
+    FieldData* field;
+    if (fieldNames.find(name) != fieldNames.end()) {
+      field = fields[fieldNames.at(name)];
+      bool sameType = field->type->getComponentType() == componentType &&
+                      field->type->getOrder() == entry.order;
+      for (size_t d = 0; sameType && d < entry.order; ++d) {
+        sameType = field->type->getDimension(d) == (size_t)dimensions[d];
+      }
+      uassert(sameType) << "The type of field " << name << " in " << filename
+                        << " does not match the Set's";
+      uassert(field->layout == AoS)
+          << "Field " << name << " can not be loaded from " << filename
+          << ", since snapshots hold fields with the AoS layout";
+      loaded[fieldNames.at(name)] = true;
+    }
+    else {
+      field = new FieldData(name, new FieldData::TensorType(componentType,
+                                                            dimensions), this);
+      fields.push_back(field);
+      fieldNames[name] = fields.size()-1;
+      loaded.push_back(true);
+    }
+
+    if (field->ownsData) {
+      free(field->data);
+    }
+    field->data = alignedArray(entry.data,
+                               (uint64_t)count * field->sizeOfType);
+    field->capacity = count;
+    field->ownsData = !isMapped(field->data);
+  }
+
+  // Fields of the Set that are not in the snapshot are zeroed
+  for (size_t i = 0; i < fields.size(); ++i) {
+    FieldData* field = fields[i];
+    if (!loaded[i]) {
+      if (field->ownsData) {
+        free(field->data);
+      }
+      field->data = nullptr;
+    }
+    if (field->data == nullptr) {
+      field->data = util::alignedCalloc(field->bufferSize(count), 1);
+      field->capacity = count;
+      field->ownsData = true;
+    }
+    for (FieldRefBase *fieldRef : field->fieldReferences) {
+      fieldRef->data = field->data;
+    }
+  }
+
+  // Endpoints
+  if (cardinality > 0) {
+    int* data = (int*)alignedArray(header->endpoints,
+                                   (uint64_t)count * cardinality * sizeof(int));
+#ifdef SIMIT_ASSERTS
+    for (int i = 0; i < count; ++i) {
+      for (int j = 0; j < cardinality; ++j) {
+        int endpoint = data[i*cardinality + j];
+        uassert(endpoint >= 0 && endpoint < endpointSets[j]->getSize())
+            << "Invalid member of set in " << filename;
+      }
+    }
+#endif
+    if (data != nullptr) {
+      free(endpoints);
+      endpoints = data;
+    }
+  }
+
+  numElements = count;
+  capacity = count;
+  modified(0, count);
+
+  snapshot = new Snapshot;
+  snapshot->addr = base;
+  snapshot->size = fileSize;
+  snapshot->neighborCoords = nullptr;
+  snapshot->neighborSinks = nullptr;
+  snapshot->version = version;
+  snapshot->endpointVersion = 0;
+  if (header->neighborCoords != 0 && cardinality > 0 && isHomogeneous() &&
+      header->neighborRows == (uint64_t)getEndpointSet(0)->getSize()) {
+    const uint32_t* coords = (const uint32_t*)array(
+        header->neighborCoords, (header->neighborRows+1) * sizeof(uint32_t));
+    snapshot->neighborCoords = coords;
+    snapshot->neighborSinks = (const uint32_t*)array(
+        header->neighborSinks,
+        (uint64_t)coords[header->neighborRows] * sizeof(uint32_t));
+    snapshot->endpointVersion = getEndpointSet(0)->getVersion();
+  }
+  releaseSnapshot();
+}
+
+bool Set::getNeighborIndex(const uint32_t **coords,
+                           const uint32_t **sinks) const {
+  if (snapshot == nullptr || snapshot->neighborCoords == nullptr ||
+      version != snapshot->version ||
+      getEndpointSet(0)->getVersion() != snapshot->endpointVersion) {
+    return false;
+  }
+  *coords = snapshot->neighborCoords;
+  *sinks = snapshot->neighborSinks;
+  return true;
 }
 
 
@@ -67,6 +576,9 @@ Box createBox(Set *vertices, Set *edges,
               unsigned numX, unsigned numY, unsigned numZ) {
   uassert(numX >= 1 && numY >= 1 && numZ >= 1);
   vector<ElementRef> points(numX*numY*numZ);
+  vertices->reserve(vertices->getSize() + numX*numY*numZ);
+  edges->reserve(edges->getSize() + (numX-1)*numY*numZ +
+                 numX*(numY-1)*numZ + numX*numY*(numZ-1));
 
   for(unsigned x = 0; x < numX; ++x) {
     for(unsigned y = 0; y < numY; ++y) {
@@ -2,6 +2,7 @@
 #define SIMIT_GRAPH_H
 
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <vector>
 #include <string>
@@ -12,6 +13,7 @@
 #include "tensor_type.h"
 #include "error.h"
 #include "types.h"
+#include "util/memory.h"
 #include "util/variadic.h"
 #include "interfaces/comparable.h"
 
@@ -92,6 +94,32 @@ class Set {
 public:
   enum Kind {Unstructured, LatticeLink};
 
+  /// Who owns a buffer that the caller provides as the storage of a field.
+  enum Ownership {
+    /// The caller owns the buffer and frees it after the Set is destroyed. If
+    /// the Set outgrows the buffer, the field is copied to a buffer of its own.
+    Borrowed,
+    /// The Set owns the buffer, which must have been allocated with malloc,
+    /// and reallocs it when the Set outgrows it and frees it when it is
+    /// destroyed.
+    Adopted
+  };
+
+  /// How the tensors of a field's elements are laid out in its buffer. Saving
+  /// and reordering require AoS fields.
+  enum Layout {
+    /// Array of structures: the components of an element's tensor are stored
+    /// together, and the tensors follow each other in element order.
+    AoS,
+    /// Structure of arrays: each component is stored in an array of its own,
+    /// which holds the component of every element the Set has room for.
+    SoA,
+    /// Array of structures of arrays: the elements are grouped in blocks, and
+    /// each block is stored as a structure of arrays with one value per
+    /// element of the block.
+    AoSoA
+  };
+
   /// Construct a normal named set with no endpoints.
   Set(const std::string &name) : Set(name, Unstructured) {}
 
@@ -102,7 +130,8 @@ public:
     static_assert(util::areSame<Set, Sets...>{},
         "Set constructor takes an optional name followed by zero or more Sets");
     this->endpointSets = {&endpoints...};
-    this->endpoints    = (int*)calloc(sizeof(int), capacity * getCardinality());
+    this->endpoints    = (int*)util::alignedCalloc(sizeof(int),
+                                                   capacity*getCardinality());
   }
 
   /// Construct a named edge set with n endpoints.
@@ -127,7 +156,8 @@ public:
         << "Lattice link Set constructor must be passed an empty underlying "
         << "point set, which it will then proceed to initialize.";
     this->endpointSets = {&points, &points};
-    this->endpoints    = (int*)calloc(sizeof(int), capacity * getCardinality());
+    this->endpoints    = (int*)util::alignedCalloc(sizeof(int),
+                                                   capacity*getCardinality());
     this->dimensions = dims;
     this->latticePointSet = &points;
 
@@ -177,6 +207,24 @@ public:
   /// Return the number of elements in the Set
   inline int getSize() const { return numElements; }
 
+  /// Return the version of the Set's elements and endpoints, which changes
+  /// whenever they are modified. Versions are unique across all Sets, so a
+  /// version identifies both a Set and its state.
+  inline unsigned long getVersion() const { return version; }
+
+  /// Record that the current version was observed by something that will ask
+  /// for the ranges modified since it (see getModifiedRanges). Later additions
+  /// are then logged as a new range instead of extending the last one, which
+  /// would include elements that were added before the observed version.
+  inline void markVersionObserved() const { versionSeen = true; }
+
+  /// Get the ranges `[begin,end)` of elements that have been added, removed or
+  /// changed since the Set had the given version. Returns false if they are
+  /// not known, because the Set only remembers a bounded number of recent
+  /// modifications.
+  bool getModifiedRanges(unsigned long version,
+                         std::vector<std::pair<int,int>> *ranges) const;
+
   /// Returns the dimensions for a lattice link set
   inline const std::vector<int>& getDimensions() const {
     uassert(kind == LatticeLink)
@@ -253,14 +301,52 @@ public:
   /// Field<double,2,3> matrix = addField<double,2,3>("mat");
   template <typename T, int... dimensions>
   FieldRef<T, dimensions...> addField(const std::string &name) {
+    return addField<T, dimensions...>(name, AoS);
+  }
+
+  /// Add a tensor field whose tensors are laid out in its buffer as described
+  /// by `layout`. The blocks of the AoSoA layout hold `blockWidth` elements,
+  /// which must be a power of two. The SoA and AoSoA layouts let loops over
+  /// the elements load a component of consecutive elements at once, while the
+  /// AoS layout keeps the tensor of an element in one cache line. Compiled
+  /// functions only bind a Set whose fields have the layouts they were
+  /// compiled for (see Program::setFieldLayout), which is AoS by default.
+  template <typename T, int... dimensions>
+  FieldRef<T, dimensions...> addField(const std::string &name, Layout layout,
+                                      int blockWidth=8) {
+    uassert(layout != AoSoA || (blockWidth > 0 &&
+                                (blockWidth & (blockWidth-1)) == 0))
+        << "The block width of field " << name << " must be a power of two";
     FieldData::TensorType *type =
         new FieldData::TensorType(typeOf<T>(), {dimensions...});
     FieldData *fieldData = new FieldData(name, type, this);
-    fieldData->data = calloc(capacity, fieldData->sizeOfType);
+    fieldData->layout = layout;
+    fieldData->blockWidth = (layout == AoSoA) ? blockWidth : 1;
+    fieldData->data = util::alignedCalloc(fieldData->bufferSize(capacity), 1);
+    fieldData->capacity = capacity;
     fields.push_back(fieldData);
     fieldNames[name] = fields.size()-1;
     return FieldRef<T, dimensions...>(fieldData);
   }
+
+  /// Add a tensor field whose values are stored in the caller's buffer `data`,
+  /// which has room for the values of `capacity` elements. The values of the
+  /// Set's elements are the first values in the buffer, and elements that are
+  /// added while they fit take the values that follow, so the field is read
+  /// and written in place without copies. The buffer must have room for the
+  /// Set's elements, and the Set does not grow beyond `capacity` without
+  /// reallocating the field, as described by `ownership`. The buffer must not
+  /// overlap the buffers of the other fields, since functions assume that
+  /// fields with different names do not alias.
+  template <typename T, int... dimensions>
+  FieldRef<T, dimensions...> addField(const std::string &name, T* data,
+                                      int capacity, Ownership ownership) {
+    FieldData::TensorType *type =
+        new FieldData::TensorType(typeOf<T>(), {dimensions...});
+    FieldData *fieldData = new FieldData(name, type, this);
+    addExternalField(fieldData, data, capacity, ownership);
+    return FieldRef<T, dimensions...>(fieldData);
+  }
  
   // Added for reordering
   void setSpatialField(const std::string& name) {
@@ -293,18 +379,55 @@ public:
   ElementRef add(Endpoints... endpoints) {
     iassert(sizeof...(endpoints) == getCardinality()) <<"Wrong number of \
       endpoints.";
-    if (numElements > capacity-1) {
-      increaseEdgeCapacity();
+    if (numElements == capacity) {
+      increaseCapacity(numElements+1);
     }
     addEndpoints(0, endpoints...);
-
-    if (numElements > capacity-1) {
-      increaseCapacity();
-    }
+    modified(numElements, numElements+1);
     return ElementRef(numElements++);
   }
 
-  /// Remove an element from the Set
+  /// Add `count` elements with zero-initialized fields, returning the handle
+  /// of the first. The elements are numbered consecutively. Fields stored in
+  /// the caller's buffers that have room for the elements are not zeroed.
+  ElementRef addElements(int count);
+
+  /// Add `count` edges, returning the handle of the first. The endpoints of
+  /// edge `i` are `endpoints[i*getCardinality()]` to
+  /// `endpoints[(i+1)*getCardinality()-1]`, and are the idents of elements of
+  /// the respective endpoint sets. The edges are numbered consecutively.
+  ElementRef addEdges(const int* endpoints, int count);
+
+  /// Make room for at least `size` elements, so that adding elements up to
+  /// that size does not reallocate the fields.
+  void reserve(int size);
+
+  /// Return the number of elements the Set has room for.
+  inline int getCapacity() const { return capacity; }
+
+  /// Write the elements, endpoints and fields of the Set to a binary snapshot
+  /// file, which `load` maps into memory. If `neighborIndex` is true, the
+  /// snapshot of an edge set whose endpoints are in one set also holds the
+  /// index of the endpoints that are connected through its edges, which is
+  /// the index of matrices assembled by maps over the set.
+  void save(const std::string &filename, bool neighborIndex=false) const;
+
+  /// Load an empty Set from a snapshot written by `save`. The snapshot is
+  /// mapped into memory and its fields and endpoints are used in place, and
+  /// copied when the Set grows. The endpoint sets of an edge set must be
+  /// loaded first. Fields that are not in the snapshot are added, and fields
+  /// of the Set that are not in the snapshot are zeroed. Fields of the Set
+  /// that are in the snapshot must have the AoS layout.
+  void load(const std::string &filename);
+
+  /// Get the neighbor index that was loaded with the Set, where
+  /// `coords[i]:coords[i+1]` are the locations in `sinks` of the endpoints
+  /// connected to endpoint `i`. Returns false if the Set has no neighbor
+  /// index, or if it or its endpoint set was modified since it was loaded.
+  bool getNeighborIndex(const uint32_t **coords,
+                        const uint32_t **sinks) const;
+
+  /// Remove an element from the Set, by moving the last element in its place
   void remove(ElementRef element) {
     uassert(kind != LatticeLink)
         << "Element removal disallowed for lattice link edge sets";
@@ -342,6 +465,13 @@ public:
         }
       }
     }
+    int cardinality = getCardinality();
+    for (int i = 0; i < cardinality; ++i) {
+      endpoints[element.ident*cardinality + i] =
+          endpoints[(numElements-1)*cardinality + i];
+    }
+    modified(element.ident, element.ident+1);
+    modified(numElements-1, numElements);
     numElements--;
   }
 
@@ -523,8 +653,40 @@ public:
     return fields[fieldNames.at(fieldName)]->data;
   }
 
+  /// Get the size in bytes of the buffer of a field.
+  size_t getFieldBufferSize(const std::string &fieldName) const {
+    uassert(fieldNames.find(fieldName) != fieldNames.end())
+        << "The Set has no field " << fieldName;
+    const FieldData *field = fields[fieldNames.at(fieldName)];
+    return field->bufferSize(field->capacity);
+  }
+
+  /// Get the layout of the tensors in the buffer of a field (see addField).
+  Layout getFieldLayout(const std::string &fieldName) const {
+    uassert(fieldNames.find(fieldName) != fieldNames.end())
+        << "The Set has no field " << fieldName;
+    return fields[fieldNames.at(fieldName)]->layout;
+  }
+
+  /// Get the distance between consecutive components of an element's tensor
+  /// in the buffer of a field, counted in components.
+  int getFieldComponentStride(const std::string &fieldName) const {
+    uassert(fieldNames.find(fieldName) != fieldNames.end())
+        << "The Set has no field " << fieldName;
+    return (int)fields[fieldNames.at(fieldName)]->componentStride();
+  }
+
+  /// Get the number of elements in the blocks of a field, which is 1 unless
+  /// the field has the AoSoA layout.
+  int getFieldBlockWidth(const std::string &fieldName) const {
+    uassert(fieldNames.find(fieldName) != fieldNames.end())
+        << "The Set has no field " << fieldName;
+    return fields[fieldNames.at(fieldName)]->blockWidth;
+  }
+
   /// Get an array containing, for each edge in a set, the elements it connects.
   int *getEndpointsData() { return endpoints; }
+  const int *getEndpointsData() const { return endpoints; }
 
   void setName(const std::string &name) { this->name = name; }
   std::string getName() const { return name; }
@@ -565,12 +727,15 @@ public:
     };
 
     FieldData(const std::string &name, const TensorType *type, Set *set)
-        : name(name), type(type), set(set), data(nullptr) {
+        : name(name), type(type), set(set), data(nullptr), capacity(0),
+        ownsData(true), layout(AoS), blockWidth(1) {
       sizeOfType = componentSize(type->getComponentType()) * type->getSize();
     }
 
     ~FieldData() {
-      free(data);
+      if (ownsData) {
+        free(data);
+      }
       delete type;
     }
 
@@ -585,6 +750,48 @@ public:
     /// Buffer for the field data
     void* data;
 
+    /// Number of elements the buffer has room for, which is at least the
+    /// capacity of the Set.
+    int capacity;
+
+    /// False if the buffer belongs to a mapped snapshot or to the caller, in
+    /// which case it is copied before it is reallocated and is not freed.
+    bool ownsData;
+
+    /// Layout of the tensors in the buffer, and the number of elements in the
+    /// blocks of the AoSoA layout.
+    Layout layout;
+    int blockWidth;
+
+    /// Size in bytes of a buffer with room for `capacity` elements, which the
+    /// AoSoA layout rounds up to whole blocks.
+    size_t bufferSize(int capacity) const {
+      size_t elements = (capacity + blockWidth-1) & ~(blockWidth-1);
+      return elements * sizeOfType;
+    }
+
+    /// Position of the first component of element `i`'s tensor in the buffer,
+    /// counted in components.
+    size_t elementOffset(int i) const {
+      switch (layout) {
+        case AoS:
+          return (size_t)i * type->getSize();
+        case SoA:
+          return i;
+        case AoSoA:
+          return (size_t)(i & ~(blockWidth-1)) * type->getSize() +
+                 (i & (blockWidth-1));
+      }
+      unreachable;
+      return 0;
+    }
+
+    /// Distance between consecutive components of an element's tensor in the
+    /// buffer, counted in components.
+    size_t componentStride() const {
+      return (layout == SoA) ? capacity : (layout == AoSoA) ? blockWidth : 1;
+    }
+
     /// Field references so that we can update their data pointers if we realloc
     /// field data. Avoids two loads on field get/set.
     std::set<FieldRefBase*> fieldReferences;
@@ -595,8 +802,12 @@ public:
     FieldData& operator=(const FieldData& f);
   };
 
-  // Added getters for reordering
-  inline int* getEndpointsPtr() { return endpoints; }
+  // Added getters for reordering. The caller may rewrite the endpoints, so the
+  // set counts as modified.
+  inline int* getEndpointsPtr() {
+    modified(0, numElements);
+    return endpoints;
+  }
   inline int getFieldIndex(std::string name) { return fieldNames[name]; } inline 
     std::vector<FieldData*>& getFields() { return fields; } inline std::string 
     getSpatialFieldName() const { return spatialFieldName; }
@@ -608,7 +819,9 @@ private:
   Set(const std::string &name, Kind kind)
       : kind(kind), name(name), numElements(0), endpoints(nullptr),
         latticePoints(nullptr), latticeLinks(nullptr),
-        capacity(capacityIncrement), neighbors(nullptr) {}
+        capacity(initialCapacity), neighbors(nullptr),
+        version(newVersion()), versionSeen(false),
+        firstLoggedVersion(version), snapshot(nullptr) {}
 
   // Set data
   Kind kind;
@@ -625,17 +838,50 @@ private:
   ElementRef* latticeLinks;                  // ordered refs to lattice links
 
   int capacity;                              // current capacity of the set
-  static const int capacityIncrement = 1024; // increment for capacity increases
+  static const int initialCapacity = 1024;   // capacity of new sets
 
   mutable internal::NeighborIndex *neighbors;// neighbor index (lazily created)
   std::map<std::string, int> fieldNames;     // name to field lookups
   std::vector<FieldData*> fields;            // fields of elements in the set
+  unsigned long version;                     // version of elements/endpoints
+  mutable bool versionSeen;                  // see markVersionObserved
+
+  /// A range of elements that was modified, which gave the Set `version`.
+  struct Modification {
+    unsigned long version;
+    int begin;
+    int end;
+  };
+  static const size_t maxModifications = 1024;
+  std::vector<Modification> modifications;   // modifications since the
+  unsigned long firstLoggedVersion;          // Set had firstLoggedVersion
+
+  struct Snapshot;
+  Snapshot *snapshot;                        // mapped snapshot (see load)
 
   /// disable copy
   Set& operator=(const Set& s);
 
-  /// increase capacity of all fields
-  void increaseCapacity();
+  /// Grow the capacity geometrically to at least `size` elements.
+  void increaseCapacity(int size);
+
+  /// Reallocate the fields and endpoints to hold `newCapacity` elements.
+  /// Fields whose buffers already have room for them are left in place.
+  void setCapacity(int newCapacity);
+
+  /// Add a field stored in a buffer provided by the caller.
+  void addExternalField(FieldData *field, void *data, int capacity,
+                        Ownership ownership);
+
+  /// Unmap the snapshot once no field or endpoints are in it.
+  void releaseSnapshot();
+
+  /// Return a version that no Set has had before.
+  static unsigned long newVersion();
+
+  /// Give the Set a new version, and record that the elements in
+  /// `[begin,end)` were modified.
+  void modified(int begin, int end);
 
   /// helpers for constructing endpoint sets
   template <typename F, typename ...T> std::vector<const Set*>
@@ -651,11 +897,6 @@ private:
   std::vector<const Set*>
   epsMaker(std::vector<const Set*> sofar) {return sofar;}
 
-  void increaseEdgeCapacity() {
-    size_t newSize = (capacity+capacityIncrement)*getCardinality()*sizeof(int);
-    endpoints = (int*)realloc(endpoints, newSize);
-  }
-
   // helper for adding edges
   template <typename F, typename ...T>
   void addEndpoints(int which, F f, T ... eps) {
@@ -701,7 +942,8 @@ private:
       FieldData::TensorType *type =
           new FieldData::TensorType(ctype, dims);
       FieldData *fieldData = new FieldData(field.name, type, this);
-      fieldData->data = calloc(capacity, fieldData->sizeOfType);
+      fieldData->data = util::alignedCalloc(capacity, fieldData->sizeOfType);
+      fieldData->capacity = capacity;
       fields.push_back(fieldData);
       fieldNames[field.name] = fields.size()-1;
     }
@@ -787,7 +1029,9 @@ public:
 
   // Return the field's data.  The data is a contigues sequence containing the
   // tensor of each element in no particular order.  The tensors are currently
-  // laid out in row-major order, but this may change in the future.
+  // laid out in row-major order, but this may change in the future.  The
+  // components of the tensors are interleaved unless the field has the AoS
+  // layout (see Set::addField).
   inline void *getData() {
     return static_cast<void*>(data);
   }
@@ -800,9 +1044,13 @@ protected:
   }
 
   template <typename T>
-  inline T *getElemDataPtr(ElementRef element, size_t elementFieldSize) const {
+  inline T *getElemDataPtr(ElementRef element) const {
     iassert(sizeof(T) == componentSize(fieldData->type->getComponentType()));
-    return &static_cast<T*>(data)[element.ident * elementFieldSize];
+    return &static_cast<T*>(data)[fieldData->elementOffset(element.ident)];
+  }
+
+  inline size_t getComponentStride() const {
+    return fieldData->componentStride();
   }
 
   Set::FieldData *fieldData;
@@ -817,11 +1065,13 @@ template <typename T, int... dimensions>
 class FieldRefBaseParameterized : public FieldRefBase {
  public:
   TensorRef<T, dimensions...> get(ElementRef element) {
-    return TensorRef<T, dimensions...>(getElemDataPtr(element));
+    return TensorRef<T, dimensions...>(getElemDataPtr(element),
+                                       this->getComponentStride());
   }
 
   const TensorRef<T, dimensions...> get(ElementRef element) const {
-    return TensorRef<T, dimensions...>(getElemDataPtr(element));
+    return TensorRef<T, dimensions...>(getElemDataPtr(element),
+                                       this->getComponentStride());
   }
 
   TensorRef<T, dimensions...> operator()(ElementRef element) {
@@ -836,9 +1086,10 @@ class FieldRefBaseParameterized : public FieldRefBase {
     iassert(values.size() == (TensorRef<T,dimensions...>::getSize()))
         << "Incorrect number of init values";
     T *elemData = this->getElemDataPtr(element);
+    size_t stride = this->getComponentStride();
     size_t i=0;
     for (T val : values) {
-      elemData[i++] = val;
+      elemData[stride * i++] = val;
     }
   }
 
@@ -848,16 +1099,16 @@ class FieldRefBaseParameterized : public FieldRefBase {
         << "Incorrect number of init values : " << 
         (TensorRef<T,dimensions...>::getSize());
     T *elemData = this->getElemDataPtr(element);
+    size_t stride = this->getComponentStride();
     size_t i=0;
     for (T val : values) {
-      elemData[i++] = val;
+      elemData[stride * i++] = val;
     }
   }
 
  protected:
   inline T *getElemDataPtr(ElementRef element) const {
-    size_t elementFieldSize = TensorRef<T,dimensions...>::getSize();
-    return FieldRefBase::getElemDataPtr<T>(element, elementFieldSize);
+    return FieldRefBase::getElemDataPtr<T>(element);
   }
 
   FieldRefBaseParameterized(void *fieldData) : FieldRefBase(fieldData) {}
@@ -947,7 +1198,7 @@ public:
     iassert(vals.size() == util::product<Dimensions...>::value);
     size_t i=0;
     for (ComponentType val : vals) {
-      data[i++] = val;
+      data[stride * i++] = val;
     }
     return *this;
   }
@@ -956,14 +1207,16 @@ public:
   inline ComponentType& operator()(Indices... index) {
     static_assert(sizeof...(index) == sizeof...(Dimensions),
                   "Incorrect number of indices used to index tensor");
-    return data[util::computeOffset(util::seq<Dimensions...>(), index...)];
+    return data[stride *
+                util::computeOffset(util::seq<Dimensions...>(), index...)];
   }
 
   template <typename... Indices> inline
   const ComponentType& operator()(Indices... index) const {
     static_assert(sizeof...(index) == sizeof...(Dimensions),
                   "Incorrect number of indices used to index tensor");
-    return data[util::computeOffset(util::seq<Dimensions...>(), index...)];
+    return data[stride *
+                util::computeOffset(util::seq<Dimensions...>(), index...)];
   }
 
   friend bool operator==(const TensorRef& l, const TensorRef& r){
@@ -975,8 +1228,10 @@ public:
   }
 
 private:
-  inline TensorRef(ComponentType *data) : data(data) {}
+  inline TensorRef(ComponentType *data, size_t stride=1)
+      : data(data), stride(stride) {}
   ComponentType *data;
+  size_t stride;  // distance between consecutive components
 
   friend class FieldRefBaseParameterized<ComponentType, Dimensions...>;
 };
@@ -1013,7 +1268,7 @@ public:
   }
 
 private:
-  inline TensorRef(ComponentType *data) : data(data) {}
+  inline TensorRef(ComponentType *data, size_t stride=1) : data(data) {}
   ComponentType* data;
 
   friend class FieldRefBaseParameterized<ComponentType>;
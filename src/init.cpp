@@ -2,4 +2,22 @@
 
 namespace simit {
 bool kIndexlessStencils;
+int kThreads = 1;
+const std::vector<std::string> VALID_REDUCTIONS = {
+  "auto", "coloring", "privatization", "atomics"
+};
+std::string kReduction = "auto";
+std::string kCacheDir;
+#ifdef SIMIT_DEBUG
+int kOptLevel = 0;
+#else
+int kOptLevel = 3;
+#endif
+std::string kCPU = "native";
+std::string kCPUFeatures;
+bool kFastMath = false;
+size_t kArenaLimit = 256 << 20;
+size_t kAlignment = 64;
+bool kHugePages = false;
+int kNumaNode = -1;
 }
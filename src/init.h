@@ -7,19 +7,74 @@
 #include "error.h"
 #include "ir.h"
 #include "program.h"
+#include "util/thread_pool.h"
 
 namespace simit {
 
 extern const std::vector<std::string> VALID_BACKENDS;
 extern std::string kBackend;
 extern bool kIndexlessStencils;
+extern int kThreads;
+extern const std::vector<std::string> VALID_REDUCTIONS;
+extern std::string kReduction;
+extern std::string kCacheDir;
+extern int kOptLevel;
+extern std::string kCPU;
+extern std::string kCPUFeatures;
+extern bool kFastMath;
+extern size_t kArenaLimit;
+extern size_t kAlignment;
+extern bool kHugePages;
+extern int kNumaNode;
 
 // Settings struct with default values
 struct Settings {
   std::string backend="cpu";
   int floatSize = 8;
   bool indexlessStencils = false;
+  int threads = 1;  // Number of threads used to execute parallel loops (cpu)
+  // How parallel loops accumulate into shared locations: auto, coloring,
+  // privatization or atomics (cpu)
+  std::string reduction = "auto";
+  // Directory where compiled functions are cached across runs, or empty to
+  // disable the cache (cpu)
+  std::string cacheDir = "";
+  // Optimization level of generated code, from 0 to 3. Debug builds do not
+  // optimize generated code by default, so that it stays debuggable (cpu)
+#ifdef SIMIT_DEBUG
+  int optLevel = 0;
+#else
+  int optLevel = 3;
+#endif
+  // Target CPU of generated code, e.g. haswell, or native for the host (cpu)
+  std::string cpu = "native";
+  // Target features to enable or disable, e.g. "+avx2,-avx512f". The features
+  // of the host are used by default when the target CPU is native (cpu)
+  std::string features = "";
+  // Allow floating-point reassociation and fused multiply-add contraction,
+  // which may change results in the last bits (cpu)
+  bool fastMath = false;
+  // Bytes of freed temporaries that a function keeps to reuse in later runs.
+  // Temporaries beyond the limit are returned to the system (cpu)
+  size_t arenaLimit = 256 << 20;
+  // Alignment in bytes of the field, endpoint, path index and temporary buffers
+  // that are allocated after init (cpu)
+  size_t alignment = 64;
+  // Back buffers of 2MB or more with transparent huge pages (cpu)
+  bool hugePages = false;
+  // NUMA node that the pages of buffers are preferably placed on, or -1 to
+  // place them on the node of the thread that first touches them (cpu)
+  int numaNode = -1;
+};
+
+/// Statistics of the compiled function cache: hits are functions whose object
+/// code was loaded from the cache, and misses are functions that were compiled
+/// and added to it.
+struct ObjectCacheStats {
+  unsigned hits = 0;
+  unsigned misses = 0;
 };
+ObjectCacheStats getObjectCacheStats();
 
 inline void init(const Settings& settings) {
   // backend
@@ -36,6 +91,42 @@ inline void init(const Settings& settings) {
 
   // indexlessStencils
   kIndexlessStencils = settings.indexlessStencils;
+
+  // threads
+  uassert(settings.threads >= 1)
+      << "Invalid number of threads: " << settings.threads;
+  kThreads = settings.threads;
+  util::ThreadPool::getInstance().setNumThreads(settings.threads);
+
+  // reduction
+  uassert(std::find(VALID_REDUCTIONS.begin(), VALID_REDUCTIONS.end(),
+                    settings.reduction) != VALID_REDUCTIONS.end())
+      << "Invalid reduction: " << settings.reduction;
+  kReduction = settings.reduction;
+
+  // cacheDir
+  kCacheDir = settings.cacheDir;
+
+  // code generation
+  uassert(settings.optLevel >= 0 && settings.optLevel <= 3)
+      << "Invalid optimization level: " << settings.optLevel;
+  kOptLevel = settings.optLevel;
+  kCPU = settings.cpu;
+  kCPUFeatures = settings.features;
+  kFastMath = settings.fastMath;
+
+  // arenaLimit
+  kArenaLimit = settings.arenaLimit;
+
+  // allocation policy
+  uassert(settings.alignment >= sizeof(void*) &&
+          (settings.alignment & (settings.alignment-1)) == 0)
+      << "Invalid alignment: " << settings.alignment;
+  kAlignment = settings.alignment;
+  kHugePages = settings.hugePages;
+  uassert(settings.numaNode >= -1 && settings.numaNode < 64)
+      << "Invalid NUMA node: " << settings.numaNode;
+  kNumaNode = settings.numaNode;
 }
 
 inline void init(std::string backend="cpu", int floatSize=8) {
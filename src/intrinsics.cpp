@@ -417,6 +417,38 @@ const Func& lltmatsolve() {
   return lltmatsolveVar;
 }
 
+static Func cgVar;
+void cgInit() {
+  cgVar = Func("cg",
+               {Var("A", Type()), Var("b", Type()), Var("x0", Type()),
+                Var("tol", Float), Var("maxiters", Int)},
+               {Var("x", Type()), Var("iterations", Int),
+                Var("residual", Float)},
+               Func::External);
+}
+const Func& cg() {
+  if (!cgVar.defined()) {
+    cgInit();
+  }
+  return cgVar;
+}
+
+static Func pcgVar;
+void pcgInit() {
+  pcgVar = Func("pcg",
+                {Var("A", Type()), Var("b", Type()), Var("x0", Type()),
+                 Var("tol", Float), Var("maxiters", Int)},
+                {Var("x", Type()), Var("iterations", Int),
+                 Var("residual", Float)},
+                Func::External);
+}
+const Func& pcg() {
+  if (!pcgVar.defined()) {
+    pcgInit();
+  }
+  return pcgVar;
+}
+
 static Func strcmpVar;
 void strcmpInit() {
   strcmpVar = Func("strcmp",
@@ -543,6 +575,34 @@ const Func& loc() {
   return locVar;
 }
 
+static Func spmvVar;
+void spmvInit() {
+  spmvVar = Func("__spmv",
+                 {Var("A", Type()), Var("x", Type()), Var("y", Type())},
+                 {},
+                 Func::Intrinsic);
+}
+const Func& spmv() {
+  if (!spmvVar.defined()) {
+    spmvInit();
+  }
+  return spmvVar;
+}
+
+static Func spmvtVar;
+void spmvtInit() {
+  spmvtVar = Func("__spmvt",
+                  {Var("A", Type()), Var("x", Type()), Var("y", Type())},
+                  {},
+                  Func::Intrinsic);
+}
+const Func& spmvt() {
+  if (!spmvtVar.defined()) {
+    spmvtInit();
+  }
+  return spmvtVar;
+}
+
 
 const std::map<std::string,Func> &byNames() {
   static std::map<std::string,Func> byNameMap;
@@ -576,6 +636,8 @@ const std::map<std::string,Func> &byNames() {
     cholfreeInit();
     lltsolveInit();
     lltmatsolveInit();
+    cgInit();
+    pcgInit();
     strcmpInit();
     strlenInit();
     strcpyInit();
@@ -585,6 +647,8 @@ const std::map<std::string,Func> &byNames() {
     mallocInit();
     freeInit();
     locInit();
+    spmvInit();
+    spmvtInit();
     byNameMap.insert({{"mod",modVar},
                       {"sin",sinVar},
                       {"cos",cosVar},
@@ -614,6 +678,8 @@ const std::map<std::string,Func> &byNames() {
                       {"cholfree", cholfreeVar},
                       {"lltsolve", lltsolveVar},
                       {"lltmatsolve", lltmatsolveVar},
+                      {"cg", cgVar},
+                      {"pcg", pcgVar},
                       {"strcmp", strcmpVar},
                       {"strlen", strlenVar},
                       {"strcpy", strcpyVar},
@@ -622,7 +688,9 @@ const std::map<std::string,Func> &byNames() {
                       {"storeTime",storeTimeVar},
                       {"malloc", mallocVar},
                       {"free", freeVar},
-                      {"__loc", locVar}});
+                      {"__loc", locVar},
+                      {"__spmv", spmvVar},
+                      {"__spmvt", spmvtVar}});
   }
   return byNameMap;
 }
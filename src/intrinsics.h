@@ -50,6 +50,8 @@ const Func& chol();
 const Func& cholfree();
 const Func& lltsolve();
 const Func& lltmatsolve();
+const Func& cg();
+const Func& pcg();
 
 // String manipulation
 const Func& strcmp();
@@ -65,6 +67,8 @@ const Func& storeTime();
 const Func& malloc();
 const Func& free();
 const Func& loc();
+const Func& spmv();
+const Func& spmvt();
 
 const std::map<std::string,Func> &byNames();
 
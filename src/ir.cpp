@@ -187,6 +187,9 @@ void Literal::cast(Type type) {
   iassert(type.toTensor()->getComponentType() ==
           this->type.toTensor()->getComponentType());
   iassert(type.toTensor()->size() == this->type.toTensor()->size());
+  iassert(type.toTensor()->getComponentType().bytes() ==
+          this->type.toTensor()->getComponentType().bytes())
+      << "casts between storage precisions are not supported";
   this->type = type;
 }
 
@@ -196,8 +199,16 @@ int Literal::getIntVal(int index) const {
   return ((int*)data)[index];
 }
 
+// True if the float components of tensors of the type are stored as floats,
+// which may differ from the global float precision (see ScalarType)
+static bool singleFloatStorage(const Type& type) {
+  const ScalarType ctype = type.toTensor()->getComponentType();
+  return ctype.isFloat() ? (ctype.bytes() == sizeof(float))
+                         : ScalarType::singleFloat();
+}
+
 double Literal::getFloatVal(int index) const {
-  if (ScalarType::singleFloat()) {
+  if (singleFloatStorage(type)) {
     return ((float*)data)[index];
   }
   else {
@@ -313,12 +324,10 @@ Expr Literal::make(Type type, void* values, size_t bufSize) {
         util::zero<int>(node->data, size);
         break;
       case ir::ScalarType::Float:
-        if (ir::ScalarType::singleFloat()) {
-          iassert(ir::ScalarType::floatBytes == sizeof(float));
+        if (singleFloatStorage(type)) {
           util::zero<float>(node->data, size);
         }
         else {
-          iassert(ir::ScalarType::floatBytes == sizeof(double));
           util::zero<double>(node->data, size);
         }
         break;
@@ -347,7 +356,7 @@ Expr Literal::make(Type type, std::vector<double> values) {
   iassert(type.toTensor()->getComponentType().isFloat() || 
           type.toTensor()->getComponentType().isComplex())
       << "Float array constructor must use float or complex component type";
-  if (ScalarType::singleFloat()) {
+  if (singleFloatStorage(type)) {
     // Convert double vector to float vector
     std::vector<float> floatValues;
     for (double val : values) {
@@ -398,16 +407,26 @@ bool operator==(const Literal& l, const Literal& r) {
     return false;
   }
 
-  iassert(getTensorByteSize(l.type.toTensor()) ==
-          getTensorByteSize(r.type.toTensor()));
-
   size_t size = l.type.toTensor()->size();
+
+  // Literals with different storage precisions are compared by value
+  if (getTensorByteSize(l.type.toTensor()) !=
+      getTensorByteSize(r.type.toTensor())) {
+    iassert(l.type.toTensor()->getComponentType().isFloat());
+    for (size_t i = 0; i < size; ++i) {
+      if (l.getFloatVal(i) != r.getFloatVal(i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   switch (l.type.toTensor()->getComponentType().kind) {
     case ir::ScalarType::Int: {
       return util::compare<int>(l.data, r.data, size);
     }
     case ir::ScalarType::Float: {
-      if (ir::ScalarType::singleFloat()) {
+      if (singleFloatStorage(l.type)) {
         return util::compare<float>(l.data, r.data, size);
       }
       else {
@@ -459,7 +478,7 @@ Expr Load::make(Expr buffer, Expr index) {
                         ? buffer.type().toTensor()->getComponentType()
                         : buffer.type().toArray()->elementType;
 
-  node->type = TensorType::make(loadType);
+  node->type = TensorType::make(ScalarType(loadType.kind));
   node->buffer = buffer;
   node->index = index;
   return node;
@@ -508,12 +527,20 @@ Expr IndexRead::make(Expr edgeSet, Kind kind, int index) {
   return node;
 }
 
+// The type of the values computed from a scalar, which have the global float
+// precision regardless of the storage precision of the scalar
+static Type computeType(const Type& type) {
+  const ScalarType ctype = type.toTensor()->getComponentType();
+  return ctype.hasStoragePrecision() ? TensorType::make(ScalarType(ctype.kind))
+                                     : type;
+}
+
 // struct Neg
 Expr Neg::make(Expr a) {
   iassert_scalar(a);
 
   Neg *node = new Neg;
-  node->type = a.type();
+  node->type = computeType(a.type());
   node->a = a;
   return node;
 }
@@ -524,7 +551,7 @@ Expr Add::make(Expr a, Expr b) {
   iassert_types_equal(a,b);
 
   Add *node = new Add;
-  node->type = a.type();
+  node->type = computeType(a.type());
   node->a = a;
   node->b = b;
   return node;
@@ -536,7 +563,7 @@ Expr Sub::make(Expr a, Expr b) {
   iassert_types_equal(a,b);
 
   Sub *node = new Sub;
-  node->type = a.type();
+  node->type = computeType(a.type());
   node->a = a;
   node->b = b;
   return node;
@@ -548,7 +575,7 @@ Expr Mul::make(Expr a, Expr b) {
   iassert_types_equal(a,b);
 
   Mul *node = new Mul;
-  node->type = a.type();
+  node->type = computeType(a.type());
   node->a = a;
   node->b = b;
   return node;
@@ -560,7 +587,7 @@ Expr Div::make(Expr a, Expr b) {
   iassert_types_equal(a,b);
 
   Div *node = new Div;
-  node->type = a.type();
+  node->type = computeType(a.type());
   node->a = a;
   node->b = b;
   return node;
@@ -796,11 +823,12 @@ Stmt ForRange::make(Var var, Expr start, Expr end, Stmt body) {
 }
 
 // struct For
-Stmt For::make(Var var, ForDomain domain, Stmt body) {
+Stmt For::make(Var var, ForDomain domain, Stmt body, Kind kind) {
   For *node = new For;
   node->var = var;
   node->domain = domain;
   node->body = Scope::make(body);
+  node->kind = kind;
   return Scope::make(node);  // Put loop variable in a scope
 }
 
@@ -960,7 +988,8 @@ Expr IndexedTensor::make(Expr tensor, std::vector<IndexVar> indexVars) {
 #endif
 
   IndexedTensor *node = new IndexedTensor;
-  node->type = TensorType::make(tensor.type().toTensor()->getComponentType());
+  node->type = computeType(
+      TensorType::make(tensor.type().toTensor()->getComponentType()));
   node->tensor = tensor;
   node->indexVars = indexVars;
   return node;
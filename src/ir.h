@@ -415,10 +415,18 @@ std::ostream &operator<<(std::ostream &os, const ForDomain &);
 
 // TODO DEPRECATED: Remove when new index system is in place.
 struct For : public StmtNode {
+  /// Serial loops execute their iterations in order. The iterations of
+  /// parallel loops are independent and may execute concurrently. Colored
+  /// loops iterate over edge sets, and their iterations only conflict through
+  /// commutative updates to their endpoints' locations. Their iterations may
+  /// execute concurrently with the iterations of edges that share no endpoint.
+  enum Kind {Serial, Parallel, Colored};
+
   Var var;
   ForDomain domain;
   Stmt body;
-  static Stmt make(Var var, ForDomain domain, Stmt body);
+  Kind kind;
+  static Stmt make(Var var, ForDomain domain, Stmt body, Kind kind=Serial);
   void accept(IRVisitorStrict *v) const {v->visit((const For*)this);}
 };
 
@@ -428,6 +428,16 @@ void IRPrinter::visit(const ForRange *op) {
 
 void IRPrinter::visit(const For *op) {
   indent();
+  switch (op->kind) {
+    case For::Serial:
+      break;
+    case For::Parallel:
+      os << "parallel ";
+      break;
+    case For::Colored:
+      os << "colored ";
+      break;
+  }
   os << "for " << op->var << " in " << op->domain << endl;
   ++indentation;
   print(op->body);
@@ -83,6 +83,16 @@ std::pair<Stmt,std::vector<Stmt>> removeVarDecls(Stmt stmt) {
       varDecls.push_back(op);
       stmt = Stmt();
     }
+
+    // The var decls of parallel loops are private to each iteration
+    void visit(const For *op) {
+      if (op->kind == For::Serial) {
+        IRRewriter::visit(op);
+      }
+      else {
+        stmt = op;
+      }
+    }
   };
   RemoveVarDeclsRewriter rewriter;
 
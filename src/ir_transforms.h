@@ -16,7 +16,8 @@ namespace ir {
 Func insertVarDecls(Func func);
 
 /// Removes the VarDecl statements from `stmt` and returns them together with
-/// the rewritten statement.
+/// the rewritten statement. VarDecls inside parallel loops are left in place,
+/// since each iteration needs its own storage.
 std::pair<Stmt,std::vector<Stmt>> removeVarDecls(Stmt stmt);
 
 /// Moves VarDecl statements from within `stmt` to in front of it.
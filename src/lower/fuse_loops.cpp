@@ -0,0 +1,631 @@
+#include "fuse_loops.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "intrinsics.h"
+#include "macros.h"
+#include "rw_analysis.h"
+#include "var_replace_rewriter.h"
+#include "lower_parallel_loops.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+static bool equals(const Expr &a, const Expr &b);
+
+template <class T>
+static bool equalOperands(const Expr &a, const Expr &b) {
+  return isa<T>(a) && isa<T>(b) &&
+         equals(to<T>(a)->a, to<T>(b)->a) && equals(to<T>(a)->b, to<T>(b)->b);
+}
+
+/// True if the two index expressions are the same sum of products of variables
+/// and constants.
+static bool equals(const Expr &a, const Expr &b) {
+  if (isa<VarExpr>(a) && isa<VarExpr>(b)) {
+    return to<VarExpr>(a)->var == to<VarExpr>(b)->var;
+  }
+  if (isa<Literal>(a) && isa<Literal>(b)) {
+    return *to<Literal>(a) == *to<Literal>(b);
+  }
+  if (isa<Length>(a) && isa<Length>(b)) {
+    const IndexSet &l = to<Length>(a)->indexSet;
+    const IndexSet &r = to<Length>(b)->indexSet;
+    return l.getKind() == IndexSet::Range && l == r;
+  }
+  return equalOperands<Add>(a, b) || equalOperands<Sub>(a, b) ||
+         equalOperands<Mul>(a, b);
+}
+
+/// True if two terms `loopVar*c` of iteration-local indices have the same
+/// constant `c`, so that the iterations own the same locations.
+static bool isSameStride(const Expr &a, const Expr &b, const Var &loopVar) {
+  class StrideRewriter : public IRRewriter {
+  public:
+    StrideRewriter(const Var &loopVar) : loopVar(loopVar) {}
+  private:
+    Var loopVar;
+    using IRRewriter::visit;
+    void visit(const VarExpr *op) {
+      expr = (op->var == loopVar) ? Literal::make(1) : Expr(op);
+    }
+  };
+  Expr strideA = StrideRewriter(loopVar).rewrite(a);
+  Expr strideB = StrideRewriter(loopVar).rewrite(b);
+  int valueA, valueB;
+  if (getConstant(strideA, &valueA) && getConstant(strideB, &valueB)) {
+    return valueA == valueB;
+  }
+  return equals(a, b);
+}
+
+/// True if two iteration-local indices shift the locations of the iterations
+/// by the same terms of the enclosing loops' variables.
+static bool isSameShift(const vector<Expr> &a, const vector<Expr> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (!equals(a[i], b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// True if `expr` only depends on constants and on the given loop variables,
+/// so that it has one value in each iteration of the loops.
+static bool isLoopIndex(const Expr &expr, const set<Var> &loopVars) {
+  if (isa<VarExpr>(expr)) {
+    return util::contains(loopVars, to<VarExpr>(expr)->var);
+  }
+  if (isa<Literal>(expr)) {
+    return true;
+  }
+  if (isa<Length>(expr)) {
+    return to<Length>(expr)->indexSet.getKind() == IndexSet::Range;
+  }
+  if (isa<Add>(expr)) {
+    return isLoopIndex(to<Add>(expr)->a, loopVars) &&
+           isLoopIndex(to<Add>(expr)->b, loopVars);
+  }
+  if (isa<Sub>(expr)) {
+    return isLoopIndex(to<Sub>(expr)->a, loopVars) &&
+           isLoopIndex(to<Sub>(expr)->b, loopVars);
+  }
+  if (isa<Mul>(expr)) {
+    return isLoopIndex(to<Mul>(expr)->a, loopVars) &&
+           isLoopIndex(to<Mul>(expr)->b, loopVars);
+  }
+  return false;
+}
+
+static void flatten(Stmt stmt, vector<Stmt> *stmts) {
+  if (isa<Block>(stmt)) {
+    flatten(to<Block>(stmt)->first, stmts);
+    if (to<Block>(stmt)->rest.defined()) {
+      flatten(to<Block>(stmt)->rest, stmts);
+    }
+  }
+  else {
+    stmts->push_back(stmt);
+  }
+}
+
+/// Returns the statement inside the scopes of a statement.
+static Stmt unscope(Stmt stmt) {
+  while (isa<Scope>(stmt)) {
+    stmt = to<Scope>(stmt)->scopedStmt;
+  }
+  return stmt;
+}
+
+/// Returns the loop of a statement, which may be scoped and commented, or
+/// nullptr.
+static const For *getLoop(Stmt stmt) {
+  if (isa<Comment>(stmt) && to<Comment>(stmt)->commentedStmt.defined()) {
+    stmt = to<Comment>(stmt)->commentedStmt;
+  }
+  stmt = unscope(stmt);
+  return isa<For>(stmt) ? to<For>(stmt) : nullptr;
+}
+
+/// True if the statement's loop is scoped.
+static bool isScoped(Stmt stmt) {
+  if (isa<Comment>(stmt) && to<Comment>(stmt)->commentedStmt.defined()) {
+    stmt = to<Comment>(stmt)->commentedStmt;
+  }
+  return isa<Scope>(stmt);
+}
+
+/// True if the loops iterate over the same set, or over ranges of the same
+/// size.
+static bool isSameDomain(const ForDomain &a, const ForDomain &b) {
+  if (a.kind != ForDomain::IndexSet || b.kind != ForDomain::IndexSet ||
+      a.indexSet.getKind() != b.indexSet.getKind()) {
+    return false;
+  }
+  switch (a.indexSet.getKind()) {
+    case IndexSet::Range:
+      return a.indexSet.getSize() == b.indexSet.getSize();
+    case IndexSet::Set: {
+      const Expr &x = a.indexSet.getSet();
+      const Expr &y = b.indexSet.getSet();
+      return isa<VarExpr>(x) && isa<VarExpr>(y) &&
+             to<VarExpr>(x)->var == to<VarExpr>(y)->var;
+    }
+    case IndexSet::Single:
+    case IndexSet::Dynamic:
+      return false;
+  }
+  return false;
+}
+
+/// The variables and buffers that the body of a loop accesses.
+class LoopAccesses : public IRVisitor {
+public:
+  LoopAccesses(const Stmt &body) {
+    body.accept(this);
+  }
+
+  /// False if the body has effects whose order fusion must not change.
+  bool fusable = true;
+
+  /// Variables declared in the body, including the variables of nested loops.
+  set<Var> localVars;
+  LoopVarBounds innerLoopVars;
+
+  /// Variables that the body refers to, and the subset that it refers to other
+  /// than as the buffers of loads and stores.
+  set<Var> referencedVars;
+  set<Var> wholeVars;
+
+  /// The loads and stores of the body, and the buffers that it stores to.
+  vector<pair<BufferId,Expr>> accesses;
+  set<BufferId> storedBuffers;
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarDecl *op) {
+    localVars.insert(op->var);
+  }
+
+  void visit(const VarExpr *op) {
+    referencedVars.insert(op->var);
+    wholeVars.insert(op->var);
+  }
+
+  void visit(const AssignStmt *op) {
+    referencedVars.insert(op->var);
+    wholeVars.insert(op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    const Func &callee = op->callee;
+    if (callee.getKind() != Func::Intrinsic ||
+        callee == intrinsics::clock() || callee == intrinsics::storeTime()) {
+      fusable = false;
+    }
+    for (auto &result : op->results) {
+      referencedVars.insert(result);
+      wholeVars.insert(result);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Load *op) {
+    BufferId buffer;
+    if (getBufferId(op->buffer, &buffer)) {
+      referencedVars.insert(buffer.first);
+      accesses.push_back(pair<BufferId,Expr>(buffer, op->index));
+    }
+    else if (!isa<IndexRead>(op->buffer)) {
+      fusable = false;
+    }
+    op->index.accept(this);
+  }
+
+  void visit(const Store *op) {
+    BufferId buffer;
+    if (getBufferId(op->buffer, &buffer)) {
+      referencedVars.insert(buffer.first);
+      accesses.push_back(pair<BufferId,Expr>(buffer, op->index));
+      storedBuffers.insert(buffer);
+    }
+    else {
+      fusable = false;
+    }
+    op->index.accept(this);
+    op->value.accept(this);
+  }
+
+  void visit(const ForRange *op) {
+    addInnerLoop(op, op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For *op) {
+    addInnerLoop(op, op->var);
+    IRVisitor::visit(op);
+  }
+
+  void addInnerLoop(const Stmt &loop, const Var &var) {
+    localVars.insert(var);
+    pair<int,int> bounds;
+    if (getLoopVarBounds(loop, &bounds)) {
+      innerLoopVars[var] = bounds;
+    }
+  }
+
+  void visit(const FieldWrite *op) {
+    fusable = false;
+  }
+
+  void visit(const Map *op) {
+    fusable = false;
+  }
+
+  void visit(const Print *op) {
+    fusable = false;
+  }
+
+  void visit(const Kernel *op) {
+    fusable = false;
+  }
+};
+
+/// True if the loop over `loopVar` with `body` followed by the loop over the
+/// same domain with `next`, whose loop variable has been replaced by
+/// `loopVar`, compute the same values as one loop with both bodies. The
+/// variables and buffers that one body writes and the other accesses must
+/// only be accessed at locations owned by the iteration (see
+/// isIterationLocal), with the same stride and shifted by the same terms of
+/// the enclosing loops' variables.
+static bool isFusable(const Var &loopVar, const Stmt &body, const Stmt &next,
+                      const set<Var> &enclosingLoopVars) {
+  LoopAccesses first(body);
+  LoopAccesses second(next);
+  if (!first.fusable || !second.fusable) {
+    return false;
+  }
+
+  set<Var> vars;
+  for (auto &var : first.referencedVars) {
+    if (!util::contains(first.localVars, var)) vars.insert(var);
+  }
+  for (auto &var : second.referencedVars) {
+    if (!util::contains(second.localVars, var)) vars.insert(var);
+  }
+  ReadWriteAnalysis firstRW(vars);
+  body.accept(&firstRW);
+  ReadWriteAnalysis secondRW(vars);
+  next.accept(&secondRW);
+
+  set<Var> conflicts;
+  for (auto &var : firstRW.getWrites()) {
+    if (util::contains(secondRW.getReads(), var) ||
+        util::contains(secondRW.getWrites(), var)) {
+      conflicts.insert(var);
+    }
+  }
+  for (auto &var : secondRW.getWrites()) {
+    if (util::contains(firstRW.getReads(), var)) {
+      conflicts.insert(var);
+    }
+  }
+
+  for (auto &var : conflicts) {
+    // Scalars and whole tensors are not owned by any iteration
+    if (util::contains(first.wholeVars, var) ||
+        util::contains(second.wholeVars, var)) {
+      return false;
+    }
+
+    // The buffers of the variable, or the fields of the set, that are stored
+    // by one body and accessed by both
+    set<BufferId> buffers;
+    for (auto &access : first.accesses) {
+      const BufferId &buffer = access.first;
+      if (buffer.first != var ||
+          (!util::contains(first.storedBuffers, buffer) &&
+           !util::contains(second.storedBuffers, buffer))) {
+        continue;
+      }
+      for (auto &other : second.accesses) {
+        if (other.first == buffer) {
+          buffers.insert(buffer);
+          break;
+        }
+      }
+    }
+
+    for (auto &buffer : buffers) {
+      Expr stride;
+      vector<Expr> shift;
+      for (auto loop : {&first, &second}) {
+        for (auto &access : loop->accesses) {
+          if (access.first != buffer) {
+            continue;
+          }
+          Expr loopVarTerm;
+          vector<Expr> invariantTerms;
+          if (!isIterationLocal(access.second, loopVar, loop->innerLoopVars,
+                                &loopVarTerm, enclosingLoopVars,
+                                &invariantTerms) ||
+              (stride.defined() &&
+               (!isSameStride(stride, loopVarTerm, loopVar) ||
+                !isSameShift(shift, invariantTerms)))) {
+            return false;
+          }
+          stride = loopVarTerm;
+          shift = invariantTerms;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/// Comments the fused loop with the comments of the loops it was fused from.
+static Stmt commentFusedLoop(const Stmt &first, const Stmt &second,
+                             const Stmt &loop) {
+  vector<string> comments;
+  bool headerSpace = false;
+  bool footerSpace = false;
+  if (isa<Comment>(first)) {
+    comments.push_back(to<Comment>(first)->comment);
+    headerSpace = to<Comment>(first)->headerSpace;
+  }
+  if (isa<Comment>(second)) {
+    comments.push_back(to<Comment>(second)->comment);
+    footerSpace = to<Comment>(second)->footerSpace;
+  }
+  if (comments.empty()) {
+    return loop;
+  }
+  return Comment::make(util::join(comments, " "), loop, footerSpace,
+                       headerSpace);
+}
+
+class FuseLoops : public IRRewriter {
+  using IRRewriter::visit;
+
+  /// The variables of the loops that enclose the statement being rewritten.
+  vector<Var> loopVars;
+
+  void visit(const For *op) {
+    loopVars.push_back(op->var);
+    IRRewriter::visit(op);
+    loopVars.pop_back();
+  }
+
+  void visit(const ForRange *op) {
+    loopVars.push_back(op->var);
+    IRRewriter::visit(op);
+    loopVars.pop_back();
+  }
+
+  /// Returns the loop fused from two loops, or an undefined statement if they
+  /// can not be fused.
+  Stmt fuse(const Stmt &first, const Stmt &second) {
+    const For *a = getLoop(first);
+    const For *b = getLoop(second);
+    if (a == nullptr || b == nullptr ||
+        a->kind != For::Serial || b->kind != For::Serial ||
+        !isSameDomain(a->domain, b->domain)) {
+      return Stmt();
+    }
+
+    Stmt next = replaceVar(b->body, b->var, a->var);
+    set<Var> enclosingLoopVars(loopVars.begin(), loopVars.end());
+    if (!isFusable(a->var, a->body, next, enclosingLoopVars)) {
+      return Stmt();
+    }
+
+    // The bodies share a scope, so that the nested loops at their seam may be
+    // fused too
+    Stmt body = Block::make(unscope(a->body), unscope(next));
+    if (isa<Scope>(a->body) || isa<Scope>(next)) {
+      body = Scope::make(body);
+    }
+    Stmt loop = For::make(a->var, a->domain, body);
+    if (isScoped(first) || isScoped(second)) {
+      loop = Scope::make(loop);
+    }
+    return rewrite(commentFusedLoop(first, second, loop));
+  }
+
+  void visit(const Block *op) {
+    vector<Stmt> stmts;
+    flatten(op, &stmts);
+
+    // Declarations between fused loops are moved before them
+    vector<Stmt> fused;
+    vector<Stmt> decls;
+    for (auto &stmt : stmts) {
+      Stmt rewritten = rewrite(stmt);
+      if (!rewritten.defined()) {
+        continue;
+      }
+      if (isa<VarDecl>(rewritten)) {
+        decls.push_back(rewritten);
+        continue;
+      }
+      Stmt loop = fused.empty() ? Stmt() : fuse(fused.back(), rewritten);
+      if (loop.defined()) {
+        fused.pop_back();
+        fused.insert(fused.end(), decls.begin(), decls.end());
+        fused.push_back(loop);
+      }
+      else {
+        fused.insert(fused.end(), decls.begin(), decls.end());
+        fused.push_back(rewritten);
+      }
+      decls.clear();
+    }
+    fused.insert(fused.end(), decls.begin(), decls.end());
+    if (fused.empty()) {
+      stmt = Stmt();
+    }
+    else {
+      stmt = (fused.size() == 1) ? fused[0] : Block::make(fused);
+    }
+  }
+};
+
+/// Replace the dense temporaries that are only stored and then loaded at the
+/// same location in one iteration of a loop by registers.
+static Func registerTemporaries(Func func) {
+  class FindRegisterTemporaries : public IRVisitor {
+  public:
+    FindRegisterTemporaries(const Storage &storage) : storage(storage) {}
+
+    /// The temporaries that can be registers, and their registers
+    map<Var,Var> registers;
+
+    void find(const Stmt &body) {
+      body.accept(this);
+      for (auto &store : stores) {
+        const Var &var = store.first;
+        if (util::contains(temporaries, var) &&
+            store.second == uses[var]) {
+          const TensorType *type = var.getType().toTensor();
+          registers[var] = Var(INTERNAL_PREFIX(var.getName()),
+                               TensorType::make(type->getComponentType()));
+        }
+      }
+    }
+
+  private:
+    const Storage &storage;
+    set<Var> temporaries;
+    map<Var,int> uses;
+
+    /// The temporaries that are stored at the start of a loop body and loaded
+    /// from the same location later in the body, and the number of the store's
+    /// and the loads' references to them.
+    map<Var,int> stores;
+    set<Var> loopVars;
+
+    using IRVisitor::visit;
+
+    void visit(const VarDecl *op) {
+      const Var &var = op->var;
+      if (var.getType().isTensor() && !isScalar(var.getType()) &&
+          (!storage.hasStorage(var) ||
+           storage.getStorage(var).getKind() == TensorStorage::Dense)) {
+        temporaries.insert(var);
+      }
+    }
+
+    void visit(const VarExpr *op) {
+      ++uses[op->var];
+    }
+
+    void visit(const For *op) {
+      loopVars.insert(op->var);
+      findStores(op->body);
+      IRVisitor::visit(op);
+      loopVars.erase(op->var);
+    }
+
+    void visit(const ForRange *op) {
+      loopVars.insert(op->var);
+      findStores(op->body);
+      IRVisitor::visit(op);
+      loopVars.erase(op->var);
+    }
+
+    void findStores(const Stmt &body) {
+      vector<Stmt> stmts;
+      flatten(unscope(body), &stmts);
+      for (size_t i = 0; i < stmts.size(); ++i) {
+        if (!isa<Store>(stmts[i])) {
+          continue;
+        }
+        const Store *store = to<Store>(stmts[i]);
+        if (!isa<VarExpr>(store->buffer) ||
+            store->cop != CompoundOperator::None ||
+            !isLoopIndex(store->index, loopVars)) {
+          continue;
+        }
+        const Var &var = to<VarExpr>(store->buffer)->var;
+        int loads = 0;
+        for (size_t j = i+1; j < stmts.size(); ++j) {
+          match(stmts[j],
+            function<void(const Load*)>([&](const Load *op) {
+              if (isa<VarExpr>(op->buffer) &&
+                  to<VarExpr>(op->buffer)->var == var &&
+                  equals(op->index, store->index)) {
+                ++loads;
+              }
+            })
+          );
+        }
+        stores[var] = (util::contains(stores, var) ? -1 : 1 + loads);
+      }
+    }
+  };
+
+  class RegisterTemporaries : public IRRewriter {
+  public:
+    RegisterTemporaries(const map<Var,Var> &registers)
+        : registers(registers) {}
+
+  private:
+    const map<Var,Var> &registers;
+
+    using IRRewriter::visit;
+
+    void visit(const VarDecl *op) {
+      stmt = util::contains(registers, op->var) ? Stmt() : op;
+    }
+
+    void visit(const Store *op) {
+      if (isa<VarExpr>(op->buffer) &&
+          util::contains(registers, to<VarExpr>(op->buffer)->var)) {
+        const Var &reg = registers.at(to<VarExpr>(op->buffer)->var);
+        stmt = Block::make(VarDecl::make(reg),
+                           AssignStmt::make(reg, rewrite(op->value)));
+      }
+      else {
+        IRRewriter::visit(op);
+      }
+    }
+
+    void visit(const Load *op) {
+      if (isa<VarExpr>(op->buffer) &&
+          util::contains(registers, to<VarExpr>(op->buffer)->var)) {
+        expr = VarExpr::make(registers.at(to<VarExpr>(op->buffer)->var));
+      }
+      else {
+        IRRewriter::visit(op);
+      }
+    }
+  };
+
+  FindRegisterTemporaries finder(func.getStorage());
+  finder.find(func.getBody());
+  if (finder.registers.empty()) {
+    return func;
+  }
+  return RegisterTemporaries(finder.registers).rewrite(func);
+}
+
+Func fuseLoops(Func func) {
+  func = FuseLoops().rewrite(func);
+  return registerTemporaries(func);
+}
+
+}}
@@ -0,0 +1,20 @@
+#ifndef SIMIT_FUSE_LOOPS_H
+#define SIMIT_FUSE_LOOPS_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Fuse consecutive loops over the same set, or over the same range, into one
+/// loop. Two loops are fused if the locations that one of them writes and the
+/// other accesses are owned by the iterations that access them (see
+/// isIterationLocal), so that the iterations of the fused loop compute the same
+/// values. Loops nested in fused loops are fused in turn.
+///
+/// Fusion turns temporaries that are stored and then loaded at the same
+/// location of one iteration, and that have no other uses, into registers.
+Func fuseLoops(Func func);
+
+}}
+#endif
@@ -1,17 +1,25 @@
 #include "lower_index_expressions.h"
 
+#include <set>
+
 #include "ir.h"
 #include "ir_rewriter.h"
+#include "ir_visitor.h"
 #include "ir_transforms.h"
+#include "util/collections.h"
 
 #include "lower_indexexprs.h"
 #include "lower_scatter_workspace.h"
 #include "lower_transpose.h"
 #include "lower_matrix_multiply.h"
+#include "lower_spmv.h"
 
 #include "path_expressions.h"
 
 namespace simit {
+extern std::string kBackend;
+extern int kThreads;
+
 namespace ir {
 
 inline unsigned getExperssionArity(const IndexExpr* iexpr) {
@@ -177,21 +185,280 @@ inline bool isGemm(const IndexExpr* iexpr) {
   return result;
 }
 
+/// The pairs of consecutive statements of a function, where declarations are
+/// skipped, and the number of definitions and uses of each variable.
+class AdjacentStatements : public IRVisitor {
+public:
+  std::vector<std::pair<Stmt,Stmt>> pairs;
+  std::map<Var,int> definitions;
+  std::map<Var,int> uses;
+
+  AdjacentStatements(Func func) {
+    func.getBody().accept(this);
+    for (auto& var : func.getArguments()) ++definitions[var];
+    for (auto& var : func.getResults()) ++definitions[var];
+  }
+
+  int getDefinitions(const Var& var) const {
+    return util::contains(definitions, var) ? definitions.at(var) : 0;
+  }
+
+  int getUses(const Var& var) const {
+    return util::contains(uses, var) ? uses.at(var) : 0;
+  }
+
+private:
+  using IRVisitor::visit;
+
+  void visit(const VarExpr* op) {
+    ++uses[op->var];
+  }
+
+  void visit(const AssignStmt* op) {
+    ++definitions[op->var];
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt* op) {
+    for (auto& var : op->results) ++definitions[var];
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Map* op) {
+    for (auto& var : op->vars) ++definitions[var];
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Block* op) {
+    // Nested blocks are one statement sequence
+    std::vector<Stmt> stmts;
+    flatten(op, &stmts);
+    for (size_t i = 0; i < stmts.size(); ++i) {
+      if (isa<VarDecl>(stmts[i])) {
+        continue;
+      }
+      size_t next = i+1;
+      while (next < stmts.size() && isa<VarDecl>(stmts[next])) {
+        ++next;
+      }
+      if (next < stmts.size()) {
+        pairs.push_back({stmts[i], stmts[next]});
+      }
+    }
+    for (auto& stmt : stmts) {
+      stmt.accept(this);
+    }
+  }
+
+  static void flatten(Stmt stmt, std::vector<Stmt>* stmts) {
+    if (isa<Block>(stmt)) {
+      flatten(to<Block>(stmt)->first, stmts);
+      if (to<Block>(stmt)->rest.defined()) {
+        flatten(to<Block>(stmt)->rest, stmts);
+      }
+    }
+    else {
+      stmts->push_back(stmt);
+    }
+  }
+};
+
+/// Returns the target and the index expression of an assignment of an index
+/// expression, or of a field write of one, that overwrites its target.
+static bool getIndexStatement(Stmt stmt, Expr* target,
+                              const IndexExpr** iexpr) {
+  Expr value;
+  if (isa<AssignStmt>(stmt) &&
+      to<AssignStmt>(stmt)->cop == CompoundOperator::None) {
+    *target = to<AssignStmt>(stmt)->var;
+    value = to<AssignStmt>(stmt)->value;
+  }
+  else if (isa<FieldWrite>(stmt) &&
+           to<FieldWrite>(stmt)->cop == CompoundOperator::None) {
+    const FieldWrite* fieldWrite = to<FieldWrite>(stmt);
+    *target = FieldRead::make(fieldWrite->elementOrSet, fieldWrite->fieldName);
+    value = fieldWrite->value;
+  }
+  if (!value.defined() || !isa<IndexExpr>(value)) {
+    return false;
+  }
+  *iexpr = to<IndexExpr>(value);
+  return true;
+}
+
+/// Returns the transposes `At = A'` whose only use is the sparse matrix-vector
+/// multiply `y = At*x` that immediately follows them, and that the runtime can
+/// compute with a transposed traversal of `A` (see isBlockedSpMVT), mapped to
+/// the transposed matrix. These transposes need not be assembled. The assembly
+/// must not allocate memory that is freed, so the transposes must have a path
+/// index.
+static std::map<Var,Expr>
+findElidableTransposes(const AdjacentStatements& stmts,
+                       const Storage& storage) {
+  std::map<Var,Expr> elidable;
+  for (auto& pair : stmts.pairs) {
+    Expr transposed;
+    const IndexExpr* transpose;
+    if (!isa<AssignStmt>(pair.first) ||
+        !getIndexStatement(pair.first, &transposed, &transpose) ||
+        !isTranspose(transpose)) {
+      continue;
+    }
+    const Var& var = to<VarExpr>(transposed)->var;
+    Expr matrix = to<IndexedTensor>(transpose->value)->tensor;
+    if (!isa<VarExpr>(matrix) || !storage.hasStorage(var) ||
+        stmts.getDefinitions(var) != 1 || stmts.getUses(var) != 1) {
+      continue;
+    }
+    const TensorStorage& transposedStorage = storage.getStorage(var);
+    if (transposedStorage.getKind() != TensorStorage::Indexed ||
+        !transposedStorage.hasTensorIndex() ||
+        !transposedStorage.getTensorIndex().getPathExpression().defined()) {
+      continue;
+    }
+
+    Expr target;
+    const IndexExpr* iexpr;
+    if (!getIndexStatement(pair.second, &target, &iexpr)) {
+      continue;
+    }
+    Expr operand = getSpMVMatrix(iexpr);
+    if (operand.defined() && isa<VarExpr>(operand) &&
+        to<VarExpr>(operand)->var == var &&
+        isBlockedSpMVT(target, iexpr, matrix, storage)) {
+      elidable[var] = matrix;
+    }
+  }
+  return elidable;
+}
+
+/// A sparse matrix-vector multiply `product = spmv` that is computed in the
+/// loop of the statement that follows it and uses its result (see
+/// isSpMVEpilogue). The product is only stored if it has other uses.
+struct SpMVEpilogue {
+  Stmt multiply;
+  Var product;
+  Expr spmv;
+  bool storeProduct;
+};
+
+/// Returns the statements that are epilogues of the sparse matrix-vector
+/// multiplies before them. Multiplies of elided transposes are computed by the
+/// runtime instead. Loops that reduce to scalars are not parallelized, so inner
+/// products are only fused when the runtime kernels would run serially too.
+static std::map<Stmt,SpMVEpilogue>
+findSpMVEpilogues(const AdjacentStatements& stmts, const Storage& storage,
+                  const std::map<Var,Expr>& elidedTransposes) {
+  std::map<Stmt,SpMVEpilogue> epilogues;
+  for (auto& pair : stmts.pairs) {
+    Expr product;
+    const IndexExpr* spmv;
+    if (!isa<AssignStmt>(pair.first) ||
+        !getIndexStatement(pair.first, &product, &spmv)) {
+      continue;
+    }
+    const Var& var = to<VarExpr>(product)->var;
+    Expr matrix = getSpMVMatrix(spmv);
+    if (!matrix.defined() || !isa<VarExpr>(matrix) ||
+        util::contains(elidedTransposes, to<VarExpr>(matrix)->var) ||
+        !isFusableSpMV(var, spmv, storage)) {
+      continue;
+    }
+
+    Expr target;
+    const IndexExpr* iexpr;
+    if (!getIndexStatement(pair.second, &target, &iexpr) ||
+        !isSpMVEpilogue(target, iexpr, var, spmv) ||
+        (iexpr->resultVars.empty() && kThreads > 1)) {
+      continue;
+    }
+
+    // The product lives in a register if the epilogue is its only use
+    int epilogueUses = 0;
+    match(Expr(iexpr),
+      std::function<void(const VarExpr*)>([&](const VarExpr* op) {
+        if (op->var == var) {
+          ++epilogueUses;
+        }
+      })
+    );
+    bool storeProduct = stmts.getDefinitions(var) != 1 ||
+                        stmts.getUses(var) != epilogueUses;
+    if (storeProduct && (!storage.hasStorage(var) ||
+        storage.getStorage(var).getKind() != TensorStorage::Dense)) {
+      continue;
+    }
+    epilogues[pair.second] = {pair.first, var, spmv, storeProduct};
+  }
+  return epilogues;
+}
+
 Func lowerIndexExpressions(Func func) {
   class LowerIndexExpressionsRewriter : private IRRewriter {
   public:
     Func lower(Func func) {
       storage = &func.getStorage();
       environment = func.getEnvironment();
+      if (kBackend == "cpu") {
+        AdjacentStatements stmts(func);
+        elidedTransposes = findElidableTransposes(stmts, *storage);
+        spmvEpilogues = findSpMVEpilogues(stmts, *storage, elidedTransposes);
+        for (auto& epilogue : spmvEpilogues) {
+          fusedMultiplies.insert(epilogue.second.multiply);
+          if (!epilogue.second.storeProduct) {
+            elidedProducts.insert(epilogue.second.product);
+          }
+        }
+      }
       return this->rewrite(func);
     }
 
   private:
     Storage *storage;
     Environment environment;
+
+    /// Transposes that are not assembled, since their only use is a sparse
+    /// matrix-vector multiply that traverses the transposed matrix instead.
+    std::map<Var,Expr> elidedTransposes;
+
+    /// Statements that are computed in the loops of the sparse matrix-vector
+    /// multiplies before them, the multiplies, and the products that are not
+    /// stored since they are only used by the epilogues.
+    std::map<Stmt,SpMVEpilogue> spmvEpilogues;
+    std::set<Stmt> fusedMultiplies;
+    std::set<Var> elidedProducts;
     
     using IRRewriter::visit;
 
+    /// Lower an epilogue together with the multiply before it.
+    void lowerSpMVEpilogue(Stmt epilogue, Expr target, const IndexExpr* iexpr) {
+      const SpMVEpilogue& fusion = spmvEpilogues.at(epilogue);
+      stmt = lowerSpMVWithEpilogue(fusion.product, to<IndexExpr>(fusion.spmv),
+                                   target, iexpr, fusion.storeProduct,
+                                   *storage);
+      stmt = Comment::make(util::toString(fusion.multiply) + " " +
+                           util::toString(epilogue), stmt, false, true);
+    }
+
+    /// Returns the matrix whose transpose is multiplied by `iexpr`, if it is
+    /// the multiply of an elided transpose, or an undefined expression.
+    Expr getElidedTransposeMatrix(const IndexExpr* iexpr) {
+      Expr operand = getSpMVMatrix(iexpr);
+      if (!operand.defined() || !isa<VarExpr>(operand) ||
+          !util::contains(elidedTransposes, to<VarExpr>(operand)->var)) {
+        return Expr();
+      }
+      return elidedTransposes.at(to<VarExpr>(operand)->var);
+    }
+
+    /// Sparse matrix-vector multiplies that overwrite their result are
+    /// computed by the block-size-specialized runtime kernels on the CPU.
+    bool isRuntimeSpMV(Expr target, CompoundOperator cop,
+                       const IndexExpr* iexpr) {
+      return kBackend == "cpu" && cop == CompoundOperator::None &&
+             isBlockedSpMV(target, iexpr, *storage);
+    }
+
     void visit(const Func* f) {
       Stmt body = rewrite(f->getBody());
       if (body != f->getBody()) {
@@ -204,6 +471,12 @@ Func lowerIndexExpressions(Func func) {
       }
     }
 
+    void visit(const VarDecl *op) {
+      bool elided = util::contains(elidedTransposes, op->var) ||
+                    util::contains(elidedProducts, op->var);
+      stmt = elided ? Stmt() : op;
+    }
+
     void visit(const AssignStmt *op) {
       if (!isa<IndexExpr>(op->value) && op->cop == CompoundOperator::None) {
         IRRewriter::visit(op);
@@ -213,11 +486,26 @@ Func lowerIndexExpressions(Func func) {
         stmt = lowerIndexStatement(op, &environment, *storage);
         return;
       }
+      if (util::contains(elidedTransposes, op->var) ||
+          util::contains(fusedMultiplies, Stmt(op))) {
+        stmt = Stmt();
+        return;
+      }
 
       const IndexExpr* iexpr = to<IndexExpr>(op->value);
+      if (util::contains(spmvEpilogues, Stmt(op))) {
+        lowerSpMVEpilogue(op, op->var, iexpr);
+        return;
+      }
+      Expr matrix = getElidedTransposeMatrix(iexpr);
+      if (matrix.defined()) {
+        stmt = lowerBlockedSpMVT(op->var, iexpr, matrix);
+        stmt = Comment::make(util::toString(*op), stmt, false, true);
+        return;
+      }
 
       // Dispatch the index expression lowering to the correct lowering pass.
-      enum Kind {Unknown, DenseResult, MatrixScale,
+      enum Kind {Unknown, DenseResult, BlockedSpMV, MatrixScale,
                  MatrixElwiseWithSameStructureOrDiagonal, MatrixElwise,
                  MatrixTranspose, MatrixMultiply};
       Kind kind = Unknown;
@@ -226,7 +514,10 @@ Func lowerIndexExpressions(Func func) {
       const Var& var = op->var;
       const TensorType* type = iexpr->type.toTensor();
 
-      if (type->order()==0 || type->order()==1 ||
+      if (isRuntimeSpMV(op->var, op->cop, iexpr)) {
+        kind = BlockedSpMV;
+      }
+      else if (type->order()==0 || type->order()==1 ||
           storage->getStorage(var).getKind() == TensorStorage::Dense) {
         kind = DenseResult;
       }
@@ -255,6 +546,9 @@ Func lowerIndexExpressions(Func func) {
         case MatrixElwiseWithSameStructureOrDiagonal:
           stmt = lowerIndexStatement(op, &environment, *storage);
           break;
+        case BlockedSpMV:
+          stmt = lowerBlockedSpMV(op->var, iexpr);
+          break;
         case MatrixElwise:
           stmt = lowerScatterWorkspace(op->var, iexpr, &environment, storage);
           break;
@@ -277,7 +571,24 @@ Func lowerIndexExpressions(Func func) {
         IRRewriter::visit(op);
         return;
       }
-      stmt = lowerIndexStatement(op, &environment, *storage);
+
+      Expr field = FieldRead::make(op->elementOrSet, op->fieldName);
+      if (util::contains(spmvEpilogues, Stmt(op))) {
+        lowerSpMVEpilogue(op, field, to<IndexExpr>(op->value));
+        return;
+      }
+      if (isa<IndexExpr>(op->value) &&
+          getElidedTransposeMatrix(to<IndexExpr>(op->value)).defined()) {
+        const IndexExpr* iexpr = to<IndexExpr>(op->value);
+        stmt = lowerBlockedSpMVT(field, iexpr, getElidedTransposeMatrix(iexpr));
+      }
+      else if (isa<IndexExpr>(op->value) &&
+          isRuntimeSpMV(field, op->cop, to<IndexExpr>(op->value))) {
+        stmt = lowerBlockedSpMV(field, to<IndexExpr>(op->value));
+      }
+      else {
+        stmt = lowerIndexStatement(op, &environment, *storage);
+      }
 
       if (isa<IndexExpr>(op->value)) {
         stmt = Comment::make(util::toString(*op), stmt, false, true);
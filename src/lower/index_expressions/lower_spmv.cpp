@@ -0,0 +1,379 @@
+#include "lower_spmv.h"
+
+#include "storage.h"
+#include "tensor_index.h"
+#include "intrinsics.h"
+#include "ir_queries.h"
+#include "ir_rewriter.h"
+
+#include <algorithm>
+
+namespace simit {
+namespace ir {
+
+// Returns the dimensions of the blocks of a system tensor whose blocks are
+// dense tensors of scalars of the same order as the tensor, where scalar blocks
+// have dimensions of 1. Returns no dimensions for any other tensor.
+static std::vector<int> getBlockDimensions(const TensorType* type) {
+  if (!type->hasSystemDimensions()) {
+    return {};
+  }
+  Type blockType = type->getBlockType();
+  if (isScalar(blockType)) {
+    return std::vector<int>(type->order(), 1);
+  }
+  const TensorType* block = blockType.toTensor();
+  if (block->order() != type->order() || !isScalar(block->getBlockType())) {
+    return {};
+  }
+  std::vector<int> dimensions;
+  for (const IndexSet& dim : block->getOuterDimensions()) {
+    if (dim.getKind() != IndexSet::Range) {
+      return {};
+    }
+    dimensions.push_back(dim.getSize());
+  }
+  return dimensions;
+}
+
+// Returns the size of the blocks of a system tensor whose blocks are square
+// matrices of floats (matrices) or vectors of floats (vectors), where scalar
+// blocks have size 1. Returns 0 for any other tensor.
+static int getBlockSize(const TensorType* type) {
+  if (type->getComponentType().kind != ScalarType::Float) {
+    return 0;
+  }
+  std::vector<int> dimensions = getBlockDimensions(type);
+  if (dimensions.empty() ||
+      std::count(dimensions.begin(), dimensions.end(), dimensions[0]) !=
+          (int)dimensions.size()) {
+    return 0;
+  }
+  return dimensions[0];
+}
+
+// Returns the matrix and vector operands of `A(i,+j)*x(+j)` in `matrix` and
+// `vector`, or false if the index expression is not of that form.
+static bool getSpMVOperands(const IndexExpr* iexpr,
+                            const IndexedTensor** matrix,
+                            const IndexedTensor** vector) {
+  if (iexpr->resultVars.size() != 1 || !isa<Mul>(iexpr->value)) {
+    return false;
+  }
+  const Mul* mul = to<Mul>(iexpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return false;
+  }
+  *matrix = to<IndexedTensor>(mul->a);
+  *vector = to<IndexedTensor>(mul->b);
+  if ((*matrix)->indexVars.size() != 2) {
+    std::swap(*matrix, *vector);
+  }
+  if ((*matrix)->indexVars.size() != 2 || (*vector)->indexVars.size() != 1) {
+    return false;
+  }
+
+  const IndexVar& i = (*matrix)->indexVars[0];
+  const IndexVar& j = (*matrix)->indexVars[1];
+  return i.isFreeVar() && i == iexpr->resultVars[0] &&
+         j.isReductionVar() && j.getOperator() == ReductionOperator::Sum &&
+         j == (*vector)->indexVars[0];
+}
+
+// True if the two vectors may be the same vector. Field reads are compared by
+// name, which is conservative for fields of different sets.
+static bool isSameVector(Expr a, Expr b) {
+  if (isa<VarExpr>(a) && isa<VarExpr>(b)) {
+    return to<VarExpr>(a)->var == to<VarExpr>(b)->var;
+  }
+  if (isa<FieldRead>(a) && isa<FieldRead>(b)) {
+    return to<FieldRead>(a)->fieldName == to<FieldRead>(b)->fieldName;
+  }
+  return false;
+}
+
+// True if the matrix is an indexed (BCSR) matrix with a stored index, whose
+// values and index the runtime kernels can read.
+static bool hasStoredIndex(Expr matrix, const Storage& storage) {
+  if (!isa<VarExpr>(matrix) || !storage.hasStorage(to<VarExpr>(matrix)->var)) {
+    return false;
+  }
+  const TensorStorage& matrixStorage =
+      storage.getStorage(to<VarExpr>(matrix)->var);
+  return matrixStorage.getKind() == TensorStorage::Indexed &&
+         matrixStorage.hasTensorIndex() &&
+         !matrixStorage.getTensorIndex().isComputed();
+}
+
+// True if the vector is a dense array that is not the result.
+static bool isDenseOperand(Expr vector, Expr target) {
+  return (isa<VarExpr>(vector) || isa<FieldRead>(vector)) &&
+         !isSameVector(vector, target);
+}
+
+bool isBlockedSpMV(Expr target, const IndexExpr* iexpr,
+                   const Storage& storage) {
+  const IndexedTensor* matrix;
+  const IndexedTensor* vector;
+  if (!getSpMVOperands(iexpr, &matrix, &vector)) {
+    return false;
+  }
+  if (!hasStoredIndex(matrix->tensor, storage) ||
+      !isDenseOperand(vector->tensor, target)) {
+    return false;
+  }
+
+  int blockSize = getBlockSize(matrix->tensor.type().toTensor());
+  return blockSize > 0 && blockSize <= kMaxSpMVBlockSize &&
+         getBlockSize(vector->tensor.type().toTensor()) == blockSize &&
+         getBlockSize(target.type().toTensor()) == blockSize;
+}
+
+Expr getSpMVMatrix(const IndexExpr* iexpr) {
+  const IndexedTensor* matrix;
+  const IndexedTensor* vector;
+  if (!getSpMVOperands(iexpr, &matrix, &vector)) {
+    return Expr();
+  }
+  return matrix->tensor;
+}
+
+bool isBlockedSpMVT(Expr target, const IndexExpr* iexpr, Expr matrix,
+                    const Storage& storage) {
+  const IndexedTensor* transposed;
+  const IndexedTensor* vector;
+  if (!getSpMVOperands(iexpr, &transposed, &vector)) {
+    return false;
+  }
+  if (!hasStoredIndex(matrix, storage) ||
+      !isDenseOperand(vector->tensor, target)) {
+    return false;
+  }
+
+  // The kernels are specialized for the components and the block dimensions.
+  // Floats of different storage precisions compare equal, and are multiplied
+  // by the mixed-precision kernels.
+  const TensorType* matrixType = matrix.type().toTensor();
+  const TensorType* vectorType = vector->tensor.type().toTensor();
+  const TensorType* targetType = target.type().toTensor();
+  ScalarType componentType = matrixType->getComponentType();
+  if ((componentType.kind != ScalarType::Float &&
+       componentType.kind != ScalarType::Int) ||
+      vectorType->getComponentType() != componentType ||
+      targetType->getComponentType() != componentType) {
+    return false;
+  }
+  std::vector<int> blockDimensions = getBlockDimensions(matrixType);
+  if (blockDimensions.size() != 2 ||
+      blockDimensions[0] > kMaxSpMVBlockSize ||
+      blockDimensions[1] > kMaxSpMVBlockSize) {
+    return false;
+  }
+  std::vector<int> vectorBlock = getBlockDimensions(vectorType);
+  std::vector<int> targetBlock = getBlockDimensions(targetType);
+  return vectorBlock.size() == 1 && vectorBlock[0] == blockDimensions[0] &&
+         targetBlock.size() == 1 && targetBlock[0] == blockDimensions[1];
+}
+
+Stmt lowerBlockedSpMV(Expr target, const IndexExpr* iexpr) {
+  const IndexedTensor* matrix;
+  const IndexedTensor* vector;
+  bool isSpMV = getSpMVOperands(iexpr, &matrix, &vector);
+  iassert(isSpMV) << "not a sparse matrix-vector multiply: " << Expr(iexpr);
+  UNUSED(isSpMV);
+
+  // The result is written through the last argument, since field writes do
+  // not have a variable that can receive it.
+  return CallStmt::make({}, intrinsics::spmv(),
+                        {matrix->tensor, vector->tensor, target});
+}
+
+Stmt lowerBlockedSpMVT(Expr target, const IndexExpr* iexpr, Expr matrix) {
+  const IndexedTensor* transposed;
+  const IndexedTensor* vector;
+  bool isSpMV = getSpMVOperands(iexpr, &transposed, &vector);
+  iassert(isSpMV) << "not a sparse matrix-vector multiply: " << Expr(iexpr);
+  UNUSED(isSpMV);
+  return CallStmt::make({}, intrinsics::spmvt(),
+                        {matrix, vector->tensor, target});
+}
+
+// True if the expression is a dense vector of floats, whose blocks have the
+// given dimensions.
+static bool isDenseVector(Expr vector, const std::vector<int>& blockDimensions) {
+  return (isa<VarExpr>(vector) || isa<FieldRead>(vector)) &&
+         vector.type().isTensor() &&
+         vector.type().toTensor()->getComponentType().kind ==
+             ScalarType::Float &&
+         getBlockDimensions(vector.type().toTensor()) == blockDimensions;
+}
+
+bool isFusableSpMV(Var target, const IndexExpr* iexpr,
+                   const Storage& storage) {
+  const IndexedTensor* matrix;
+  const IndexedTensor* vector;
+  if (!getSpMVOperands(iexpr, &matrix, &vector) ||
+      !hasStoredIndex(matrix->tensor, storage) ||
+      !isDenseOperand(vector->tensor, target)) {
+    return false;
+  }
+  const TensorType* matrixType = matrix->tensor.type().toTensor();
+  std::vector<int> blockDimensions = getBlockDimensions(matrixType);
+  return matrixType->getComponentType().kind == ScalarType::Float &&
+         blockDimensions.size() == 2 &&
+         isDenseVector(vector->tensor, {blockDimensions[1]}) &&
+         isDenseVector(target, {blockDimensions[0]});
+}
+
+bool isSpMVEpilogue(Expr target, const IndexExpr* iexpr, Var product,
+                    const IndexExpr* spmv) {
+  const IndexedTensor* matrix;
+  const IndexedTensor* vector;
+  bool isSpMV = getSpMVOperands(spmv, &matrix, &vector);
+  iassert(isSpMV) << "not a sparse matrix-vector multiply: " << Expr(spmv);
+  UNUSED(isSpMV);
+
+  // Rows of the result are written before later rows of the vector are read
+  Expr productExpr = VarExpr::make(product);
+  if (isSameVector(target, vector->tensor) ||
+      isSameVector(target, productExpr)) {
+    return false;
+  }
+
+  std::vector<int> blockDimensions =
+      {getBlockDimensions(product.getType().toTensor())[0]};
+  bool usesProduct = false;
+  bool operandsFuse = true;
+  match(Expr(iexpr),
+    std::function<void(const IndexedTensor*)>([&](const IndexedTensor* op) {
+      usesProduct |= isSameVector(op->tensor, productExpr);
+      // Scalars are broadcast to every component
+      if (op->indexVars.empty() && isScalar(op->tensor.type()) &&
+          (isa<Literal>(op->tensor) || isa<VarExpr>(op->tensor))) {
+        return;
+      }
+      if (!isDenseVector(op->tensor, blockDimensions) ||
+          op->indexVars.size() != 1 ||
+          (!iexpr->resultVars.empty() &&
+           op->indexVars[0] != iexpr->resultVars[0])) {
+        operandsFuse = false;
+      }
+    }),
+    std::function<void(const IndexExpr*)>([&](const IndexExpr* op) {
+      operandsFuse &= (op == iexpr);
+    })
+  );
+  if (!usesProduct || !operandsFuse) {
+    return false;
+  }
+
+  // Element-wise vector expressions
+  if (iexpr->resultVars.size() == 1) {
+    return isDenseVector(target, blockDimensions);
+  }
+
+  // Inner products
+  if (!iexpr->resultVars.empty() || !isa<VarExpr>(target) ||
+      !isScalar(target.type()) || !isa<Mul>(iexpr->value)) {
+    return false;
+  }
+  const Mul* mul = to<Mul>(iexpr->value);
+  if (!isa<IndexedTensor>(mul->a) || !isa<IndexedTensor>(mul->b)) {
+    return false;
+  }
+  const IndexVar& i = to<IndexedTensor>(mul->a)->indexVars[0];
+  return i.isReductionVar() && i.getOperator() == ReductionOperator::Sum &&
+         i == to<IndexedTensor>(mul->b)->indexVars[0];
+}
+
+Stmt lowerSpMVWithEpilogue(Var product, const IndexExpr* spmv, Expr target,
+                           const IndexExpr* epilogue, bool storeProduct,
+                           const Storage& storage) {
+  const IndexedTensor* matrix;
+  const IndexedTensor* vector;
+  bool isSpMV = getSpMVOperands(spmv, &matrix, &vector);
+  iassert(isSpMV) << "not a sparse matrix-vector multiply: " << Expr(spmv);
+  UNUSED(isSpMV);
+
+  Var A = to<VarExpr>(matrix->tensor)->var;
+  const TensorIndex& index = storage.getStorage(A).getTensorIndex();
+  const TensorType* type = A.getType().toTensor();
+  std::vector<int> blockDimensions = getBlockDimensions(type);
+  bool blocked = !isScalar(type->getBlockType());
+  int rows = blockDimensions[0];
+  int cols = blockDimensions[1];
+
+  Var i("i", Int);
+  Var ij("ij", Int);
+  Var ii("ii", Int);
+  Var jj("jj", Int);
+  Var value(INTERNAL_PREFIX(product.getName()), Float);
+
+  // Each component of the product is computed from a block row of the matrix
+  Expr j = Load::make(index.getColidxArray(), ij);
+  Expr component  = blocked ? i*rows + ii : Expr(i);
+  Expr matrixLoc  = blocked ? (ij*rows + ii)*cols + jj : Expr(ij);
+  Expr vectorLoc  = blocked ? j*cols + jj : j;
+  Stmt multiply = AssignStmt::make(value, Load::make(A, matrixLoc) *
+                                          Load::make(vector->tensor, vectorLoc),
+                                   CompoundOperator::Add);
+  if (blocked) {
+    multiply = For::make(jj, ForDomain(IndexSet(cols)), multiply);
+  }
+  Expr start = Load::make(index.getRowptrArray(), i);
+  Expr stop  = Load::make(index.getRowptrArray(), i+1);
+  std::vector<Stmt> body = {VarDecl::make(value),
+                            AssignStmt::make(value, 0.0),
+                            ForRange::make(ij, start, stop, multiply)};
+  if (storeProduct) {
+    body.push_back(Store::make(product, component, value));
+  }
+
+  // The epilogue reads the product from a register, and the components of the
+  // other vectors of the current row
+  class SubstituteOperands : public IRRewriter {
+  public:
+    SubstituteOperands(Var product, Var value, Expr component)
+        : product(product), value(value), component(component) {}
+  private:
+    Var product;
+    Var value;
+    Expr component;
+    using IRRewriter::visit;
+    void visit(const IndexedTensor* op) {
+      if (isa<VarExpr>(op->tensor) && to<VarExpr>(op->tensor)->var == product) {
+        expr = value;
+      }
+      else if (op->indexVars.empty()) {
+        expr = op->tensor;
+      }
+      else {
+        expr = Load::make(op->tensor, component);
+      }
+    }
+  };
+  SubstituteOperands substitute(product, value, component);
+
+  // Element-wise epilogues store the components of the result, and inner
+  // products accumulate them
+  Stmt init;
+  if (!epilogue->resultVars.empty()) {
+    body.push_back(Store::make(target, component,
+                               substitute.rewrite(epilogue->value)));
+  }
+  else {
+    Var result = to<VarExpr>(target)->var;
+    init = AssignStmt::make(result, 0.0);
+    body.push_back(AssignStmt::make(result, substitute.rewrite(epilogue->value),
+                                    CompoundOperator::Add));
+  }
+
+  Stmt loop = Block::make(body);
+  if (blocked) {
+    loop = For::make(ii, ForDomain(IndexSet(rows)), loop);
+  }
+  loop = For::make(i, type->getOuterDimensions()[0], loop);
+  return init.defined() ? Block::make(init, loop) : loop;
+}
+
+}}
@@ -0,0 +1,62 @@
+#ifndef SIMIT_LOWER_SPMV_H
+#define SIMIT_LOWER_SPMV_H
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// The largest block size of the block-specialized sparse matrix-vector
+/// multiply kernels in the runtime.
+const int kMaxSpMVBlockSize = 4;
+
+/// True if `target = iexpr` is a multiplication `y(i) = A(i,+j)*x(+j)` of an
+/// indexed (BCSR) system matrix, with square blocks of a size the runtime has
+/// specialized kernels for, by a dense vector. Operands whose components are
+/// stored with different precisions are multiplied by mixed-precision kernels.
+bool isBlockedSpMV(Expr target, const IndexExpr* iexpr, const Storage& storage);
+
+/// Lower a blocked sparse matrix-vector multiply (see isBlockedSpMV) to a call
+/// to the block-size-specialized runtime kernel.
+Stmt lowerBlockedSpMV(Expr target, const IndexExpr* iexpr);
+
+/// Returns the matrix of a multiplication `y(i) = A(i,+j)*x(+j)`, or an
+/// undefined expression if `iexpr` is not a matrix-vector multiply.
+Expr getSpMVMatrix(const IndexExpr* iexpr);
+
+/// True if `target = iexpr` is a multiplication `y(i) = At(i,+j)*x(+j)`, where
+/// `At` is the transpose of `matrix`, that can be computed by a transposed
+/// traversal of `matrix` instead. The matrix must be an indexed (BCSR) system
+/// matrix of floats or ints, with blocks of at most kMaxSpMVBlockSize rows and
+/// columns, and the vectors must be dense.
+bool isBlockedSpMVT(Expr target, const IndexExpr* iexpr, Expr matrix,
+                    const Storage& storage);
+
+/// Lower a transposed sparse matrix-vector multiply (see isBlockedSpMVT) to a
+/// call to the block-specialized runtime kernel, which scatters the products
+/// of the rows of `matrix` into the result.
+Stmt lowerBlockedSpMVT(Expr target, const IndexExpr* iexpr, Expr matrix);
+
+/// True if `target = iexpr` is a multiplication `y(i) = A(i,+j)*x(+j)` of an
+/// indexed (BCSR) system matrix of floats by a dense vector, which can be
+/// computed in one loop with a statement that uses its result.
+bool isFusableSpMV(Var target, const IndexExpr* iexpr, const Storage& storage);
+
+/// True if `target = iexpr` uses the result `product` of the fusable multiply
+/// `spmv` (see isFusableSpMV), and can be computed row by row as the multiply
+/// computes the product. That is, if it is an element-wise expression of dense
+/// vectors or the inner product of two dense vectors, and its target is not
+/// the multiplied vector.
+bool isSpMVEpilogue(Expr target, const IndexExpr* iexpr, Var product,
+                    const IndexExpr* spmv);
+
+/// Lower the multiply `product = spmv` and its epilogue `target = epilogue`
+/// (see isSpMVEpilogue) to one loop over the rows of the matrix, where each
+/// component of the product is used by the epilogue as soon as it is computed.
+/// The product is only stored if `storeProduct`.
+Stmt lowerSpMVWithEpilogue(Var product, const IndexExpr* spmv, Expr target,
+                           const IndexExpr* epilogue, bool storeProduct,
+                           const Storage& storage);
+
+}}
+#endif
@@ -5,8 +5,17 @@
 #include "intrinsics.h"
 
 namespace simit {
+extern std::string kBackend;
+
 namespace ir {
 
+/// True if the tensor index is assembled when the function is initialized.
+static bool isPreassembled(const TensorIndex& index, const Environment* env) {
+  return index.getKind() == TensorIndex::PExpr &&
+         env->hasTensorIndex(index.getPathExpression()) &&
+         env->getTensorIndex(index.getPathExpression()) == index;
+}
+
 Stmt lowerTranspose(Var target, const IndexExpr* iexpr,
                     Environment* env, Storage* storage) {
   iassert(isa<IndexedTensor>(iexpr->value));
@@ -23,11 +32,21 @@ Stmt lowerTranspose(Var target, const IndexExpr* iexpr,
   Var ij("ij", Int);
   Var  j("j",  Int);
 
+  // The locations of the transposed non-zeros of pre-assembled indices are
+  // computed when the function is initialized. Other indices are searched.
   Var locVar(INTERNAL_PREFIX("locVar"), Int);
-  Stmt locStmt = CallStmt::make({locVar}, intrinsics::loc(),
-                                {Load::make(sourceIndex.getColidxArray(),ij), i,
-                                 targetIndex.getRowptrArray(),
-                                 targetIndex.getColidxArray()});
+  Stmt locStmt;
+  if (kBackend == "cpu" && isPreassembled(sourceIndex, env) &&
+      isPreassembled(targetIndex, env)) {
+    Var locations = env->addTransposition(sourceIndex, targetIndex);
+    locStmt = AssignStmt::make(locVar, Load::make(locations, ij));
+  }
+  else {
+    locStmt = CallStmt::make({locVar}, intrinsics::loc(),
+                             {Load::make(sourceIndex.getColidxArray(),ij), i,
+                              targetIndex.getRowptrArray(),
+                              targetIndex.getColidxArray()});
+  }
   Stmt body;
   auto blockType = *sourceType->getBlockType().toTensor();
   if (blockType.order() == 0) {  // Not blocked
@@ -10,6 +10,8 @@
 #include "lower_prints.h"
 #include "lower_string_ops.h"
 #include "lower_stencil_assemblies.h"
+#include "lower_parallel_loops.h"
+#include "fuse_loops.h"
 
 #include "storage.h"
 #include "timers.h"
@@ -29,6 +31,7 @@ using namespace std;
 
 namespace simit {
 extern std::string kBackend;
+extern int kThreads;
 
 namespace ir {
 
@@ -145,12 +148,24 @@ Func lower(Func func, std::ostream* os, bool time) {
   func = rewriteCallGraph(func, lowerTensorAccesses);
   printCallGraph("Lower Tensor Reads and Writes", func, os);
 
+  // Fuse consecutive loops over the same sets
+  if (kBackend == "cpu") {
+    func = rewriteCallGraph(func, fuseLoops);
+    printCallGraph("Fuse Loops", func, os);
+  }
+
   if (time) {
     printTimedCallGraph("Insert Timers", func, os);
     func = rewriteCallGraph(func, insertTimers);
     printCallGraph("Insert Timers", func, os);
   }
 
+  // Lower independent loops to parallel loops
+  if (kBackend == "cpu" && kThreads > 1) {
+    func = rewriteCallGraph(func, lowerParallelLoops);
+    printCallGraph("Lower Parallel Loops", func, os);
+  }
+
   // Lower to GPU Kernels
 #if GPU
   if (kBackend == "gpu") {
@@ -0,0 +1,627 @@
+#include "lower_parallel_loops.h"
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir_rewriter.h"
+#include "ir_visitor.h"
+#include "intrinsics.h"
+#include "util/collections.h"
+
+using namespace std;
+
+namespace simit {
+namespace ir {
+
+bool getBufferId(const Expr &buffer, BufferId *id) {
+  if (isa<VarExpr>(buffer)) {
+    *id = BufferId(to<VarExpr>(buffer)->var, "");
+    return true;
+  }
+  if (isa<FieldRead>(buffer)) {
+    const FieldRead *fieldRead = to<FieldRead>(buffer);
+    if (isa<VarExpr>(fieldRead->elementOrSet)) {
+      *id = BufferId(to<VarExpr>(fieldRead->elementOrSet)->var,
+                     fieldRead->fieldName);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool getConstant(const Expr &expr, int *value) {
+  if (isa<Literal>(expr) && isScalar(expr.type()) &&
+      expr.type().toTensor()->getComponentType().kind == ScalarType::Int) {
+    *value = to<Literal>(expr)->getIntVal(0);
+    return true;
+  }
+  if (isa<Length>(expr) &&
+      to<Length>(expr)->indexSet.getKind() == IndexSet::Range) {
+    *value = to<Length>(expr)->indexSet.getSize();
+    return true;
+  }
+  int a, b;
+  if (isa<Mul>(expr) && getConstant(to<Mul>(expr)->a, &a) &&
+      getConstant(to<Mul>(expr)->b, &b)) {
+    *value = a * b;
+    return true;
+  }
+  return false;
+}
+
+bool getLoopVarBounds(const Stmt &loop, pair<int,int> *bounds) {
+  if (isa<ForRange>(loop)) {
+    int start, end;
+    if (!getConstant(to<ForRange>(loop)->start, &start) ||
+        !getConstant(to<ForRange>(loop)->end, &end) || end <= start) {
+      return false;
+    }
+    *bounds = pair<int,int>(start, end-1);
+    return true;
+  }
+  if (isa<For>(loop)) {
+    const ForDomain &domain = to<For>(loop)->domain;
+    if (domain.kind != ForDomain::IndexSet ||
+        domain.indexSet.getKind() != IndexSet::Range ||
+        domain.indexSet.getSize() <= 0) {
+      return false;
+    }
+    *bounds = pair<int,int>(0, domain.indexSet.getSize()-1);
+    return true;
+  }
+  return false;
+}
+
+/// Retrieve the stride `c` of a term `loopVar` or `loopVar*c`, where `c` is a
+/// positive constant.
+static bool getLoopVarStride(const Expr &expr, const Var &loopVar,
+                             int *stride) {
+  if (isa<VarExpr>(expr)) {
+    *stride = 1;
+    return to<VarExpr>(expr)->var == loopVar;
+  }
+  if (isa<Mul>(expr)) {
+    const Mul *mul = to<Mul>(expr);
+    int a, b;
+    if ((getLoopVarStride(mul->a, loopVar, &a) && getConstant(mul->b, &b)) ||
+        (getConstant(mul->a, &a) && getLoopVarStride(mul->b, loopVar, &b))) {
+      *stride = a * b;
+      return *stride > 0;
+    }
+  }
+  return false;
+}
+
+/// Retrieve the smallest and largest values of a sum of constants and of
+/// constant multiples of the bounded loop variables.
+static bool getBounds(const Expr &expr, const LoopVarBounds &loopVars,
+                      int *min, int *max) {
+  int value;
+  if (getConstant(expr, &value)) {
+    *min = value;
+    *max = value;
+    return true;
+  }
+  if (isa<VarExpr>(expr)) {
+    auto bounds = loopVars.find(to<VarExpr>(expr)->var);
+    if (bounds == loopVars.end()) {
+      return false;
+    }
+    *min = bounds->second.first;
+    *max = bounds->second.second;
+    return true;
+  }
+  int aMin, aMax, bMin, bMax;
+  if (isa<Add>(expr)) {
+    if (!getBounds(to<Add>(expr)->a, loopVars, &aMin, &aMax) ||
+        !getBounds(to<Add>(expr)->b, loopVars, &bMin, &bMax)) {
+      return false;
+    }
+    *min = aMin + bMin;
+    *max = aMax + bMax;
+    return true;
+  }
+  if (isa<Mul>(expr)) {
+    const Mul *mul = to<Mul>(expr);
+    Expr term = mul->a;
+    if (!getConstant(mul->b, &value)) {
+      term = mul->b;
+      if (!getConstant(mul->a, &value)) {
+        return false;
+      }
+    }
+    if (!getBounds(term, loopVars, &aMin, &aMax)) {
+      return false;
+    }
+    *min = std::min(value*aMin, value*aMax);
+    *max = std::max(value*aMin, value*aMax);
+    return true;
+  }
+  return false;
+}
+
+/// True if `expr` is computed from constants and from at least one of `vars`.
+static bool isInvariant(const Expr &expr, const set<Var> &vars) {
+  class InvariantVisitor : public IRVisitor {
+  public:
+    InvariantVisitor(const set<Var> &vars) : vars(vars) {}
+    bool invariant = true;
+    bool found = false;
+  private:
+    const set<Var> &vars;
+    using IRVisitor::visit;
+    void visit(const VarExpr *op) {
+      if (util::contains(vars, op->var)) {
+        found = true;
+      }
+      else {
+        invariant = false;
+      }
+    }
+    void visit(const Literal *op) {}
+    void visit(const Length *op) {
+      invariant &= (op->indexSet.getKind() == IndexSet::Range);
+    }
+    void visit(const Add *op) {IRVisitor::visit(op);}
+    void visit(const Sub *op) {IRVisitor::visit(op);}
+    void visit(const Mul *op) {IRVisitor::visit(op);}
+    void visit(const Load *op) {invariant = false;}
+    void visit(const Div *op) {invariant = false;}
+    void visit(const Rem *op) {invariant = false;}
+    void visit(const FieldRead *op) {invariant = false;}
+    void visit(const IndexRead *op) {invariant = false;}
+  };
+  InvariantVisitor visitor(vars);
+  expr.accept(&visitor);
+  return visitor.invariant && visitor.found;
+}
+
+static void getTerms(const Expr &expr, vector<Expr> *terms) {
+  if (isa<Add>(expr)) {
+    getTerms(to<Add>(expr)->a, terms);
+    getTerms(to<Add>(expr)->b, terms);
+  }
+  else {
+    terms->push_back(expr);
+  }
+}
+
+bool isIterationLocal(const Expr &index, const Var &loopVar,
+                      const LoopVarBounds &innerLoopVars, Expr *loopVarTerm,
+                      const set<Var> &invariantVars,
+                      vector<Expr> *invariantTerms) {
+  vector<Expr> terms;
+  getTerms(index, &terms);
+
+  int loopVarTerms = 0;
+  int stride = 0;
+  int offsetMin = 0;
+  int offsetMax = 0;
+  for (auto &term : terms) {
+    int termStride, min, max;
+    if (getLoopVarStride(term, loopVar, &termStride)) {
+      stride = termStride;
+      ++loopVarTerms;
+      if (loopVarTerm != nullptr) {
+        *loopVarTerm = term;
+      }
+    }
+    else if (getBounds(term, innerLoopVars, &min, &max)) {
+      offsetMin += min;
+      offsetMax += max;
+    }
+    else if (isInvariant(term, invariantVars)) {
+      if (invariantTerms != nullptr) {
+        invariantTerms->push_back(term);
+      }
+    }
+    else {
+      return false;
+    }
+  }
+  return loopVarTerms == 1 && offsetMin >= 0 && offsetMax < stride;
+}
+
+/// True if the function, or a function it calls, declares non-scalar local
+/// tensors. The backend stores these in global buffers that can not be shared
+/// by concurrent iterations.
+static bool hasLocalTensors(const Func &func) {
+  class LocalTensorsVisitor : public IRVisitor {
+  public:
+    bool found = false;
+
+  private:
+    set<Func> visited;
+
+    using IRVisitor::visit;
+
+    void visit(const VarDecl *op) {
+      if (!isScalar(op->var.getType())) {
+        found = true;
+      }
+    }
+
+    void visit(const CallStmt *op) {
+      IRVisitor::visit(op);
+      const Func &callee = op->callee;
+      if (callee.getKind() == Func::Internal &&
+          !util::contains(visited, callee)) {
+        visited.insert(callee);
+        callee.getBody().accept(this);
+      }
+    }
+  };
+  LocalTensorsVisitor visitor;
+  func.getBody().accept(&visitor);
+  return visitor.found;
+}
+
+/// Classifies the dependences between the iterations of a loop over a set, and
+/// determines the most parallel loop kind that respects them.
+class LoopDependences : public IRVisitor {
+public:
+  LoopDependences(const Var &loopVar, const Expr &set)
+      : loopVar(loopVar), loopSet(set) {}
+
+  For::Kind analyze(const Stmt &body) {
+    independent = true;
+    colorable = loopSet.type().isUnstructuredSet() &&
+                loopSet.type().toUnstructuredSet()->getCardinality() > 0;
+    body.accept(this);
+
+    // Reads from buffers the loop writes to must not touch the locations
+    // written by iterations that may execute concurrently
+    for (auto &load : loads) {
+      if (!util::contains(writtenBuffers, load.first) ||
+          isIterationLocal(load.second, loopVar, innerLoopBounds)) {
+        continue;
+      }
+      if (isEndpointAddressed(load.second)) {
+        independent = false;
+      }
+      else {
+        dependent();
+      }
+    }
+
+    if (independent) {
+      return For::Parallel;
+    }
+    return colorable ? For::Colored : For::Serial;
+  }
+
+private:
+  Var loopVar;
+  Expr loopSet;
+
+  bool independent;
+  bool colorable;
+
+  set<Var> declaredVars;
+  set<Var> innerLoopVars;
+  LoopVarBounds innerLoopBounds;
+  set<BufferId> writtenBuffers;
+  vector<pair<BufferId,Expr>> loads;
+
+  /// Variables and local buffers whose values are computed from the endpoints
+  /// of the current edge.
+  set<Var> endpointVars;
+
+  using IRVisitor::visit;
+
+  void dependent() {
+    independent = false;
+    colorable = false;
+  }
+
+  bool isDeclared(const Var &var) {
+    return util::contains(declaredVars, var);
+  }
+
+  bool isEndpointsRead(const Expr &buffer) {
+    if (!isa<IndexRead>(buffer)) {
+      return false;
+    }
+    const IndexRead *indexRead = to<IndexRead>(buffer);
+    if (indexRead->kind != IndexRead::Endpoints) {
+      return false;
+    }
+    const Expr &edgeSet = indexRead->edgeSet;
+    if (isa<VarExpr>(edgeSet) && isa<VarExpr>(loopSet)) {
+      return to<VarExpr>(edgeSet)->var == to<VarExpr>(loopSet)->var;
+    }
+    return edgeSet == loopSet;
+  }
+
+  bool isEndpointVar(const Expr &expr) {
+    return isa<VarExpr>(expr) &&
+           util::contains(endpointVars, to<VarExpr>(expr)->var);
+  }
+
+  /// True if `expr` reads the endpoints of the current edge.
+  bool refersToEndpoints(const Expr &expr) {
+    class EndpointsVisitor : public IRVisitor {
+    public:
+      EndpointsVisitor(LoopDependences *analysis) : analysis(analysis) {}
+      bool found = false;
+    private:
+      LoopDependences *analysis;
+      using IRVisitor::visit;
+      void visit(const VarExpr *op) {
+        if (analysis->isEndpointVar(op)) {
+          found = true;
+        }
+      }
+      void visit(const Load *op) {
+        if (analysis->isEndpointsRead(op->buffer)) {
+          found = true;
+        }
+        IRVisitor::visit(op);
+      }
+    };
+    EndpointsVisitor visitor(this);
+    expr.accept(&visitor);
+    return visitor.found;
+  }
+
+  /// True if the index only addresses locations owned by the endpoints of the
+  /// current edge. Edges that share no endpoints therefore write to disjoint
+  /// locations.
+  bool isEndpointAddressed(const Expr &index) {
+    class AddressVisitor : public IRVisitor {
+    public:
+      AddressVisitor(LoopDependences *analysis) : analysis(analysis) {}
+      bool addressed = true;
+    private:
+      LoopDependences *analysis;
+      using IRVisitor::visit;
+      void visit(const VarExpr *op) {
+        if (!analysis->isEndpointVar(op) &&
+            !util::contains(analysis->innerLoopVars, op->var)) {
+          addressed = false;
+        }
+      }
+      void visit(const Load *op) {
+        // The index of an endpoint read is computed within the iteration
+        if (!analysis->isEndpointsRead(op->buffer) &&
+            !analysis->isEndpointVar(op->buffer)) {
+          addressed = false;
+        }
+      }
+      void visit(const Add *op) {IRVisitor::visit(op);}
+      void visit(const Sub *op) {IRVisitor::visit(op);}
+      void visit(const Mul *op) {IRVisitor::visit(op);}
+      void visit(const Literal *op) {}
+      void visit(const Div *op) {addressed = false;}
+      void visit(const Rem *op) {addressed = false;}
+      void visit(const FieldRead *op) {addressed = false;}
+      void visit(const Length *op) {addressed = false;}
+      void visit(const IndexRead *op) {addressed = false;}
+    };
+    AddressVisitor visitor(this);
+    index.accept(&visitor);
+    return visitor.addressed && refersToEndpoints(index);
+  }
+
+  void visit(const VarDecl *op) {
+    // System tensors declared in the loop can not be given private storage
+    if (isSystemTensorType(op->var.getType()) ||
+        !op->var.getType().isTensor()) {
+      dependent();
+    }
+    declaredVars.insert(op->var);
+  }
+
+  void visit(const AssignStmt *op) {
+    if (!isDeclared(op->var)) {
+      dependent();
+    }
+    if (refersToEndpoints(op->value)) {
+      endpointVars.insert(op->var);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const CallStmt *op) {
+    const Func &callee = op->callee;
+    if (callee.getKind() == Func::External ||
+        callee == intrinsics::clock() || callee == intrinsics::storeTime() ||
+        (callee.getKind() == Func::Internal && hasLocalTensors(callee))) {
+      dependent();
+    }
+    bool endpointActuals = false;
+    for (auto &actual : op->actuals) {
+      endpointActuals |= refersToEndpoints(actual);
+    }
+    for (auto &result : op->results) {
+      if (!isDeclared(result)) {
+        dependent();
+      }
+      if (endpointActuals) {
+        endpointVars.insert(result);
+      }
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Store *op) {
+    BufferId buffer;
+    if (!getBufferId(op->buffer, &buffer)) {
+      dependent();
+    }
+    else if (buffer.second == "" && isDeclared(buffer.first)) {
+      if (refersToEndpoints(op->value)) {
+        endpointVars.insert(buffer.first);
+      }
+    }
+    else {
+      if (isIterationLocal(op->index, loopVar, innerLoopBounds)) {
+        // Each iteration writes to its own locations
+      }
+      else if (op->cop == CompoundOperator::Add &&
+               isEndpointAddressed(op->index)) {
+        // Edges that share endpoints accumulate to the same locations
+        independent = false;
+      }
+      else {
+        dependent();
+      }
+      writtenBuffers.insert(buffer);
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const Load *op) {
+    BufferId buffer;
+    if (getBufferId(op->buffer, &buffer)) {
+      loads.push_back(pair<BufferId,Expr>(buffer, op->index));
+    }
+    IRVisitor::visit(op);
+  }
+
+  void visit(const ForRange *op) {
+    addInnerLoop(op, op->var);
+    IRVisitor::visit(op);
+  }
+
+  void visit(const For *op) {
+    addInnerLoop(op, op->var);
+    IRVisitor::visit(op);
+  }
+
+  void addInnerLoop(const Stmt &loop, const Var &var) {
+    innerLoopVars.insert(var);
+    pair<int,int> bounds;
+    if (getLoopVarBounds(loop, &bounds)) {
+      innerLoopBounds[var] = bounds;
+    }
+  }
+
+  void visit(const FieldWrite *op) {
+    dependent();
+  }
+
+  void visit(const Print *op) {
+    dependent();
+  }
+
+  void visit(const Kernel *op) {
+    dependent();
+  }
+};
+
+class LowerParallelLoops : public IRRewriter {
+  using IRRewriter::visit;
+
+  void visit(const For *op) {
+    For::Kind kind = For::Serial;
+    if (op->kind == For::Serial && op->domain.kind == ForDomain::IndexSet &&
+        op->domain.indexSet.getKind() == IndexSet::Set) {
+      const Expr &set = op->domain.indexSet.getSet();
+      kind = LoopDependences(op->var, set).analyze(op->body);
+    }
+
+    if (kind != For::Serial) {
+      stmt = For::make(op->var, op->domain, op->body, kind);
+    }
+    else {
+      IRRewriter::visit(op);
+    }
+  }
+};
+
+Func lowerParallelLoops(Func func) {
+  return LowerParallelLoops().rewrite(func);
+}
+
+bool getReductionBuffers(const For *loop, std::vector<Var> *buffers) {
+  class ReductionBuffersVisitor : public IRVisitor {
+  public:
+    ReductionBuffersVisitor(const Var &loopVar) : loopVar(loopVar) {}
+
+    bool reducible = true;
+    vector<Var> reductionBuffers;
+    set<BufferId> loadedBuffers;
+    set<BufferId> overwrittenBuffers;
+
+  private:
+    Var loopVar;
+    set<Var> declaredVars;
+    LoopVarBounds innerLoopVars;
+
+    using IRVisitor::visit;
+
+    void visit(const VarDecl *op) {
+      declaredVars.insert(op->var);
+    }
+
+    void visit(const Store *op) {
+      BufferId buffer;
+      if (!getBufferId(op->buffer, &buffer)) {
+        reducible = false;
+      }
+      else if (buffer.second != "" || !util::contains(declaredVars,
+                                                      buffer.first)) {
+        if (!isIterationLocal(op->index, loopVar, innerLoopVars)) {
+          if (op->cop == CompoundOperator::Add && buffer.second == "") {
+            if (!util::contains(reductionBuffers, buffer.first)) {
+              reductionBuffers.push_back(buffer.first);
+            }
+          }
+          else {
+            reducible = false;
+          }
+        }
+        else if (op->cop != CompoundOperator::Add) {
+          overwrittenBuffers.insert(buffer);
+        }
+      }
+      IRVisitor::visit(op);
+    }
+
+    void visit(const Load *op) {
+      BufferId buffer;
+      if (getBufferId(op->buffer, &buffer)) {
+        loadedBuffers.insert(buffer);
+      }
+      IRVisitor::visit(op);
+    }
+
+    void visit(const ForRange *op) {
+      pair<int,int> bounds;
+      if (getLoopVarBounds(op, &bounds)) {
+        innerLoopVars[op->var] = bounds;
+      }
+      IRVisitor::visit(op);
+    }
+
+    void visit(const For *op) {
+      pair<int,int> bounds;
+      if (getLoopVarBounds(op, &bounds)) {
+        innerLoopVars[op->var] = bounds;
+      }
+      IRVisitor::visit(op);
+    }
+  };
+
+  iassert(loop->kind == For::Colored);
+  ReductionBuffersVisitor visitor(loop->var);
+  loop->body.accept(&visitor);
+  if (!visitor.reducible) {
+    return false;
+  }
+  for (auto &buffer : visitor.reductionBuffers) {
+    BufferId bufferId(buffer, "");
+    if (util::contains(visitor.loadedBuffers, bufferId) ||
+        util::contains(visitor.overwrittenBuffers, bufferId)) {
+      return false;
+    }
+  }
+  *buffers = visitor.reductionBuffers;
+  return true;
+}
+
+}}
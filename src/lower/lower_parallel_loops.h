@@ -0,0 +1,72 @@
+#ifndef SIMIT_LOWER_PARALLEL_LOOPS_H
+#define SIMIT_LOWER_PARALLEL_LOOPS_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+
+namespace simit {
+namespace ir {
+
+/// Identifies a buffer by its variable, or by a set variable and a field name.
+typedef std::pair<Var,std::string> BufferId;
+
+/// Retrieve the identifier of a loaded or stored buffer. Returns false if the
+/// buffer is not a variable or a field of a set variable.
+bool getBufferId(const Expr &buffer, BufferId *id);
+
+/// The smallest and largest values of the variables of loops over ranges with
+/// constant bounds.
+typedef std::map<Var,std::pair<int,int>> LoopVarBounds;
+
+/// Retrieve the value of an integer constant: a literal, the length of a range,
+/// or a product of them.
+bool getConstant(const Expr &expr, int *value);
+
+/// Retrieve the smallest and largest values of the variable of a loop, if the
+/// loop is a ForRange or a For over a range with constant bounds. Returns
+/// false otherwise.
+bool getLoopVarBounds(const Stmt &loop, std::pair<int,int> *bounds);
+
+/// True if the index only addresses locations owned by the current iteration
+/// of the loop over `loopVar`. That is, the index has the form
+/// `loopVar*c + offset`, where `c` is a positive constant and the offset is a
+/// sum of constants and of constant multiples of the variables of loops nested
+/// inside the loop (the components of the element's block), that lies in
+/// [0,c) for all values of the variables. The iterations therefore address
+/// disjoint slices of length `c`. If `loopVarTerm` is given, it is set to the
+/// term `loopVar*c`.
+///
+/// If `invariantVars` are given, the index may also have terms computed from
+/// them and from constants, that are the same in all iterations of the loop,
+/// and that shift every slice alike. If `invariantTerms` is given, it is set
+/// to these terms.
+bool isIterationLocal(const Expr &index, const Var &loopVar,
+                      const LoopVarBounds &innerLoopVars,
+                      Expr *loopVarTerm=nullptr,
+                      const std::set<Var> &invariantVars=std::set<Var>(),
+                      std::vector<Expr> *invariantTerms=nullptr);
+
+/// Mark the outermost set loops whose iterations are independent as parallel
+/// loops. A loop is independent if each iteration only writes to its own
+/// locations in tensors declared outside the loop (locations indexed by the
+/// loop variable), and does not assign variables declared outside the loop.
+///
+/// Loops over edge sets whose iterations also accumulate (reduce +) into
+/// locations owned by the edge endpoints are marked as colored loops. They
+/// can execute in parallel one edge color at a time.
+Func lowerParallelLoops(Func func);
+
+/// Retrieve the buffers that the iterations of a colored loop accumulate into.
+/// If the iterations only conflict through these updates, then the loop can
+/// also be executed with atomic updates to the buffers, or by accumulating
+/// into thread-private copies of them. Returns false if the loop also reads or
+/// overwrites the buffers, or if it accumulates into set fields.
+bool getReductionBuffers(const For *loop, std::vector<Var> *buffers);
+
+}}
+#endif
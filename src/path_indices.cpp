@@ -1,13 +1,20 @@
 #include "path_indices.h"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <stack>
+#include <iterator>
 #include <map>
+#include <numeric>
+#include <sstream>
 #include <vector>
 
 #include "path_expressions.h"
 #include "graph.h"
 #include "util/collections.h"
+#include "util/memory.h"
+#include "util/thread_pool.h"
 
 using namespace std;
 
@@ -144,12 +151,477 @@ void SegmentedPathIndex::print(std::ostream &os) const {
 }
 
 
+namespace {
+
+/// The rows of a segmented path index, as CSR arrays.
+struct Rows {
+  Rows(const PathIndex &pi)
+      : numElements(pi.numElements()),
+        coords(to<SegmentedPathIndex>(pi)->getCoordData()),
+        sinks(to<SegmentedPathIndex>(pi)->getSinkData()) {}
+
+  const unsigned* begin(unsigned elem) const {return &sinks[coords[elem]];}
+  const unsigned* end(unsigned elem) const {return &sinks[coords[elem+1]];}
+  unsigned size(unsigned elem) const {return coords[elem+1]-coords[elem];}
+  unsigned numNeighbors() const {return coords[numElements];}
+
+  unsigned numElements;
+  const unsigned* coords;
+  const unsigned* sinks;
+};
+
+/// Call `body(chunk)` for every chunk in [0,numChunks) on the thread pool.
+template <typename Body>
+void forEachChunk(size_t numChunks, const Body &body) {
+  if (numChunks == 1) {
+    body(0);
+    return;
+  }
+  util::ThreadPool::getInstance().parallelFor(numChunks,
+      [&body](int start, int end) {
+        for (int chunk = start; chunk < end; ++chunk) {
+          body(chunk);
+        }
+      });
+}
+
+/// Build the CSR arrays of a path index with `numElements` elements, where
+/// `appendRow(elem, &sinks)` appends the path neighbors of `elem` to `sinks`.
+/// If `dedup` is true then every row is sorted and its duplicates removed.
+///
+/// The rows are built in parallel, in contiguous chunks of elements that are
+/// appended to one buffer per chunk. The buffers are copied into the sinks
+/// array once the row sizes have been prefix-summed into the coords array.
+template <typename AppendRow>
+void buildRows(size_t numElements, const AppendRow &appendRow, bool dedup,
+               uint32_t **coordsData, uint32_t **sinksData) {
+  const size_t minChunkSize = 1024;
+  size_t numThreads = util::ThreadPool::getInstance().getNumThreads();
+  size_t numChunks = max<size_t>(1, min(4*numThreads,
+                                        numElements/minChunkSize));
+  auto chunkStart = [=](size_t chunk) {return chunk*numElements/numChunks;};
+
+  uint32_t* coords = (uint32_t*)
+      util::alignedMalloc((numElements+1)*sizeof(uint32_t));
+  vector<vector<uint32_t>> chunkSinks(numChunks);
+  forEachChunk(numChunks, [&](size_t chunk) {
+    vector<uint32_t> &sinks = chunkSinks[chunk];
+    for (size_t elem = chunkStart(chunk); elem < chunkStart(chunk+1); ++elem) {
+      size_t rowStart = sinks.size();
+      appendRow(elem, &sinks);
+      if (dedup) {
+        sort(sinks.begin()+rowStart, sinks.end());
+        sinks.erase(unique(sinks.begin()+rowStart, sinks.end()), sinks.end());
+      }
+      coords[elem+1] = sinks.size() - rowStart;
+    }
+  });
+
+  coords[0] = 0;
+  for (size_t elem = 0; elem < numElements; ++elem) {
+    coords[elem+1] += coords[elem];
+  }
+
+  uint32_t* sinks = (uint32_t*)
+      util::alignedMalloc(coords[numElements]*sizeof(uint32_t));
+  forEachChunk(numChunks, [&](size_t chunk) {
+    vector<uint32_t> &chunkSink = chunkSinks[chunk];
+    if (chunkSink.size() > 0) {
+      memcpy(&sinks[coords[chunkStart(chunk)]], chunkSink.data(),
+             chunkSink.size()*sizeof(uint32_t));
+    }
+    vector<uint32_t>().swap(chunkSink);
+  });
+
+  *coordsData = coords;
+  *sinksData = sinks;
+}
+
+/// Compute the `changed` rows with `appendRow` (as in buildRows). Changed row
+/// `i` is stored in `changedSinks` from `changedStarts[i]` to
+/// `changedStarts[i+1]`.
+template <typename AppendRow>
+void buildChangedRows(const vector<unsigned> &changed,
+                      const AppendRow &appendRow, bool dedup,
+                      vector<uint32_t> *changedSinks,
+                      vector<size_t> *changedStarts) {
+  changedStarts->assign(1, 0);
+  for (unsigned elem : changed) {
+    size_t rowStart = changedSinks->size();
+    appendRow(elem, changedSinks);
+    if (dedup) {
+      sort(changedSinks->begin()+rowStart, changedSinks->end());
+      changedSinks->erase(unique(changedSinks->begin()+rowStart,
+                                 changedSinks->end()), changedSinks->end());
+    }
+    changedStarts->push_back(changedSinks->size());
+  }
+}
+
+/// Build the CSR arrays of a path index with `numElements` elements from the
+/// rows of an old version of it, where only the `changed` rows are recomputed
+/// with `appendRow` (as in buildRows). Runs of unchanged rows are contiguous in
+/// the old sinks, so they are copied in one piece. Rows past the end of the old
+/// path index must be changed. Used when the old path index is shared, and
+/// must be left as it is.
+template <typename AppendRow>
+void patchRows(const Rows &old, size_t numElements,
+               const vector<unsigned> &changed, const AppendRow &appendRow,
+               bool dedup, uint32_t **coordsData, uint32_t **sinksData) {
+  vector<uint32_t> changedSinks;
+  vector<size_t> changedStarts;
+  buildChangedRows(changed, appendRow, dedup, &changedSinks, &changedStarts);
+
+  uint32_t* coords = (uint32_t*)
+      util::alignedMalloc((numElements+1)*sizeof(uint32_t));
+  coords[0] = 0;
+  size_t next = 0;
+  for (size_t elem = 0; elem < numElements; ++elem) {
+    size_t size;
+    if (next < changed.size() && changed[next] == elem) {
+      size = changedStarts[next+1] - changedStarts[next];
+      ++next;
+    }
+    else {
+      iassert(elem < old.numElements) << "new rows must be changed";
+      size = old.size(elem);
+    }
+    coords[elem+1] = coords[elem] + size;
+  }
+
+  uint32_t* sinks = (uint32_t*)
+      util::alignedMalloc(coords[numElements]*sizeof(uint32_t));
+  size_t elem = 0;
+  next = 0;
+  while (elem < numElements) {
+    if (next < changed.size() && changed[next] == elem) {
+      memcpy(&sinks[coords[elem]], &changedSinks[changedStarts[next]],
+             (coords[elem+1]-coords[elem])*sizeof(uint32_t));
+      ++next;
+      ++elem;
+    }
+    else {
+      size_t end = (next < changed.size()) ? changed[next] : numElements;
+      memcpy(&sinks[coords[elem]], old.begin(elem),
+             (coords[end]-coords[elem])*sizeof(uint32_t));
+      elem = end;
+    }
+  }
+
+  *coordsData = coords;
+  *sinksData = sinks;
+}
+
+/// Grow an array that was allocated with alignedMalloc to `size` elements.
+/// realloc remaps large buffers rather than copying them, but the array is
+/// copied to a new buffer if realloc did not keep it aligned.
+uint32_t* growArray(uint32_t *array, size_t size) {
+  uint32_t *grown = (uint32_t*)realloc(array, size*sizeof(uint32_t));
+  if (!util::isAligned(grown)) {
+    grown = (uint32_t*)util::alignedRealloc(grown, size*sizeof(uint32_t),
+                                            size*sizeof(uint32_t));
+  }
+  return grown;
+}
+
+/// Patch the CSR arrays `coordsData` and `sinksData` of a path index with
+/// `oldElements` elements in place, into a path index with `numElements`
+/// elements where the `changed` rows are recomputed with `appendRow` (as in
+/// buildRows). Rows past the end of the old path index must be changed.
+///
+/// Unchanged rows stay where they are until a changed row changes size, and
+/// the runs of unchanged rows after it are moved by the sizes the rows before
+/// them gained or lost. Only the changed rows and the moved runs are touched,
+/// so patching rows that keep their sizes, such as the rows of edges whose
+/// endpoints changed, and appending rows take time proportional to the number
+/// of changed rows.
+template <typename AppendRow>
+void patchRowsInPlace(size_t oldElements, size_t numElements,
+                      const vector<unsigned> &changed,
+                      const AppendRow &appendRow, bool dedup,
+                      uint32_t **coordsData, uint32_t **sinksData) {
+  vector<uint32_t> changedSinks;
+  vector<size_t> changedStarts;
+  buildChangedRows(changed, appendRow, dedup, &changedSinks, &changedStarts);
+
+  uint32_t* coords = *coordsData;
+  uint32_t* sinks = *sinksData;
+  size_t oldNeighbors = coords[oldElements];
+  if (numElements > oldElements) {
+    coords = growArray(coords, numElements+1);
+  }
+
+  // Update the coords of the changed rows and of the runs of unchanged rows
+  // that move, and record the locations of the runs in the old sinks. The
+  // coords up to `elem` are new, and the ones after it are old, so `shift` is
+  // how much the sinks of the next unchanged row move.
+  struct Run {
+    size_t begin;
+    size_t end;
+    ptrdiff_t shift;
+  };
+  vector<Run> runs;
+  ptrdiff_t shift = 0;
+  size_t elem = 0;
+  size_t next = 0;
+  while (elem < numElements) {
+    if (next < changed.size() && changed[next] == elem) {
+      size_t oldEnd = (elem < oldElements) ? coords[elem+1]
+                                           : coords[elem] - shift;
+      size_t size = changedStarts[next+1] - changedStarts[next];
+      coords[elem+1] = coords[elem] + size;
+      shift = (ptrdiff_t)coords[elem+1] - (ptrdiff_t)oldEnd;
+      ++next;
+      ++elem;
+    }
+    else {
+      size_t end = (next < changed.size()) ? changed[next] : numElements;
+      iassert(end <= oldElements) << "new rows must be changed";
+      if (shift != 0) {
+        runs.push_back({(size_t)(coords[elem] - shift), coords[end], shift});
+        for (size_t row = elem+1; row <= end; ++row) {
+          coords[row] += shift;
+        }
+      }
+      elem = end;
+    }
+  }
+
+  // Move the runs without overwriting the ones that have not moved yet: runs
+  // that move left are moved first to last, and runs that move right last to
+  // first. The sinks of a run never overlap the destination of another run.
+  size_t numNeighbors = coords[numElements];
+  if (numNeighbors > oldNeighbors) {
+    sinks = growArray(sinks, numNeighbors);
+  }
+  for (const Run &run : runs) {
+    if (run.shift < 0) {
+      memmove(&sinks[run.begin + run.shift], &sinks[run.begin],
+              (run.end-run.begin)*sizeof(uint32_t));
+    }
+  }
+  for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+    if (run->shift > 0) {
+      memmove(&sinks[run->begin + run->shift], &sinks[run->begin],
+              (run->end-run->begin)*sizeof(uint32_t));
+    }
+  }
+
+  for (size_t i = 0; i < changed.size(); ++i) {
+    size_t size = changedStarts[i+1] - changedStarts[i];
+    if (size > 0) {
+      memcpy(&sinks[coords[changed[i]]], &changedSinks[changedStarts[i]],
+             size*sizeof(uint32_t));
+    }
+  }
+
+  *coordsData = coords;
+  *sinksData = sinks;
+}
+
+/// Prints the key of the path index of a path expression in the
+/// PathIndexCache: the structure of the path expression, with its variables
+/// numbered in order of appearance, and the address and version of the set
+/// that each of its sets is bound to.
+class PathIndexKeyPrinter : public PathExpressionVisitor {
+public:
+  PathIndexKeyPrinter(const PathIndexBuilder *builder) : builder(builder) {}
+
+  string print(const PathExpression &pe, unsigned sourceEndpoint) {
+    os << sourceEndpoint << "(";
+    for (unsigned i=0; i < pe.getNumPathEndpoints(); ++i) {
+      print(pe.getPathEndpoint(i));
+      os << ",";
+    }
+    os << ")";
+    pe.accept(this);
+    return os.str();
+  }
+
+private:
+  const PathIndexBuilder *builder;
+  map<Var,unsigned> varIds;
+  stringstream os;
+
+  void visit(const Link *link) {
+    os << "link" << link->getType() << "(";
+    print(rename(link->getLhs()));
+    print(builder->getBinding(link->getLhsSet()));
+    os << ",";
+    print(rename(link->getRhs()));
+    print(builder->getBinding(link->getRhsSet()));
+    if (link->hasStencil()) {
+      const ir::StencilLayout &stencil = link->getStencil();
+      os << "," << stencil;
+      print(builder->getBinding(stencil.getLatticeSet()));
+    }
+    os << ")";
+  }
+
+  void visit(const And *f) {
+    os << "and";
+    printConnective(f);
+  }
+
+  void visit(const Or *f) {
+    os << "or";
+    printConnective(f);
+  }
+
+  void printConnective(const QuantifiedConnective *f) {
+    os << "[";
+    for (const QuantifiedVar &qvar : f->getQuantifiedVars()) {
+      os << (int)qvar.getQuantifier();
+      print(qvar.getVar());
+    }
+    os << "](";
+    f->getLhs().accept(this);
+    os << ",";
+    f->getRhs().accept(this);
+    os << ")";
+  }
+
+  void print(const Var &var) {
+    if (!util::contains(varIds, var)) {
+      varIds.insert({var, varIds.size()});
+    }
+    os << "v" << varIds.at(var);
+  }
+
+  void print(const simit::Set *set) {
+    os << ":" << set << "@" << set->getVersion();
+  }
+};
+
+}
+
+void computeTransposition(const PathIndex &source, const PathIndex &target,
+                          uint32_t *locations) {
+  Rows sourceRows(source);
+  Rows targetRows(target);
+  iassert(sourceRows.numNeighbors() == targetRows.numNeighbors())
+      << "the target is not the transpose of the source";
+
+  // Bucket the neighbors of the source by their sink, in source row order, so
+  // that bucket `j` holds the rows `i` and locations of the source neighbors
+  // that are transposed into target row `j`
+  const unsigned nnz = sourceRows.numNeighbors();
+  vector<uint32_t> bucketStart(targetRows.numElements+1, 0);
+  for (unsigned k = 0; k < nnz; ++k) {
+    iassert(sourceRows.sinks[k] < targetRows.numElements);
+    ++bucketStart[sourceRows.sinks[k]+1];
+  }
+  partial_sum(bucketStart.begin(), bucketStart.end(), bucketStart.begin());
+  vector<uint32_t> bucketRows(nnz);
+  vector<uint32_t> bucketLocations(nnz);
+  vector<uint32_t> next(bucketStart.begin(), bucketStart.end()-1);
+  for (unsigned i = 0; i < sourceRows.numElements; ++i) {
+    for (unsigned k = sourceRows.coords[i]; k < sourceRows.coords[i+1]; ++k) {
+      uint32_t bucketLoc = next[sourceRows.sinks[k]]++;
+      bucketRows[bucketLoc] = i;
+      bucketLocations[bucketLoc] = k;
+    }
+  }
+
+  // Scatter the locations of each target row by their sinks, and gather them
+  // for the source neighbors in the row's bucket. Target rows need not be
+  // sorted.
+  const size_t minChunkSize = 1024;
+  size_t numThreads = util::ThreadPool::getInstance().getNumThreads();
+  size_t numChunks = max<size_t>(1, min(numThreads,
+                                        targetRows.numElements/minChunkSize));
+  forEachChunk(numChunks, [&](size_t chunk) {
+    vector<uint32_t> locationOfSink(sourceRows.numElements);
+    unsigned start = chunk*targetRows.numElements/numChunks;
+    unsigned end = (chunk+1)*targetRows.numElements/numChunks;
+    for (unsigned j = start; j < end; ++j) {
+      for (unsigned k = targetRows.coords[j]; k < targetRows.coords[j+1]; ++k) {
+        iassert(targetRows.sinks[k] < sourceRows.numElements);
+        locationOfSink[targetRows.sinks[k]] = k;
+      }
+      for (unsigned b = bucketStart[j]; b < bucketStart[j+1]; ++b) {
+        uint32_t k = locationOfSink[bucketRows[b]];
+        iassert(k >= targetRows.coords[j] && k < targetRows.coords[j+1] &&
+                targetRows.sinks[k] == bucketRows[b])
+            << "the target is not the transpose of the source";
+        locations[bucketLocations[b]] = k;
+      }
+    }
+  });
+}
+
+// class PathIndexCache
+PathIndexCache &PathIndexCache::getInstance() {
+  static PathIndexCache cache;
+  return cache;
+}
+
+PathIndex PathIndexCache::get(const std::string &key) {
+  lock_guard<std::mutex> lock(mutex);
+  auto it = pathIndices.find(key);
+  return (it != pathIndices.end()) ? it->second : PathIndex();
+}
+
+void PathIndexCache::insert(const std::string &key, PathIndex pi) {
+  lock_guard<std::mutex> lock(mutex);
+  if (util::contains(pathIndices, key) || keys.find(pi.ptr) != keys.end()) {
+    return;
+  }
+  pi.ptr->cached = true;
+  pathIndices.insert({key, pi});
+  keys.insert({pi.ptr, key});
+}
+
+void PathIndexCache::evict(const PathIndexImpl *pi) {
+  PathIndex evicted;
+  lock_guard<std::mutex> lock(mutex);
+  auto it = keys.find(pi);
+  if (it == keys.end() || pi->ref != 1) {
+    return;
+  }
+  // Release the cache's reference after unlocking, when evicted is destroyed
+  auto pathIndex = pathIndices.find(it->second);
+  evicted = std::move(pathIndex->second);
+  evicted.ptr->cached = false;
+  pathIndices.erase(pathIndex);
+  keys.erase(it);
+}
+
+bool PathIndexCache::takeExclusive(const PathIndex &pi) {
+  PathIndex taken;
+  lock_guard<std::mutex> lock(mutex);
+  if (pi.ptr->ref != (pi.ptr->cached ? 2 : 1)) {
+    return false;
+  }
+  if (pi.ptr->cached) {
+    // Release the cache's reference after unlocking, when taken is destroyed
+    auto it = keys.find(pi.ptr);
+    iassert(it != keys.end());
+    auto pathIndex = pathIndices.find(it->second);
+    taken = std::move(pathIndex->second);
+    taken.ptr->cached = false;
+    pathIndices.erase(pathIndex);
+    keys.erase(it);
+  }
+  return true;
+}
+
+size_t PathIndexCache::size() {
+  lock_guard<std::mutex> lock(mutex);
+  return pathIndices.size();
+}
+
 // class PathIndexBuilder
+
 PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
                                            unsigned sourceEndpoint){
   /// Interpret the path expression, starting at sourceEndpoint, over the graph.
   /// That is given an element, the find its neighbors through the paths
   /// described by the path expression.
+  ///
+  /// If `old` is the memo of the path index built before the sets were
+  /// modified, then the visitor also finds the rows that changed, and patches
+  /// the old path index instead of rebuilding it if they are few.
   class PathNeighborVisitor : public PathExpressionVisitor {
   public:
     struct Location {
@@ -158,7 +630,8 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
     };
     typedef map<Var, vector<Location>> VarToLocationsMap;
 
-    PathNeighborVisitor(PathIndexBuilder *builder) : builder(builder) {}
+    PathNeighborVisitor(PathIndexBuilder *builder, const Memo *old)
+        : builder(builder), old(old) {}
 
     PathIndex build(const PathExpression &pe) {
       pe.accept(this);
@@ -167,42 +640,111 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       return pit;
     }
 
+    const ChangedRows &getChangedRows() const {return changed;}
+
   private:
-    /// Pack neighbor vectors into a segmented vector (contiguous array).
-    PathIndex pack(const map<unsigned, vector<unsigned>> &pathNeighbors,
-                   bool sorted=true) {
-      unsigned numNeighbors = 0;
-      for (auto &p : pathNeighbors) {
-        numNeighbors += p.second.size();
+    /// Path indices with a larger fraction of changed rows are rebuilt.
+    const double maxChangedFraction = 0.1;
+
+    bool tooManyChanged(size_t numChanged, size_t numElements) const {
+      return numChanged > maxChangedFraction * numElements;
+    }
+
+    /// Whether to patch the old path index rather than rebuild it.
+    bool patch(size_t numElements) {
+      if (old == nullptr || changed.all ||
+          tooManyChanged(changed.rows.size(), numElements)) {
+        changed.all = true;
+        return false;
       }
+      return true;
+    }
 
-      size_t numElements = pathNeighbors.size();
-      uint32_t* coordsData= (uint32_t*)malloc((numElements+1)*sizeof(uint32_t));
-      uint32_t* sinksData = (uint32_t*)malloc(numNeighbors*sizeof(uint32_t));
+    /// Mark the rows that were added since the old path index was built.
+    void addNewRows(size_t numElements) {
+      size_t oldElements = old->pathIndex.numElements();
+      if (tooManyChanged(numElements - min(oldElements, numElements),
+                         numElements)) {
+        changed.all = true;
+        return;
+      }
+      for (size_t elem = oldElements; elem < numElements; ++elem) {
+        changed.rows.push_back(elem);
+      }
+    }
 
-      int currNbrsStart = 0;
-      for (auto& p : pathNeighbors) {
-        unsigned elem = p.first;
-        coordsData[elem] = currNbrsStart;
+    /// Sort the changed rows, and drop duplicates and rows past the end.
+    void normalizeChangedRows(size_t numElements) {
+      vector<unsigned> &rows = changed.rows;
+      sort(rows.begin(), rows.end());
+      rows.erase(unique(rows.begin(), rows.end()), rows.end());
+      rows.erase(lower_bound(rows.begin(), rows.end(), numElements),
+                 rows.end());
+    }
 
-        unsigned pNeighborSize = p.second.size();
-        if (pNeighborSize > 0) {
-          vector<unsigned> pNeighbors(p.second.begin(), p.second.end());
-          if (sorted) {
-            sort(pNeighbors.begin(), pNeighbors.end());
-          }
+    /// The elements of `set` that were modified since the old path index was
+    /// built. Returns false if they are not known.
+    bool getModifiedElements(const simit::Set *set, size_t numElements,
+                             vector<unsigned> *elements) {
+      vector<pair<int,int>> ranges;
+      if (!set->getModifiedRanges(old->versions.at(set), &ranges)) {
+        return false;
+      }
+      size_t numModified = 0;
+      for (auto &range : ranges) {
+        numModified += range.second - range.first;
+      }
+      if (tooManyChanged(numModified, numElements)) {
+        return false;
+      }
+      for (auto &range : ranges) {
+        for (int elem = range.first; elem < range.second; ++elem) {
+          elements->push_back(elem);
+        }
+      }
+      return true;
+    }
 
-          memcpy(&sinksData[currNbrsStart], pNeighbors.data(),
-                 pNeighbors.size() * sizeof(uint32_t));
+    /// The rows of a child path index that changed since the old path index
+    /// was built.
+    ChangedRows getChangedRows(const PathExpression &pe, unsigned endpoint) {
+      const Memo &child = builder->pathIndices.at({pe,endpoint});
+      if (isBuiltOver(child.versions, old->versions)) {
+        return ChangedRows();
+      }
+      if (!child.updatedFrom.empty() &&
+          isBuiltOver(child.updatedFrom, old->versions)) {
+        return child.changedRows;
+      }
+      ChangedRows all;
+      all.all = true;
+      return all;
+    }
 
-          currNbrsStart += pNeighborSize;
+    /// True if the child versions are the versions of the same sets in the
+    /// parent versions.
+    static bool isBuiltOver(const SetVersions &child,
+                            const SetVersions &parent) {
+      for (auto &version : child) {
+        if (!util::contains(parent, version.first) ||
+            parent.at(version.first) != version.second) {
+          return false;
         }
       }
-      coordsData[numElements] = currNbrsStart;
-      return new SegmentedPathIndex(numElements, coordsData, sinksData);;
+      return true;
+    }
+
+    void addChangedRows(const ChangedRows &rows) {
+      changed.all |= rows.all;
+      if (!changed.all) {
+        changed.rows.insert(changed.rows.end(),
+                            rows.rows.begin(), rows.rows.end());
+      }
     }
 
     void visit(const Link *link) {
+      // Links are rebuilt when their sets are modified, since that takes
+      // linear time, but the rows that changed are tracked for their parents
       switch (link->getType()) {
         case Link::ev: {
           const simit::Set& edgeSet = *builder->getBinding(link->getEdgeSet());
@@ -214,79 +756,142 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
           //       mix of segmented and set endpoint indices.
           // pi = new SetEndpointPathIndex(edgeSet);
 
+          // The endpoints of the edges are already laid out as CSR sinks
           size_t n   = edgeSet.getSize();
           size_t nnz = edgeSet.getSize() * cardinality;
 
-          uint32_t* ptr = (uint32_t*)malloc((n+1)*sizeof(uint32_t));
-          uint32_t* idx = (uint32_t*)malloc(nnz*sizeof(uint32_t));
+          uint32_t* ptr = (uint32_t*)
+              util::alignedMalloc((n+1)*sizeof(uint32_t));
+          uint32_t* idx = (uint32_t*)util::alignedMalloc(nnz*sizeof(uint32_t));
 
           for (size_t i=0; i<=n; ++i) {
             ptr[i] = i*cardinality;
           }
+          if (nnz > 0) {
+            memcpy(idx, edgeSet.getEndpointsData(), nnz*sizeof(uint32_t));
+          }
 
-          for (auto e : edgeSet) {
-            for (int i=0; i<cardinality; ++i) {
-              int ep = edgeSet.getEndpoint(e,i).getIdent();
-              idx[e.getIdent()*cardinality + i] = ep;
+          // The rows of modified edges changed
+          if (old != nullptr) {
+            changed.all = !getModifiedElements(&edgeSet, n, &changed.rows);
+            if (!changed.all) {
+              addNewRows(n);
+              normalizeChangedRows(n);
             }
           }
 
-          pi = new SegmentedPathIndex(n, ptr, idx);;
+          pi = new SegmentedPathIndex(n, ptr, idx);
           break;
         }
         case Link::ve: {
           const simit::Set& edgeSet = *builder->getBinding(link->getEdgeSet());
-          iassert(edgeSet.getCardinality() > 0)
-              << "not an edge set" << edgeSet.getName();
-          
-          // add each edge to the neighbor vectors of its endpoints
-          map<unsigned, vector<unsigned>> pathNeighbors;
+          int cardinality = edgeSet.getCardinality();
+          iassert(cardinality > 0) << "not an edge set" << edgeSet.getName();
 
-          // create neighbor lists
           const simit::Set& vertexSet =
               *builder->getBinding(link->getVertexSet());
-          for (auto &v : vertexSet) {
-            pathNeighbors.insert({v.getIdent(), vector<unsigned>()});
+          size_t n   = vertexSet.getSize();
+          size_t nnz = edgeSet.getSize() * cardinality;
+          const int* endpoints = edgeSet.getEndpointsData();
+
+          // Count the edges of each vertex
+          uint32_t* ptr = (uint32_t*)util::alignedCalloc(n+1, sizeof(uint32_t));
+          for (size_t i=0; i<nnz; ++i) {
+            iassert(endpoints[i] >= 0 && (size_t)endpoints[i] < n);
+            ++ptr[endpoints[i]+1];
+          }
+          for (size_t v=0; v<n; ++v) {
+            ptr[v+1] += ptr[v];
           }
 
-          // populate neighbor lists
-          for (auto &e : edgeSet) {
-            iassert(e.getIdent() >= 0);
-            for (auto &ep : edgeSet.getEndpoints(e)) {
-              iassert(ep.getIdent() >= 0);
-              pathNeighbors.at(ep.getIdent()).push_back(e.getIdent());
+          // Add each edge to the neighbors of its endpoints. The edges are
+          // added in order, so the neighbors of each vertex are sorted.
+          uint32_t* idx = (uint32_t*)util::alignedMalloc(nnz*sizeof(uint32_t));
+          vector<uint32_t> next(ptr, ptr+n);
+          for (size_t i=0; i<nnz; ++i) {
+            idx[next[endpoints[i]]++] = i / cardinality;
+          }
+
+          // The rows of modified vertices changed, and so did the rows of the
+          // old and new endpoints of modified edges
+          if (old != nullptr) {
+            vector<unsigned> edges;
+            changed.all = !getModifiedElements(&vertexSet, n, &changed.rows) ||
+                          !getModifiedElements(&edgeSet, edgeSet.getSize(),
+                                               &edges);
+            if (!changed.all) {
+              size_t numEdges = edgeSet.getSize();
+              vector<bool> isModified;
+              for (unsigned e : edges) {
+                if (e < numEdges) {
+                  for (int i=0; i<cardinality; ++i) {
+                    changed.rows.push_back(endpoints[e*cardinality + i]);
+                  }
+                }
+                if (e >= isModified.size()) {
+                  isModified.resize(e+1, false);
+                }
+                isModified[e] = true;
+              }
+              Rows oldRows(old->pathIndex);
+              for (unsigned v=0; v < oldRows.numElements; ++v) {
+                for (auto e = oldRows.begin(v); e != oldRows.end(v); ++e) {
+                  if (*e < isModified.size() && isModified[*e]) {
+                    changed.rows.push_back(v);
+                    break;
+                  }
+                }
+              }
+              addNewRows(n);
+              normalizeChangedRows(n);
+              changed.all |= tooManyChanged(changed.rows.size(), n);
             }
           }
-          pi = pack(pathNeighbors);
+
+          pi = new SegmentedPathIndex(n, ptr, idx);
           break;
         }
         case Link::vv: {
           const ir::StencilLayout& stencil = link->getStencil();
           const simit::Set& throughSet =
               *builder->getBinding(stencil.getLatticeSet());
-          
-          map<unsigned, vector<unsigned>> pathNeighbors;
+          const vector<int>& dimensions = throughSet.getDimensions();
 
-          // create neighbor lists
           const simit::Set& sourceSet =
               *builder->getBinding(link->getVertexSet(0));
           iassert(sourceSet.getName() ==
                   builder->getBinding(link->getVertexSet(1))->getName());
-          for (auto &v : sourceSet) {
-            pathNeighbors.insert({v.getIdent(), vector<unsigned>()});
-            for (auto &kv : stencil.getLayoutReversed()) {
-              const vector<int> &offsets = kv.second;
-              vector<int> base = throughSet.getLatticePointCoords(v);
-              iassert(offsets.size() == base.size());
+
+          vector<vector<int>> offsets;
+          for (auto &kv : stencil.getLayoutReversed()) {
+            offsets.push_back(kv.second);
+          }
+
+          uint32_t *ptr, *idx;
+          buildRows(sourceSet.getSize(),
+                    [&](size_t v, vector<uint32_t> *nbrs) {
+            // Lattice coordinates of v (see Set::getLatticePointCoords)
+            vector<int> base(dimensions.size());
+            size_t index = v;
+            for (unsigned i = 0; i < dimensions.size(); ++i) {
+              base[i] = index % dimensions[i];
+              index /= dimensions[i];
+            }
+            for (const vector<int> &offset : offsets) {
+              iassert(offset.size() == base.size());
+              vector<int> coords(base.size());
               for (unsigned i = 0; i < base.size(); ++i) {
-                base[i] += offsets[i] + throughSet.getDimensions()[i];
-                base[i] = base[i] % throughSet.getDimensions()[i];
+                coords[i] = (base[i] + offset[i] + dimensions[i]) %
+                            dimensions[i];
               }
-              pathNeighbors.at(v.getIdent()).push_back(
-                  throughSet.getLatticePoint(base).getIdent());
+              nbrs->push_back(throughSet.getLatticePoint(coords).getIdent());
             }
-          }
-          pi = pack(pathNeighbors, false);
+          }, false, &ptr, &idx);
+
+          // Lattices are not modified element by element
+          changed.all = true;
+
+          pi = new SegmentedPathIndex(sourceSet.getSize(), ptr, idx);
           break;
         }
         default: unreachable;
@@ -314,15 +919,26 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
           << "source variable is not in the path expression";
       iassert(util::contains(locs, sink))
           << "sink variable is not in the path expression";
-      return builder->buildSegmented(locs.at(source)[0].pathExpr,
-                                     locs.at(source)[0].endpoint);
+      Location sourceLoc = locs.at(source)[0];
+      PathIndex index = builder->buildSegmented(sourceLoc.pathExpr,
+                                                sourceLoc.endpoint);
+      if (old != nullptr) {
+        addChangedRows(getChangedRows(sourceLoc.pathExpr, sourceLoc.endpoint));
+      }
+      return index;
     }
 
+    /// Builds the indices from the source to the quantified variable and from
+    /// the quantified variable to the sink. If the old path index is being
+    /// updated, then the rows of each that changed are stored in
+    /// `changedSourceToQuantified` and `changedQuantifiedToSink`.
     tuple<PathIndex,PathIndex> buildIndices(const PathExpression &lhs,
                                             const PathExpression &rhs,
                                             const Var &source,
                                             const Var &quantified,
-                                            const Var &sink) {
+                                            const Var &sink,
+                                            ChangedRows *changedSourceToQuantified,
+                                            ChangedRows *changedQuantifiedToSink) {
       VarToLocationsMap varToLocations = getVarToLocationsMap({lhs,rhs});
       iassert(varToLocations.find(quantified) != varToLocations.end())
           << "could not find quantified variable locations";
@@ -332,16 +948,54 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       Location sourceLoc = varToLocations[source][0];
       PathIndex sourceToQuantified =
           builder->buildSegmented(sourceLoc.pathExpr, sourceLoc.endpoint);
-      PathIndex sourceToQuantified2, quantifiedToSink2;
 
       Location sinkLoc = varToLocations[sink][0];
       unsigned quantifiedLoc = ((sinkLoc.endpoint) == 0) ? 1 : 0;
       PathIndex quantifiedToSink =
           builder->buildSegmented(sinkLoc.pathExpr, quantifiedLoc);
 
+      if (old != nullptr) {
+        *changedSourceToQuantified =
+            getChangedRows(sourceLoc.pathExpr, sourceLoc.endpoint);
+        *changedQuantifiedToSink =
+            getChangedRows(sinkLoc.pathExpr, quantifiedLoc);
+      }
       return make_pair(sourceToQuantified, quantifiedToSink);
     }
 
+    /// Build the CSR arrays of the path index with `appendRow` (see
+    /// buildRows), or patch the changed rows of the old path index.
+    void buildOrPatchRows(size_t numElements,
+                          const function<void(size_t,vector<uint32_t>*)> &appendRow,
+                          bool dedup, uint32_t **coords, uint32_t **sinks) {
+      if (old != nullptr && !changed.all) {
+        addNewRows(numElements);
+        normalizeChangedRows(numElements);
+      }
+      if (patch(numElements)) {
+        // The old path index is patched in place if nothing else uses it
+        PathIndexCache &cache = PathIndexCache::getInstance();
+        if (cache.takeExclusive(old->pathIndex)) {
+          SegmentedPathIndex *oldIndex =
+              static_cast<SegmentedPathIndex*>(old->pathIndex.ptr);
+          *coords = oldIndex->coordsData;
+          *sinks = oldIndex->sinksData;
+          oldIndex->coordsData = nullptr;
+          oldIndex->sinksData = nullptr;
+          patchRowsInPlace(oldIndex->numElems, numElements, changed.rows,
+                           appendRow, dedup, coords, sinks);
+          oldIndex->numElems = 0;
+        }
+        else {
+          patchRows(Rows(old->pathIndex), numElements, changed.rows,
+                    appendRow, dedup, coords, sinks);
+        }
+      }
+      else {
+        buildRows(numElements, appendRow, dedup, coords, sinks);
+      }
+    }
+
     void visit(const And *f) {
       auto &freeVars = f->getFreeVars();
       iassert(freeVars.size() == 2)
@@ -350,31 +1004,33 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
+      size_t numElements;
+      uint32_t *coords, *sinks;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
         PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
         PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
-
-        // Build a path index that is the intersection of lhsIndex and rhsIndex.
-        // OPT: If path indices supported efficient lookups we could instead:
-        //      for each (elem,nbr) pair in lhs, if it exist in rhs then emit.
-        map<unsigned, set<unsigned>> lhsPathNeighbors;
-        for (unsigned elem : lhsIndex) {
-          lhsPathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            lhsPathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            auto &elemNbrs = lhsPathNeighbors.at(elem);
-            if (elemNbrs.find(nbr) != elemNbrs.end()) {
-              pathNeighbors.at(elem).insert(nbr);
+        Rows lhsRows(lhsIndex);
+        Rows rhsRows(rhsIndex);
+        iassert(rhsRows.numElements <= lhsRows.numElements);
+
+        // Build a path index that is the intersection of lhsIndex and rhsIndex,
+        // by looking up the rhs neighbors of each element in its sorted lhs
+        // neighbors, which are staged at the end of the row.
+        numElements = rhsRows.numElements;
+        buildOrPatchRows(numElements, [&](size_t elem, vector<uint32_t> *nbrs) {
+          size_t lhsStart = nbrs->size();
+          nbrs->insert(nbrs->end(), lhsRows.begin(elem), lhsRows.end(elem));
+          sort(nbrs->begin()+lhsStart, nbrs->end());
+          size_t lhsEnd = nbrs->size();
+          for (auto nbr = rhsRows.begin(elem); nbr != rhsRows.end(elem); ++nbr) {
+            if (binary_search(nbrs->begin()+lhsStart, nbrs->begin()+lhsEnd,
+                              *nbr)) {
+              nbrs->push_back(*nbr);
             }
           }
-        }
+          nbrs->erase(nbrs->begin()+lhsStart, nbrs->begin()+lhsEnd);
+        }, true, &coords, &sinks);
       }
       else {
         iassert(f->getQuantifiedVars().size() == 1)
@@ -390,28 +1046,50 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         // and from the quantified var to the second free variable
         PathIndex sourceToQuantified;
         PathIndex quantifiedToSink;
+        ChangedRows changedSourceToQuantified;
+        ChangedRows changedQuantifiedToSink;
 
         tie(sourceToQuantified, quantifiedToSink) =
-            buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1]);
+            buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1],
+                         &changedSourceToQuantified, &changedQuantifiedToSink);
+        Rows sourceToQuantifiedRows(sourceToQuantified);
+        Rows quantifiedToSinkRows(quantifiedToSink);
+        numElements = sourceToQuantifiedRows.numElements;
+
+        // The rows of sources whose quantified neighbors changed, or that have
+        // a quantified neighbor whose sinks changed, changed
+        if (old != nullptr) {
+          addChangedRows(changedSourceToQuantified);
+          changed.all |= changedQuantifiedToSink.all;
+          if (!changed.all && !changedQuantifiedToSink.rows.empty()) {
+            vector<bool> isChanged(quantifiedToSinkRows.numElements, false);
+            for (unsigned q : changedQuantifiedToSink.rows) {
+              isChanged[q] = true;
+            }
+            for (unsigned source = 0; source < numElements; ++source) {
+              for (auto q = sourceToQuantifiedRows.begin(source);
+                   q != sourceToQuantifiedRows.end(source); ++q) {
+                if (isChanged[*q]) {
+                  changed.rows.push_back(source);
+                  break;
+                }
+              }
+            }
+          }
+        }
 
         // Build a path index from the first free variable to the second free
         // variable, through the quantified variable.
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          for (unsigned q : sourceToQuantified.neighbors(source)) {
-            for (unsigned sink : quantifiedToSink.neighbors(q)) {
-              pathNeighbors.at(source).insert(sink);
-            }
+        buildOrPatchRows(numElements, [&](size_t source,
+                                          vector<uint32_t> *nbrs) {
+          for (auto q = sourceToQuantifiedRows.begin(source);
+               q != sourceToQuantifiedRows.end(source); ++q) {
+            nbrs->insert(nbrs->end(), quantifiedToSinkRows.begin(*q),
+                         quantifiedToSinkRows.end(*q));
           }
-        }
+        }, true, &coords, &sinks);
       }
-      // Convert path neighbors to vector values
-      map<unsigned, vector<unsigned>> pathNeighborsVec;
-      for (auto &kv : pathNeighbors) {
-        pathNeighborsVec[kv.first] =
-            vector<unsigned>(kv.second.begin(), kv.second.end());
-      }
-      pi = pack(pathNeighborsVec);
+      pi = new SegmentedPathIndex(numElements, coords, sinks);
     }
 
     void visit(const Or *f) {
@@ -422,25 +1100,24 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
       PathExpression lhs = f->getLhs();
       PathExpression rhs = f->getRhs();
 
-      map<unsigned, set<unsigned>> pathNeighbors;
+      size_t numElements;
+      uint32_t *coords, *sinks;
       if (!f->isQuantified()) {
         // Build indices from first to second free variable through lhs and rhs
         PathIndex lhsIndex = buildIndex(lhs, freeVars[0], freeVars[1]);
         PathIndex rhsIndex = buildIndex(rhs, freeVars[0], freeVars[1]);
+        Rows lhsRows(lhsIndex);
+        Rows rhsRows(rhsIndex);
+        iassert(rhsRows.numElements <= lhsRows.numElements);
 
         // Build a path index that is the union of lhsIndex and rhsIndex
-        for (unsigned elem : lhsIndex) {
-          pathNeighbors.insert({elem, set<unsigned>()});
-          for (unsigned nbr : lhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
-          }
-        }
-        for (unsigned elem : rhsIndex) {
-          iassert(pathNeighbors.find(elem) != pathNeighbors.end());
-          for (unsigned nbr : rhsIndex.neighbors(elem)) {
-            pathNeighbors.at(elem).insert(nbr);
+        numElements = lhsRows.numElements;
+        buildOrPatchRows(numElements, [&](size_t elem, vector<uint32_t> *nbrs) {
+          nbrs->insert(nbrs->end(), lhsRows.begin(elem), lhsRows.end(elem));
+          if (elem < rhsRows.numElements) {
+            nbrs->insert(nbrs->end(), rhsRows.begin(elem), rhsRows.end(elem));
           }
-        }
+        }, true, &coords, &sinks);
       }
       else {
         iassert(f->getQuantifiedVars().size() == 1)
@@ -456,13 +1133,18 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         // and from the quantified var to the second free variable
         PathIndex sourceToQuantified;
         PathIndex quantifiedToSink;
+        ChangedRows changedSourceToQuantified;
+        ChangedRows changedQuantifiedToSink;
 
         // OPT: The index building algorithm is agnostic to the direction these
         //      indices are built in. We should take advantage by:
         //      - checking whether one direction is already available/memoized
         //      - checking whether one direction is an ev link (which is fast)
         tie(sourceToQuantified, quantifiedToSink) =
-            buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1]);
+            buildIndices(lhs, rhs, freeVars[0], qvar.getVar(), freeVars[1],
+                         &changedSourceToQuantified, &changedQuantifiedToSink);
+        Rows sourceToQuantifiedRows(sourceToQuantified);
+        Rows quantifiedToSinkRows(quantifiedToSink);
 
         // Build a path index that from the first free variable to the
         // quantified variable. Every free variable that can reach any
@@ -471,49 +1153,171 @@ PathIndex PathIndexBuilder::buildSegmented(const PathExpression &pe,
         // quantified var.
         auto sinkSet = builder->getBinding(f->getSet(freeVars[1]));
 
-        for (unsigned source : sourceToQuantified) {
-          pathNeighbors.insert({source, set<unsigned>()});
-          if (sourceToQuantified.numNeighbors(source) > 0) {
-            for (auto &sinkElem : *sinkSet) {
-              unsigned sink = sinkElem.getIdent();
-              pathNeighbors.at(source).insert(sink);
-            }
-          }
-        }
-
-        for (unsigned quantified : quantifiedToSink) {
-          for (unsigned sink: quantifiedToSink.neighbors(quantified)) {
-            for (unsigned source : sourceToQuantified) {
-              pathNeighbors.at(source).insert(sink);
-            }
-          }
-        }
+        // Every source links to the sinks that are reached from any quantified
+        // element, and sources with quantified neighbors link to all sinks
+        vector<uint32_t> reached(quantifiedToSinkRows.sinks,
+                                 quantifiedToSinkRows.sinks +
+                                 quantifiedToSinkRows.numNeighbors());
+        sort(reached.begin(), reached.end());
+        reached.erase(unique(reached.begin(), reached.end()), reached.end());
+
+        vector<uint32_t> sinkElems(sinkSet->getSize());
+        iota(sinkElems.begin(), sinkElems.end(), 0);
+        vector<uint32_t> all;
+        set_union(sinkElems.begin(), sinkElems.end(),
+                  reached.begin(), reached.end(), back_inserter(all));
+
+        // Every row depends on every quantified element, so it is rebuilt
+        numElements = sourceToQuantifiedRows.numElements;
+        changed.all = true;
+        buildRows(numElements, [&](size_t source, vector<uint32_t> *nbrs) {
+          const vector<uint32_t> &row =
+              (sourceToQuantifiedRows.size(source) > 0) ? all : reached;
+          nbrs->insert(nbrs->end(), row.begin(), row.end());
+        }, false, &coords, &sinks);
       }
-      // Convert path neighbors to vector values
-      map<unsigned, vector<unsigned>> pathNeighborsVec;
-      for (auto &kv : pathNeighbors) {
-        pathNeighborsVec[kv.first] =
-            vector<unsigned>(kv.second.begin(), kv.second.end());
-      }
-      pi = pack(pathNeighborsVec);
+      pi = new SegmentedPathIndex(numElements, coords, sinks);
     }
 
     PathIndex pi;  // Path index returned from cases
     PathIndexBuilder *builder;
+    const Memo *old;       // Memo of the path index before the update
+    ChangedRows changed;   // Rows that changed since the old path index
   };
 
   // TODO: Possible optimization is to detect symmetric path expressions, and
   //       return the same path index when they are evaluated in both directions
 
   // Check if we have memoized the path index for this path expression, starting
-  // at this sourceEndpoint, bound to these sets.
+  // at this sourceEndpoint, bound to these sets. If the sets have since been
+  // modified then the memoized path index is updated.
+  SetVersions versions = getVersions(pe);
+  const Memo *old = nullptr;
   if (util::contains(pathIndices, {pe,sourceEndpoint})) {
-    return pathIndices.at({pe,sourceEndpoint});
+    const Memo &memo = pathIndices.at({pe,sourceEndpoint});
+    if (memo.versions == versions) {
+      return memo.pathIndex;
+    }
+    old = &memo;
+  }
+
+  // Check if another builder has built the path index over the same sets
+  Memo memo;
+  memo.versions = versions;
+  PathIndexCache &cache = PathIndexCache::getInstance();
+  string key = PathIndexKeyPrinter(this).print(pe, sourceEndpoint);
+  memo.pathIndex = cache.get(key);
+  if (!memo.pathIndex.defined()) {
+    memo.pathIndex = getLoadedNeighborIndex(pe);
+    if (memo.pathIndex.defined()) {
+      cache.insert(key, memo.pathIndex);
+    }
+  }
+  if (memo.pathIndex.defined()) {
+    memo.changedRows.all = true;
+  }
+  else {
+    PathNeighborVisitor visitor(this, old);
+    memo.pathIndex = visitor.build(pe);
+    memo.changedRows = visitor.getChangedRows();
+    cache.insert(key, memo.pathIndex);
+  }
+  if (old != nullptr) {
+    memo.updatedFrom = old->versions;
+  }
+  pathIndices[{pe,sourceEndpoint}] = memo;
+  return memo.pathIndex;
+}
+
+bool PathIndexBuilder::isUpToDate(const PathExpression &pe,
+                                  unsigned sourceEndpoint) const {
+  auto memo = pathIndices.find({pe,sourceEndpoint});
+  return memo != pathIndices.end() && memo->second.versions == getVersions(pe);
+}
+
+PathIndexBuilder::SetVersions
+PathIndexBuilder::getVersions(const PathExpression &pe) const {
+  class GetVersions : public PathExpressionVisitor {
+  public:
+    GetVersions(const PathIndexBuilder *builder) : builder(builder) {}
+
+    SetVersions get(const PathExpression &pe) {
+      pe.accept(this);
+      return versions;
+    }
+
+  private:
+    const PathIndexBuilder *builder;
+    SetVersions versions;
+
+    void visit(const Link *link) {
+      add(builder->getBinding(link->getLhsSet()));
+      add(builder->getBinding(link->getRhsSet()));
+      if (link->hasStencil()) {
+        add(builder->getBinding(link->getStencil().getLatticeSet()));
+      }
+    }
+
+    void add(const simit::Set *set) {
+      set->markVersionObserved();
+      versions[set] = set->getVersion();
+    }
+  };
+  return GetVersions(this).get(pe);
+}
+
+PathIndex
+PathIndexBuilder::getLoadedNeighborIndex(const PathExpression &pe) const {
+  // The endpoints linked through the edges of a set are an existentially
+  // quantified conjunction of a ve and an ev link to the edge set
+  if (!isa<And>(pe)) {
+    return PathIndex();
+  }
+  const And *f = to<And>(pe);
+  if (f->getQuantifiedVars().size() != 1) {
+    return PathIndex();
   }
 
-  PathIndex pi = PathNeighborVisitor(this).build(pe);
-  pathIndices.insert({{pe,sourceEndpoint}, pi});
-  return pi;
+  // The links are usually renamed to the variables of the conjunction
+  auto getLink = [](PathExpression pe) -> const Link* {
+    while (isa<RenamedPathExpression>(pe)) {
+      pe = to<RenamedPathExpression>(pe)->getPathExpression();
+    }
+    return isa<Link>(pe) ? to<Link>(pe) : nullptr;
+  };
+  const Link *lhs = getLink(f->getLhs());
+  const Link *rhs = getLink(f->getRhs());
+  if (lhs == nullptr || rhs == nullptr ||
+      lhs->getType() != Link::ve || rhs->getType() != Link::ev ||
+      lhs->hasStencil() || rhs->hasStencil()) {
+    return PathIndex();
+  }
+  const Var &edgeVar = f->getQuantifiedVars()[0].getVar();
+  if (f->getLhs().getPathEndpoint(1) != edgeVar ||
+      f->getRhs().getPathEndpoint(0) != edgeVar) {
+    return PathIndex();
+  }
+  const simit::Set *edgeSet = getBinding(lhs->getEdgeSet());
+  if (edgeSet != getBinding(rhs->getEdgeSet()) ||
+      edgeSet->getCardinality() == 0 || !edgeSet->isHomogeneous() ||
+      getBinding(lhs->getVertexSet()) != edgeSet->getEndpointSet(0) ||
+      getBinding(rhs->getVertexSet()) != edgeSet->getEndpointSet(0)) {
+    return PathIndex();
+  }
+
+  const uint32_t *coords, *sinks;
+  if (!edgeSet->getNeighborIndex(&coords, &sinks)) {
+    return PathIndex();
+  }
+  size_t numElements = edgeSet->getEndpointSet(0)->getSize();
+  size_t numNeighbors = coords[numElements];
+  uint32_t *coordsCopy = (uint32_t*)
+      util::alignedMalloc((numElements+1)*sizeof(uint32_t));
+  uint32_t *sinksCopy = (uint32_t*)
+      util::alignedMalloc(numNeighbors*sizeof(uint32_t));
+  memcpy(coordsCopy, coords, (numElements+1)*sizeof(uint32_t));
+  memcpy(sinksCopy, sinks, numNeighbors*sizeof(uint32_t));
+  return new SegmentedPathIndex(numElements, coordsCopy, sinksCopy);
 }
 
 void PathIndexBuilder::bind(std::string name, const simit::Set* set) {
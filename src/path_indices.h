@@ -1,20 +1,26 @@
 #ifndef SIMIT_PATH_INDICES_H
 #define SIMIT_PATH_INDICES_H
 
+#include <atomic>
 #include <ostream>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <typeinfo>
+#include <vector>
 
 #include "graph.h"
 #include "path_expressions.h"
 #include "interfaces/printable.h"
+#include "util/memory.h"
 
 namespace simit {
 class Set;
 namespace pe {
 class PathExpression;
 class PathIndexBuilder;
+class PathIndexCache;
 class PathIndexImpl;
 
 class PathIndexImpl : public interfaces::Printable {
@@ -107,9 +113,13 @@ public:
   virtual Neighbors neighbors(unsigned elemID) const = 0;
 
 private:
-  mutable long ref = 0;
+  /// Path indices are shared across threads through the PathIndexCache, which
+  /// is told when only its own reference is left.
+  mutable std::atomic<long> ref{0};
+  std::atomic<bool> cached{false};
   friend inline void aquire(PathIndexImpl *p) {++p->ref;}
-  friend inline void release(PathIndexImpl *p) {if (--p->ref==0) delete p;}
+  friend void release(PathIndexImpl *p);
+  friend PathIndexCache;
 };
 
 
@@ -207,7 +217,7 @@ private:
       : numElems(numElements), coordsData(nbrsStart), sinksData(nbrs) {}
 
   SegmentedPathIndex() : numElems(0), coordsData(nullptr), sinksData(nullptr) {
-    coordsData = new uint32_t[1];
+    coordsData = (uint32_t*)util::alignedMalloc(sizeof(uint32_t));
     coordsData[0] = 0;
   }
 };
@@ -223,11 +233,77 @@ inline const PI* to(PathIndex pi) {
   return static_cast<const PI*>(pi.ptr);
 }
 
+/// Computes where the neighbors of the segmented path index `source` are in
+/// the segmented path index `target`, whose path expression is the transpose
+/// of the source's: if `j` is the `k`th neighbor of `i` in the source, then
+/// `locations[k]` is the location of `i` among the neighbors of `j` in the
+/// target. Transposing a matrix with the source index is then a gather.
+void computeTransposition(const PathIndex &source, const PathIndex &target,
+                          uint32_t *locations);
+
+
+/// A process-wide cache of the path indices built by PathIndexBuilders, so that
+/// functions bound to the same sets share their path indices. Path indices are
+/// keyed by the structure of their path expression and by the identities and
+/// versions of the sets it is evaluated over, so sets that are modified get new
+/// path indices. Set versions are unique across sets, so the keys of destroyed
+/// sets are never matched again. The cache only keeps path indices that are
+/// referenced outside of it, and drops them when their last outside reference
+/// is released.
+class PathIndexCache {
+public:
+  static PathIndexCache &getInstance();
+
+  /// Returns the path index with the given key, or an undefined path index.
+  PathIndex get(const std::string &key);
+
+  /// Adds a path index with the given key.
+  void insert(const std::string &key, PathIndex pi);
+
+  /// Removes the path index from the cache and returns true if `pi` and the
+  /// cache hold the only references to it, so that the caller may modify it
+  /// without other builders seeing the changes.
+  bool takeExclusive(const PathIndex &pi);
+
+  /// The number of path indices in the cache.
+  size_t size();
+
+private:
+  std::mutex mutex;
+  std::map<std::string, PathIndex> pathIndices;
+  std::map<const PathIndexImpl*, std::string> keys;
+
+  PathIndexCache() {}
+
+  /// Drops the path index if the cache holds its only reference. The path
+  /// index may have been dropped and deleted already, so it is only
+  /// dereferenced if it is still in the cache.
+  void evict(const PathIndexImpl *pi);
+
+  friend void release(PathIndexImpl *p);
+};
+
+inline void release(PathIndexImpl *p) {
+  long ref = --p->ref;
+  if (ref == 0) {
+    delete p;
+  }
+  else if (ref == 1 && p->cached) {
+    PathIndexCache::getInstance().evict(p);
+  }
+}
+
 
 /// A builder that builds path indices by evaluating path expressions on graphs.
 /// The builder memoizes previously computed path indices, and uses these to
 /// accelerate subsequent path index construction (since path expressions can be
-/// recursively constructed from path expressions).
+/// recursively constructed from path expressions). Path indices are also shared
+/// with other builders through the PathIndexCache.
+///
+/// When the sets a memoized path index was built over are modified, the builder
+/// updates the path index the next time it is built. Only the rows of the path
+/// index that the modifications affect are recomputed, unless there are so
+/// many of them that it is rebuilt.
 class PathIndexBuilder {
 public:
   PathIndexBuilder() {}
@@ -237,14 +313,44 @@ public:
   // Build a Segmented path index by evaluating the `pe` over the given graph.
   PathIndex buildSegmented(const PathExpression &pe, unsigned sourceEndpoint);
 
+  /// True if the path index of `pe` has been built, and the sets it was built
+  /// over have not been modified since.
+  bool isUpToDate(const PathExpression &pe, unsigned sourceEndpoint) const;
+
   void bind(std::string name, const simit::Set* set);
 
   const simit::Set* getBinding(pe::Set pset) const;
   const simit::Set* getBinding(ir::Var var) const;
 
 private:
-  std::map<std::pair<PathExpression,unsigned>, PathIndex> pathIndices;
+  typedef std::map<const simit::Set*, unsigned long> SetVersions;
+
+  /// The rows of a path index that changed when it was updated.
+  struct ChangedRows {
+    bool all = false;
+    std::vector<unsigned> rows;  // sorted
+  };
+
+  /// A memoized path index and the versions of the sets it was built over. A
+  /// path index that was updated also records the versions of the sets it was
+  /// updated from, and which of its rows changed.
+  struct Memo {
+    PathIndex pathIndex;
+    SetVersions versions;
+    SetVersions updatedFrom;
+    ChangedRows changedRows;
+  };
+
+  std::map<std::pair<PathExpression,unsigned>, Memo> pathIndices;
   std::map<std::string, const simit::Set*> bindings;
+
+  /// The versions of the sets that `pe` is evaluated over.
+  SetVersions getVersions(const PathExpression &pe) const;
+
+  /// Returns the neighbor index that an edge set was loaded with (see
+  /// Set::load), if `pe` links the endpoints of its edges, or an undefined
+  /// path index.
+  PathIndex getLoadedNeighborIndex(const PathExpression &pe) const;
 };
 
 }}
@@ -97,6 +97,12 @@ std::vector<std::string> Program::getFunctionNames() const {
   return functionNames;
 }
 
+void Program::setFieldLayout(const std::string &elementType,
+                             const std::string &field, Set::Layout layout,
+                             int blockWidth) {
+  content->backend->setFieldLayout(elementType, field, layout, blockWidth);
+}
+
 Function Program::compile(const std::string &function) {
   ir::Func simitFunc = content->ctx.getFunction(function);
   uassert(simitFunc.defined()) << "Attempting to compile an unknown function "
@@ -7,6 +7,7 @@
 #include <memory>
 
 #include "function.h"
+#include "graph.h"
 #include "init.h"
 #include "interfaces/uncopyable.h"
 
@@ -43,6 +44,14 @@ public:
   /// Returns the names of all the functions in the program.
   std::vector<std::string> getFunctionNames() const;
 
+  /// Compile the functions from now on to follow `layout` for the field
+  /// `field` of the elements of type `elementType` (see Set::addField). The
+  /// functions then only bind sets whose field has that layout and block
+  /// width. Fields default to AoS, which is the only layout of fields that
+  /// functions pass whole to runtime calls, such as solvers.
+  void setFieldLayout(const std::string &elementType, const std::string &field,
+                      Set::Layout layout, int blockWidth=8);
+
   /// Compile and return a runnable function, or an undefined function if an
   /// error occured.
   Function compile(const std::string &function);
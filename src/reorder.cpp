@@ -168,6 +168,9 @@ namespace simit {
   void reorderFields(vector<Set::FieldData*>& fields, const vector<int>& 
       ordering) {
     for (auto f : fields) {
+      uassert(f->layout == Set::AoS)
+          << "Field " << f->name << " can not be reordered, since only fields "
+          << "with the AoS layout can be reordered";
       switch (f->type->getComponentType()) {
         case ComponentType::Float: {
           float* data = static_cast<float *>(f->data);
@@ -2,10 +2,19 @@
 
 #include <cmath>
 #include <time.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <type_traits>
 #include <vector>
 
+#include "sparse_cholesky.h"
 #include "timers.h"
+#include "util/arena.h"
+#include "util/memory.h"
+#include "util/thread_pool.h"
 #include "stdio.h"
 
 #ifdef EIGEN
@@ -15,139 +24,413 @@
 using namespace Eigen;
 #endif
 
-extern "C" {
-int loc(int v0, int v1, int *neighbors_start, int *neighbors) {
-  int l = neighbors_start[v0];
-  while(neighbors[l] != v1) l++;
-  return l;
-}
+/// Component types of the reduction buffers of privatized parallel loops.
+enum PrivatizedComponent {PrivatizedInt, PrivatizedFloat, PrivatizedDouble};
 
-double atan2_f64(double y, double x) {
-  return atan2(y, x);
+/// Add the private copies of a reduction buffer into the first copy, by
+/// merging pairs of copies in a tree. The components of each merge level are
+/// split across the thread pool.
+template <typename T>
+static void mergePrivateCopies(const std::vector<void*> &copies, int len) {
+  simit::util::ThreadPool &pool = simit::util::ThreadPool::getInstance();
+  for (size_t stride = 1; stride < copies.size(); stride *= 2) {
+    pool.parallelFor(len, [&copies, stride](int start, int end) {
+      for (size_t t = 0; t + stride < copies.size(); t += 2*stride) {
+        T *dst = (T*)copies[t];
+        const T *src = (const T*)copies[t+stride];
+        for (int i = start; i < end; ++i) {
+          dst[i] += src[i];
+        }
+      }
+    });
+  }
 }
 
-float atan2_f32(float y, float x) {
-  double d_y = y;
-  double d_x = x;
-  return (float)atan2(d_y, d_x);
+namespace simit {
+namespace ffi {
+extern "C" void* simit_malloc(std::size_t size) {
+  util::Arena* arena = util::Arena::getCurrent();
+  return (arena != nullptr) ? arena->allocate(size)
+                            : util::alignedMalloc(size);
 }
 
-double tan_f64(double x) {
-  return tan(x);
+extern "C" void simit_free(void* ptr) {
+  util::Arena* arena = util::Arena::getCurrent();
+  if ((arena == nullptr || !arena->release(ptr)) &&
+      !util::Arena::releaseToOwner(ptr)) {
+    free(ptr);
+  }
 }
+}}
 
-float tan_f32(float x) {
-  double d_x = x;
-  return (float)tan(d_x);
+/// Allocate the private copies of a reduction buffer of `size` bytes for the
+/// chunks [1,numChunks) of a parallel loop. They are taken from the arena of
+/// the running function, so that runs with the same sizes reuse the copies of
+/// earlier runs, and must be zeroed by the chunks before they accumulate.
+static void allocatePrivateCopies(std::vector<void*> &copies, int numChunks,
+                                  size_t size) {
+  for (int c = 1; c < numChunks; ++c) {
+    copies.push_back(simit::ffi::simit_malloc(size));
+  }
 }
 
-double asin_f64(double x) {
-  return asin(x);
+/// Release the private copies of allocatePrivateCopies to the arena.
+static void releasePrivateCopies(const std::vector<void*> &copies) {
+  for (size_t c = 1; c < copies.size(); ++c) {
+    simit::ffi::simit_free(copies[c]);
+  }
 }
 
-float asin_f32(float x) {
-  double d_x = x;
-  return (float)asin(d_x);
+extern "C" {
+/// Returns the location of v1 among the neighbors of v0. Rows of path indices
+/// are usually sorted, so they are binary searched, and unsorted rows are
+/// searched linearly if that fails.
+int loc(int v0, int v1, int *neighbors_start, int *neighbors) {
+  int *begin = &neighbors[neighbors_start[v0]];
+  int *end = &neighbors[neighbors_start[v0+1]];
+  int *l = std::lower_bound(begin, end, v1);
+  if (l != end && *l == v1) {
+    return l - neighbors;
+  }
+  l = begin;
+  while(*l != v1) l++;
+  return l - neighbors;
 }
 
-double acos_f64(double x) {
-  return acos(x);
+void simitStoreTime(int i, double value) {
+  simit::ir::TimerStorage::getInstance().storeTime(i, value);
 }
 
-float acos_f32(float x) {
-  double d_x = x;
-  return (float)acos(d_x);
+double simitClock() {
+  using namespace std::chrono;
+  auto t = high_resolution_clock::now();
+  time_point<high_resolution_clock,microseconds> usec = time_point_cast<microseconds>(t);
+  return (double)(usec.time_since_epoch().count());
 }
 
-double det3_f64(double * a){
-  return a[0] * (a[4]*a[8]-a[5]*a[7])
-       - a[1] * (a[3]*a[8]-a[5]*a[6])
-       + a[2] * (a[3]*a[7]-a[4]*a[6]);
+/// Execute the iterations [0,n) of a parallel loop, whose body has been
+/// outlined into `body`, on the thread pool.
+void simitParallelFor(void (*body)(int start, int end, void *closure),
+                      void *closure, int n) {
+  simit::util::ThreadPool::getInstance().parallelFor(n,
+      [body, closure](int start, int end) {
+    body(start, end, closure);
+  });
 }
 
-float det3_f32(float * a){
-  return a[0] * (a[4]*a[8]-a[5]*a[7])
-       - a[1] * (a[3]*a[8]-a[5]*a[6])
-       + a[2] * (a[3]*a[7]-a[4]*a[6]);
+/// Execute the iterations of a colored parallel loop one color at a time. The
+/// edges of each color are executed in parallel, and `body` is called with
+/// ranges of the coloring's edge list (see colorEdges).
+void simitColoredParallelFor(void (*body)(int start, int end, void *closure),
+                             void *closure, const int *coloring) {
+  const int numColors = coloring[0];
+  const int *offsets = &coloring[1];
+  for (int c = 0; c < numColors; ++c) {
+    const int colorStart = offsets[c];
+    simit::util::ThreadPool::getInstance().parallelFor(
+        offsets[c+1] - colorStart,
+        [body, closure, colorStart](int start, int end) {
+      body(colorStart + start, colorStart + end, closure);
+    });
+  }
 }
 
-void inv3_f64(double * a, double * inv){
-  double cof00 = a[4]*a[8]-a[5]*a[7];
-  double cof01 =-a[3]*a[8]+a[5]*a[6];
-  double cof02 = a[3]*a[7]-a[4]*a[6];
+/// Execute the iterations [0,n) of a parallel loop that accumulates into the
+/// given reduction buffers. The first chunk of iterations accumulates into the
+/// buffers themselves, while the other chunks accumulate into private copies
+/// that they zero first, which are merged into the buffers once all chunks
+/// complete.
+/// `lengths` and `components` hold the number of components of each buffer and
+/// their type (see PrivatizedComponent).
+void simitPrivatizedParallelFor(void (*body)(int start, int end,
+                                             void *closure, void **buffers),
+                                void *closure, int n, int numBuffers,
+                                void **buffers, const int *lengths,
+                                const int *components) {
+  if (n <= 0) {
+    return;
+  }
+  simit::util::ThreadPool &pool = simit::util::ThreadPool::getInstance();
+  const int numChunks = std::min((int)pool.getNumThreads(), n);
+  if (numChunks == 1) {
+    body(0, n, closure, buffers);
+    return;
+  }
 
-  double cof10 =-a[1]*a[8]+a[2]*a[7];
-  double cof11 = a[0]*a[8]-a[2]*a[6];
-  double cof12 =-a[0]*a[7]+a[1]*a[6];
+  static const size_t componentSizes[] = {sizeof(int), sizeof(float),
+                                          sizeof(double)};
+  std::vector<std::vector<void*>> copies(numBuffers);
+  for (int b = 0; b < numBuffers; ++b) {
+    copies[b].push_back(buffers[b]);
+    allocatePrivateCopies(copies[b], numChunks,
+                          lengths[b] * componentSizes[components[b]]);
+  }
 
-  double cof20 = a[1]*a[5]-a[2]*a[4];
-  double cof21 =-a[0]*a[5]+a[2]*a[3];
-  double cof22 = a[0]*a[4]-a[1]*a[3];
+  pool.parallelFor(numChunks, [&](int chunkStart, int chunkEnd) {
+    std::vector<void*> privates(numBuffers);
+    for (int c = chunkStart; c < chunkEnd; ++c) {
+      for (int b = 0; b < numBuffers; ++b) {
+        privates[b] = copies[b][c];
+        if (c > 0) {
+          memset(privates[b], 0, lengths[b] * componentSizes[components[b]]);
+        }
+      }
+      int start = (int)(((long long)n * c) / numChunks);
+      int end   = (int)(((long long)n * (c+1)) / numChunks);
+      body(start, end, closure, privates.data());
+    }
+  });
 
-  double determ = a[0] * cof00 + a[1] * cof01 + a[2]*cof02;
+  for (int b = 0; b < numBuffers; ++b) {
+    switch (components[b]) {
+      case PrivatizedInt:
+        mergePrivateCopies<int>(copies[b], lengths[b]);
+        break;
+      case PrivatizedFloat:
+        mergePrivateCopies<float>(copies[b], lengths[b]);
+        break;
+      case PrivatizedDouble:
+        mergePrivateCopies<double>(copies[b], lengths[b]);
+        break;
+    }
+    releasePrivateCopies(copies[b]);
+  }
+}
+} // extern "C"
 
-  determ = 1.0/determ;
-  inv[0] = cof00 * determ;
-  inv[1] = cof10 * determ;
-  inv[2] = cof20 * determ;
 
-  inv[3] = cof01 * determ;
-  inv[4] = cof11 * determ;
-  inv[5] = cof21 * determ;
+/// The type that the sparse matrix-vector multiply kernels accumulate in by
+/// default: the type of their operands, or double if the operands have mixed
+/// precisions, such as a float32 matrix and double vectors.
+template <typename TA, typename TX, typename TY>
+struct Accumulator {typedef double Type;};
+template <typename T>
+struct Accumulator<T,T,T> {typedef T Type;};
 
-  inv[6] = cof02 * determ;
-  inv[7] = cof12 * determ;
-  inv[8] = cof22 * determ;
+/// Multiply the block rows [start,end) of a BCSR matrix, whose blocks are BxB,
+/// by x. The block size is a compile-time constant, so the block products are
+/// fully unrolled and vectorized by the compiler.
+template <int B, typename TA, typename TX, typename TY,
+          typename Acc=typename Accumulator<TA,TX,TY>::Type>
+static inline void spmvRows(int start, int end, const int* rowptr,
+                            const int* colidx, const TA* A, const TX* x,
+                            TY* y) {
+  for (int i = start; i < end; ++i) {
+    Acc yi[B] = {};
+    for (int ij = rowptr[i]; ij < rowptr[i+1]; ++ij) {
+      const TA* a = &A[ij*B*B];
+      const TX* xj = &x[colidx[ij]*B];
+      for (int bi = 0; bi < B; ++bi) {
+        for (int bj = 0; bj < B; ++bj) {
+          yi[bi] += (Acc)a[bi*B + bj] * (Acc)xj[bj];
+        }
+      }
+    }
+    for (int bi = 0; bi < B; ++bi) {
+      y[i*B + bi] = (TY)yi[bi];
+    }
+  }
 }
 
-void inv3_f32(float * a, float * inv){
-  float cof00 = a[4]*a[8]-a[5]*a[7];
-  float cof01 =-a[3]*a[8]+a[5]*a[6];
-  float cof02 = a[3]*a[7]-a[4]*a[6];
+/// The number of blocks below which a thread is not worth the synchronization.
+static const int kSpMVBlocksPerThread = 4096;
 
-  float cof10 =-a[1]*a[8]+a[2]*a[7];
-  float cof11 = a[0]*a[8]-a[2]*a[6];
-  float cof12 =-a[0]*a[7]+a[1]*a[6];
+/// Split the block rows of a BCSR matrix into row ranges with about the same
+/// number of blocks, one per thread that is worth using. Chunk `c` is the rows
+/// [chunks[c], chunks[c+1]), and the trailing empty rows are in the last one.
+static std::vector<int> splitRows(int rows, const int* rowptr) {
+  simit::util::ThreadPool &pool = simit::util::ThreadPool::getInstance();
+  const int nnz = rowptr[rows];
+  const int numChunks = std::max(1, std::min((int)pool.getNumThreads(),
+                                             nnz / kSpMVBlocksPerThread));
+  std::vector<int> chunks(numChunks+1, rows);
+  for (int c = 0; c < numChunks; ++c) {
+    int blocks = (int)(((long long)nnz * c) / numChunks);
+    chunks[c] = std::lower_bound(rowptr, rowptr + rows, blocks) - rowptr;
+  }
+  return chunks;
+}
 
-  float cof20 = a[1]*a[5]-a[2]*a[4];
-  float cof21 =-a[0]*a[5]+a[2]*a[3];
-  float cof22 = a[0]*a[4]-a[1]*a[3];
+/// Compute y = A*x, where A is a BCSR matrix with `rows` block rows of BxB
+/// blocks. Large matrices are split into row ranges with about the same number
+/// of blocks, that are multiplied in parallel on the thread pool.
+template <int B, typename TA, typename TX, typename TY,
+          typename Acc=typename Accumulator<TA,TX,TY>::Type>
+static void spmv(int rows, const int* rowptr, const int* colidx,
+                 const TA* A, const TX* x, TY* y) {
+  std::vector<int> chunks = splitRows(rows, rowptr);
+  const int numChunks = chunks.size()-1;
+  if (numChunks == 1) {
+    spmvRows<B,TA,TX,TY,Acc>(0, rows, rowptr, colidx, A, x, y);
+    return;
+  }
+  simit::util::ThreadPool &pool = simit::util::ThreadPool::getInstance();
+  pool.parallelFor(numChunks, [&](int start, int end) {
+    for (int c = start; c < end; ++c) {
+      spmvRows<B,TA,TX,TY,Acc>(chunks[c], chunks[c+1], rowptr, colidx, A, x,
+                               y);
+    }
+  });
+}
 
-  float determ = a[0] * cof00 + a[1] * cof01 + a[2]*cof02;
+extern "C" {
+void spmv1_f64(int rows, int* rowptr, int* colidx,
+               double* A, double* x, double* y) {
+  spmv<1>(rows, rowptr, colidx, A, x, y);
+}
+void spmv2_f64(int rows, int* rowptr, int* colidx,
+               double* A, double* x, double* y) {
+  spmv<2>(rows, rowptr, colidx, A, x, y);
+}
+void spmv3_f64(int rows, int* rowptr, int* colidx,
+               double* A, double* x, double* y) {
+  spmv<3>(rows, rowptr, colidx, A, x, y);
+}
+void spmv4_f64(int rows, int* rowptr, int* colidx,
+               double* A, double* x, double* y) {
+  spmv<4>(rows, rowptr, colidx, A, x, y);
+}
+void spmv1_f32(int rows, int* rowptr, int* colidx,
+               float* A, float* x, float* y) {
+  spmv<1>(rows, rowptr, colidx, A, x, y);
+}
+void spmv2_f32(int rows, int* rowptr, int* colidx,
+               float* A, float* x, float* y) {
+  spmv<2>(rows, rowptr, colidx, A, x, y);
+}
+void spmv3_f32(int rows, int* rowptr, int* colidx,
+               float* A, float* x, float* y) {
+  spmv<3>(rows, rowptr, colidx, A, x, y);
+}
+void spmv4_f32(int rows, int* rowptr, int* colidx,
+               float* A, float* x, float* y) {
+  spmv<4>(rows, rowptr, colidx, A, x, y);
+}
 
-  determ = 1.0/determ;
-  inv[0] = cof00 * determ;
-  inv[1] = cof10 * determ;
-  inv[2] = cof20 * determ;
+// The mixed-precision kernels, for matrices and vectors whose components are
+// stored with other precisions than the compute precision, are named
+// spmv<B>_<A>_<x>_<y> after the types of their operands, and accumulate in
+// double.
+#define SPMV_MIXED(B, TA, TX, TY, NA, NX, NY)                               \
+void spmv##B##_##NA##_##NX##_##NY(int rows, int* rowptr, int* colidx,       \
+                                  TA* A, TX* x, TY* y) {                    \
+  spmv<B,TA,TX,TY,double>(rows, rowptr, colidx, A, x, y);                   \
+}
+#define SPMV_MIXED_TYPES(B)                                                 \
+  SPMV_MIXED(B, float,  float,  float,  f32, f32, f32)                      \
+  SPMV_MIXED(B, double, double, double, f64, f64, f64)                      \
+  SPMV_MIXED(B, float,  double, double, f32, f64, f64)                      \
+  SPMV_MIXED(B, float,  float,  double, f32, f32, f64)                      \
+  SPMV_MIXED(B, float,  double, float,  f32, f64, f32)                      \
+  SPMV_MIXED(B, double, float,  float,  f64, f32, f32)                      \
+  SPMV_MIXED(B, double, double, float,  f64, f64, f32)                      \
+  SPMV_MIXED(B, double, float,  double, f64, f32, f64)
 
-  inv[3] = cof01 * determ;
-  inv[4] = cof11 * determ;
-  inv[5] = cof21 * determ;
+SPMV_MIXED_TYPES(1) SPMV_MIXED_TYPES(2) SPMV_MIXED_TYPES(3) SPMV_MIXED_TYPES(4)
+#undef SPMV_MIXED_TYPES
+#undef SPMV_MIXED
+} // extern "C"
 
-  inv[6] = cof02 * determ;
-  inv[7] = cof12 * determ;
-  inv[8] = cof22 * determ;
+/// Add the products of the transposes of the blocks in the block rows
+/// [start,end) of a BCSR matrix, whose blocks are RxC, and x to y. Each block
+/// row scatters into the rows of y that are its columns.
+template <int R, int C, typename TA, typename TX, typename Acc>
+static inline void spmvtRows(int start, int end, const int* rowptr,
+                             const int* colidx, const TA* A, const TX* x,
+                             Acc* y) {
+  for (int i = start; i < end; ++i) {
+    const TX* xi = &x[i*R];
+    for (int ij = rowptr[i]; ij < rowptr[i+1]; ++ij) {
+      const TA* a = &A[ij*R*C];
+      Acc* yj = &y[colidx[ij]*C];
+      for (int bi = 0; bi < R; ++bi) {
+        for (int bj = 0; bj < C; ++bj) {
+          yj[bj] += (Acc)a[bi*C + bj] * (Acc)xi[bi];
+        }
+      }
+    }
+  }
 }
 
-double complexNorm_f64(double r, double i) {
-  return sqrt(r*r+i*i);
-}
+/// Compute y = A'x, where A is a BCSR matrix with `rows` block rows and `cols`
+/// block columns of RxC blocks, without transposing A. The block rows are split
+/// into the row ranges of `spmv`. Ranges may scatter into the same rows of y,
+/// so every range but the first scatters into a private copy of y (see
+/// allocatePrivateCopies), and the copies are added to y when all ranges are
+/// done. Multiplies that accumulate in another type than y's scatter into a
+/// copy of y of that type too, which is converted to y when all ranges are
+/// done.
+template <int R, int C, typename TA, typename TX, typename TY,
+          typename Acc=typename Accumulator<TA,TX,TY>::Type>
+static void spmvt(int rows, int cols, const int* rowptr, const int* colidx,
+                  const TA* A, const TX* x, TY* y) {
+  const int len = cols*C;
+  std::vector<int> chunks = splitRows(rows, rowptr);
+  const int numChunks = chunks.size()-1;
 
-float complexNorm_f32(float r, float i) {
-  return sqrt(r*r+i*i);
-}
+  Acc* result = std::is_same<Acc,TY>::value
+      ? (Acc*)y : (Acc*)simit::ffi::simit_malloc(len * sizeof(Acc));
+  std::fill(result, result + len, Acc(0));
+  if (numChunks == 1) {
+    spmvtRows<R,C>(0, rows, rowptr, colidx, A, x, result);
+  }
+  else {
+    std::vector<void*> copies = {result};
+    allocatePrivateCopies(copies, numChunks, len * sizeof(Acc));
+    simit::util::ThreadPool &pool = simit::util::ThreadPool::getInstance();
+    pool.parallelFor(numChunks, [&](int start, int end) {
+      for (int c = start; c < end; ++c) {
+        if (c > 0) {
+          std::fill((Acc*)copies[c], (Acc*)copies[c] + len, Acc(0));
+        }
+        spmvtRows<R,C>(chunks[c], chunks[c+1], rowptr, colidx, A, x,
+                       (Acc*)copies[c]);
+      }
+    });
+    mergePrivateCopies<Acc>(copies, len);
+    releasePrivateCopies(copies);
+  }
 
-void simitStoreTime(int i, double value) {
-  simit::ir::TimerStorage::getInstance().storeTime(i, value);
+  if ((void*)result != (void*)y) {
+    std::copy(result, result + len, y);
+    simit::ffi::simit_free(result);
+  }
 }
 
-double simitClock() {
-  using namespace std::chrono;
-  auto t = high_resolution_clock::now();
-  time_point<high_resolution_clock,microseconds> usec = time_point_cast<microseconds>(t);
-  return (double)(usec.time_since_epoch().count());
+// The transposed kernels are named spmvt<R>x<C>_<type>, for blocks with up to
+// kMaxSpMVBlockSize rows and columns of doubles, floats and ints.
+#define SPMVT(R, C, T, TypeName)                                            \
+void spmvt##R##x##C##_##TypeName(int rows, int cols, int* rowptr,           \
+                                 int* colidx, T* A, T* x, T* y) {          \
+  spmvt<R,C>(rows, cols, rowptr, colidx, A, x, y);                          \
 }
+// Mixed-precision kernels are named spmvt<R>x<C>_<A>_<x>_<y> after the types
+// of their operands, and accumulate in double.
+#define SPMVT_MIXED(R, C, TA, TX, TY, NA, NX, NY)                           \
+void spmvt##R##x##C##_##NA##_##NX##_##NY(int rows, int cols, int* rowptr,   \
+                                         int* colidx, TA* A, TX* x, TY* y) {\
+  spmvt<R,C,TA,TX,TY,double>(rows, cols, rowptr, colidx, A, x, y);          \
+}
+#define SPMVT_TYPES(R, C)                                                   \
+  SPMVT(R, C, double, f64) SPMVT(R, C, float, f32) SPMVT(R, C, int, i32)    \
+  SPMVT_MIXED(R, C, float,  float,  float,  f32, f32, f32)                  \
+  SPMVT_MIXED(R, C, double, double, double, f64, f64, f64)                  \
+  SPMVT_MIXED(R, C, float,  double, double, f32, f64, f64)                  \
+  SPMVT_MIXED(R, C, float,  float,  double, f32, f32, f64)                  \
+  SPMVT_MIXED(R, C, float,  double, float,  f32, f64, f32)                  \
+  SPMVT_MIXED(R, C, double, float,  float,  f64, f32, f32)                  \
+  SPMVT_MIXED(R, C, double, double, float,  f64, f64, f32)                  \
+  SPMVT_MIXED(R, C, double, float,  double, f64, f32, f64)
+
+extern "C" {
+SPMVT_TYPES(1,1) SPMVT_TYPES(1,2) SPMVT_TYPES(1,3) SPMVT_TYPES(1,4)
+SPMVT_TYPES(2,1) SPMVT_TYPES(2,2) SPMVT_TYPES(2,3) SPMVT_TYPES(2,4)
+SPMVT_TYPES(3,1) SPMVT_TYPES(3,2) SPMVT_TYPES(3,3) SPMVT_TYPES(3,4)
+SPMVT_TYPES(4,1) SPMVT_TYPES(4,2) SPMVT_TYPES(4,3) SPMVT_TYPES(4,4)
 } // extern "C"
+#undef SPMVT_TYPES
+#undef SPMVT_MIXED
+#undef SPMVT
 
 
 /// Temporary external spmm implementation until Simit supports assembling
@@ -337,22 +620,21 @@ extern "C" int dlumatsolve(void** solverPtr,
 }
 
 
-/// Cholesky factorization. Returns a solver object that can be used with
+/// Cholesky (LDL') factorization. Returns a solver object that can be used with
 /// `lltsolve` and `lltmatsolve`. The solver object must be freed using
-/// `cholfree`.
+/// `cholfree`. The symbolic analysis of the matrix is shared by every matrix
+/// with the same index, so only the numeric factorization is redone when the
+/// matrix is reassembled from the same path expression.
 template <typename Float>
 int chol(int An,  int Am,  int* Arowptr, int* Acolidx,
          int Ann, int Amm, Float* Avals,
          void** solverPtr) {
-#ifdef EIGEN
-  auto A = csr2eigen<Float,Eigen::ColMajor>(An, Am, Arowptr, Acolidx,
-                                            Ann, Amm, Avals);
-  auto solver = new SimplicialCholesky<SparseMatrix<Float>>();
-  solver->compute(A);
+  uassert(An == Am && Ann == Amm)
+      << "chol requires a square matrix with square blocks";
+  auto analysis = simit::analyzeCholesky(An/Ann, Ann, Arowptr, Acolidx);
+  auto solver = new simit::SparseCholesky<Float>(analysis);
+  solver->factorize(Avals);
   *solverPtr = static_cast<void*>(solver);
-#else
-  SOLVER_ERROR;
-#endif
   return 0;
 }
 extern "C" int schol(int An,  int Am,  int* Arowptr, int* Acolidx,
@@ -369,12 +651,7 @@ extern "C" int dchol(int An,  int Am,  int* Arowptr, int* Acolidx,
 /// Free a Cholesky solver.
 template <typename Float>
 int cholfree(void** solverPtr) {
-#ifdef EIGEN
-  auto solver=static_cast<SimplicialCholesky<SparseMatrix<Float>>*>(*solverPtr);
-  delete solver;
-#else
-  SOLVER_ERROR;
-#endif
+  delete static_cast<simit::SparseCholesky<Float>*>(*solverPtr);
   return 0;
 }
 extern "C" int scholfree(void** solverPtr) {
@@ -388,17 +665,9 @@ extern "C" int dcholfree(void** solverPtr){
 /// factorized with the provided solver using `chol`.
 template <typename Float>
 int lltsolve(void** solverPtr, int nb, Float *bvals, int nx, Float *xvals) {
-#ifdef EIGEN
-  auto solver=static_cast<SimplicialCholesky<SparseMatrix<Float>>*>(*solverPtr);
-  auto b = dense2eigen(nb, bvals);
-  auto x = Eigen::Matrix<Float,Eigen::Dynamic,1>(nx);
-  x = solver->solve(b);
-  for (int i=0; i<nx; ++i) {
-    xvals[i] = x(i);
-  }
-#else
-  SOLVER_ERROR;
-#endif
+  auto solver = static_cast<simit::SparseCholesky<Float>*>(*solverPtr);
+  iassert(nb == solver->getAnalysis().getSize() && nx == nb);
+  solver->solve(bvals, xvals);
   return 0;
 }
 extern "C" {
@@ -411,23 +680,67 @@ int dlltsolve(void** solverPtr, int bn, double *bvals, int xn, double *xvals){
 }
 
 /// Solve `T=L^{-1}*B` and `X=L'^{-1}*T`, where `A=LL'` is the matrix that was
-/// factorized with the provided solver using `chol`.
+/// factorized with the provided solver using `chol`. The columns of `X` are
+/// solved one at a time, and their nonzeros are stored in a new CSR matrix.
 template <typename Float>
 int lltmatsolve(void** solverPtr,
                  int Bn,  int Bm,  int* Browptr, int* Bcolidx,
                  int Bnn, int Bmm, Float* Bvals,
                  int Xn,  int Xm,  int** Xrowptr, int** Xcolidx,
                  int Xnn, int Xmm, Float** Xvals){
-#ifdef EIGEN
-  auto solver=static_cast<SimplicialCholesky<SparseMatrix<Float>>*>(*solverPtr);
-  auto B = csr2eigen<Float>(Bn, Bm, Browptr, Bcolidx, Bnn, Bmm, Bvals);
-  SparseMatrix<Float> X(Xn, Xm);
-  X = solver->solve(B);
-  X = X.transpose();
-  eigen2csr<Float>(X, Xn, Xm, Xrowptr, Xcolidx, Xnn, Xmm, Xvals);
-#else
-  SOLVER_ERROR;
-#endif
+  auto solver = static_cast<simit::SparseCholesky<Float>*>(*solverPtr);
+  iassert(Bn == solver->getAnalysis().getSize() && Xn == Bn && Xm == Bm);
+  tassert(Xnn == 1 && Xmm == 1) << "lltmatsolve does not support blocked results";
+
+  // The columns of B
+  std::vector<std::vector<std::pair<int,Float>>> columns(Bm);
+  for (int i = 0; i < Bn/Bnn; ++i) {
+    for (int ij = Browptr[i]; ij < Browptr[i+1]; ++ij) {
+      for (int bi = 0; bi < Bnn; ++bi) {
+        for (int bj = 0; bj < Bmm; ++bj) {
+          Float val = Bvals[(ij*Bnn + bi)*Bmm + bj];
+          columns[Bcolidx[ij]*Bmm + bj].push_back({i*Bnn + bi, val});
+        }
+      }
+    }
+  }
+
+  // Solve for the columns of X, and count the nonzeros of its rows
+  std::vector<Float> b(Bn);
+  std::vector<Float> x(Bn);
+  std::vector<std::vector<std::pair<int,Float>>> solutions(Xm);
+  std::vector<int> rowCounts(Xn, 0);
+  for (int j = 0; j < Xm; ++j) {
+    std::fill(b.begin(), b.end(), Float(0));
+    for (auto& entry : columns[j]) {
+      b[entry.first] += entry.second;
+    }
+    solver->solve(b.data(), x.data());
+    for (int i = 0; i < Xn; ++i) {
+      if (x[i] != 0) {
+        solutions[j].push_back({i, x[i]});
+        ++rowCounts[i];
+      }
+    }
+  }
+
+  int nnz = 0;
+  for (int count : rowCounts) {
+    nnz += count;
+  }
+  mallocMatrix(Xn, Xm, Xrowptr, Xcolidx, Xnn, Xmm, Xvals, nnz);
+  (*Xrowptr)[0] = 0;
+  for (int i = 0; i < Xn; ++i) {
+    (*Xrowptr)[i+1] = (*Xrowptr)[i] + rowCounts[i];
+  }
+  std::vector<int> next(*Xrowptr, *Xrowptr + Xn);
+  for (int j = 0; j < Xm; ++j) {
+    for (auto& entry : solutions[j]) {
+      int ij = next[entry.first]++;
+      (*Xcolidx)[ij] = j;
+      (*Xvals)[ij] = entry.second;
+    }
+  }
   return 0;
 }
 extern "C" int slltmatsolve(void** solverPtr,
@@ -448,3 +761,292 @@ extern "C" int dlltmatsolve(void** solverPtr,
                       Bn, Bm, Browptr, Bcolidx, Bnn, Bmm, Bvals,
                       Xn, Xm, Xrowptr, Xcolidx, Xnn, Xmm, Xvals);
 }
+
+
+// Iterative solvers
+
+/// Invert the BxB block `a` by Gauss-Jordan elimination with partial pivoting.
+/// Returns false if the block is singular.
+template <int B, typename Float>
+static bool invertBlock(const Float* a, Float* inv) {
+  Float m[B][2*B];
+  for (int i = 0; i < B; ++i) {
+    for (int j = 0; j < B; ++j) {
+      m[i][j] = a[i*B + j];
+      m[i][B+j] = (i == j) ? 1 : 0;
+    }
+  }
+  for (int k = 0; k < B; ++k) {
+    int pivot = k;
+    for (int i = k+1; i < B; ++i) {
+      if (std::abs(m[i][k]) > std::abs(m[pivot][k])) {
+        pivot = i;
+      }
+    }
+    if (m[pivot][k] == 0) {
+      return false;
+    }
+    for (int j = 0; j < 2*B; ++j) {
+      std::swap(m[k][j], m[pivot][j]);
+    }
+    Float scale = 1 / m[k][k];
+    for (int j = 0; j < 2*B; ++j) {
+      m[k][j] *= scale;
+    }
+    for (int i = 0; i < B; ++i) {
+      if (i != k && m[i][k] != 0) {
+        Float f = m[i][k];
+        for (int j = 0; j < 2*B; ++j) {
+          m[i][j] -= f * m[k][j];
+        }
+      }
+    }
+  }
+  for (int i = 0; i < B; ++i) {
+    for (int j = 0; j < B; ++j) {
+      inv[i*B + j] = m[i][B+j];
+    }
+  }
+  return true;
+}
+
+/// Compute z = M^{-1}*r for block row i, where M is the block diagonal of the
+/// matrix (block-Jacobi, or Jacobi for scalar blocks). Minv is null when the
+/// solve is not preconditioned.
+template <int B, typename Float>
+static inline void precondition(int i, const Float* Minv, const Float* r,
+                                Float* z) {
+  if (Minv == nullptr) {
+    for (int bi = 0; bi < B; ++bi) {
+      z[bi] = r[i*B + bi];
+    }
+    return;
+  }
+  const Float* m = &Minv[i*B*B];
+  for (int bi = 0; bi < B; ++bi) {
+    Float zi = 0;
+    for (int bj = 0; bj < B; ++bj) {
+      zi += m[bi*B + bj] * r[i*B + bj];
+    }
+    z[bi] = zi;
+  }
+}
+
+/// Solve `Ax=b` with the (preconditioned) conjugate gradient method, starting
+/// from x0, where A is a symmetric positive definite BCSR matrix with `rows`
+/// block rows of BxB blocks. Iterates until the residual norm relative to the
+/// norm of b is at most `tol`, or for at most `maxiters` iterations.
+///
+/// Each iteration makes three passes over the system: the matrix-vector
+/// product fused with the dot product it feeds, the update of x and r fused
+/// with the preconditioner and the residual dot products, and the update of
+/// the search direction, which recomputes the preconditioned residual instead
+/// of storing it. Each pass is split into the row ranges used by `spmv`, and
+/// the partial dot products of the ranges are summed in order, so results do
+/// not depend on the thread schedule.
+template <int B, typename Float>
+static void cg(int rows, const int* rowptr, const int* colidx, const Float* A,
+               const Float* b, const Float* x0, Float tol, int maxiters,
+               bool preconditioned, Float* x, int* iterations,
+               Float* residual) {
+  const int n = rows*B;
+
+  std::vector<Float> Minv;
+  if (preconditioned) {
+    Minv.resize(rows*B*B);
+    for (int i = 0; i < rows; ++i) {
+      const int* diag = std::lower_bound(colidx + rowptr[i],
+                                         colidx + rowptr[i+1], i);
+      uassert(diag != colidx + rowptr[i+1] && *diag == i &&
+              invertBlock<B>(&A[(diag - colidx)*B*B], &Minv[i*B*B]))
+          << "pcg: the diagonal block of row " << i << " is singular";
+    }
+  }
+  const Float* M = preconditioned ? Minv.data() : nullptr;
+
+  std::vector<Float> r(n), p(n), q(n);
+  std::vector<int> chunks = splitRows(rows, rowptr);
+  const int numChunks = chunks.size()-1;
+
+  // Run `body(start, end, sums)` on every chunk and return the sums of the
+  // partial sums that it accumulates
+  simit::util::ThreadPool &pool = simit::util::ThreadPool::getInstance();
+  struct Sums {double s0, s1, s2;};
+  std::vector<Sums> partial(numChunks);
+  auto forChunks = [&](const std::function<void(int,int,Sums*)> &body) {
+    if (numChunks == 1) {
+      partial[0] = {0,0,0};
+      body(0, rows, &partial[0]);
+    }
+    else {
+      pool.parallelFor(numChunks, [&](int start, int end) {
+        for (int c = start; c < end; ++c) {
+          partial[c] = {0,0,0};
+          body(chunks[c], chunks[c+1], &partial[c]);
+        }
+      });
+    }
+    Sums sums = {0,0,0};
+    for (const Sums &chunk : partial) {
+      sums.s0 += chunk.s0;
+      sums.s1 += chunk.s1;
+      sums.s2 += chunk.s2;
+    }
+    return sums;
+  };
+
+  // r = b - A*x0, p = M^{-1}*r
+  Sums init = forChunks([&](int start, int end, Sums *sums) {
+    std::copy(x0 + start*B, x0 + end*B, x + start*B);
+    spmvRows<B>(start, end, rowptr, colidx, A, x0, &r[0]);
+    for (int i = start; i < end; ++i) {
+      Float z[B];
+      for (int bi = 0; bi < B; ++bi) {
+        int j = i*B + bi;
+        r[j] = b[j] - r[j];
+      }
+      precondition<B>(i, M, r.data(), z);
+      for (int bi = 0; bi < B; ++bi) {
+        int j = i*B + bi;
+        p[j] = z[bi];
+        sums->s0 += r[j] * z[bi];
+        sums->s1 += r[j] * r[j];
+        sums->s2 += b[j] * b[j];
+      }
+    }
+  });
+  double rz = init.s0;
+  double bnorm = std::sqrt(init.s2);
+  if (bnorm == 0) {
+    std::fill(x, x+n, 0);
+    *iterations = 0;
+    *residual = 0;
+    return;
+  }
+  double relres = std::sqrt(init.s1) / bnorm;
+
+  int k = 0;
+  while (relres > tol && k < maxiters) {
+    // q = A*p
+    Sums pq = forChunks([&](int start, int end, Sums *sums) {
+      spmvRows<B>(start, end, rowptr, colidx, A, p.data(), &q[0]);
+      for (int i = start*B; i < end*B; ++i) {
+        sums->s0 += p[i] * q[i];
+      }
+    });
+    // The matrix is not positive definite, or the iteration has stagnated at
+    // the precision of Float. The residual tells how far it got.
+    if (pq.s0 <= 0) {
+      break;
+    }
+    const Float alpha = rz / pq.s0;
+
+    // x += alpha*p, r -= alpha*q
+    Sums rr = forChunks([&](int start, int end, Sums *sums) {
+      for (int i = start; i < end; ++i) {
+        for (int bi = 0; bi < B; ++bi) {
+          int j = i*B + bi;
+          x[j] += alpha * p[j];
+          r[j] -= alpha * q[j];
+          sums->s1 += r[j] * r[j];
+        }
+        Float z[B];
+        precondition<B>(i, M, r.data(), z);
+        for (int bi = 0; bi < B; ++bi) {
+          sums->s0 += r[i*B + bi] * z[bi];
+        }
+      }
+    });
+    const Float beta = rr.s0 / rz;
+    rz = rr.s0;
+    relres = std::sqrt(rr.s1) / bnorm;
+    ++k;
+
+    // p = M^{-1}*r + beta*p
+    if (relres > tol && k < maxiters) {
+      forChunks([&](int start, int end, Sums*) {
+        for (int i = start; i < end; ++i) {
+          Float z[B];
+          precondition<B>(i, M, r.data(), z);
+          for (int bi = 0; bi < B; ++bi) {
+            p[i*B + bi] = z[bi] + beta * p[i*B + bi];
+          }
+        }
+      });
+    }
+  }
+  *iterations = k;
+  *residual = relres;
+}
+
+template <typename Float>
+int cg(int An,  int Am,  int* Arowptr, int* Acolidx,
+       int Ann, int Amm, Float* Avals,
+       int bn, Float* bvals, int x0n, Float* x0vals,
+       Float tol, int maxiters, bool preconditioned,
+       int xn, Float* xvals, int* iterations, Float* residual) {
+  uassert(An == Am && Ann == Amm)
+      << "cg requires a square matrix with square blocks";
+  iassert(bn == An && x0n == An && xn == An);
+  const int rows = An/Ann;
+  switch (Ann) {
+    case 1:
+      cg<1>(rows, Arowptr, Acolidx, Avals, bvals, x0vals, tol, maxiters,
+            preconditioned, xvals, iterations, residual);
+      break;
+    case 2:
+      cg<2>(rows, Arowptr, Acolidx, Avals, bvals, x0vals, tol, maxiters,
+            preconditioned, xvals, iterations, residual);
+      break;
+    case 3:
+      cg<3>(rows, Arowptr, Acolidx, Avals, bvals, x0vals, tol, maxiters,
+            preconditioned, xvals, iterations, residual);
+      break;
+    case 4:
+      cg<4>(rows, Arowptr, Acolidx, Avals, bvals, x0vals, tol, maxiters,
+            preconditioned, xvals, iterations, residual);
+      break;
+    default:
+      uerror << "cg does not support " << Ann << "x" << Ann << " blocks";
+  }
+  return 0;
+}
+
+/// Conjugate gradient solve of `Ax=b`. Returns x and the number of iterations
+/// and relative residual norm it took.
+extern "C" int scg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                   int Ann, int Amm, float* Avals,
+                   int bn, float* bvals, int x0n, float* x0vals,
+                   float tol, int maxiters,
+                   int xn, float* xvals, int* iterations, float* residual) {
+  return cg(An, Am, Arowptr, Acolidx, Ann, Amm, Avals, bn, bvals, x0n, x0vals,
+            tol, maxiters, false, xn, xvals, iterations, residual);
+}
+extern "C" int dcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                   int Ann, int Amm, double* Avals,
+                   int bn, double* bvals, int x0n, double* x0vals,
+                   double tol, int maxiters,
+                   int xn, double* xvals, int* iterations, double* residual) {
+  return cg(An, Am, Arowptr, Acolidx, Ann, Amm, Avals, bn, bvals, x0n, x0vals,
+            tol, maxiters, false, xn, xvals, iterations, residual);
+}
+
+/// Block-Jacobi preconditioned conjugate gradient solve of `Ax=b`, which
+/// preconditions with the inverse of the diagonal blocks of A (Jacobi for
+/// matrices with scalar blocks).
+extern "C" int spcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                    int Ann, int Amm, float* Avals,
+                    int bn, float* bvals, int x0n, float* x0vals,
+                    float tol, int maxiters,
+                    int xn, float* xvals, int* iterations, float* residual) {
+  return cg(An, Am, Arowptr, Acolidx, Ann, Amm, Avals, bn, bvals, x0n, x0vals,
+            tol, maxiters, true, xn, xvals, iterations, residual);
+}
+extern "C" int dpcg(int An,  int Am,  int* Arowptr, int* Acolidx,
+                    int Ann, int Amm, double* Avals,
+                    int bn, double* bvals, int x0n, double* x0vals,
+                    double tol, int maxiters,
+                    int xn, double* xvals, int* iterations, double* residual) {
+  return cg(An, Am, Arowptr, Acolidx, Ann, Amm, Avals, bn, bvals, x0n, x0vals,
+            tol, maxiters, true, xn, xvals, iterations, residual);
+}
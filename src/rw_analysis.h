@@ -89,7 +89,7 @@ public:
     else if (isa<FieldRead>(op->buffer)) {
       const FieldRead* fieldRead = to<FieldRead>(op->buffer);
       iassert(isa<VarExpr>(fieldRead->elementOrSet));
-      maybeWrite(to<VarExpr>(fieldRead->elementOrSet)->var);
+      maybeRead(to<VarExpr>(fieldRead->elementOrSet)->var);
     }
     IRVisitor::visit(op);
   }
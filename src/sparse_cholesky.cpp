@@ -0,0 +1,297 @@
+#include "sparse_cholesky.h"
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+
+using namespace std;
+
+namespace simit {
+
+/// Part of the graph of the block rows that is being ordered, by vertices.
+struct Subgraph {
+  const vector<vector<int>>& adjacent;
+  vector<int>& part;     // The subgraph of each vertex
+  vector<int>& level;    // BFS level of each vertex, or -1
+  vector<int>& order;    // Vertices in elimination order
+};
+
+/// Breadth-first search of the component of `root` in subgraph `id`, which
+/// returns the component in the order it was visited and sets their levels.
+static vector<int> visitLevels(Subgraph& g, int id, int root) {
+  vector<int> visited = {root};
+  g.level[root] = 0;
+  for (size_t k = 0; k < visited.size(); ++k) {
+    int v = visited[k];
+    for (int w : g.adjacent[v]) {
+      if (g.part[w] == id && g.level[w] == -1) {
+        g.level[w] = g.level[v] + 1;
+        visited.push_back(w);
+      }
+    }
+  }
+  return visited;
+}
+
+/// Order the vertices of subgraph `id` by nested dissection: split each
+/// component in halves with a separator, order the halves recursively and order
+/// the separator last. Separators are the middle level of a breadth-first
+/// search from a pseudo-peripheral vertex, which are small on meshes.
+static void dissect(Subgraph& g, int id, vector<int> vertices, int* numParts) {
+  const size_t leafSize = 64;
+  while (vertices.size() > leafSize) {
+    // Find a pseudo-peripheral vertex, the last vertex of two searches
+    vector<int> component = visitLevels(g, id, vertices[0]);
+    for (int v : component) g.level[v] = -1;
+    component = visitLevels(g, id, component.back());
+    int depth = g.level[component.back()];
+
+    // Unreached vertices are in other components, which are ordered next
+    vector<int> others;
+    if (component.size() < vertices.size()) {
+      for (int v : vertices) {
+        if (g.level[v] == -1) {
+          others.push_back(v);
+        }
+      }
+    }
+
+    vector<int> first, second, separator;
+    if (depth < 2) {
+      first = component;  // Too dense to separate
+    }
+    else {
+      int middle = g.level[component[component.size()/2]];
+      middle = max(1, min(middle, depth-1));
+      for (int v : component) {
+        if (g.level[v] < middle) first.push_back(v);
+        else if (g.level[v] > middle) second.push_back(v);
+        else separator.push_back(v);
+      }
+    }
+    for (int v : component) g.level[v] = -1;
+
+    if (separator.empty()) {
+      g.order.insert(g.order.end(), first.begin(), first.end());
+    }
+    else {
+      int firstId = (*numParts)++;
+      int secondId = (*numParts)++;
+      for (int v : first) g.part[v] = firstId;
+      for (int v : second) g.part[v] = secondId;
+      for (int v : separator) g.part[v] = -1;
+      dissect(g, firstId, first, numParts);
+      dissect(g, secondId, second, numParts);
+      g.order.insert(g.order.end(), separator.begin(), separator.end());
+    }
+    vertices.swap(others);
+  }
+  g.order.insert(g.order.end(), vertices.begin(), vertices.end());
+}
+
+/// Order the block rows of a matrix by nested dissection of their graph.
+/// Returns the block rows in elimination order.
+static vector<int> nestedDissectionOrder(int rows, const int* rowptr,
+                                         const int* colidx) {
+  vector<vector<int>> adjacent(rows);
+  for (int i = 0; i < rows; ++i) {
+    for (int ij = rowptr[i]; ij < rowptr[i+1]; ++ij) {
+      int j = colidx[ij];
+      if (i != j) {
+        adjacent[i].push_back(j);
+        adjacent[j].push_back(i);
+      }
+    }
+  }
+
+  vector<int> part(rows, 0);
+  vector<int> level(rows, -1);
+  vector<int> order;
+  order.reserve(rows);
+  Subgraph graph = {adjacent, part, level, order};
+
+  vector<int> vertices(rows);
+  for (int i = 0; i < rows; ++i) {
+    vertices[i] = i;
+  }
+  int numParts = 1;
+  dissect(graph, 0, vertices, &numParts);
+  return order;
+}
+
+CholeskyAnalysis::CholeskyAnalysis(int rows, int blockSize, const int* rowptr,
+                                   const int* colidx)
+    : n(rows*blockSize), blockSize(blockSize),
+      rowptr(rowptr, rowptr+rows+1), colidx(colidx, colidx+rowptr[rows]) {
+  const int B = blockSize;
+
+  // Fill-reducing ordering of the scalar rows
+  vector<int> blockOrder = nestedDissectionOrder(rows, rowptr, colidx);
+  perm.resize(n);
+  vector<int> pinv(n);
+  for (int k = 0; k < rows; ++k) {
+    for (int b = 0; b < B; ++b) {
+      perm[k*B + b] = blockOrder[k]*B + b;
+      pinv[blockOrder[k]*B + b] = k*B + b;
+    }
+  }
+
+  // Upper triangle of the permuted matrix, from the lower triangle of the
+  // matrix. Sorting the entries by column and row makes the columns sorted.
+  struct Entry {int col, row, source;};
+  vector<Entry> entries;
+  for (int i = 0; i < rows; ++i) {
+    for (int ij = rowptr[i]; ij < rowptr[i+1]; ++ij) {
+      int j = colidx[ij];
+      for (int bi = 0; bi < B; ++bi) {
+        for (int bj = 0; bj < B; ++bj) {
+          int row = i*B + bi;
+          int col = j*B + bj;
+          if (row >= col) {
+            int prow = pinv[row];
+            int pcol = pinv[col];
+            entries.push_back({max(prow,pcol), min(prow,pcol),
+                               (ij*B + bi)*B + bj});
+          }
+        }
+      }
+    }
+  }
+  sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+    return a.col < b.col || (a.col == b.col && a.row < b.row);
+  });
+  Cp.assign(n+1, 0);
+  Ci.reserve(entries.size());
+  Csource.reserve(entries.size());
+  for (const Entry& entry : entries) {
+    ++Cp[entry.col+1];
+    Ci.push_back(entry.row);
+    Csource.push_back(entry.source);
+  }
+  for (int k = 0; k < n; ++k) {
+    Cp[k+1] += Cp[k];
+  }
+
+  // Elimination tree
+  vector<int> parent(n, -1);
+  vector<int> ancestor(n, -1);
+  for (int k = 0; k < n; ++k) {
+    for (int p = Cp[k]; p < Cp[k+1]; ++p) {
+      int i = Ci[p];
+      while (i != -1 && i < k) {
+        int next = ancestor[i];
+        ancestor[i] = k;
+        if (next == -1) {
+          parent[i] = k;
+        }
+        i = next;
+      }
+    }
+  }
+
+  // The nonzeros of row k of L are the nodes of the elimination tree that are
+  // reachable from the nonzeros of column k of the upper triangle.
+  vector<int> flag(n, -1);
+  vector<int> stack(n);
+  vector<int> counts(n, 0);
+  Rp.assign(n+1, 0);
+  for (int k = 0; k < n; ++k) {
+    flag[k] = k;
+    int top = n;
+    for (int p = Cp[k]; p < Cp[k+1]; ++p) {
+      int len = 0;
+      for (int i = Ci[p]; flag[i] != k; i = parent[i]) {
+        stack[len++] = i;
+        flag[i] = k;
+      }
+      while (len > 0) {
+        stack[--top] = stack[--len];
+      }
+    }
+    for (int t = top; t < n; ++t) {
+      Rj.push_back(stack[t]);
+      ++counts[stack[t]];
+    }
+    Rp[k+1] = Rj.size();
+  }
+
+  // Columns of L
+  Lp.assign(n+1, 0);
+  for (int j = 0; j < n; ++j) {
+    Lp[j+1] = Lp[j] + counts[j];
+  }
+  Li.resize(Lp[n]);
+  vector<int> next(Lp.begin(), Lp.end()-1);
+  for (int k = 0; k < n; ++k) {
+    for (int r = Rp[k]; r < Rp[k+1]; ++r) {
+      Li[next[Rj[r]]++] = k;
+    }
+  }
+}
+
+bool CholeskyAnalysis::matches(int rows, int blockSize, const int* rowptr,
+                               const int* colidx) const {
+  return this->blockSize == blockSize &&
+         (int)this->rowptr.size() == rows+1 &&
+         equal(this->rowptr.begin(), this->rowptr.end(), rowptr) &&
+         equal(this->colidx.begin(), this->colidx.end(), colidx);
+}
+
+namespace {
+/// The analyses of the most recently factorized matrices, most recent first.
+struct AnalysisCache {
+  struct Entry {
+    const int* rowptr;
+    const int* colidx;
+    shared_ptr<const CholeskyAnalysis> analysis;
+  };
+  static const size_t capacity = 16;
+
+  mutex lock;
+  list<Entry> entries;
+  unsigned misses = 0;
+
+  static AnalysisCache& getInstance() {
+    static AnalysisCache cache;
+    return cache;
+  }
+};
+}
+
+shared_ptr<const CholeskyAnalysis>
+analyzeCholesky(int rows, int blockSize, const int* rowptr, const int* colidx) {
+  AnalysisCache& cache = AnalysisCache::getInstance();
+  {
+    lock_guard<mutex> guard(cache.lock);
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+      if (it->rowptr == rowptr && it->colidx == colidx) {
+        // The index arrays may have been freed and reallocated for another
+        // matrix since they were analyzed
+        if (it->analysis->matches(rows, blockSize, rowptr, colidx)) {
+          cache.entries.splice(cache.entries.begin(), cache.entries, it);
+          return it->analysis;
+        }
+        cache.entries.erase(it);
+        break;
+      }
+    }
+  }
+
+  auto analysis = make_shared<const CholeskyAnalysis>(rows, blockSize,
+                                                      rowptr, colidx);
+  lock_guard<mutex> guard(cache.lock);
+  ++cache.misses;
+  cache.entries.push_front({rowptr, colidx, analysis});
+  if (cache.entries.size() > AnalysisCache::capacity) {
+    cache.entries.pop_back();
+  }
+  return analysis;
+}
+
+unsigned getCholeskyAnalysisCount() {
+  AnalysisCache& cache = AnalysisCache::getInstance();
+  lock_guard<mutex> guard(cache.lock);
+  return cache.misses;
+}
+
+}
@@ -0,0 +1,150 @@
+#ifndef SIMIT_SPARSE_CHOLESKY_H
+#define SIMIT_SPARSE_CHOLESKY_H
+
+#include <memory>
+#include <vector>
+
+#include "error.h"
+
+namespace simit {
+
+/// The symbolic analysis of the LDL' factorization of a symmetric BCSR matrix:
+/// a fill-reducing ordering, the elimination tree and the nonzero structure of
+/// the factor. The analysis only depends on the sparsity of the matrix, so it
+/// is shared by every factorization of matrices with the same index.
+///
+/// The factorization is of the scalar matrix `PAP'`, where `P` is a nested
+/// dissection ordering of the block rows that keeps the scalar rows of each block
+/// together. Only the lower triangle of `A` is read, like the Eigen solvers.
+class CholeskyAnalysis {
+public:
+  CholeskyAnalysis(int rows, int blockSize, const int* rowptr,
+                   const int* colidx);
+
+  /// True if the analysis was made for a matrix with the given index.
+  bool matches(int rows, int blockSize, const int* rowptr,
+               const int* colidx) const;
+
+  /// Number of scalar rows of the matrix.
+  int getSize() const {return n;}
+
+  /// Number of nonzeros of the strictly lower triangular factor `L`.
+  int getFactorNonZeros() const {return Lp[n];}
+
+private:
+  int n;
+  int blockSize;
+
+  // A copy of the matrix index, to check that cached analyses still match
+  std::vector<int> rowptr;
+  std::vector<int> colidx;
+
+  // Scalar row `k` of the permuted matrix is row `perm[k]` of the matrix
+  std::vector<int> perm;
+
+  // Upper triangle of the permuted matrix (CSC), where `Cx[p]` is the matrix
+  // value `vals[Csource[p]]`
+  std::vector<int> Cp;
+  std::vector<int> Ci;
+  std::vector<int> Csource;
+
+  // Strictly lower triangle of the factor (CSC, sorted rows)
+  std::vector<int> Lp;
+  std::vector<int> Li;
+
+  // The columns `j` of the nonzeros `L(k,j)` of each row `k` of the factor, in
+  // the topological order of the elimination tree that they are computed in
+  std::vector<int> Rp;
+  std::vector<int> Rj;
+
+  template <typename Float> friend class SparseCholesky;
+};
+
+/// Returns the analysis of a matrix with the given index. Analyses are cached
+/// by the address of the index arrays. These are the arrays of the matrix's
+/// path index (see SegmentedPathIndex), so matrices that are assembled from the
+/// same path expression in every time step share one analysis.
+std::shared_ptr<const CholeskyAnalysis>
+analyzeCholesky(int rows, int blockSize, const int* rowptr, const int* colidx);
+
+/// Number of analyses that have been computed, rather than taken from the
+/// cache, by `analyzeCholesky`.
+unsigned getCholeskyAnalysisCount();
+
+/// A numeric LDL' factorization of a symmetric BCSR matrix, which solves linear
+/// systems with the matrix.
+template <typename Float>
+class SparseCholesky {
+public:
+  SparseCholesky(std::shared_ptr<const CholeskyAnalysis> analysis)
+      : analysis(analysis), Lx(analysis->Lp[analysis->n]), D(analysis->n) {}
+
+  /// Factorize the matrix with the given values, which are laid out like the
+  /// matrix that was analyzed.
+  void factorize(const Float* vals) {
+    const CholeskyAnalysis& a = *analysis;
+    const int n = a.n;
+    std::vector<Float> y(n, 0);
+    std::vector<int> next(a.Lp.begin(), a.Lp.end()-1);
+
+    for (int k = 0; k < n; ++k) {
+      // Scatter column k of the upper triangle of the permuted matrix
+      for (int p = a.Cp[k]; p < a.Cp[k+1]; ++p) {
+        y[a.Ci[p]] += vals[a.Csource[p]];
+      }
+      Float d = y[k];
+      y[k] = 0;
+
+      // Compute row k of L from the rows that it depends on
+      for (int r = a.Rp[k]; r < a.Rp[k+1]; ++r) {
+        int i = a.Rj[r];
+        Float yi = y[i];
+        y[i] = 0;
+        for (int p = a.Lp[i]; p < next[i]; ++p) {
+          y[a.Li[p]] -= Lx[p] * yi;
+        }
+        Float lki = yi / D[i];
+        d -= lki * yi;
+        Lx[next[i]++] = lki;
+      }
+      uassert(d != 0) << "chol: the matrix is singular";
+      D[k] = d;
+    }
+  }
+
+  /// Solve `Ax=b`.
+  void solve(const Float* b, Float* x) const {
+    const CholeskyAnalysis& a = *analysis;
+    const int n = a.n;
+    std::vector<Float> t(n);
+    for (int k = 0; k < n; ++k) {
+      t[k] = b[a.perm[k]];
+    }
+    for (int j = 0; j < n; ++j) {
+      for (int p = a.Lp[j]; p < a.Lp[j+1]; ++p) {
+        t[a.Li[p]] -= Lx[p] * t[j];
+      }
+    }
+    for (int j = 0; j < n; ++j) {
+      t[j] /= D[j];
+    }
+    for (int j = n-1; j >= 0; --j) {
+      for (int p = a.Lp[j]; p < a.Lp[j+1]; ++p) {
+        t[j] -= Lx[p] * t[a.Li[p]];
+      }
+    }
+    for (int k = 0; k < n; ++k) {
+      x[a.perm[k]] = t[k];
+    }
+  }
+
+  const CholeskyAnalysis& getAnalysis() const {return *analysis;}
+
+private:
+  std::shared_ptr<const CholeskyAnalysis> analysis;
+  std::vector<Float> Lx;
+  std::vector<Float> D;
+};
+
+}
+#endif
@@ -127,7 +127,7 @@ class InsertTimers : public IRRewriter {
     void visit(const For *op) {
       Stmt body = rewrite(op->body);
       
-      stmt = For::make(op->var, op->domain, body);
+      stmt = For::make(op->var, op->domain, body, op->kind);
     }
   
     Var getTimeVar() {
@@ -362,6 +362,9 @@ std::ostream& operator<<(std::ostream& os, const ScalarType& type) {
       break;
     case ScalarType::Float:
       os << "float";
+      if (type.storageBytes != 0) {
+        os << type.storageBytes*8;
+      }
       break;
     case ScalarType::Boolean:
       os << "boolean";
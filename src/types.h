@@ -84,15 +84,33 @@ private:
 struct ScalarType {
   enum Kind {Float, Int, Boolean, Complex, String};
 
-  ScalarType() : kind(Int) {}
-  ScalarType(Kind kind) : kind(kind) {}
+  ScalarType() : kind(Int), storageBytes(0) {}
+  ScalarType(Kind kind) : kind(kind), storageBytes(0) {}
+
+  /// A float type whose values are stored in memory with `storageBytes`, and
+  /// are computed with the precision defined by floatBytes. Loads from
+  /// tensors of the type widen the values, and stores narrow them.
+  ScalarType(Kind kind, unsigned storageBytes)
+      : kind(kind), storageBytes(storageBytes) {
+    iassert(kind == Float || storageBytes == 0);
+  }
 
   static unsigned floatBytes;
 
   Kind kind;
 
+  /// The size of float values in memory, if it is independent of floatBytes,
+  /// and 0 otherwise. Types that differ in their storage precision are equal.
+  unsigned storageBytes;
+
   static bool singleFloat();
 
+  /// True if values of the type are stored with a different precision than
+  /// they are computed with.
+  bool hasStoragePrecision() const {
+    return storageBytes != 0 && storageBytes != floatBytes;
+  }
+
   unsigned bytes() const {
     if (isInt()) {
       return 4;
@@ -109,7 +127,7 @@ struct ScalarType {
     }
     else {
       iassert(isFloat());
-      return floatBytes;
+      return (storageBytes != 0) ? storageBytes : floatBytes;
     }
   }
 
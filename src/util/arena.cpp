@@ -0,0 +1,160 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "error.h"
+#include "memory.h"
+
+using namespace std;
+
+namespace simit {
+namespace util {
+
+static thread_local Arena* currentArena = nullptr;
+
+// The arenas that own the buffers they allocated from the system, so that
+// buffers released by threads they do not serve are returned to them. The
+// table is sharded by address, so that releases from different threads rarely
+// contend.
+namespace {
+struct OwnerShard {
+  std::mutex mutex;
+  unordered_map<void*,Arena*> owners;
+};
+}
+
+static const size_t numOwnerShards = 64;
+
+static OwnerShard& ownerShard(void* ptr) {
+  static OwnerShard shards[numOwnerShards];
+  // Buffers are aligned, so the low address bits do not distinguish them
+  return shards[((uintptr_t)ptr >> 6) % numOwnerShards];
+}
+
+static void setOwner(void* ptr, Arena* arena) {
+  OwnerShard& shard = ownerShard(ptr);
+  lock_guard<std::mutex> lock(shard.mutex);
+  shard.owners[ptr] = arena;
+}
+
+static void removeOwner(void* ptr) {
+  OwnerShard& shard = ownerShard(ptr);
+  lock_guard<std::mutex> lock(shard.mutex);
+  shard.owners.erase(ptr);
+}
+
+static Arena* getOwner(void* ptr) {
+  OwnerShard& shard = ownerShard(ptr);
+  lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.owners.find(ptr);
+  return (it != shard.owners.end()) ? it->second : nullptr;
+}
+
+// class Arena
+Arena::Arena(size_t limit) : limit(limit), allocatedBytes(0) {
+}
+
+Arena::~Arena() {
+  clear();
+
+  // Buffers that are still allocated belong to their callers from now on
+  lock_guard<std::mutex> lock(mutex);
+  for (auto& buffer : allocated) {
+    removeOwner(buffer.first);
+  }
+}
+
+void* Arena::allocate(size_t size) {
+  void* ptr;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    stats.allocations++;
+
+    // Reuse the smallest released buffer that fits, unless it is more than
+    // twice as large as needed
+    auto it = released.lower_bound(size);
+    if (it != released.end() && it->first <= 2*max(size,(size_t)1)) {
+      ptr = it->second;
+      allocated.insert({ptr, it->first});
+      stats.pooledBytes -= it->first;
+      released.erase(it);
+      stats.reuses++;
+      return ptr;
+    }
+
+    ptr = alignedMalloc(size);
+    allocated.insert({ptr, size});
+    allocatedBytes += size;
+    stats.peakBytes = max(stats.peakBytes, allocatedBytes);
+    stats.systemAllocations++;
+  }
+  setOwner(ptr, this);
+  return ptr;
+}
+
+bool Arena::release(void* ptr) {
+  {
+    lock_guard<std::mutex> lock(mutex);
+    auto it = allocated.find(ptr);
+    if (it == allocated.end()) {
+      return false;
+    }
+    size_t size = it->second;
+    allocated.erase(it);
+    if (stats.pooledBytes + size <= limit) {
+      released.insert({size, ptr});
+      stats.pooledBytes += size;
+      return true;
+    }
+    allocatedBytes -= size;
+    stats.systemFrees++;
+  }
+  removeOwner(ptr);
+  free(ptr);
+  return true;
+}
+
+bool Arena::releaseToOwner(void* ptr) {
+  Arena* owner = getOwner(ptr);
+  return owner != nullptr && owner->release(ptr);
+}
+
+void Arena::clear() {
+  vector<void*> buffers;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    for (auto& buffer : released) {
+      buffers.push_back(buffer.second);
+      allocatedBytes -= buffer.first;
+      stats.systemFrees++;
+    }
+    released.clear();
+    stats.pooledBytes = 0;
+  }
+  for (void* ptr : buffers) {
+    removeOwner(ptr);
+    free(ptr);
+  }
+}
+
+AllocationStats Arena::getStats() const {
+  lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+Arena* Arena::getCurrent() {
+  return currentArena;
+}
+
+// class Arena::Scope
+Arena::Scope::Scope(Arena* arena) : previous(currentArena) {
+  currentArena = arena;
+}
+
+Arena::Scope::~Scope() {
+  currentArena = previous;
+}
+
+}}
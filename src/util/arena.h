@@ -0,0 +1,94 @@
+#ifndef SIMIT_ARENA_H
+#define SIMIT_ARENA_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace simit {
+
+/// Allocation counts of the temporaries that a function allocated while it
+/// ran. Allocations are the buffers that were requested, of which reuses were
+/// served from buffers released by earlier requests and system allocations
+/// were served by malloc.
+struct AllocationStats {
+  unsigned long allocations = 0;
+  unsigned long reuses = 0;
+  unsigned long systemAllocations = 0;
+  unsigned long systemFrees = 0;
+  /// Bytes of released buffers that are kept for reuse.
+  size_t pooledBytes = 0;
+  /// The most bytes that were allocated from the system at once.
+  size_t peakBytes = 0;
+};
+
+namespace util {
+
+/// A pool of buffers for the temporaries that are allocated and freed by every
+/// run of a function, such as the indices and values of sparse matrices that
+/// are computed by runtime functions. Released buffers are kept and handed out
+/// again to requests of up to the same size, so that runs with the same sizes
+/// do not call malloc and free. They are freed when the arena is cleared, or
+/// as soon as they are released if keeping them would exceed the limit.
+///
+/// Buffers that are still allocated when the arena is destroyed belong to
+/// their callers, which free them with free().
+class Arena {
+public:
+  /// Create an arena that keeps up to `limit` bytes of released buffers.
+  Arena(size_t limit);
+  ~Arena();
+
+  /// Allocate a buffer of at least `size` bytes.
+  void* allocate(size_t size);
+
+  /// Release a buffer to the arena. Returns false, and leaves the buffer alone,
+  /// if it was not allocated by the arena.
+  bool release(void* ptr);
+
+  /// Release a buffer to the live arena that allocated it, which need not
+  /// serve the calling thread. The owner is looked up in a table that arenas
+  /// record their buffers in when they allocate them from the system. Returns
+  /// false if no live arena allocated it.
+  static bool releaseToOwner(void* ptr);
+
+  /// Free the released buffers.
+  void clear();
+
+  AllocationStats getStats() const;
+
+  /// Returns the arena that serves the allocations of the calling thread, or
+  /// null if they are served by malloc.
+  static Arena* getCurrent();
+
+  /// Serves the allocations of the calling thread from an arena while in
+  /// scope.
+  class Scope {
+  public:
+    Scope(Arena* arena);
+    ~Scope();
+  private:
+    Arena* previous;
+  };
+
+private:
+  size_t limit;
+  size_t allocatedBytes;
+
+  /// The sizes of the buffers that are allocated to callers.
+  std::unordered_map<void*,size_t> allocated;
+
+  /// Released buffers by size.
+  std::multimap<size_t,void*> released;
+
+  AllocationStats stats;
+  mutable std::mutex mutex;
+
+  Arena(const Arena&) = delete;
+  Arena &operator=(const Arena&) = delete;
+};
+
+}}
+#endif
@@ -0,0 +1,116 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "error.h"
+#include "init.h"
+
+using namespace std;
+
+namespace simit {
+namespace util {
+
+static const size_t hugePageSize = 2 << 20;
+
+// Apply the huge page and NUMA policies to the pages that the buffer covers
+// entirely, which no other buffer shares. The policies are advice, so failures
+// are ignored. Pages must not have been touched for the NUMA policy to place
+// them.
+static void applyPolicy(void* ptr, size_t size) {
+#ifdef __linux__
+  if (!kHugePages && kNumaNode < 0) {
+    return;
+  }
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = ((uintptr_t)ptr + pageSize-1) / pageSize * pageSize;
+  uintptr_t end = ((uintptr_t)ptr + size) / pageSize * pageSize;
+  if (end <= begin) {
+    return;
+  }
+  if (kHugePages) {
+    madvise((void*)begin, end-begin, MADV_HUGEPAGE);
+  }
+  if (kNumaNode >= 0) {
+    unsigned long nodes = 1ul << kNumaNode;
+    syscall(SYS_mbind, begin, end-begin, MPOL_PREFERRED, &nodes,
+            sizeof(nodes)*8, 0);
+  }
+#endif
+}
+
+void* alignedMalloc(size_t size) {
+  // Huge pages back the buffers that are aligned to them
+  size_t alignment = kAlignment;
+  if (kHugePages && size >= hugePageSize) {
+    alignment = max(alignment, hugePageSize);
+  }
+  void* ptr = nullptr;
+  int error = posix_memalign(&ptr, alignment, max(size,(size_t)1));
+  uassert(error == 0) << "out of memory";
+  applyPolicy(ptr, size);
+  return ptr;
+}
+
+// Zero a buffer without touching the pages that it covers entirely. Those are
+// dropped instead, so that they are zero-filled when first touched, by the
+// thread that touches them. Buffers are freed with free(), so they cannot be
+// obtained from mmap directly, but malloc'd memory is private and anonymous
+// and can be dropped.
+static void zeroUntouched(void* ptr, size_t size) {
+#ifdef __linux__
+  static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = ((uintptr_t)ptr + pageSize-1) / pageSize * pageSize;
+  uintptr_t end = ((uintptr_t)ptr + size) / pageSize * pageSize;
+  if (end > begin &&
+      madvise((void*)begin, end-begin, MADV_DONTNEED) == 0) {
+    memset(ptr, 0, begin - (uintptr_t)ptr);
+    memset((void*)end, 0, (uintptr_t)ptr + size - end);
+    return;
+  }
+#endif
+  memset(ptr, 0, size);
+}
+
+void* alignedCalloc(size_t count, size_t size) {
+  size_t bytes = count * size;
+
+  // calloc's buffers are lazily zeroed and are aligned enough for small
+  // alignments
+  if (kAlignment <= alignof(max_align_t) &&
+      !(kHugePages && bytes >= hugePageSize)) {
+    void* ptr = calloc(max(bytes,(size_t)1), 1);
+    uassert(ptr != nullptr) << "out of memory";
+    applyPolicy(ptr, bytes);
+    return ptr;
+  }
+
+  void* ptr = alignedMalloc(bytes);
+  zeroUntouched(ptr, bytes);
+  return ptr;
+}
+
+void* alignedRealloc(void* ptr, size_t oldSize, size_t newSize) {
+  void* newPtr = alignedMalloc(newSize);
+  if (ptr != nullptr) {
+    memcpy(newPtr, ptr, min(oldSize, newSize));
+    free(ptr);
+  }
+  return newPtr;
+}
+
+bool isAligned(const void* ptr) {
+  return (uintptr_t)ptr % kAlignment == 0;
+}
+
+}}
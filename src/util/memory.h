@@ -0,0 +1,30 @@
+#ifndef SIMIT_MEMORY_H
+#define SIMIT_MEMORY_H
+
+#include <cstddef>
+
+namespace simit {
+namespace util {
+
+/// Allocate a buffer of `size` bytes that follows the allocation policy of
+/// Settings: it is aligned to Settings::alignment, it is backed by transparent
+/// huge pages if Settings::hugePages is set, and its pages are preferably
+/// placed on Settings::numaNode. The buffer is freed with free().
+void* alignedMalloc(size_t size);
+
+/// Allocate a zero-initialized buffer of `count` elements of `size` bytes that
+/// follows the allocation policy (see alignedMalloc). Pages are zeroed lazily,
+/// so they are placed by the thread that first touches them.
+void* alignedCalloc(size_t count, size_t size);
+
+/// Resize a buffer of `oldSize` bytes, that was allocated with malloc or
+/// alignedMalloc, to a buffer of `newSize` bytes that follows the allocation
+/// policy (see alignedMalloc). The contents are kept up to the smaller size,
+/// and the old buffer is freed.
+void* alignedRealloc(void* ptr, size_t oldSize, size_t newSize);
+
+/// Returns true if `ptr` is aligned to Settings::alignment.
+bool isAligned(const void* ptr);
+
+}}
+#endif
@@ -0,0 +1,163 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <exception>
+
+#include "arena.h"
+#include "error.h"
+
+using namespace std;
+
+namespace simit {
+namespace util {
+
+// True on threads that are currently executing a chunk of a parallel loop
+static thread_local bool inParallelLoop = false;
+
+/// Run one chunk of a parallel loop, and return the exception it threw, if any.
+/// Exceptions must not escape a chunk: on a worker they would terminate the
+/// process, and on the calling thread they would unwind past the wait for the
+/// workers that still reference the loop body.
+static inline exception_ptr runChunk(const ThreadPool::LoopBody &body, int n,
+                                     unsigned numChunks, unsigned chunk) {
+  int start = (int)(((long long)n * chunk) / numChunks);
+  int end   = (int)(((long long)n * (chunk+1)) / numChunks);
+  exception_ptr error;
+  if (start < end) {
+    inParallelLoop = true;
+    try {
+      body(start, end);
+    }
+    catch (...) {
+      error = current_exception();
+    }
+    inParallelLoop = false;
+  }
+  return error;
+}
+
+// class ThreadPool
+ThreadPool &ThreadPool::getInstance() {
+  static ThreadPool pool;
+  return pool;
+}
+
+ThreadPool::ThreadPool(unsigned numThreads)
+    : numThreads(numThreads), body(nullptr), arena(nullptr), n(0),
+      numChunks(0),
+      generation(0), pending(0), shutdown(false) {
+  iassert(numThreads >= 1);
+  startWorkers();
+}
+
+ThreadPool::~ThreadPool() {
+  stopWorkers();
+}
+
+void ThreadPool::setNumThreads(unsigned numThreads) {
+  iassert(numThreads >= 1);
+  lock_guard<std::mutex> loopLock(loopMutex);
+  if (numThreads == this->numThreads) {
+    return;
+  }
+  stopWorkers();
+  this->numThreads = numThreads;
+  startWorkers();
+}
+
+void ThreadPool::parallelFor(int n, const LoopBody &body) {
+  if (n <= 0) {
+    return;
+  }
+  if (numThreads == 1 || n == 1 || inParallelLoop) {
+    body(0, n);
+    return;
+  }
+
+  lock_guard<std::mutex> loopLock(loopMutex);
+  unsigned chunks = std::min(numThreads, (unsigned)n);
+  {
+    lock_guard<std::mutex> lock(mutex);
+    this->body = &body;
+    this->arena = Arena::getCurrent();
+    this->n = n;
+    this->numChunks = chunks;
+    this->pending = chunks - 1;
+    ++generation;
+  }
+  workAvailable.notify_all();
+
+  // The calling thread executes the first chunk
+  exception_ptr callerError = runChunk(body, n, chunks, 0);
+
+  // Always wait for the workers, even if the first chunk failed, since they
+  // reference body until they are done
+  exception_ptr error;
+  {
+    unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this]{return pending == 0;});
+    this->body = nullptr;
+    this->arena = nullptr;
+    error = callerError ? callerError : this->error;
+    this->error = nullptr;
+  }
+  if (error) {
+    rethrow_exception(error);
+  }
+}
+
+void ThreadPool::startWorkers() {
+  shutdown = false;
+  for (unsigned i = 1; i < numThreads; ++i) {
+    workers.push_back(std::thread(&ThreadPool::work, this, i, generation));
+  }
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    lock_guard<std::mutex> lock(mutex);
+    shutdown = true;
+  }
+  workAvailable.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void ThreadPool::work(unsigned worker, unsigned long seenGeneration) {
+  while (true) {
+    unique_lock<std::mutex> lock(mutex);
+    workAvailable.wait(lock, [this, seenGeneration] {
+      return shutdown || generation != seenGeneration;
+    });
+    if (shutdown) {
+      return;
+    }
+    seenGeneration = generation;
+    if (worker >= numChunks) {
+      continue;
+    }
+    const LoopBody &loopBody = *this->body;
+    Arena *loopArena = this->arena;
+    int loopLength = this->n;
+    unsigned loopChunks = this->numChunks;
+    lock.unlock();
+
+    exception_ptr chunkError;
+    {
+      Arena::Scope scope(loopArena);
+      chunkError = runChunk(loopBody, loopLength, loopChunks, worker);
+    }
+
+    lock.lock();
+    if (chunkError && !error) {
+      error = chunkError;
+    }
+    if (--pending == 0) {
+      workDone.notify_one();
+    }
+  }
+}
+
+}}
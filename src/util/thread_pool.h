@@ -0,0 +1,70 @@
+#ifndef SIMIT_THREAD_POOL_H
+#define SIMIT_THREAD_POOL_H
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace simit {
+namespace util {
+class Arena;
+
+/// A pool of persistent worker threads that execute parallel loops. A loop
+/// over [0,n) is split into one contiguous chunk per thread, and the calling
+/// thread executes the first chunk itself. Parallel loops issued from within a
+/// worker (nested parallelism) are executed serially by that worker. Workers
+/// serve their allocations from the arena of the thread that issued the loop.
+class ThreadPool {
+public:
+  typedef std::function<void(int start, int end)> LoopBody;
+
+  /// Returns the process-wide thread pool.
+  static ThreadPool &getInstance();
+
+  ThreadPool(unsigned numThreads=1);
+  ~ThreadPool();
+
+  /// Set the number of threads that participate in parallel loops, including
+  /// the calling thread.
+  void setNumThreads(unsigned numThreads);
+  unsigned getNumThreads() const {return numThreads;}
+
+  /// Call `body` on contiguous chunks that together cover [0,n), and return
+  /// once every chunk has completed. If chunks throw, the exception of one of
+  /// them is rethrown on the calling thread after every chunk has completed.
+  void parallelFor(int n, const LoopBody &body);
+
+private:
+  unsigned numThreads;
+  std::vector<std::thread> workers;
+
+  // Serializes parallel loops issued by different application threads
+  std::mutex loopMutex;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+
+  // State of the current parallel loop, guarded by mutex
+  const LoopBody *body;
+  Arena *arena;
+  int n;
+  unsigned numChunks;
+  unsigned long generation;
+  unsigned pending;
+  std::exception_ptr error;
+  bool shutdown;
+
+  void startWorkers();
+  void stopWorkers();
+  void work(unsigned worker, unsigned long seenGeneration);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool &operator=(const ThreadPool&) = delete;
+};
+
+}}
+#endif
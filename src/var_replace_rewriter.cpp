@@ -88,10 +88,10 @@ public:
 
       ForDomain domain = ForDomain(op->domain.set, final,
                                    op->domain.kind, op->domain.indexSet);
-      stmt = For::make(op->var, domain, body);
+      stmt = For::make(op->var, domain, body, op->kind);
     }
     else if (op->var == init) {
-      stmt = For::make(final, op->domain, body);
+      stmt = For::make(final, op->domain, body, op->kind);
     }
     else {
       IRRewriter::visit(op);
@@ -0,0 +1,46 @@
+// Calls a function that simit-aot compiled to object code, through the header
+// it wrote, to check that the object links and runs with the runtime library.
+#include <stdio.h>
+
+#include "add_points.h"
+
+#define ALIGNED __attribute__((aligned(64)))
+
+int main(void) {
+  static int32_t a[4] ALIGNED = {1, 2, 3, 4};
+  static int32_t x[12] ALIGNED = {0, 0, 0,  1, 10, 100,  3, 30, 300,
+                                  6, 60, 600};
+  static int32_t endpoints[6] ALIGNED = {0, 1,  1, 2,  2, 3};
+  static int32_t b[3] ALIGNED = {0, 0, 0};
+  static int32_t d[9] ALIGNED = {0, 0, 0,  0, 0, 0,  0, 0, 0};
+  static const int32_t expected[3] = {3, 5, 7};
+  static const int32_t expectedD[9] = {1, 10, 100,  2, 20, 200,  3, 30, 300};
+
+  // The fields are arrays of structures, whose strides are left 0
+  points.size = 4;
+  points.a = a;
+  points.x = x;
+  edges.size = 3;
+  edges.endpoints = endpoints;
+  edges.b = b;
+  edges.d = d;
+
+  add_points_init();
+  add_points();
+  add_points_deinit();
+
+  for (int i = 0; i < 3; ++i) {
+    if (b[i] != expected[i]) {
+      fprintf(stderr, "edges.b[%d] is %d, expected %d\n", i, b[i], expected[i]);
+      return 1;
+    }
+  }
+  for (int i = 0; i < 9; ++i) {
+    if (d[i] != expectedD[i]) {
+      fprintf(stderr, "edges.d[%d] is %d, expected %d\n", i, d[i],
+              expectedD[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -29,6 +29,53 @@ TEST(apply, vertices) {
   ASSERT_EQ(6.0, (int)a.get(v2));
 }
 
+TEST(apply, vertices_unaligned) {
+  // Fields may be stored in buffers of the caller that are not aligned
+  std::vector<int> buffer = {0, 1, 2, 3, 0};
+  Set V;
+  V.addField<int>("a", buffer.data()+1, 4, Set::Borrowed);
+  V.addElements(3);
+
+  Function func = loadFunction(std::string(TEST_INPUT_DIR) +
+                               "/apply/vertices.sim", "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.runSafe();
+
+  ASSERT_EQ(buffer.data()+1, V.getFieldData("a"));
+  ASSERT_EQ(2, buffer[1]);
+  ASSERT_EQ(4, buffer[2]);
+  ASSERT_EQ(6, buffer[3]);
+  ASSERT_EQ(0, buffer[4]);
+}
+
+TEST(apply, edges_overlapping_fields) {
+  // Functions assume that fields with different names do not alias, so they
+  // do not bind sets whose field buffers overlap
+  std::vector<int> buffer = {1, 2, 3, 0, 0};
+  Set V;
+  V.addField<int>("a", buffer.data(), 3, Set::Borrowed);
+  V.addElements(3);
+  Set E(V,V);
+  E.addField<int>("b", buffer.data()+2, 3, Set::Borrowed);
+  int endpoints[] = {0, 1,  1, 2};
+  E.addEdges(endpoints, 2);
+
+  Function func = loadFunction(std::string(TEST_INPUT_DIR) +
+                               "/apply/edges_binary_gather.sim", "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  ASSERT_THROW(func.bind("E", &E), SimitException);
+
+  Set F(V,V);
+  F.addField<int>("b", buffer.data()+3, 2, Set::Borrowed);
+  F.addEdges(endpoints, 2);
+  func.bind("E", &F);
+  func.runSafe();
+  ASSERT_EQ(3, buffer[3]);
+  ASSERT_EQ(5, buffer[4]);
+}
+
 TEST(apply, edges_no_endpoints) {
   Set V;
   ElementRef v0 = V.add();
@@ -1,5 +1,12 @@
 #include "simit-test.h"
 
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "init.h"
 #include "tensor.h"
 #include "tensor_data.h"
 #include "graph.h"
@@ -41,6 +48,62 @@ TEST(Function, bindSet) {
   SIMIT_ASSERT_FLOAT_EQ(-44, field(p2));
 }
 
+TEST(Function, bindSetFieldLayouts) {
+  Type vertexType = ElementType::make("Vertex", {Field("field", Vec3i)});
+  Type vertexSetType = UnstructuredSetType::make(vertexType, {});
+  Var V("V", vertexSetType);
+  Var i("i", Int);
+  Var j("j", Int);
+  Var k("k", Int);
+  Expr field = FieldRead::make(V, "field");
+
+  // Negate the components element by element, then increment them in one
+  // loop over the components of all elements
+  Expr index = Add::make(Mul::make(i, Literal::make(3)), j);
+  Stmt neg = ForRange::make(i, 0, Length::make(IndexSet(V)),
+                 ForRange::make(j, 0, 3,
+                     Store::make(field, index, -Load::make(field, index))));
+  Stmt inc = ForRange::make(k, 0, Mul::make(Length::make(IndexSet(V)),
+                                            Literal::make(3)),
+                 Store::make(field, k, Add::make(Load::make(field, k),
+                                                 Literal::make(1))));
+
+  Environment env;
+  env.addExtern(V);
+
+  // Compile for each layout and bind sets whose fields have it, with more
+  // elements than fit in an AoSoA block
+  simit::Set::Layout layouts[3] = {simit::Set::AoS, simit::Set::SoA,
+                                   simit::Set::AoSoA};
+  for (int l = 0; l < 3; ++l) {
+    std::unique_ptr<simit::backend::Backend> backend = getTestBackend();
+    backend->setFieldLayout("Vertex", "field", layouts[l], 4);
+    simit::Function function = backend->compile(Block::make(neg, inc), env);
+
+    simit::Set VArg;
+    auto fieldArg = VArg.addField<int,3>("field", layouts[l], 4);
+    std::vector<simit::ElementRef> elements;
+    for (int e = 0; e < 10; ++e) {
+      elements.push_back(VArg.add());
+      fieldArg.set(elements.back(), {e, 10*e, 100*e});
+    }
+    function.bind("V", &VArg);
+
+    // Run and check output
+    function.runSafe();
+    for (int e = 0; e < 10; ++e) {
+      ASSERT_EQ(1 - e, fieldArg.get(elements[e])(0));
+      ASSERT_EQ(1 - 10*e, fieldArg.get(elements[e])(1));
+      ASSERT_EQ(1 - 100*e, fieldArg.get(elements[e])(2));
+    }
+
+    // Sets whose field has another layout do not bind
+    simit::Set otherArg;
+    otherArg.addField<int,3>("field", layouts[(l+1) % 3], 4);
+    ASSERT_THROW(function.bind("V", &otherArg), simit::SimitException);
+  }
+}
+
 TEST(Function, bindScalar) {
   Var a("a", Int);
   Var b("b", Int);
@@ -64,6 +127,123 @@ TEST(Function, bindScalar) {
   ASSERT_EQ(42, bArg);
 }
 
+/// Points the object cache at a directory of the process while in scope, and
+/// removes the directory when it goes out of scope.
+class TemporaryCacheDir {
+public:
+  TemporaryCacheDir() : oldCacheDir(simit::kCacheDir) {
+    simit::kCacheDir = "/tmp/simit-object-cache-" + std::to_string(getpid());
+  }
+
+  ~TemporaryCacheDir() {
+    DIR* dir = opendir(simit::kCacheDir.c_str());
+    if (dir != nullptr) {
+      for (dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+          unlink((simit::kCacheDir + "/" + name).c_str());
+        }
+      }
+      closedir(dir);
+      rmdir(simit::kCacheDir.c_str());
+    }
+    simit::kCacheDir = oldCacheDir;
+  }
+
+private:
+  std::string oldCacheDir;
+};
+
+TEST(Function, objectCache) {
+  Var a("a", Int);
+  Var b("b", Int);
+  Stmt neg = AssignStmt::make(a, -b);
+  Environment env;
+  env.addExtern(a);
+  env.addExtern(b);
+
+  TemporaryCacheDir cacheDir;
+  simit::ObjectCacheStats stats = simit::getObjectCacheStats();
+
+  // The first compile generates the object code and adds it to the cache, and
+  // the second loads it from the cache
+  for (unsigned i = 0; i < 2; ++i) {
+    simit::Function function = getTestBackend()->compile(neg, env);
+    simit::Tensor<int> aArg = 0;
+    simit::Tensor<int> bArg = 42;
+    function.bind("a", &aArg);
+    function.bind("b", &bArg);
+    function.runSafe();
+    ASSERT_EQ(-42, aArg);
+  }
+
+  if (simit::kBackend == "cpu") {
+    ASSERT_EQ(stats.misses + 1, simit::getObjectCacheStats().misses);
+    ASSERT_EQ(stats.hits + 1, simit::getObjectCacheStats().hits);
+  }
+}
+
+TEST(Function, objectCacheLiterals) {
+  // a = b + [1,2,3]
+  auto compile = [](Expr literal) {
+    Var a("a", Vec3i);
+    Var b("b", Vec3i);
+    Var i("i", Int);
+    Stmt add = ForRange::make(i, 0, 3,
+                              Store::make(a, i, Add::make(Load::make(b, i),
+                                                          Load::make(literal,
+                                                                     i))));
+    Environment env;
+    env.addExtern(a);
+    env.addExtern(b);
+    return simit::Function(getTestBackend()->compile(add, env));
+  };
+  auto run = [](simit::Function function) {
+    simit::Tensor<int,3> aArg = {0, 0, 0};
+    simit::Tensor<int,3> bArg = {10, 20, 30};
+    function.bind("a", &aArg);
+    function.bind("b", &bArg);
+    function.runSafe();
+    return aArg(0) == 11 && aArg(1) == 22 && aArg(2) == 33;
+  };
+
+  TemporaryCacheDir cacheDir;
+
+  // A fresh process compiles the program and adds it to the cache, and tells
+  // where its literal was
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    Expr literal = Literal::make(Vec3i, std::vector<int>({1, 2, 3}));
+    const void* data = to<Literal>(literal)->data;
+    bool passed = run(compile(literal)) &&
+                  write(fds[1], &data, sizeof(data)) == sizeof(data);
+    _exit(passed ? 0 : 1);
+  }
+  close(fds[1]);
+  const void* childData = nullptr;
+  ASSERT_EQ((ssize_t)sizeof(childData),
+            read(fds[0], &childData, sizeof(childData)));
+  close(fds[0]);
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  // The same program, with its literal elsewhere in memory, is loaded from the
+  // cache. The decoy takes the place that the child allocated its literal at.
+  Expr decoy = Literal::make(Vec3i, std::vector<int>({1, 2, 3}));
+  Expr literal = Literal::make(Vec3i, std::vector<int>({1, 2, 3}));
+  ASSERT_NE(childData, to<Literal>(literal)->data);
+  simit::ObjectCacheStats stats = simit::getObjectCacheStats();
+  ASSERT_TRUE(run(compile(literal)));
+  if (simit::kBackend == "cpu") {
+    ASSERT_EQ(stats.misses, simit::getObjectCacheStats().misses);
+    ASSERT_EQ(stats.hits + 1, simit::getObjectCacheStats().hits);
+  }
+}
+
 TEST(Function, bindVector) {
   Var a("a", Vec3i);
   Var b("b", Vec3i);
@@ -1,8 +1,11 @@
 #include "simit-test.h"
 
+#include <unistd.h>
 #include <vector>
 
 #include "graph.h"
+#include "path_expressions.h"
+#include "path_indices.h"
 
 using namespace std;
 using namespace simit;
@@ -61,6 +64,42 @@ TEST(Set, IncreaseCapacity) {
   ASSERT_EQ(count, 1029);
 }
 
+TEST(Set, Reserve) {
+  Set myset;
+  auto fld = myset.addField<int>("foo");
+  ElementRef first = myset.add();
+  fld.set(first, 42);
+
+  myset.reserve(5000);
+  ASSERT_GE(myset.getCapacity(), 5000);
+  void* data = myset.getFieldData("foo");
+  for (int i=1; i<5000; i++) {
+    ElementRef item = myset.add();
+    fld.set(item, i);
+  }
+  ASSERT_EQ(data, myset.getFieldData("foo"));
+  ASSERT_EQ(5000, myset.getSize());
+  ASSERT_EQ(42, fld.get(first));
+}
+
+TEST(Set, AddElements) {
+  Set myset;
+  auto fld = myset.addField<int>("foo");
+  myset.add();
+
+  ElementRef first = myset.addElements(3000);
+  ASSERT_EQ(1, first.getIdent());
+  ASSERT_EQ(3001, myset.getSize());
+
+  int count = 0;
+  for (auto elem : myset) {
+    ASSERT_EQ(0, fld.get(elem));
+    fld.set(elem, count++);
+  }
+  ASSERT_EQ(3001, count);
+  ASSERT_EQ(1, fld.get(first));
+}
+
 TEST(Set, FieldAccessByName) {
   Set myset;
   
@@ -76,6 +115,110 @@ TEST(Set, FieldAccessByName) {
 }
 
 // Iterator tests
+TEST(Set, ExternalField) {
+  // Borrowed buffers are used in place while they have room for the elements
+  std::vector<simit_float> xs = {1.0, 2.0,  3.0, 4.0,  5.0, 6.0,  7.0, 8.0};
+  Set points;
+  FieldRef<int> id = points.addField<int>("id");
+  FieldRef<simit_float,2> x =
+      points.addField<simit_float,2>("x", xs.data(), 4, Set::Borrowed);
+  ASSERT_EQ(4, points.getCapacity());
+  points.addElements(3);
+  vector<ElementRef> elements;
+  for (auto p : points) {
+    elements.push_back(p);
+    id.set(p, p.getIdent());
+    SIMIT_ASSERT_FLOAT_EQ(2.0*p.getIdent()+1.0, x.get(p)(0));
+  }
+  ElementRef p = points.add();
+  x.set(p, {-1.0, -2.0});
+  SIMIT_ASSERT_FLOAT_EQ(-2.0, xs[7]);
+  ASSERT_EQ(xs.data(), points.getFieldData("x"));
+
+  // Growing beyond the buffer copies the field out of it
+  ElementRef q = points.add();
+  ASSERT_NE(xs.data(), points.getFieldData("x"));
+  x.set(q, {9.0, 10.0});
+  SIMIT_ASSERT_FLOAT_EQ(-2.0, xs[7]);
+  SIMIT_ASSERT_FLOAT_EQ(-2.0, x.get(p)(1));
+  SIMIT_ASSERT_FLOAT_EQ(3.0, x.get(elements[1])(0));
+  ASSERT_EQ(2, id.get(elements[2]));
+
+  // Adopted buffers are reallocated and freed by the Set
+  int* vs = (int*)malloc(points.getSize() * sizeof(int));
+  for (int i = 0; i < points.getSize(); ++i) {
+    vs[i] = 10*i;
+  }
+  FieldRef<int> v = points.addField<int>("v", vs, points.getSize(),
+                                         Set::Adopted);
+  ASSERT_EQ(5, points.getCapacity());
+  ElementRef r = points.add();
+  ASSERT_EQ(0, v.get(r));
+  ASSERT_EQ(40, v.get(q));
+  SIMIT_ASSERT_FLOAT_EQ(9.0, x.get(q)(0));
+}
+
+TEST(Set, OverlappingExternalFields) {
+  // Functions assume that the fields of a Set do not alias
+  std::vector<int> buffer(8);
+  Set points;
+  points.addField<int>("a", buffer.data(), 4, Set::Borrowed);
+  ASSERT_THROW(points.addField<int>("b", buffer.data()+3, 4, Set::Borrowed),
+               SimitException);
+  points.addField<int>("c", buffer.data()+4, 4, Set::Borrowed);
+  ASSERT_EQ(buffer.data()+4, points.getFieldData("c"));
+}
+
+TEST(Set, AlignedFields) {
+  Set points;
+  FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+  points.addElements(3);
+  Set edges(points, points);
+  edges.addField<int>("a");
+  for (int i = 0; i < 3000; ++i) {
+    ElementRef p = points.add();
+    x.set(p, {1.0, 2.0, 3.0});
+    edges.add(p, p);
+    ASSERT_EQ(0u, (uintptr_t)points.getFieldData("x") % 64);
+    ASSERT_EQ(0u, (uintptr_t)edges.getFieldData("a") % 64);
+    ASSERT_EQ(0u, (uintptr_t)edges.getEndpointsData() % 64);
+  }
+  SIMIT_ASSERT_FLOAT_EQ(0.0, x.get(*points.begin())(0));
+  SIMIT_ASSERT_FLOAT_EQ(3.0, x.get(edges.getEndpoint(*edges.begin(), 0))(2));
+}
+
+TEST(Set, FieldLayouts) {
+  Set points;
+  FieldRef<int,2> aos = points.addField<int,2>("aos");
+  FieldRef<int,2> soa = points.addField<int,2>("soa", Set::SoA);
+  FieldRef<int,2> aosoa = points.addField<int,2>("aosoa", Set::AoSoA, 4);
+  ASSERT_EQ(Set::SoA, points.getFieldLayout("soa"));
+
+  // Growing the set keeps the values, which the SoA layout moves apart
+  vector<ElementRef> elements;
+  for (int i = 0; i < 3000; ++i) {
+    ElementRef p = points.add();
+    elements.push_back(p);
+    aos.set(p, {i, -i});
+    soa.set(p, {i, -i});
+    aosoa(p) = {i, -i};
+  }
+  for (int i = 0; i < 3000; ++i) {
+    for (auto field : {&aos, &soa, &aosoa}) {
+      ASSERT_EQ(i, field->get(elements[i])(0));
+      ASSERT_EQ(-i, field->get(elements[i])(1));
+    }
+  }
+
+  int capacity = points.getCapacity();
+  const int* soaData = (const int*)points.getFieldData("soa");
+  ASSERT_EQ(5, soaData[5]);
+  ASSERT_EQ(-5, soaData[capacity + 5]);
+  const int* aosoaData = (const int*)points.getFieldData("aosoa");
+  ASSERT_EQ(5, aosoaData[9]);
+  ASSERT_EQ(-5, aosoaData[13]);
+}
+
 TEST(ElementIteratorTests, TestElementIteratorLoop) {
   Set myset;
   
@@ -287,6 +430,169 @@ TEST(EdgeSet, EdgeIteratorTest) {
   ASSERT_EQ(count, 4);
 }
 
+TEST(EdgeSet, AddEdges) {
+  Set points;
+  FieldRef<simit_float> x = points.addField<simit_float>("x");
+  ElementRef p0 = points.addElements(3);
+  x.set(p0, 1.1);
+
+  Set edges(points, points);
+  FieldRef<int> y = edges.addField<int>("y");
+  ElementRef e0 = edges.add(p0, p0);
+  int endpoints[] = {0, 1,  1, 2,  2, 0};
+  ElementRef e1 = edges.addEdges(endpoints, 3);
+  ASSERT_EQ(1, e1.getIdent());
+  ASSERT_EQ(4, edges.getSize());
+
+  int count = 0;
+  for (auto edge : edges) {
+    ASSERT_EQ(0, y.get(edge));
+    if (edge != e0) {
+      ASSERT_EQ(endpoints[count*2], edges.getEndpoint(edge,0).getIdent());
+      ASSERT_EQ(endpoints[count*2+1], edges.getEndpoint(edge,1).getIdent());
+      count++;
+    }
+  }
+  ASSERT_EQ(3, count);
+  SIMIT_ASSERT_FLOAT_EQ(x.get(edges.getEndpoint(e1,0)), 1.1);
+}
+
+TEST(EdgeSet, Snapshot) {
+  std::string dir = "/tmp/simit-snapshot-" + std::to_string(getpid());
+  int endpoints[] = {0, 1,  1, 2,  3, 4};
+  {
+    Set points;
+    FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+    FieldRef<int> id = points.addField<int>("id");
+    points.addElements(5);
+    for (auto p : points) {
+      simit_float i = p.getIdent();
+      x.set(p, {i, i+0.5, -i});
+      id.set(p, p.getIdent());
+    }
+
+    Set edges(points, points);
+    FieldRef<simit_float> w = edges.addField<simit_float>("w");
+    edges.addEdges(endpoints, 3);
+    for (auto edge : edges) {
+      w.set(edge, 2.0*edge.getIdent());
+    }
+
+    points.save(dir + "-points");
+    edges.save(dir + "-edges", true);
+  }
+
+  // Fields of the Set are replaced by the snapshot's, or zeroed if the
+  // snapshot does not have them
+  Set points;
+  FieldRef<int> id = points.addField<int>("id");
+  FieldRef<simit_float> m = points.addField<simit_float>("m");
+  points.load(dir + "-points");
+  Set edges(points, points);
+  edges.load(dir + "-edges");
+  unlink((dir + "-points").c_str());
+  unlink((dir + "-edges").c_str());
+
+  ASSERT_EQ(5, points.getSize());
+  ASSERT_EQ(3, edges.getSize());
+  FieldRef<simit_float,3> x = points.getField<simit_float,3>("x");
+  for (auto p : points) {
+    simit_float i = p.getIdent();
+    SIMIT_ASSERT_FLOAT_EQ(i, x.get(p)(0));
+    SIMIT_ASSERT_FLOAT_EQ(i+0.5, x.get(p)(1));
+    SIMIT_ASSERT_FLOAT_EQ(-i, x.get(p)(2));
+    ASSERT_EQ(p.getIdent(), id.get(p));
+    SIMIT_ASSERT_FLOAT_EQ(0.0, m.get(p));
+  }
+  FieldRef<simit_float> w = edges.getField<simit_float>("w");
+  for (auto edge : edges) {
+    int e = edge.getIdent();
+    ASSERT_EQ(endpoints[e*2], edges.getEndpoint(edge,0).getIdent());
+    ASSERT_EQ(endpoints[e*2+1], edges.getEndpoint(edge,1).getIdent());
+    SIMIT_ASSERT_FLOAT_EQ(2.0*e, w.get(edge));
+  }
+
+  // The neighbor index lists the points that share an edge
+  const uint32_t *coords, *sinks;
+  ASSERT_TRUE(edges.getNeighborIndex(&coords, &sinks));
+  vector<vector<uint32_t>> neighbors = {{0,1}, {0,1,2}, {1,2}, {3,4}, {3,4}};
+  for (size_t i = 0; i < neighbors.size(); ++i) {
+    vector<uint32_t> row(sinks + coords[i], sinks + coords[i+1]);
+    ASSERT_EQ(neighbors[i], row);
+  }
+
+  // Path index builders use the neighbor index instead of building it
+  pe::Var u("u", pe::Set("V"));
+  pe::Var v("v", pe::Set("V"));
+  pe::Var e("e", pe::Set("E"));
+  pe::PathExpression ve = pe::Link::make(u, e, pe::Link::ve);
+  pe::PathExpression ev = pe::Link::make(e, v, pe::Link::ev);
+  pe::PathExpression vev = pe::And::make({u,v}, {{pe::QuantifiedVar::Exist,e}},
+                                         ve(u,e), ev(e,v));
+  pe::PathIndexBuilder builder;
+  builder.bind("V", &points);
+  builder.bind("E", &edges);
+  pe::PathIndex index = builder.buildSegmented(vev, 0);
+  ASSERT_EQ(11u, index.numNeighbors());
+  for (size_t i = 0; i < neighbors.size(); ++i) {
+    vector<uint32_t> row;
+    for (unsigned n : index.neighbors(i)) {
+      row.push_back(n);
+    }
+    ASSERT_EQ(neighbors[i], row);
+  }
+
+  // Growing the Set copies its fields out of the snapshot, and invalidates the
+  // neighbor index of its edges
+  ElementRef p = points.add();
+  id.set(p, 5);
+  ASSERT_EQ(6, points.getSize());
+  ASSERT_FALSE(edges.getNeighborIndex(&coords, &sinks));
+  for (auto q : points) {
+    ASSERT_EQ(q.getIdent(), id.get(q));
+    if (q != p) {
+      SIMIT_ASSERT_FLOAT_EQ(q.getIdent()+0.5, x.get(q)(1));
+    }
+  }
+}
+
+TEST(Set, SnapshotFieldLayouts) {
+  std::string file = "/tmp/simit-snapshot-layouts-" + std::to_string(getpid());
+  {
+    Set points;
+    FieldRef<int,3> x = points.addField<int,3>("x");
+    points.addElements(5);
+    for (auto p : points) {
+      int i = p.getIdent();
+      x.set(p, {i, 10*i, 100*i});
+    }
+    points.save(file);
+  }
+
+  // Snapshots hold AoS fields, so fields with other layouts are not loaded
+  // from them
+  for (Set::Layout layout : {Set::SoA, Set::AoSoA}) {
+    Set points;
+    points.addField<int,3>("x", layout, 4);
+    ASSERT_THROW(points.load(file), SimitException);
+  }
+
+  // Fields with other layouts that are not in the snapshot are zeroed
+  Set points;
+  FieldRef<int,3> v = points.addField<int,3>("v", Set::AoSoA, 4);
+  points.load(file);
+  unlink(file.c_str());
+  ASSERT_EQ(5, points.getSize());
+  FieldRef<int,3> x = points.getField<int,3>("x");
+  for (auto p : points) {
+    int i = p.getIdent();
+    ASSERT_EQ(100*i, x.get(p)(2));
+    for (int c = 0; c < 3; ++c) {
+      ASSERT_EQ(0, v.get(p)(c));
+    }
+  }
+}
+
 TEST(GraphGenerator, createBox) {
   Set points;
   Set edges(points, points);
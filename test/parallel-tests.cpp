@@ -0,0 +1,380 @@
+#include "simit-test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "init.h"
+#include "coloring.h"
+#include "graph.h"
+#include "tensor.h"
+#include "program.h"
+#include "error.h"
+#include "ffi.h"
+#include "ir.h"
+#include "lower/lower_parallel_loops.h"
+#include "util/arena.h"
+#include "util/thread_pool.h"
+
+using namespace std;
+using namespace simit;
+
+/// Returns the kind of a loop over a vertex set, whose body is made from the
+/// loop variable, after lowering parallel loops.
+static ir::For::Kind
+lowerLoop(std::function<ir::Stmt(const ir::Expr &i)> makeBody) {
+  using namespace ir;
+  Type point = ElementType::make("Point", {});
+  Var V("V", UnstructuredSetType::make(point, {}));
+  Var i("i", ir::Int);
+  Stmt loop = For::make(i, ForDomain(VarExpr::make(V)), makeBody(i));
+  Func func("f", {V}, {}, loop);
+
+  For::Kind kind = For::Serial;
+  match(lowerParallelLoops(func).getBody(),
+    std::function<void(const For*)>([&kind](const For *op) {
+      kind = op->kind;
+    })
+  );
+  return kind;
+}
+
+TEST(parallel, iteration_local) {
+  using namespace ir;
+  Var x("x", ir::TensorType::make(ir::ScalarType::Float,
+                                   {IndexDomain(IndexSet(300))}));
+  Var j("j", ir::Int);
+  Var k("k", ir::Int);
+  Expr one = Literal::make(1.0);
+
+  // x[i] and x[i*3+j], with j in 0:3, are owned by iteration i
+  ASSERT_EQ(For::Parallel, lowerLoop([&](const Expr &i) {
+    return Store::make(x, i, one);
+  }));
+  ASSERT_EQ(For::Parallel, lowerLoop([&](const Expr &i) {
+    Expr index = Add::make(Mul::make(i, 3), j);
+    return ForRange::make(j, 0, 3, Store::make(x, index, one));
+  }));
+  ASSERT_EQ(For::Parallel, lowerLoop([&](const Expr &i) {
+    Expr index = Add::make(Mul::make(i, 6), Add::make(Mul::make(j, 2), k));
+    return ForRange::make(j, 0, 3,
+                          ForRange::make(k, 0, 2, Store::make(x, index, one)));
+  }));
+
+  // x[i+1] is owned by iteration i+1
+  ASSERT_EQ(For::Serial, lowerLoop([&](const Expr &i) {
+    return Store::make(x, Add::make(i, 1), one);
+  }));
+
+  // x[i*3+5] is owned by iteration i+1
+  ASSERT_EQ(For::Serial, lowerLoop([&](const Expr &i) {
+    return Store::make(x, Add::make(Mul::make(i, 3), 5), one);
+  }));
+
+  // x[i*3+j], with j in 0:4, reaches into the block of iteration i+1
+  ASSERT_EQ(For::Serial, lowerLoop([&](const Expr &i) {
+    Expr index = Add::make(Mul::make(i, 3), j);
+    return ForRange::make(j, 0, 4, Store::make(x, index, one));
+  }));
+
+  // x[i*3+j], with j in an unknown range, may reach into other blocks
+  ASSERT_EQ(For::Serial, lowerLoop([&](const Expr &i) {
+    Expr index = Add::make(Mul::make(i, 3), j);
+    return ForRange::make(j, 0, k, Store::make(x, index, one));
+  }));
+
+  // x[i*3-1] is owned by iteration i-1
+  ASSERT_EQ(For::Serial, lowerLoop([&](const Expr &i) {
+    return Store::make(x, Sub::make(Mul::make(i, 3), 1), one);
+  }));
+
+  // Reading x[i+1] while iteration i+1 writes it races
+  ASSERT_EQ(For::Serial, lowerLoop([&](const Expr &i) {
+    return Store::make(x, i, Load::make(x, Add::make(i, 1)));
+  }));
+}
+
+TEST(parallel, thread_pool) {
+  util::ThreadPool pool(4);
+  for (int n : {0, 1, 3, 4, 1001}) {
+    vector<atomic<int>> visits(n);
+    for (auto &visit : visits) {
+      visit = 0;
+    }
+    pool.parallelFor(n, [&visits](int start, int end) {
+      for (int i = start; i < end; ++i) {
+        ++visits[i];
+      }
+    });
+    for (int i = 0; i < n; ++i) {
+      ASSERT_EQ(1, visits[i].load());
+    }
+  }
+}
+
+TEST(parallel, thread_pool_exceptions) {
+  util::ThreadPool pool(4);
+  for (int failingChunk : {0, 2}) {
+    atomic<int> completed(0);
+    ASSERT_THROW(pool.parallelFor(4, [&](int start, int end) {
+      if (start == failingChunk) {
+        throw SimitException();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      ++completed;
+    }), SimitException);
+
+    // Every other chunk completed before the exception was rethrown
+    ASSERT_EQ(3, completed.load());
+  }
+
+  // The pool remains usable
+  atomic<int> visits(0);
+  pool.parallelFor(4, [&visits](int start, int end) {visits += end-start;});
+  ASSERT_EQ(4, visits.load());
+}
+
+TEST(parallel, arena_threads) {
+  util::ThreadPool pool(4);
+  void* escaped;
+  {
+    util::Arena arena(1 << 20);
+    util::Arena::Scope scope(&arena);
+
+    // Workers allocate from the arena of the thread that issued the loop, and
+    // release to it
+    vector<void*> buffers(8);
+    pool.parallelFor(8, [&buffers](int start, int end) {
+      for (int i = start; i < end; ++i) {
+        buffers[i] = ffi::simit_malloc(64);
+      }
+    });
+    pool.parallelFor(8, [&buffers](int start, int end) {
+      for (int i = start; i < end; ++i) {
+        ffi::simit_free(buffers[i]);
+      }
+    });
+    ASSERT_EQ(8u, arena.getStats().systemAllocations);
+    ASSERT_EQ(0u, arena.getStats().systemFrees);
+
+    // Threads that the arena does not serve release to it too
+    void* buffer = ffi::simit_malloc(64);
+    ASSERT_EQ(7u*64, arena.getStats().pooledBytes);
+    std::thread([buffer]{ffi::simit_free(buffer);}).join();
+    ASSERT_EQ(8u*64, arena.getStats().pooledBytes);
+
+    escaped = ffi::simit_malloc(64);
+  }
+
+  // Buffers that outlive the arena belong to the caller
+  ffi::simit_free(escaped);
+}
+
+TEST(parallel, vertices) {
+  ParallelSettings settings(4);
+
+  const int numVertices = 10000;
+  Set V;
+  FieldRef<simit_float,3> x = V.addField<simit_float,3>("x");
+  FieldRef<simit_float,3> y = V.addField<simit_float,3>("y");
+  vector<ElementRef> vertices;
+  for (int i = 0; i < numVertices; ++i) {
+    ElementRef v = V.add();
+    x.set(v, {(simit_float)i, 1.0, 2.0});
+    y.set(v, {1.0, 1.0, 1.0});
+    vertices.push_back(v);
+  }
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.runSafe();
+
+  for (int i = 0; i < numVertices; ++i) {
+    TensorRef<simit_float,3> yi = y.get(vertices[i]);
+    SIMIT_ASSERT_FLOAT_EQ(2.0*i + 1.0, yi(0));
+    SIMIT_ASSERT_FLOAT_EQ(3.0, yi(1));
+    SIMIT_ASSERT_FLOAT_EQ(5.0, yi(2));
+  }
+}
+
+TEST(parallel, gemv) {
+  for (string reduction : VALID_REDUCTIONS) {
+    SCOPED_TRACE(reduction);
+    ParallelSettings settings(4, reduction);
+
+    // A chain of springs
+    const int numPoints = 1000;
+    Set points;
+    FieldRef<simit_float> b = points.addField<simit_float>("b");
+    FieldRef<simit_float> c = points.addField<simit_float>("c");
+    vector<ElementRef> pointRefs;
+    for (int i = 0; i < numPoints; ++i) {
+      ElementRef p = points.add();
+      b.set(p, (simit_float)i);
+      c.set(p, 42.0);
+      pointRefs.push_back(p);
+    }
+
+    Set springs(points,points);
+    FieldRef<simit_float> a = springs.addField<simit_float>("a");
+    for (int i = 0; i < numPoints-1; ++i) {
+      ElementRef s = springs.add(pointRefs[i], pointRefs[i+1]);
+      a.set(s, 1.0);
+    }
+
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    if (!func.defined()) FAIL();
+    func.bind("points", &points);
+    func.bind("springs", &springs);
+    func.runSafe();
+
+    SIMIT_ASSERT_FLOAT_EQ(1.0, c.get(pointRefs[0]));
+    for (int i = 1; i < numPoints-1; ++i) {
+      SIMIT_ASSERT_FLOAT_EQ(4.0*i, c.get(pointRefs[i]));
+    }
+    SIMIT_ASSERT_FLOAT_EQ(2.0*numPoints-3.0, c.get(pointRefs[numPoints-1]));
+  }
+}
+
+TEST(parallel, edges_reduce) {
+  for (string reduction : VALID_REDUCTIONS) {
+    SCOPED_TRACE(reduction);
+    ParallelSettings settings(4, reduction);
+
+    // A chain of edges, so that all interior vertices have two neighbors
+    const int numVertices = 1000;
+    Set V;
+    FieldRef<int> a = V.addField<int>("a");
+    vector<ElementRef> vertices;
+    for (int i = 0; i < numVertices; ++i) {
+      vertices.push_back(V.add());
+    }
+    Set E(V,V);
+    for (int i = 0; i < numVertices-1; ++i) {
+      E.add(vertices[i], vertices[i+1]);
+    }
+
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    if (!func.defined()) FAIL();
+    func.bind("V", &V);
+    func.bind("E", &E);
+    func.runSafe();
+
+    ASSERT_EQ(1, (int)a(vertices[0]));
+    for (int i = 1; i < numVertices-1; ++i) {
+      ASSERT_EQ(2, (int)a(vertices[i]));
+    }
+    ASSERT_EQ(1, (int)a(vertices[numVertices-1]));
+  }
+}
+
+TEST(parallel, edge_coloring) {
+  // A triangle strip and a second vertex set, so that edges share endpoints
+  // through several endpoint positions and through several endpoint sets
+  const int numVertices = 100;
+  Set V, W;
+  vector<ElementRef> vertices, others;
+  for (int i = 0; i < numVertices; ++i) {
+    vertices.push_back(V.add());
+    others.push_back(W.add());
+  }
+  Set T(V,V,W);
+  for (int i = 0; i < numVertices-2; ++i) {
+    T.add(vertices[i], vertices[i+1], others[i%3]);
+  }
+
+  vector<int> coloring = colorEdges(T);
+  int numColors = coloring[0];
+  ASSERT_GT(numColors, 0);
+  const int *offsets = &coloring[1];
+  const int *edges = &coloring[2+numColors];
+  ASSERT_EQ(0, offsets[0]);
+  ASSERT_EQ(T.getSize(), offsets[numColors]);
+
+  const int *endpoints = T.getEndpointsData();
+  vector<int> edgeColors(T.getSize(), -1);
+  for (int c = 0; c < numColors; ++c) {
+    set<pair<const Set*,int>> touched;
+    for (int k = offsets[c]; k < offsets[c+1]; ++k) {
+      int e = edges[k];
+      ASSERT_EQ(-1, edgeColors[e]);
+      edgeColors[e] = c;
+      for (int j = 0; j < T.getCardinality(); ++j) {
+        auto vertex = make_pair(T.getEndpointSet(j), endpoints[e*3 + j]);
+        ASSERT_EQ(0u, touched.count(vertex));
+        touched.insert(vertex);
+      }
+    }
+  }
+  for (int color : edgeColors) {
+    ASSERT_NE(-1, color);
+  }
+}
+
+TEST(parallel, triangles_reduce) {
+  for (string reduction : VALID_REDUCTIONS) {
+    SCOPED_TRACE(reduction);
+    ParallelSettings settings(4, reduction);
+
+    // A triangle strip, where interior vertices are shared by three triangles
+    const int numVertices = 1000;
+    Set V;
+    FieldRef<simit_float,3> a = V.addField<simit_float,3>("a");
+    vector<ElementRef> vertices;
+    for (int i = 0; i < numVertices; ++i) {
+      vertices.push_back(V.add());
+    }
+    Set T(V,V,V);
+    for (int i = 0; i < numVertices-2; ++i) {
+      T.add(vertices[i], vertices[i+1], vertices[i+2]);
+    }
+
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    if (!func.defined()) FAIL();
+    func.bind("V", &V);
+    func.bind("T", &T);
+    func.runSafe();
+
+    for (int i = 0; i < numVertices; ++i) {
+      int triangles = min(3, min(i+1, numVertices-i));
+      TensorRef<simit_float,3> ai = a.get(vertices[i]);
+      SIMIT_ASSERT_FLOAT_EQ(1.0*triangles, ai(0));
+      SIMIT_ASSERT_FLOAT_EQ(2.0*triangles, ai(1));
+      SIMIT_ASSERT_FLOAT_EQ(3.0*triangles, ai(2));
+    }
+  }
+}
+
+TEST(parallel, choose_reduction) {
+  const vector<ParallelReduction> all = {ColoredReduction, PrivatizedReduction,
+                                         AtomicReduction};
+  const int numVertices = 1000;
+
+  // A chain has low degrees, so atomic updates rarely contend
+  Set V;
+  vector<ElementRef> vertices;
+  for (int i = 0; i < numVertices; ++i) {
+    vertices.push_back(V.add());
+  }
+  Set chain(V,V);
+  for (int i = 0; i < numVertices-1; ++i) {
+    chain.add(vertices[i], vertices[i+1]);
+  }
+  ASSERT_EQ(AtomicReduction, chooseParallelReduction(chain, all, 4));
+
+  // A star has a single color per edge and a highly contended center
+  Set star(V,V);
+  for (int i = 1; i < numVertices; ++i) {
+    star.add(vertices[0], vertices[i]);
+  }
+  ASSERT_EQ(PrivatizedReduction, chooseParallelReduction(star, all, 4));
+
+  // Coloring is always supported
+  ASSERT_EQ(ColoredReduction,
+            chooseParallelReduction(star, {ColoredReduction}, 4));
+}
@@ -367,3 +367,150 @@ TEST(pathindex, hypergraph) {
   PathIndex pidx = builder.buildSegmented(vevORvfv, 0);
   VERIFY_INDEX(pidx, nbrs({{0,1,2}, {0,1,2,3}, {0,1,2,3}, {1,2,3}}));
 }
+
+TEST(pathindex, shared) {
+  simit::Set V;
+  simit::Set E(V,V);
+  Box box = createBox(&V, &E, 3, 1, 1);  // v-e-v-e-v
+  size_t cacheSize = PathIndexCache::getInstance().size();
+
+  // Builders bound to the same sets share path indices, also when they build
+  // them from different path expression objects
+  auto buildVEV = [&]() {
+    Var vi("vi");
+    Var e("e");
+    Var vj("vj");
+    PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                   makeVE()(vi,e), makeEV()(e,vj));
+    PathIndexBuilder builder;
+    builder.bind("V", &V);
+    builder.bind("E", &E);
+    return builder.buildSegmented(vev, 0);
+  };
+  PathIndex index = buildVEV();
+  VERIFY_INDEX(index, nbrs({{0,1}, {0,1,2}, {1,2}}));
+  ASSERT_EQ(index, buildVEV());
+
+  // Modifying a set invalidates the path indices built over it
+  E.add(box(0,0,0), box(2,0,0));
+  PathIndex newIndex = buildVEV();
+  ASSERT_NE(index, newIndex);
+  VERIFY_INDEX(newIndex, nbrs({{0,1,2}, {0,1,2}, {0,1,2}}));
+
+  // Path indices are dropped from the cache with their last outside reference
+  index = PathIndex();
+  newIndex = PathIndex();
+  ASSERT_EQ(cacheSize, PathIndexCache::getInstance().size());
+}
+
+/// The vertex-edge-vertex neighbors of a graph, computed directly.
+static nbrs vevNeighbors(const simit::Set &V, const simit::Set &E) {
+  vector<set<unsigned>> neighbors(V.getSize());
+  for (ElementRef e : E) {
+    for (ElementRef vi : E.getEndpoints(e)) {
+      for (ElementRef vj : E.getEndpoints(e)) {
+        neighbors[vi.getIdent()].insert(vj.getIdent());
+      }
+    }
+  }
+  nbrs result;
+  for (auto &vertexNeighbors : neighbors) {
+    result.push_back(vector<unsigned>(vertexNeighbors.begin(),
+                                      vertexNeighbors.end()));
+  }
+  return result;
+}
+
+TEST(pathindex, update) {
+  simit::Set V;
+  simit::Set E(V,V);
+  Box box = createBox(&V, &E, 100, 1, 1);
+
+  Var vi("vi");
+  Var e("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,e}},
+                                 makeVE()(vi,e), makeEV()(e,vj));
+  PathIndexBuilder builder;
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+  PathIndex index = builder.buildSegmented(vev, 0);
+  nbrs expected = vevNeighbors(V, E);
+  VERIFY_INDEX(index, expected);
+
+  // Adding elements updates the memoized path index
+  ElementRef v = V.add();
+  E.add(box(99,0,0), v);
+  E.add(box(0,0,0), box(2,0,0));
+  PathIndex addedIndex = builder.buildSegmented(vev, 0);
+  ASSERT_NE(index, addedIndex);
+  VERIFY_INDEX(addedIndex, vevNeighbors(V, E));
+  VERIFY_INDEX(index, expected);
+
+  // Removing an edge moves the last edge in its place
+  E.remove(*E.begin());
+  PathIndex removedIndex = builder.buildSegmented(vev, 0);
+  VERIFY_INDEX(removedIndex, vevNeighbors(V, E));
+
+  // Rebuilding without modifications returns the memoized path index
+  ASSERT_EQ(removedIndex, builder.buildSegmented(vev, 0));
+
+  // Path indices that are only referenced by the builder are patched in place,
+  // also when rows grow, shrink and are appended
+  index = PathIndex();
+  addedIndex = PathIndex();
+  removedIndex = PathIndex();
+  E.add(box(10,0,0), box(50,0,0));
+  auto edge = E.begin();
+  for (int i = 0; i < 20; ++i) {
+    ++edge;
+  }
+  E.remove(*edge);
+  VERIFY_INDEX(builder.buildSegmented(vev, 0), vevNeighbors(V, E));
+  E.add(box(90,0,0), V.add());
+  E.add(box(5,0,0), box(80,0,0));
+  VERIFY_INDEX(builder.buildSegmented(vev, 0), vevNeighbors(V, E));
+}
+
+TEST(pathindex, transposition) {
+  PathIndexBuilder builder;
+
+  simit::Set V;
+  simit::Set E(V,V);
+  Box box = createBox(&V, &E, 5, 1, 1);  // v-e-v-e-v-e-v-e-v
+  E.add(box(4,0,0), box(0,0,0));
+  builder.bind("V", &V);
+  builder.bind("E", &E);
+
+  // The ve index is the transpose of the ev index, with unsorted rows
+  Var e("e", simit::pe::Set("E"));
+  Var v("v", simit::pe::Set("V"));
+  PathIndex evIndex = builder.buildSegmented(Link::make(e, v, Link::ev), 0);
+  PathIndex veIndex = builder.buildSegmented(Link::make(v, e, Link::ve), 0);
+
+  auto verifyTransposition = [](PathIndex source, PathIndex target) {
+    const SegmentedPathIndex *s = to<SegmentedPathIndex>(source);
+    const SegmentedPathIndex *t = to<SegmentedPathIndex>(target);
+    vector<uint32_t> locations(source.numNeighbors());
+    computeTransposition(source, target, locations.data());
+    for (unsigned i = 0; i < source.numElements(); ++i) {
+      for (unsigned k = s->getCoordData()[i]; k < s->getCoordData()[i+1]; ++k) {
+        unsigned j = s->getSinkData()[k];
+        ASSERT_GE(locations[k], t->getCoordData()[j]);
+        ASSERT_LT(locations[k], t->getCoordData()[j+1]);
+        ASSERT_EQ(i, t->getSinkData()[locations[k]]);
+      }
+    }
+  };
+  verifyTransposition(evIndex, veIndex);
+  verifyTransposition(veIndex, evIndex);
+
+  // The vev index is its own transpose
+  Var vi("vi");
+  Var ve("e");
+  Var vj("vj");
+  PathExpression vev = And::make({vi,vj}, {{QuantifiedVar::Exist,ve}},
+                                 makeVE()(vi,ve), makeEV()(ve,vj));
+  PathIndex vevIndex = builder.buildSegmented(vev, 0);
+  verifyTransposition(vevIndex, vevIndex);
+}
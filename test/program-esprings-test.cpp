@@ -1,8 +1,10 @@
 #include "simit-test.h"
 
+#include "init.h"
 #include "graph.h"
 #include "program.h"
 #include "error.h"
+#include "util/util.h"
 
 using namespace std;
 using namespace simit;
@@ -144,3 +146,31 @@ TEST(Program, esprings) {
   SIMIT_ASSERT_FLOAT_EQ(0.959075182791508, x8(1));
   SIMIT_ASSERT_FLOAT_EQ(0.905120182791508, x8(2));
 }
+
+TEST(Program, espringsMetadata) {
+  Function func = loadFunction(string(TEST_INPUT_DIR) + "/program/esprings.sim",
+                               "main");
+  if (!func.defined()) FAIL();
+
+  if (kBackend != "cpu") {
+    return;
+  }
+
+  // Field and temporary accesses are annotated so that the vectorizers know
+  // that they do not alias (alias scopes require LLVM 3.6)
+  string llvm = util::toString(func);
+  ASSERT_NE(string::npos, llvm.find("!tbaa"));
+#if !(LLVM_MAJOR_VERSION <= 3 && LLVM_MINOR_VERSION <= 5)
+  ASSERT_NE(string::npos, llvm.find("!alias.scope"));
+  ASSERT_NE(string::npos, llvm.find("!noalias"));
+#endif
+
+  // The loops over the points' fields are vectorized on targets with vector
+  // units when functions are optimized at level 2 or 3
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  if (kOptLevel >= 2) {
+    ASSERT_TRUE(llvm.find(" x double>") != string::npos ||
+                llvm.find(" x float>") != string::npos);
+  }
+#endif
+}
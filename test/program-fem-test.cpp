@@ -3,15 +3,21 @@
 #include <iostream>
 
 #include "graph.h"
+#include "init.h"
 #include "program.h"
 #include "error.h"
 #include "mesh.h"
 #include "timers.h"
+#include "util/util.h"
 
 using namespace std;
 using namespace simit;
 
-TEST(Program, femTet) {
+/// Runs ten time steps of the tet FEM program in `fileName`, whose tets store
+/// their B matrices with components of type BFloat, and returns the positions
+/// of vertices 100, 200 and 300.
+template <typename BFloat>
+static vector<simit_float> runFemTet(string fileName) {
   string dir(TEST_INPUT_DIR);
   string prefix=dir+"/program/fem/bar2k";
   string nodeFile = prefix + ".node";
@@ -37,7 +43,7 @@ TEST(Program, femTet) {
   simit::FieldRef<simit_float>    u = m_tets.addField<simit_float>("u");
   simit::FieldRef<simit_float>    l = m_tets.addField<simit_float>("l");
   simit::FieldRef<simit_float>    W = m_tets.addField<simit_float>("W");
-  simit::FieldRef<simit_float,3,3>B = m_tets.addField<simit_float,3,3>("B");
+  simit::FieldRef<BFloat,3,3>     B = m_tets.addField<BFloat,3,3>("B");
   
   simit_float uval, lval;
   //Youngs modulus and poisson's ratio
@@ -76,15 +82,15 @@ TEST(Program, femTet) {
     l.set(t,lval);    
   }
   
-  m_precomputation = loadFunction(TEST_FILE_NAME, "initializeTet");
+  m_precomputation = loadFunction(fileName, "initializeTet");
 
   m_precomputation.bind("verts", &m_verts);
   m_precomputation.bind("tets", &m_tets);
   m_precomputation.init();
   m_precomputation.runSafe();
   
-  m_timeStepper = loadFunction(TEST_FILE_NAME, "main");
-  if(!m_timeStepper.defined()) FAIL();
+  m_timeStepper = loadFunction(fileName, "main");
+  if(!m_timeStepper.defined()) return {};
   m_timeStepper.bind("verts", &m_verts);
   m_timeStepper.bind("tets", &m_tets);
   m_timeStepper.init();
@@ -93,15 +99,87 @@ TEST(Program, femTet) {
     m_timeStepper.runSafe();
   }
   
+  vector<simit_float> positions;
+  for (int i : {100, 200, 300}) {
+    for (int j = 0; j < 3; ++j) {
+      positions.push_back(x.get(vertRefs[i])(j));
+    }
+  }
+  return positions;
+}
+
+TEST(Program, femTet) {
+  vector<simit_float> x = runFemTet<simit_float>(TEST_FILE_NAME);
+  if (x.empty()) FAIL();
+
   // Check outputs
-  SIMIT_ASSERT_FLOAT_EQ(0.010771915616785779,  x.get(vertRefs[100])(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.058853573999788439,  x.get(vertRefs[100])(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.030899457015375883,  x.get(vertRefs[100])(2));
-  SIMIT_ASSERT_FLOAT_EQ(0.0028221631202928516, x.get(vertRefs[200])(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.017969982607667911,  x.get(vertRefs[200])(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.012885386063393013,  x.get(vertRefs[200])(2));
-  SIMIT_ASSERT_FLOAT_EQ(0.02411959295647129,   x.get(vertRefs[300])(0));
-  SIMIT_ASSERT_FLOAT_EQ(0.052036155669135678,  x.get(vertRefs[300])(1));
-  SIMIT_ASSERT_FLOAT_EQ(0.030173075240629205,  x.get(vertRefs[300])(2));
+  SIMIT_ASSERT_FLOAT_EQ(0.010771915616785779,  x[0]);
+  SIMIT_ASSERT_FLOAT_EQ(0.058853573999788439,  x[1]);
+  SIMIT_ASSERT_FLOAT_EQ(0.030899457015375883,  x[2]);
+  SIMIT_ASSERT_FLOAT_EQ(0.0028221631202928516, x[3]);
+  SIMIT_ASSERT_FLOAT_EQ(0.017969982607667911,  x[4]);
+  SIMIT_ASSERT_FLOAT_EQ(0.012885386063393013,  x[5]);
+  SIMIT_ASSERT_FLOAT_EQ(0.02411959295647129,   x[6]);
+  SIMIT_ASSERT_FLOAT_EQ(0.052036155669135678,  x[7]);
+  SIMIT_ASSERT_FLOAT_EQ(0.030173075240629205,  x[8]);
+}
+
+TEST(Program, femTetFloat32) {
+  // The tets store their B matrices with single precision, so the positions
+  // only match those of femTet to about single precision
+  vector<simit_float> x = runFemTet<float>(TEST_FILE_NAME);
+  if (x.empty()) FAIL();
+
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.010771915616785779,  x[0]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.058853573999788439,  x[1]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.030899457015375883,  x[2]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.0028221631202928516, x[3]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.017969982607667911,  x[4]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.012885386063393013,  x[5]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.02411959295647129,   x[6]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.052036155669135678,  x[7]);
+  SIMIT_ASSERT_FLOAT_NEAR_EQ(0.030173075240629205,  x[8]);
 }
 
+TEST(Program, femTetIntrinsics) {
+  Function func = loadFunction(string(TEST_INPUT_DIR) + "/program/femTet.sim",
+                               "main");
+  if (!func.defined()) FAIL();
+
+  // det and inv are emitted inline, so that they can be optimized together
+  // with the PK1 and dPdF kernels that call them
+  if (kBackend == "cpu") {
+    string llvm = util::toString(func);
+    ASSERT_EQ(string::npos, llvm.find("det3"));
+    ASSERT_EQ(string::npos, llvm.find("inv3"));
+  }
+}
+
+TEST(Program, invDet) {
+  Set points;
+  FieldRef<simit_float,3,3> F = points.addField<simit_float,3,3>("F");
+  FieldRef<simit_float,3,3> Finv = points.addField<simit_float,3,3>("Finv");
+  FieldRef<simit_float> J = points.addField<simit_float>("J");
+
+  // The matrix is not symmetric, so an inverse that is computed from the
+  // cofactor matrix instead of its transpose, the adjugate, is caught
+  ElementRef p = points.add();
+  F.set(p, {4.0, 1.0, 8.0,
+            3.0, 4.0, 5.0,
+            1.0, 7.0, 7.0});
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.runSafe();
+
+  SIMIT_ASSERT_FLOAT_EQ(92.0, J.get(p));
+  simit_float adjugate[3][3] = {{ -7.0,  49.0, -27.0},
+                                {-16.0,  20.0,   4.0},
+                                { 17.0, -27.0,  13.0}};
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      SIMIT_ASSERT_FLOAT_EQ(adjugate[i][j] / 92.0, Finv.get(p)(i,j));
+    }
+  }
+}
@@ -9,6 +9,7 @@
 #include "init.h"
 #include "ir.h"
 #include "util/util.h"
+#include "util/thread_pool.h"
 
 #include "program.h"
 #include "backend/backend.h"
@@ -77,6 +78,13 @@ int main(int argc, char **argv) {
 
   // Handle leftover flags
   std::string simitBackend = "cpu";
+  int simitThreads = 1;
+  std::string simitReduction = "auto";
+  simit::Settings defaults;
+  int simitOptLevel = defaults.optLevel;
+  std::string simitCPU = defaults.cpu;
+  std::string simitFeatures = defaults.features;
+  bool simitFastMath = defaults.fastMath;
   for (int i = 0; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg.substr(0,2) == "--") {
@@ -85,6 +93,9 @@ int main(int argc, char **argv) {
         if (keyValPair[0] == "--profile") {
           PROFILE = true;
         }
+        else if (keyValPair[0] == "--fast-math") {
+          simitFastMath = true;
+        }
         else {
           std::cerr << "Unrecognized arg: " << arg << std::endl;
           return 1;
@@ -94,6 +105,21 @@ int main(int argc, char **argv) {
         if (keyValPair[0] == "--backend") {
           simitBackend = keyValPair[1];
         } 
+        else if (keyValPair[0] == "--threads") {
+          simitThreads = std::stoi(keyValPair[1]);
+        }
+        else if (keyValPair[0] == "--reduction") {
+          simitReduction = keyValPair[1];
+        }
+        else if (keyValPair[0] == "--opt") {
+          simitOptLevel = std::stoi(keyValPair[1]);
+        }
+        else if (keyValPair[0] == "--cpu") {
+          simitCPU = keyValPair[1];
+        }
+        else if (keyValPair[0] == "--features") {
+          simitFeatures = keyValPair[1];
+        }
         else {
           std::cerr << "Unrecognized arg: " << keyValPair[0] << std::endl;
           return 1;
@@ -115,7 +141,16 @@ int main(int argc, char **argv) {
   int floatSize = sizeof(double);
 #endif
 
-  simit::init(simitBackend, floatSize);
+  simit::Settings settings;
+  settings.backend = simitBackend;
+  settings.floatSize = floatSize;
+  settings.threads = simitThreads;
+  settings.reduction = simitReduction;
+  settings.optLevel = simitOptLevel;
+  settings.cpu = simitCPU;
+  settings.features = simitFeatures;
+  settings.fastMath = simitFastMath;
+  simit::init(settings);
 
   int returnValue = RUN_ALL_TESTS();
 
@@ -173,3 +208,15 @@ simit::Function loadFunctionWithTimers(std::string fileName, std::string funcNam
   return f;
 }
 
+ParallelSettings::ParallelSettings(int threads, std::string reduction)
+    : oldThreads(simit::kThreads), oldReduction(simit::kReduction) {
+  simit::kThreads = threads;
+  simit::kReduction = reduction;
+  simit::util::ThreadPool::getInstance().setNumThreads(threads);
+}
+
+ParallelSettings::~ParallelSettings() {
+  simit::kThreads = oldThreads;
+  simit::kReduction = oldReduction;
+  simit::util::ThreadPool::getInstance().setNumThreads(oldThreads);
+}
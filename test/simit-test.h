@@ -1,5 +1,5 @@
-#ifndef SIMIT_TEST_H
-#define SIMIT_TEST_H
+#ifndef SIMIT_SIMIT_TEST_H
+#define SIMIT_SIMIT_TEST_H
 
 #include "gtest/gtest.h"
 #include <iostream>
@@ -53,6 +53,17 @@ simit::Function loadFunction(std::string fileName, std::string funcName="main");
 simit::Function loadFunctionWithTimers(std::string fileName, std::string 
     funcName="main");
 
+/// Compiles and runs functions with parallel loops, that accumulate into
+/// shared locations with the given reduction, for the lifetime of the object.
+class ParallelSettings {
+public:
+  ParallelSettings(int threads, std::string reduction="auto");
+  ~ParallelSettings();
+private:
+  int oldThreads;
+  std::string oldReduction;
+};
+
 #define Vec3f TensorType::make(ScalarType::Float, {IndexDomain(3)})
 
 #define Mat3f TensorType::make(ScalarType::Float, \
@@ -1,8 +1,11 @@
-/// Built-in solver functions. Require that Simit is built with Eigen.
-#ifdef EIGEN
-
+/// Built-in solver functions. All but the Cholesky and conjugate gradient
+/// solvers require that Simit is built with Eigen.
 #include "simit-test.h"
 
+#include <cmath>
+#include <vector>
+
+#include "init.h"
 #include "tensor.h"
 #include "ir.h"
 #include "intrinsics.h"
@@ -13,11 +16,93 @@
 #include "types.h"
 
 #include "runtime.h"
+#include "sparse_cholesky.h"
 
 using namespace std;
 using namespace simit;
 using namespace simit::ir;
 
+#ifdef F32
+static const double residualTol = 1e-4;
+#else
+static const double residualTol = 1e-10;
+#endif
+
+/// Returns |Ax-b|/|b|, where x and b hold B components per vertex of E's
+/// endpoint set and A is assembled like dist_a in chol_refactor.sim: every
+/// edge e adds w[e] times the BxB block K to its off-diagonal blocks and to the
+/// diagonal blocks of its endpoints, twice to those of fixed endpoints.
+static double relativeResidual(const Set &E, const vector<double> &w,
+                               const vector<bool> &fixed, int B,
+                               const vector<double> &K,
+                               const vector<double> &x,
+                               const vector<double> &b) {
+  vector<double> r(b.size());
+  for (size_t i = 0; i < b.size(); ++i) {
+    r[i] = -b[i];
+  }
+  auto addBlock = [&](int row, int col, double weight) {
+    for (int i = 0; i < B; ++i) {
+      for (int j = 0; j < B; ++j) {
+        r[row*B + i] += weight * K[i*B + j] * x[col*B + j];
+      }
+    }
+  };
+  for (ElementRef e : E) {
+    int p0 = E.getEndpoint(e, 0).getIdent();
+    int p1 = E.getEndpoint(e, 1).getIdent();
+    double we = w[e.getIdent()];
+    addBlock(p0, p0, fixed[p0] ? 2.0*we : we);
+    addBlock(p1, p1, fixed[p1] ? 2.0*we : we);
+    addBlock(p0, p1, we);
+    addBlock(p1, p0, we);
+  }
+  double rnorm = 0.0;
+  double bnorm = 0.0;
+  for (size_t i = 0; i < b.size(); ++i) {
+    rnorm += r[i] * r[i];
+    bnorm += b[i] * b[i];
+  }
+  return std::sqrt(rnorm / bnorm);
+}
+
+/// Adds three vertices to V in a chain of two edges of E, and fixes the first
+/// one. Most solver tests solve the systems that their edges assemble.
+static vector<ElementRef> createChain(Set *V, Set *E) {
+  FieldRef<bool> fixed = V->getField<bool>("fixed");
+  vector<ElementRef> v = {V->add(), V->add(), V->add()};
+  fixed(v[0]) = true;
+  E->add(v[0], v[1]);
+  E->add(v[1], v[2]);
+  return v;
+}
+
+/// Adds a n x n x n box of vertices and edges to V and E, and fixes the
+/// vertices of its bottom face. Returns which vertices are fixed.
+static vector<bool> createFixedBox(Set *V, Set *E, unsigned n) {
+  FieldRef<bool> fixed = V->getField<bool>("fixed");
+  Box box = createBox(V, E, n, n, n);
+  vector<bool> isFixed(V->getSize());
+  for (unsigned i = 0; i < n; ++i) {
+    for (unsigned j = 0; j < n; ++j) {
+      fixed(box(i,j,0)) = true;
+      isFixed[box(i,j,0).getIdent()] = true;
+    }
+  }
+  return isFixed;
+}
+
+/// Adds the chain of createChain, with the right-hand sides 10, 20 and 30.
+static vector<ElementRef> createChain(Set *V, Set *E,
+                                      FieldRef<simit_float> b) {
+  vector<ElementRef> v = createChain(V, E);
+  b(v[0]) = 10.0;
+  b(v[1]) = 20.0;
+  b(v[2]) = 30.0;
+  return v;
+}
+
+#ifdef EIGEN
 TEST(solver, solve) {
   Set V;
   FieldRef<simit_float> b = V.addField<simit_float>("b");
@@ -140,22 +225,15 @@ TEST(solver, lumat) {
   SIMIT_ASSERT_FLOAT_EQ( 1.625, (simit_float)x(v2));
 }
 
+#endif
+
 TEST(solver, chol) {
   Set V;
   FieldRef<simit_float> b = V.addField<simit_float>("b");
   FieldRef<simit_float> x = V.addField<simit_float>("x");
-  FieldRef<bool> fixed = V.addField<bool>("fixed");
-  ElementRef v0 = V.add();
-  ElementRef v1 = V.add();
-  ElementRef v2 = V.add();
-  b(v0) = 10.0;
-  b(v1) = 20.0;
-  b(v2) = 30.0;
-  fixed(v0) = true;
-
+  V.addField<bool>("fixed");
   Set E(V,V);
-  E.add(v0,v1);
-  E.add(v1,v2);
+  vector<ElementRef> v = createChain(&V, &E, b);
 
   Function func = loadFunction(TEST_FILE_NAME, "main");
   if (!func.defined()) FAIL();
@@ -163,28 +241,22 @@ TEST(solver, chol) {
   func.bind("E", &E);
   func.runSafe();
 
-  SIMIT_ASSERT_FLOAT_EQ( 20.0, x(v0));
-  SIMIT_ASSERT_FLOAT_EQ(-30.0, x(v1));
-  SIMIT_ASSERT_FLOAT_EQ( 60.0, x(v2));
+  SIMIT_ASSERT_FLOAT_EQ( 20.0, x(v[0]));
+  SIMIT_ASSERT_FLOAT_EQ(-30.0, x(v[1]));
+  SIMIT_ASSERT_FLOAT_EQ( 60.0, x(v[2]));
 }
 
 TEST(solver, cholmat) {
   Set V;
   FieldRef<simit_float> x = V.addField<simit_float>("x");
-  FieldRef<bool> fixed = V.addField<bool>("fixed");
-  ElementRef v0 = V.add();
-  ElementRef v1 = V.add();
-  ElementRef v2 = V.add();
-  fixed(v0) = true;
-
+  V.addField<bool>("fixed");
   Set E(V,V);
-  E.add(v0,v1);
-  E.add(v1,v2);
+  vector<ElementRef> v = createChain(&V, &E);
 
   Set T(V);
   FieldRef<simit_float> b = T.addField<simit_float>("b");
-  ElementRef d0 = T.add(v0);
-  ElementRef d1 = T.add(v2);
+  ElementRef d0 = T.add(v[0]);
+  ElementRef d1 = T.add(v[2]);
   b(d0) = 1.0;
   b(d1) = 2.0;
 
@@ -195,11 +267,308 @@ TEST(solver, cholmat) {
   func.bind("T", &T);
   func.runSafe();
 
-  SIMIT_ASSERT_FLOAT_EQ( 3.0, (simit_float)x(v0));
-  SIMIT_ASSERT_FLOAT_EQ(-5.0, (simit_float)x(v1));
-  SIMIT_ASSERT_FLOAT_EQ( 7.0, (simit_float)x(v2));
+  SIMIT_ASSERT_FLOAT_EQ( 3.0, (simit_float)x(v[0]));
+  SIMIT_ASSERT_FLOAT_EQ(-5.0, (simit_float)x(v[1]));
+  SIMIT_ASSERT_FLOAT_EQ( 7.0, (simit_float)x(v[2]));
 }
 
+TEST(solver, cholmat_arena) {
+  Set V;
+  FieldRef<simit_float> x = V.addField<simit_float>("x");
+  V.addField<bool>("fixed");
+  Set E(V,V);
+  vector<ElementRef> v = createChain(&V, &E);
+
+  Set T(V);
+  FieldRef<simit_float> b = T.addField<simit_float>("b");
+  ElementRef d0 = T.add(v[0]);
+  ElementRef d1 = T.add(v[2]);
+  b(d0) = 1.0;
+  b(d1) = 2.0;
+
+  Function func = loadFunction(std::string(TEST_INPUT_DIR) +
+                               "/solver/cholmat.sim", "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.bind("T", &T);
+  func.runSafe();
+  AllocationStats first = func.getAllocationStats();
+  for (int i = 0; i < 2; ++i) {
+    func.runSafe();
+  }
+
+  SIMIT_ASSERT_FLOAT_EQ( 3.0, (simit_float)x(v[0]));
+  SIMIT_ASSERT_FLOAT_EQ(-5.0, (simit_float)x(v[1]));
+  SIMIT_ASSERT_FLOAT_EQ( 7.0, (simit_float)x(v[2]));
+
+  // The temporaries, such as the indices and values of X, are allocated by the
+  // first run and reused by the others
+  if (simit::kBackend == "cpu") {
+    AllocationStats stats = func.getAllocationStats();
+    ASSERT_LT(0u, first.allocations);
+    ASSERT_EQ(first.systemAllocations, stats.systemAllocations);
+    ASSERT_EQ(stats.allocations - first.allocations,
+              stats.reuses - first.reuses);
+  }
+}
+
+TEST(solver, chol_blocked) {
+  Set V;
+  FieldRef<simit_float,2> b = V.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> x = V.addField<simit_float,2>("x");
+  V.addField<bool>("fixed");
+  Set E(V,V);
+  vector<ElementRef> v = createChain(&V, &E);
+  b(v[0]) = {30.0, 0.0};
+  b(v[1]) = {60.0, 0.0};
+  b(v[2]) = {90.0, 0.0};
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  SIMIT_ASSERT_FLOAT_EQ(  40.0, x(v[0])(0));
+  SIMIT_ASSERT_FLOAT_EQ( -20.0, x(v[0])(1));
+  SIMIT_ASSERT_FLOAT_EQ( -60.0, x(v[1])(0));
+  SIMIT_ASSERT_FLOAT_EQ(  30.0, x(v[1])(1));
+  SIMIT_ASSERT_FLOAT_EQ( 120.0, x(v[2])(0));
+  SIMIT_ASSERT_FLOAT_EQ( -60.0, x(v[2])(1));
+}
+
+// The ordering dissects the 1000 vertices of the box several times before it
+// reaches leaves small enough to factorize directly
+TEST(solver, chol_box) {
+  Set V;
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  FieldRef<simit_float> x = V.addField<simit_float>("x");
+  V.addField<bool>("fixed");
+  Set E(V,V);
+  vector<bool> isFixed = createFixedBox(&V, &E, 10);
+
+  vector<double> bs(V.getSize());
+  for (ElementRef v : V) {
+    bs[v.getIdent()] = 1.0 + v.getIdent() % 5;
+    b(v) = bs[v.getIdent()];
+  }
+
+  Function func = loadFunction(std::string(TEST_INPUT_DIR) +
+                               "/solver/chol.sim", "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  vector<double> xs(V.getSize());
+  for (ElementRef v : V) {
+    xs[v.getIdent()] = x(v);
+  }
+  vector<double> w(E.getSize(), 1.0);
+  ASSERT_GT(residualTol, relativeResidual(E, w, isFixed, 1, {1.0}, xs, bs));
+}
+
+TEST(solver, chol_box_blocked) {
+  Set V;
+  FieldRef<simit_float,2> b = V.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> x = V.addField<simit_float,2>("x");
+  V.addField<bool>("fixed");
+  Set E(V,V);
+  vector<bool> isFixed = createFixedBox(&V, &E, 10);
+
+  vector<double> bs(2*V.getSize());
+  for (ElementRef v : V) {
+    int i = v.getIdent();
+    bs[2*i]   = 1.0 + i % 5;
+    bs[2*i+1] = -1.0 - i % 3;
+    b(v) = {(simit_float)bs[2*i], (simit_float)bs[2*i+1]};
+  }
+
+  Function func = loadFunction(std::string(TEST_INPUT_DIR) +
+                               "/solver/chol_blocked.sim", "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  vector<double> xs(2*V.getSize());
+  for (ElementRef v : V) {
+    xs[2*v.getIdent()]   = x(v)(0);
+    xs[2*v.getIdent()+1] = x(v)(1);
+  }
+  vector<double> w(E.getSize(), 1.0);
+  vector<double> K = {2.0, 1.0, 1.0, 2.0};
+  ASSERT_GT(residualTol, relativeResidual(E, w, isFixed, 2, K, xs, bs));
+}
+
+TEST(solver, chol_refactor) {
+  Set V;
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  FieldRef<simit_float> x = V.addField<simit_float>("x");
+  V.addField<bool>("fixed");
+  Set E(V,V);
+  FieldRef<simit_float> w = E.addField<simit_float>("w");
+  vector<ElementRef> v = createChain(&V, &E, b);
+  for (ElementRef e : E) {
+    w(e) = 1.0;
+  }
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  SIMIT_ASSERT_FLOAT_EQ( 20.0, x(v[0]));
+  SIMIT_ASSERT_FLOAT_EQ(-30.0, x(v[1]));
+  SIMIT_ASSERT_FLOAT_EQ( 60.0, x(v[2]));
+
+  // The matrix has the same path index, so it is refactorized numerically
+  // without analyzing it again
+  unsigned analyses = getCholeskyAnalysisCount();
+  for (ElementRef e : E) {
+    w(e) = 2.0;
+  }
+  func.runSafe();
+  ASSERT_EQ(analyses, getCholeskyAnalysisCount());
+
+  SIMIT_ASSERT_FLOAT_EQ( 10.0, x(v[0]));
+  SIMIT_ASSERT_FLOAT_EQ(-15.0, x(v[1]));
+  SIMIT_ASSERT_FLOAT_EQ( 30.0, x(v[2]));
+}
+
+TEST(solver, cg) {
+  Set V;
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  FieldRef<simit_float> x = V.addField<simit_float>("x");
+  V.addField<bool>("fixed");
+  FieldRef<int> iterations = V.addField<int>("iterations");
+  FieldRef<simit_float> residual = V.addField<simit_float>("residual");
+  Set E(V,V);
+  vector<ElementRef> v = createChain(&V, &E, b);
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  ASSERT_NEAR( 20.0, x(v[0]), 1e-4);
+  ASSERT_NEAR(-30.0, x(v[1]), 1e-4);
+  ASSERT_NEAR( 60.0, x(v[2]), 1e-4);
+  ASSERT_GE(3, (int)iterations(v[0]));
+  ASSERT_GE(1e-4, (simit_float)residual(v[0]));
+}
+
+TEST(solver, pcg) {
+  Set V;
+  FieldRef<simit_float> b = V.addField<simit_float>("b");
+  FieldRef<simit_float> x = V.addField<simit_float>("x");
+  V.addField<bool>("fixed");
+  FieldRef<int> iterations = V.addField<int>("iterations");
+  FieldRef<simit_float> residual = V.addField<simit_float>("residual");
+  Set E(V,V);
+  vector<ElementRef> v = createChain(&V, &E, b);
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  ASSERT_NEAR( 20.0, x(v[0]), 1e-4);
+  ASSERT_NEAR(-30.0, x(v[1]), 1e-4);
+  ASSERT_NEAR( 60.0, x(v[2]), 1e-4);
+  ASSERT_GE(3, (int)iterations(v[0]));
+  ASSERT_GE(1e-4, (simit_float)residual(v[0]));
+}
+
+// A box large enough that pcg splits its passes into chunks on several
+// threads, with edge weights that make the system take many iterations
+TEST(solver, pcg_blocked) {
+  Set V;
+  FieldRef<simit_float,2> b = V.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> x = V.addField<simit_float,2>("x");
+  V.addField<bool>("fixed");
+  FieldRef<int> iterations = V.addField<int>("iterations");
+  FieldRef<simit_float> residual = V.addField<simit_float>("residual");
+  Set E(V,V);
+  FieldRef<simit_float> w = E.addField<simit_float>("w");
+  vector<bool> isFixed = createFixedBox(&V, &E, 16);
+  ElementRef v0 = *V.begin();
+
+  vector<double> bs(2*V.getSize());
+  for (ElementRef v : V) {
+    int i = v.getIdent();
+    bs[2*i]   = 1.0 + i % 5;
+    bs[2*i+1] = -1.0 - i % 3;
+    b(v) = {(simit_float)bs[2*i], (simit_float)bs[2*i+1]};
+  }
+  vector<double> ws(E.getSize());
+  for (ElementRef e : E) {
+    ws[e.getIdent()] = 1.0 + e.getIdent() % 3;
+    w(e) = ws[e.getIdent()];
+  }
+  vector<double> K = {2.0, 1.0, 1.0, 2.0};
+
+  // Solve on one thread, and twice on four threads
+  vector<vector<double>> xs;
+  vector<int> its;
+  for (int threads : {1, 4, 4}) {
+    ParallelSettings settings(threads, "coloring");
+    Function func = loadFunction(TEST_FILE_NAME, "main");
+    if (!func.defined()) FAIL();
+    for (ElementRef v : V) {
+      x(v) = {0.0, 0.0};
+    }
+    func.bind("V", &V);
+    func.bind("E", &E);
+    func.runSafe();
+
+    xs.push_back(vector<double>(2*V.getSize()));
+    for (ElementRef v : V) {
+      xs.back()[2*v.getIdent()]   = x(v)(0);
+      xs.back()[2*v.getIdent()+1] = x(v)(1);
+    }
+    its.push_back(iterations(v0));
+
+    // The relative residual, rather than the limit of 1000 iterations, stops
+    // the solver
+    ASSERT_LT(10, its.back());
+    ASSERT_GT(1000, its.back());
+    ASSERT_GE(1e-6, (simit_float)residual(v0));
+    ASSERT_GT(1e-5, relativeResidual(E, ws, isFixed, 2, K, xs.back(), bs));
+  }
+
+  // The partial sums of the chunks are added in order, so runs on the same
+  // number of threads have the same results
+  ASSERT_EQ(its[1], its[2]);
+  ASSERT_EQ(xs[1], xs[2]);
+
+  // Negated weights make the matrix negative definite, so p'Ap is negative in
+  // the first iteration and pcg stops before it updates x
+  for (ElementRef e : E) {
+    w(e) = -ws[e.getIdent()];
+  }
+  for (ElementRef v : V) {
+    x(v) = {0.0, 0.0};
+  }
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  ASSERT_EQ(0, (int)iterations(v0));
+  SIMIT_ASSERT_FLOAT_EQ(1.0, (simit_float)residual(v0));
+  for (ElementRef v : V) {
+    ASSERT_EQ(0.0, x(v)(0));
+    ASSERT_EQ(0.0, x(v)(1));
+  }
+}
+
+#ifdef EIGEN
 TEST(solver, schur) {
   Set V;
   FieldRef<bool> fixed = V.addField<bool>("fixed");
@@ -851,6 +851,60 @@ TEST(system, gemv_inplace) {
   ASSERT_EQ(10.0, (double)b.get(p2));
 }
 
+TEST(system, gemv_epilogue) {
+  // Points
+  Set points;
+  FieldRef<simit_float> b = points.addField<simit_float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+  FieldRef<simit_float> d = points.addField<simit_float>("d");
+  FieldRef<simit_float> e = points.addField<simit_float>("e");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, 1.0);
+  b.set(p1, 2.0);
+  b.set(p2, 3.0);
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, 1.0);
+  a.set(s1, 2.0);
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that inputs are preserved
+  ASSERT_EQ(1.0, b.get(p0));
+  ASSERT_EQ(2.0, b.get(p1));
+  ASSERT_EQ(3.0, b.get(p2));
+
+  // Check that outputs are correct, where A*b is (3,13,10) and b'A*b is 59
+  SIMIT_ASSERT_FLOAT_EQ(-5.0, c.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(-24.0, c.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(-17.0, c.get(p2));
+
+  SIMIT_ASSERT_FLOAT_EQ(60.0, d.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(61.0, d.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(62.0, d.get(p2));
+
+  SIMIT_ASSERT_FLOAT_EQ(177.0, e.get(p0));
+  SIMIT_ASSERT_FLOAT_EQ(767.0, e.get(p1));
+  SIMIT_ASSERT_FLOAT_EQ(590.0, e.get(p2));
+}
+
 TEST(system, gemv_blocked) {
   // Points
   Set points;
@@ -903,6 +957,178 @@ TEST(system, gemv_blocked) {
   ASSERT_EQ(136.0, c2(1));
 }
 
+TEST(system, gemv_blocked_epilogue) {
+  // Points
+  Set points;
+  FieldRef<simit_float,2> b = points.addField<simit_float,2>("b");
+  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+  FieldRef<simit_float,2> d = points.addField<simit_float,2>("d");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0});
+  b.set(p1, {3.0, 4.0});
+  b.set(p2, {5.0, 6.0});
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float,2,2> a = springs.addField<simit_float,2,2>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0, 4.0});
+  a.set(s1, {5.0, 6.0, 7.0, 8.0});
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that outputs are correct, where A*b is the result of gemv_blocked
+  // and b'A*b is 2440
+  std::vector<std::vector<simit_float>> expectedC = {{-15.0, -34.0},
+                                                     {-113.0, -168.0},
+                                                     {-95.0, -130.0}};
+  std::vector<std::vector<simit_float>> expectedD = {{2440.0, 4880.0},
+                                                     {7320.0, 9760.0},
+                                                     {12200.0, 14640.0}};
+  std::vector<ElementRef> elements = {p0, p1, p2};
+  for (size_t i = 0; i < elements.size(); ++i) {
+    for (int j = 0; j < 2; ++j) {
+      SIMIT_ASSERT_FLOAT_EQ(expectedC[i][j], c(elements[i])(j));
+      SIMIT_ASSERT_FLOAT_EQ(expectedD[i][j], d(elements[i])(j));
+    }
+  }
+}
+
+TEST(system, gemv_blocked3) {
+  // Points
+  Set points;
+  FieldRef<simit_float,3> b = points.addField<simit_float,3>("b");
+  FieldRef<simit_float,3> c = points.addField<simit_float,3>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0, 3.0});
+  b.set(p1, {4.0, 5.0, 6.0});
+  b.set(p2, {7.0, 8.0, 9.0});
+
+  // Taint c
+  c.set(p0, {42.0, 42.0, 42.0});
+  c.set(p2, {42.0, 42.0, 42.0});
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float,3,3> a = springs.addField<simit_float,3,3>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0,
+             4.0, 5.0, 6.0,
+             7.0, 8.0, 9.0});
+  a.set(s1, {10.0, 11.0, 12.0,
+             13.0, 14.0, 15.0,
+             16.0, 17.0, 18.0});
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that outputs are correct
+  TensorRef<simit_float,3> c0 = c.get(p0);
+  ASSERT_EQ(46.0, c0(0));
+  ASSERT_EQ(109.0, c0(1));
+  ASSERT_EQ(172.0, c0(2));
+
+  TensorRef<simit_float,3> c1 = c.get(p1);
+  ASSERT_EQ(479.0, c1(0));
+  ASSERT_EQ(659.0, c1(1));
+  ASSERT_EQ(839.0, c1(2));
+
+  TensorRef<simit_float,3> c2 = c.get(p2);
+  ASSERT_EQ(433.0, c2(0));
+  ASSERT_EQ(550.0, c2(1));
+  ASSERT_EQ(667.0, c2(2));
+}
+
+TEST(system, gemv_blocked4) {
+  // Points
+  Set points;
+  FieldRef<simit_float,4> b = points.addField<simit_float,4>("b");
+  FieldRef<simit_float,4> c = points.addField<simit_float,4>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0, 3.0, 4.0});
+  b.set(p1, {5.0, 6.0, 7.0, 8.0});
+  b.set(p2, {9.0, 10.0, 11.0, 12.0});
+
+  // Taint c
+  c.set(p0, {42.0, 42.0, 42.0, 42.0});
+  c.set(p2, {42.0, 42.0, 42.0, 42.0});
+
+  // Springs
+  Set springs(points,points);
+  FieldRef<simit_float,4,4> a = springs.addField<simit_float,4,4>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0, 4.0,
+             5.0, 6.0, 7.0, 8.0,
+             9.0, 10.0, 11.0, 12.0,
+             13.0, 14.0, 15.0, 16.0});
+  a.set(s1, {17.0, 18.0, 19.0, 20.0,
+             21.0, 22.0, 23.0, 24.0,
+             25.0, 26.0, 27.0, 28.0,
+             29.0, 30.0, 31.0, 32.0});
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that outputs are correct
+  TensorRef<simit_float,4> c0 = c.get(p0);
+  ASSERT_EQ(100.0, c0(0));
+  ASSERT_EQ(244.0, c0(1));
+  ASSERT_EQ(388.0, c0(2));
+  ASSERT_EQ(532.0, c0(3));
+
+  TensorRef<simit_float,4> c1 = c.get(p1);
+  ASSERT_EQ(1368.0, c1(0));
+  ASSERT_EQ(1784.0, c1(1));
+  ASSERT_EQ(2200.0, c1(2));
+  ASSERT_EQ(2616.0, c1(3));
+
+  TensorRef<simit_float,4> c2 = c.get(p2);
+  ASSERT_EQ(1268.0, c2(0));
+  ASSERT_EQ(1540.0, c2(1));
+  ASSERT_EQ(1812.0, c2(2));
+  ASSERT_EQ(2084.0, c2(3));
+}
+
 TEST(system, gemv_blocked_nw) {
   // Points
   Set points;
@@ -1208,6 +1434,151 @@ TEST(system, gemv_diagonal_storage_and_sysreduced) {
  }
 
  
+TEST(system, gemv_mixed_precision) {
+  // Points, whose b field is stored with single precision
+  Set points;
+  FieldRef<float>       b = points.addField<float>("b");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, 1.0);
+  b.set(p1, 2.0);
+  b.set(p2, 3.0);
+
+  // Taint c
+  c.set(p0, 42.0);
+  c.set(p2, 42.0);
+
+  // Springs, whose a field is stored with single precision
+  Set springs(points,points);
+  FieldRef<float> a = springs.addField<float>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, 1.5);
+  a.set(s1, 0.25);
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that inputs are preserved
+  ASSERT_EQ(1.0, b.get(p0));
+  ASSERT_EQ(2.0, b.get(p1));
+  ASSERT_EQ(3.0, b.get(p2));
+
+  // Check that outputs are correct
+  ASSERT_EQ(4.5, c.get(p0));
+  ASSERT_EQ(5.75, c.get(p1));
+  ASSERT_EQ(1.25, c.get(p2));
+}
+
+TEST(system, gemv_blocked_float32) {
+  // Points, whose b field is stored with single precision
+  Set points;
+  FieldRef<float,2>       b = points.addField<float,2>("b");
+  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0});
+  b.set(p1, {3.0, 4.0});
+  b.set(p2, {5.0, 6.0});
+
+  // Taint c
+  c.set(p0, {42.0, 42.0});
+  c.set(p2, {42.0, 42.0});
+
+  // Springs, whose a blocks are stored with single precision, so that the
+  // blocked matrix is multiplied by the mixed-precision runtime kernel
+  Set springs(points,points);
+  FieldRef<float,2,2> a = springs.addField<float,2,2>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0, 4.0});
+  a.set(s1, {5.0, 6.0, 7.0, 8.0});
+
+  // Compile program and bind arguments
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  // Check that outputs are correct
+  TensorRef<simit_float,2> c0 = c.get(p0);
+  ASSERT_EQ(16.0, c0(0));
+  ASSERT_EQ(36.0, c0(1));
+
+  TensorRef<simit_float,2> c1 = c.get(p1);
+  ASSERT_EQ(116.0, c1(0));
+  ASSERT_EQ(172.0, c1(1));
+
+  TensorRef<simit_float,2> c2 = c.get(p2);
+  ASSERT_EQ(100.0, c2(0));
+  ASSERT_EQ(136.0, c2(1));
+}
+
+TEST(system, gemv_blocked_float32_transposed) {
+  Set points;
+  FieldRef<float,2>       b = points.addField<float,2>("b");
+  FieldRef<simit_float,2> c = points.addField<simit_float,2>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+
+  b.set(p0, {1.0, 2.0});
+  b.set(p1, {3.0, 4.0});
+  b.set(p2, {5.0, 6.0});
+
+  // Springs, whose a blocks are stored with single precision, so that the
+  // transposed matrix is multiplied by the mixed-precision runtime kernel
+  Set springs(points,points);
+  FieldRef<float,2,2> a = springs.addField<float,2,2>("a");
+
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+
+  a.set(s0, {1.0, 2.0, 3.0, 4.0});
+  a.set(s1, {5.0, 6.0, 7.0, 8.0});
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  TensorRef<simit_float,2> c0 = c.get(p0);
+  ASSERT_EQ(22.0, c0(0));
+  ASSERT_EQ(32.0, c0(1));
+
+  TensorRef<simit_float,2> c1 = c.get(p1);
+  ASSERT_EQ(132.0, c1(0));
+  ASSERT_EQ(160.0, c1(1));
+
+  TensorRef<simit_float,2> c2 = c.get(p2);
+  ASSERT_EQ(110.0, c2(0));
+  ASSERT_EQ(128.0, c2(1));
+}
+
 TEST(system, DISABLED_gemv_pass_element) {
   // Points
   Set points;
@@ -118,6 +118,43 @@ TEST(system, transpose_blocked) {
   ASSERT_EQ(29, (int)c(v2)(2));
 }
 
+TEST(system, transpose_gemv) {
+  Set V;
+  FieldRef<simit_float,2> b = V.addField<simit_float,2>("b");
+  FieldRef<simit_float,3> c = V.addField<simit_float,3>("c");
+  FieldRef<simit_float,3> d = V.addField<simit_float,3>("d");
+  FieldRef<simit_float,3> e = V.addField<simit_float,3>("e");
+  ElementRef v0 = V.add();
+  ElementRef v1 = V.add();
+  ElementRef v2 = V.add();
+  b(v0) = {1.0, 2.0};
+  b(v1) = {3.0, 4.0};
+  b(v2) = {5.0, 6.0};
+
+  Set E(V,V);
+  E.add(v0,v1);
+  E.add(v1,v2);
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("V", &V);
+  func.bind("E", &E);
+  func.runSafe();
+
+  // c is computed without assembling A', and d and e from the assembled A'
+  std::vector<std::vector<simit_float>> expected = {{13.0, 12.0, 18.0},
+                                                    {26.0, 28.0, 38.0},
+                                                    {3.0, 4.0, 0.0}};
+  std::vector<ElementRef> vertices = {v0, v1, v2};
+  for (size_t i = 0; i < vertices.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      SIMIT_ASSERT_FLOAT_EQ(expected[i][j], c(vertices[i])(j));
+      SIMIT_ASSERT_FLOAT_EQ(expected[i][j], d(vertices[i])(j));
+      SIMIT_ASSERT_FLOAT_EQ(expected[i][j], e(vertices[i])(j));
+    }
+  }
+}
+
 TEST(system, swap) {
   Set V;
   FieldRef<simit_float> val = V.addField<simit_float>("val");
@@ -2,12 +2,46 @@
 
 #include "graph.h"
 #include "program.h"
+#include "program_context.h"
 #include "error.h"
 #include "types.h"
+#include "ir.h"
+#include "frontend/frontend.h"
+#include "lower/lower.h"
+#include "lower/fuse_loops.h"
 
 using namespace std;
 using namespace simit;
 
+/// Returns the lowered function with the given name in a Simit file.
+static ir::Func lowerFunction(string fileName, string funcName) {
+  internal::Frontend frontend;
+  internal::ProgramContext ctx;
+  vector<ParseError> errors;
+  if (frontend.parseFile(fileName, &ctx, &errors) != 0) {
+    return ir::Func();
+  }
+  return ir::lower(ctx.getFunction(funcName));
+}
+
+/// Returns the number of loops over the set variable with the given name.
+static int countLoops(const ir::Stmt &stmt, string setName) {
+  int loops = 0;
+  ir::match(stmt,
+    std::function<void(const ir::For*)>([&](const ir::For *op) {
+      const ir::ForDomain &domain = op->domain;
+      if (domain.kind == ir::ForDomain::IndexSet &&
+          domain.indexSet.getKind() == ir::IndexSet::Set &&
+          ir::isa<ir::VarExpr>(domain.indexSet.getSet()) &&
+          ir::to<ir::VarExpr>(domain.indexSet.getSet())->var.getName() ==
+              setName) {
+        ++loops;
+      }
+    })
+  );
+  return loops;
+}
+
 TEST(system, vector_add) {
   Set points;
   FieldRef<simit_float> x = points.addField<simit_float>("x");
@@ -165,3 +199,89 @@ TEST(system, vector_add_large_system) {
     SIMIT_EXPECT_FLOAT_EQ(i*2, (size_t)x.get(ps[i]));
   }
 }
+
+TEST(system, vector_fused) {
+  Set points;
+  FieldRef<simit_float,3> x = points.addField<simit_float,3>("x");
+  FieldRef<simit_float,3> v = points.addField<simit_float,3>("v");
+  FieldRef<simit_float> m = points.addField<simit_float>("m");
+  FieldRef<simit_float> w = points.addField<simit_float>("w");
+  FieldRef<simit_float> c = points.addField<simit_float>("c");
+
+  ElementRef p0 = points.add();
+  ElementRef p1 = points.add();
+  ElementRef p2 = points.add();
+  std::vector<ElementRef> ps = {p0, p1, p2};
+  for (size_t i = 0; i < ps.size(); ++i) {
+    x.set(ps[i], {1.0, 1.0, 1.0});
+    v.set(ps[i], {3.0*i+1.0, 3.0*i+2.0, 3.0*i+3.0});
+    m.set(ps[i], i+1.0);
+  }
+
+  Set springs(points,points);
+  FieldRef<simit_float> a = springs.addField<simit_float>("a");
+  ElementRef s0 = springs.add(p0,p1);
+  ElementRef s1 = springs.add(p1,p2);
+  a.set(s0, 1.0);
+  a.set(s1, 2.0);
+
+  Function func = loadFunction(TEST_FILE_NAME, "main");
+  if (!func.defined()) FAIL();
+  func.bind("points", &points);
+  func.bind("springs", &springs);
+
+  func.runSafe();
+
+  std::vector<simit_float> expectedW = {2.0, 6.0, 12.0};
+  std::vector<simit_float> expectedC = {-14.0, -82.0, -60.0};
+  for (size_t i = 0; i < ps.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      SIMIT_EXPECT_FLOAT_EQ(1.0 + 2.0*(3.0*i+j+1.0), x.get(ps[i])(j));
+    }
+    SIMIT_EXPECT_FLOAT_EQ(expectedW[i], w.get(ps[i]));
+    SIMIT_EXPECT_FLOAT_EQ(2.0*expectedW[i], m.get(ps[i]));
+    SIMIT_EXPECT_FLOAT_EQ(expectedC[i], c.get(ps[i]));
+  }
+
+  if (kBackend == "cpu") {
+    ir::Func lowered = lowerFunction(TEST_FILE_NAME, "main");
+    if (!lowered.defined()) FAIL();
+
+    // The element-wise loops over points are fused into one loop, that is
+    // followed by the matrix-vector product's loop
+    ASSERT_EQ(2, countLoops(lowered.getBody(), "points"));
+
+    // The temporaries t and s are replaced by registers
+    ir::match(lowered.getBody(),
+      std::function<void(const ir::VarDecl*)>([](const ir::VarDecl *op) {
+        ASSERT_NE("t", op->var.getName());
+        ASSERT_NE("s", op->var.getName());
+      })
+    );
+  }
+}
+
+TEST(system, vector_fused_offset) {
+  using namespace ir;
+  Type point = ElementType::make("Point", {});
+  Var points("points", UnstructuredSetType::make(point, {}));
+  Var x("x", ir::TensorType::make(ir::ScalarType::Float,
+                                   {IndexDomain(IndexSet(VarExpr::make(points)))}));
+  Var y("y", ir::TensorType::make(ir::ScalarType::Float,
+                                   {IndexDomain(IndexSet(VarExpr::make(points)))}));
+  Var i("i", ir::Int);
+  Var j("j", ir::Int);
+  ForDomain domain(VarExpr::make(points));
+  Stmt first = For::make(i, domain, Store::make(x, i, Literal::make(1.0)));
+
+  // y[j] = x[j] reads the location that the same iteration wrote
+  Stmt local = For::make(j, domain, Store::make(y, j, Load::make(x, j)));
+  Func fused = fuseLoops(Func("f", {points}, {}, Block::make(first, local)));
+  ASSERT_EQ(1, countLoops(fused.getBody(), "points"));
+
+  // y[j] = x[j+1] reads the location that the next iteration writes
+  Stmt next = For::make(j, domain,
+                        Store::make(y, j, Load::make(x, Add::make(j, 1))));
+  Func unfused = fuseLoops(Func("f", {points}, {}, Block::make(first, next)));
+  ASSERT_EQ(2, countLoops(unfused.getBody(), "points"));
+}
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <fstream>
+#include <memory>
+
+#include "ir.h"
+#include "lower/lower.h"
+#include "frontend/frontend.h"
+#include "program_context.h"
+#include "error.h"
+#include "init.h"
+#include "util/util.h"
+
+#include "backend/backend.h"
+#include "backend/backend_function.h"
+
+using namespace std;
+using namespace simit;
+
+static void printUsage() {
+  cerr << "Usage: simit-aot [options] <simit-source> " << endl << endl
+       << "Compiles an exported function to a position-independent object file"
+       << endl
+       << "(.o), and writes a C header that declares it. Link the object with"
+       << endl
+       << "the simit-runtime library." << endl
+       << endl
+       << "Options:"              << endl
+       << "-compile=<function>"   << endl
+       << "-o=<output>"           << endl
+       << "-header=<header>"      << endl
+       << "-threads=<threads>"    << endl
+       << "-opt=<0-3>"            << endl
+       << "-cpu=<cpu>"            << endl
+       << "-features=<features>"  << endl
+       << "-fast-math"            << endl;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    printUsage();
+    return 3;
+  }
+
+  string function;
+  string output;
+  string header;
+  string sourceFile;
+  int threads = 1;
+  int optLevel = 3;
+  string cpu = "generic";  // Objects run on other hosts than the compiling one
+  string features;
+  bool fastMath = false;
+
+  // Parse Arguments
+  for (int i=1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg[0] == '-') {
+      std::vector<std::string> keyValPair = simit::util::split(arg, "=");
+      if (keyValPair.size() == 1 && arg == "-fast-math") {
+        fastMath = true;
+      }
+      else if (keyValPair.size() != 2) {
+        printUsage();
+        return 3;
+      }
+      else if (keyValPair[0] == "-compile") {
+        function = keyValPair[1];
+      }
+      else if (keyValPair[0] == "-o") {
+        output = keyValPair[1];
+      }
+      else if (keyValPair[0] == "-header") {
+        header = keyValPair[1];
+      }
+      else if (keyValPair[0] == "-threads") {
+        threads = std::stoi(keyValPair[1]);
+      }
+      else if (keyValPair[0] == "-opt") {
+        optLevel = std::stoi(keyValPair[1]);
+      }
+      else if (keyValPair[0] == "-cpu") {
+        cpu = keyValPair[1];
+      }
+      else if (keyValPair[0] == "-features") {
+        features = keyValPair[1];
+      }
+      else {
+        printUsage();
+        return 3;
+      }
+    }
+    else {
+      if (sourceFile != "") {
+        printUsage();
+        return 3;
+      }
+      else {
+        sourceFile = arg;
+      }
+    }
+  }
+  if (sourceFile == "") {
+    printUsage();
+    return 3;
+  }
+
+  simit::Settings settings;
+#ifdef F32
+  settings.floatSize = sizeof(float);
+#else
+  settings.floatSize = sizeof(double);
+#endif
+  settings.threads = threads;
+  settings.optLevel = optLevel;
+  settings.cpu = cpu;
+  settings.features = features;
+  settings.fastMath = fastMath;
+  simit::init(settings);
+
+  std::string source;
+  int status = simit::util::loadText(sourceFile, &source);
+  if (status != 0) {
+    cerr << "Error: Could not open file " << sourceFile << endl;
+    return 2;
+  }
+
+  simit::internal::Frontend frontend;
+  std::vector<simit::ParseError> errors;
+  simit::internal::ProgramContext ctx;
+
+  status = frontend.parseString(source, &ctx, &errors);
+  if (status != 0) {
+    for (auto &error : errors) {
+      cerr << error << endl;
+    }
+    return 1;
+  }
+
+  auto functions = ctx.getFunctions();
+  simit::ir::Func func;
+  if (function != "") {
+    func = functions[function];
+    if (!func.defined()) {
+      cerr << "Error: Could not find function " << function <<
+              " in " << sourceFile << endl;
+      return 4;
+    }
+  }
+  else if (functions.size() == 1) {
+    func = functions.begin()->second;
+    function = func.getName();
+  }
+  else {
+    cerr << "Error: choose which function to compile using "
+         << "-compile=<function>" << endl;
+    return 5;
+  }
+
+  if (output == "") {
+    output = function + ".o";
+  }
+  if (header == "") {
+    string base = output.substr(0, output.find_last_of('.'));
+    header = base + ".h";
+  }
+
+  func = lower(func);
+  backend::Backend backend("cpu");
+  backend.setKeepMachineCode(true);
+  unique_ptr<backend::Function> compiled(backend.compile(func));
+
+  compiled->emitObject(output);
+
+  ofstream headerStream(header, ios_base::trunc);
+  if (!headerStream.good()) {
+    cerr << "Error: Could not write " << header << endl;
+    return 2;
+  }
+  compiled->printHeader(headerStream);
+
+  return 0;
+}
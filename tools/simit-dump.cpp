@@ -254,6 +254,7 @@ int main(int argc, const char* argv[]) {
     // NB: The LLVM code gets further optimized at init time (OSR, etc.)
     if (llvmos || asmos) {
       backend::Backend backend("cpu");
+      backend.setKeepMachineCode(asmos != nullptr);
       simit::Function  llvmFunc(backend.compile(func));
 
       if (llvmos) {